@@ -34,6 +34,7 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
@@ -41,14 +42,29 @@
 #include <sys/select.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../lib/libplctag.h"
+#include "../protocols/shm/shm_region.h"
 #include "utils.h"
+#include "data_log.h"
 
 #define REQUIRED_VERSION 2,1,0
 
 #define MAX_TAGS 5000
 #define RECONNECT_DELAY_MS 5000
 
+/* binary logging mode */
+#define SAMPLE_QUEUE_SIZE (1 << 20) /* must be a power of two */
+#define TAG_ID_MAP_SIZE (16384) /* must be a power of two and well over MAX_TAGS */
+#define BLOCK_FLUSH_MS (1000)
+#define STATS_INTERVAL_MS (5000)
+
+/* shared memory publish mode */
+#define HEARTBEAT_INTERVAL_MS (100)
+
 
 typedef enum { UNKNOWN = 0, DINT, INT, SINT, REAL } data_type_t;
 
@@ -59,6 +75,8 @@ struct {
     int32_t tag_id;
     int reading;
     data_type_t data_type;
+    int have_value;
+    uint32_t last_value;
     union {
         int32_t DINT_val;
         int16_t INT_val;
@@ -69,6 +87,46 @@ struct {
 
 int num_tags = 0;
 
+/*
+ * Binary logging mode (-b).
+ *
+ * The library reads each tag on its own with auto_sync_read_ms set to the
+ * RPI.  The tag callback runs in the library's helper thread.  It drops
+ * values that did not change and puts the rest in a single producer,
+ * single consumer ring.  A writer thread drains the ring into blocks of
+ * the data_log.h format.
+ */
+const char *binary_log_prefix = NULL;
+
+data_log_sample_t sample_queue[SAMPLE_QUEUE_SIZE];
+uint64_t queue_head = 0; /* only written by the callback. */
+uint64_t queue_tail = 0; /* only written by the writer thread. */
+uint64_t samples_dropped = 0;
+uint64_t samples_written = 0;
+
+/*
+ * Shared memory publish mode (-p).
+ *
+ * The tags are read the same way as in binary logging mode.  The callback
+ * copies each tag's raw data into its slot of a shared memory region,
+ * see shm_region.h.  Local programs read the slots with tags using
+ * protocol=shm&region=<region>&name=<name>, so only this process talks to
+ * the PLC however many readers there are.
+ */
+const char *publish_region = NULL;
+
+uint8_t *region = NULL;
+shm_region_slot_t *region_slots = NULL;
+uint8_t *publish_buf = NULL; /* only used by the callback. */
+uint64_t slots_updated = 0;
+uint64_t slots_changed = 0;
+
+/* tag ID to tags[] index, for the callback. */
+struct {
+    int32_t tag_id;
+    int index;
+} tag_id_map[TAG_ID_MAP_SIZE];
+
 
 volatile sig_atomic_t terminate = 0;
 
@@ -203,7 +261,16 @@ int process_line(const char *line)
 
     tags[num_tags].rpi = atoi(parts[2]);
     tags[num_tags].next_read = 0;
-    tags[num_tags].tag_id = plc_tag_create(parts[3], 0); /* create async */
+
+    if(binary_log_prefix || publish_region) {
+        /* let the library do the reads at the RPI. */
+        char attribs[1024];
+
+        snprintf(attribs, sizeof(attribs), "%s&auto_sync_read_ms=%d", parts[3], tags[num_tags].rpi);
+        tags[num_tags].tag_id = plc_tag_create(attribs, 0); /* create async */
+    } else {
+        tags[num_tags].tag_id = plc_tag_create(parts[3], 0); /* create async */
+    }
 
     if(tags[num_tags].tag_id < 0) {
         fprintf(stderr, "Error, %s, creating tag %s with string %s!\n", plc_tag_decode_error(tags[num_tags].tag_id), tags[num_tags].name, parts[3]);
@@ -467,6 +534,486 @@ int start_reads()
 }
 
 
+
+/***** binary logging mode *****/
+
+void map_tag_id(int32_t tag_id, int index)
+{
+    uint32_t slot = (uint32_t)tag_id & (TAG_ID_MAP_SIZE - 1);
+
+    while(tag_id_map[slot].tag_id != 0) {
+        slot = (slot + 1) & (TAG_ID_MAP_SIZE - 1);
+    }
+
+    tag_id_map[slot].tag_id = tag_id;
+    tag_id_map[slot].index = index;
+}
+
+
+int find_tag_index(int32_t tag_id)
+{
+    uint32_t slot = (uint32_t)tag_id & (TAG_ID_MAP_SIZE - 1);
+
+    while(tag_id_map[slot].tag_id != 0) {
+        if(tag_id_map[slot].tag_id == tag_id) {
+            return tag_id_map[slot].index;
+        }
+
+        slot = (slot + 1) & (TAG_ID_MAP_SIZE - 1);
+    }
+
+    return -1;
+}
+
+
+/* the value as 32 bits, sign extended for the integer types. */
+uint32_t get_tag_value(int index)
+{
+    int32_t tag_id = tags[index].tag_id;
+    union {
+        float f;
+        uint32_t u;
+    } real_val;
+
+    switch(tags[index].data_type) {
+    case DINT:
+        return (uint32_t)plc_tag_get_int32(tag_id, 0);
+
+    case INT:
+        return (uint32_t)(int32_t)plc_tag_get_int16(tag_id, 0);
+
+    case SINT:
+        return (uint32_t)(int32_t)plc_tag_get_int8(tag_id, 0);
+
+    case REAL:
+        real_val.f = plc_tag_get_float32(tag_id, 0);
+        return real_val.u;
+
+    default:
+        return 0;
+    }
+}
+
+
+/* called in the library helper thread, the only producer for the queue. */
+void tag_callback(int32_t tag_id, int event, int status)
+{
+    uint64_t head, tail;
+    uint32_t value;
+    int index;
+
+    if(event != PLCTAG_EVENT_READ_COMPLETED || status != PLCTAG_STATUS_OK) {
+        return;
+    }
+
+    if((index = find_tag_index(tag_id)) < 0) {
+        return;
+    }
+
+    value = get_tag_value(index);
+
+    /* only log changes. */
+    if(tags[index].have_value && tags[index].last_value == value) {
+        return;
+    }
+
+    tags[index].have_value = 1;
+    tags[index].last_value = value;
+
+    head = __atomic_load_n(&queue_head, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE);
+
+    if(head - tail >= SAMPLE_QUEUE_SIZE) {
+        /* the writer is behind, do not block the library. */
+        __atomic_add_fetch(&samples_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    sample_queue[head & (SAMPLE_QUEUE_SIZE - 1)].timestamp_ms = util_time_ms();
+    sample_queue[head & (SAMPLE_QUEUE_SIZE - 1)].tag_index = (uint32_t)index;
+    sample_queue[head & (SAMPLE_QUEUE_SIZE - 1)].value = value;
+
+    __atomic_store_n(&queue_head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+data_log_writer_p open_binary_log(int64_t timestamp_ms)
+{
+    static data_log_tag_t log_tags[MAX_TAGS];
+    char file_name[1024];
+    time_t epoch = (time_t)(timestamp_ms / 1000);
+    struct tm t;
+
+    localtime_r(&epoch, &t);
+
+    /* a new name per file, so a restart never overwrites an earlier log. */
+    snprintf(file_name, sizeof(file_name), "%s-%04d%02d%02d-%02d%02d%02d.pld", binary_log_prefix,
+             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+
+    for(int i=0; i < num_tags; i++) {
+        log_tags[i].data_type = (uint8_t)tags[i].data_type;
+        log_tags[i].name = tags[i].name;
+    }
+
+    printf("Logging to %s.\n", file_name);
+
+    return data_log_writer_open(file_name, log_tags, num_tags);
+}
+
+
+int day_of(int64_t timestamp_ms)
+{
+    time_t epoch = (time_t)(timestamp_ms / 1000);
+    struct tm t;
+
+    localtime_r(&epoch, &t);
+
+    return t.tm_year * 1000 + t.tm_yday;
+}
+
+
+void *writer_thread_func(void *not_used)
+{
+    static data_log_sample_t block[DATA_LOG_MAX_BLOCK_SAMPLES];
+    data_log_writer_p log = NULL;
+    int log_day = -1;
+    int count = 0;
+    int64_t block_start = 0;
+
+    (void)not_used;
+
+    for(;;) {
+        uint64_t tail = __atomic_load_n(&queue_tail, __ATOMIC_RELAXED);
+        uint64_t head = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+        int stopping = terminate;
+
+        /* take what is there, up to a full block. */
+        while(tail != head && count < DATA_LOG_MAX_BLOCK_SAMPLES) {
+            if(count == 0) {
+                block_start = util_time_ms();
+            }
+
+            block[count++] = sample_queue[tail & (SAMPLE_QUEUE_SIZE - 1)];
+            tail++;
+        }
+
+        __atomic_store_n(&queue_tail, tail, __ATOMIC_RELEASE);
+
+        if(count == DATA_LOG_MAX_BLOCK_SAMPLES || (count > 0 && (stopping || util_time_ms() - block_start >= BLOCK_FLUSH_MS))) {
+            /* one file per day. */
+            if(day_of(block[0].timestamp_ms) != log_day) {
+                if(log) {
+                    data_log_writer_close(log);
+                }
+
+                log_day = day_of(block[0].timestamp_ms);
+
+                if(!(log = open_binary_log(block[0].timestamp_ms))) {
+                    fprintf(stderr, "Unable to open the log file, stopping!\n");
+                    terminate = 1;
+                    break;
+                }
+            }
+
+            if(data_log_writer_append(log, block, count) != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Unable to write to the log file, stopping!\n");
+                terminate = 1;
+                break;
+            }
+
+            samples_written += (uint64_t)count;
+            count = 0;
+        } else if(tail == head) {
+            /* everything is drained. */
+            if(stopping) {
+                break;
+            }
+
+            util_sleep_ms(1);
+        }
+    }
+
+    if(log) {
+        data_log_writer_close(log);
+    }
+
+    return NULL;
+}
+
+
+int run_binary_log(void)
+{
+    pthread_t writer_thread;
+    uint64_t last_written = 0;
+    int64_t last_stats = util_time_ms();
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int t=0; t < num_tags; t++) {
+        map_tag_id(tags[t].tag_id, t);
+    }
+
+    if(pthread_create(&writer_thread, NULL, writer_thread_func, NULL) != 0) {
+        fprintf(stderr, "Unable to create the writer thread!\n");
+        return PLCTAG_ERR_THREAD_CREATE;
+    }
+
+    for(int t=0; t < num_tags; t++) {
+        if((rc = plc_tag_register_callback(tags[t].tag_id, tag_callback)) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to register the callback for tag %s, %s!\n", tags[t].name, plc_tag_decode_error(rc));
+            terminate = 1;
+            break;
+        }
+    }
+
+    while(!terminate) {
+        int64_t now;
+
+        util_sleep_ms(100);
+
+        now = util_time_ms();
+
+        if(now - last_stats >= STATS_INTERVAL_MS) {
+            uint64_t written = samples_written;
+
+            printf("Logged %.0f samples/s, %" PRIu64 " dropped so far.\n",
+                   (double)(written - last_written) * 1000.0 / (double)(now - last_stats),
+                   __atomic_load_n(&samples_dropped, __ATOMIC_RELAXED));
+
+            last_written = written;
+            last_stats = now;
+        }
+    }
+
+    /* no more callbacks once the tags are gone, then the writer drains the queue. */
+    destroy_tags();
+    pthread_join(writer_thread, NULL);
+
+    return rc;
+}
+
+
+/***** shared memory publish mode *****/
+
+/* called in the library helper thread, the only writer of the region. */
+void publish_callback(int32_t tag_id, int event, int status)
+{
+    shm_region_slot_t *slot;
+    uint8_t *data;
+    uint32_t seq;
+    int changed = 0;
+    int index;
+
+    if(event != PLCTAG_EVENT_READ_COMPLETED) {
+        return;
+    }
+
+    if((index = find_tag_index(tag_id)) < 0) {
+        return;
+    }
+
+    slot = &region_slots[index];
+    data = region + slot->data_offset;
+
+    if(status == PLCTAG_STATUS_OK) {
+        if(plc_tag_get_raw_bytes(tag_id, 0, publish_buf, (int)slot->data_size) != PLCTAG_STATUS_OK) {
+            return;
+        }
+
+        changed = (memcmp(publish_buf, data, slot->data_size) != 0 || !tags[index].have_value);
+        tags[index].have_value = 1;
+    }
+
+    /* readers only see the sequence number move when there is something new. */
+    if(changed || slot->status != status) {
+        seq = slot->seq;
+
+        __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if(changed) {
+            memcpy(data, publish_buf, slot->data_size);
+            slot->change_count++;
+        }
+
+        slot->status = status;
+        slot->timestamp_ms = util_time_ms();
+
+        __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&slot->timestamp_ms, util_time_ms(), __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&slots_updated, 1, __ATOMIC_RELAXED);
+
+    if(changed) {
+        __atomic_add_fetch(&slots_changed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/* lay out and map the region, one slot per tag. */
+int create_region(char *os_name)
+{
+    shm_region_header_t *header;
+    uint32_t offset;
+    uint32_t max_size = 0;
+    int fd;
+
+    offset = (uint32_t)(sizeof(shm_region_header_t) + (size_t)num_tags * sizeof(shm_region_slot_t));
+
+    for(int t=0; t < num_tags; t++) {
+        int size = plc_tag_get_size(tags[t].tag_id);
+
+        if(size <= 0) {
+            fprintf(stderr, "Unable to get the size of tag %s!\n", tags[t].name);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        if(strlen(tags[t].name) >= SHM_SLOT_NAME_SIZE) {
+            fprintf(stderr, "Tag name %s is longer than %d characters!\n", tags[t].name, SHM_SLOT_NAME_SIZE - 1);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        /* each tag's data starts on its own cache line. */
+        offset = (offset + SHM_DATA_ALIGN - 1) & ~(uint32_t)(SHM_DATA_ALIGN - 1);
+        offset += (uint32_t)size;
+
+        if((uint32_t)size > max_size) {
+            max_size = (uint32_t)size;
+        }
+    }
+
+    /* a region left behind by a publisher that crashed is replaced. */
+    shm_unlink(os_name);
+
+    fd = shm_open(os_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) {
+        perror("Unable to create the shared memory region");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    if(ftruncate(fd, (off_t)offset) != 0) {
+        perror("Unable to size the shared memory region");
+        close(fd);
+        shm_unlink(os_name);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    region = mmap(NULL, offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(region == MAP_FAILED) {
+        perror("Unable to map the shared memory region");
+        region = NULL;
+        shm_unlink(os_name);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    if(!(publish_buf = malloc(max_size))) {
+        fprintf(stderr, "Unable to allocate the publish buffer!\n");
+        shm_unlink(os_name);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    header = (shm_region_header_t *)region;
+    region_slots = SHM_REGION_SLOTS(region);
+
+    /* ftruncate() filled the region with zeros. */
+    offset = (uint32_t)(sizeof(shm_region_header_t) + (size_t)num_tags * sizeof(shm_region_slot_t));
+
+    for(int t=0; t < num_tags; t++) {
+        offset = (offset + SHM_DATA_ALIGN - 1) & ~(uint32_t)(SHM_DATA_ALIGN - 1);
+
+        strcpy(region_slots[t].name, tags[t].name);
+        region_slots[t].data_offset = offset;
+        region_slots[t].data_size = (uint32_t)plc_tag_get_size(tags[t].tag_id);
+        region_slots[t].status = PLCTAG_ERR_NO_DATA;
+
+        offset += region_slots[t].data_size;
+    }
+
+    header->magic = SHM_REGION_MAGIC;
+    header->version = SHM_REGION_VERSION;
+    header->slot_count = (uint32_t)num_tags;
+    header->region_size = offset;
+    header->publisher_pid = (int32_t)getpid();
+    header->heartbeat_ms = util_time_ms();
+
+    /* readers check this last. */
+    __atomic_store_n(&header->publisher_running, 1, __ATOMIC_RELEASE);
+
+    printf("Publishing %d tags in %u bytes of shared memory %s.\n", num_tags, offset, os_name);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int run_publisher(void)
+{
+    shm_region_header_t *header;
+    char os_name[256];
+    uint64_t last_updated = 0;
+    uint64_t last_changed = 0;
+    int64_t last_stats = util_time_ms();
+    int rc = PLCTAG_STATUS_OK;
+
+    snprintf(os_name, sizeof(os_name), "/%s%s", SHM_REGION_NAME_PREFIX, publish_region);
+
+    for(int t=0; t < num_tags; t++) {
+        map_tag_id(tags[t].tag_id, t);
+    }
+
+    if((rc = create_region(os_name)) != PLCTAG_STATUS_OK) {
+        destroy_tags();
+        return rc;
+    }
+
+    header = (shm_region_header_t *)region;
+
+    for(int t=0; t < num_tags; t++) {
+        if((rc = plc_tag_register_callback(tags[t].tag_id, publish_callback)) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to register the callback for tag %s, %s!\n", tags[t].name, plc_tag_decode_error(rc));
+            terminate = 1;
+            break;
+        }
+    }
+
+    while(!terminate) {
+        int64_t now;
+
+        util_sleep_ms(HEARTBEAT_INTERVAL_MS);
+
+        now = util_time_ms();
+
+        __atomic_store_n(&header->heartbeat_ms, now, __ATOMIC_RELAXED);
+
+        if(now - last_stats >= STATS_INTERVAL_MS) {
+            uint64_t updated = __atomic_load_n(&slots_updated, __ATOMIC_RELAXED);
+            uint64_t changed = __atomic_load_n(&slots_changed, __ATOMIC_RELAXED);
+
+            printf("Published %.0f reads/s, %.0f changes/s.\n",
+                   (double)(updated - last_updated) * 1000.0 / (double)(now - last_stats),
+                   (double)(changed - last_changed) * 1000.0 / (double)(now - last_stats));
+
+            last_updated = updated;
+            last_changed = changed;
+            last_stats = now;
+        }
+    }
+
+    destroy_tags();
+
+    /*
+     * readers fail from now on.  The region stays mapped until the process
+     * exits, in case a callback is still running.
+     */
+    __atomic_store_n(&header->publisher_running, 0, __ATOMIC_RELEASE);
+    shm_unlink(os_name);
+
+    return rc;
+}
+
+
 void SIGINT_handler(int not_used)
 {
     (void)not_used;
@@ -476,7 +1023,11 @@ void SIGINT_handler(int not_used)
 
 void usage(void)
 {
-    fprintf(stderr, "Usage: data_dumper <config file>\n");
+    fprintf(stderr, "Usage: data_dumper [-b <log file prefix> | -p <region>] <config file>\n");
+    fprintf(stderr, "\t-b = log changed values to binary files <prefix>-<date>-<time>.pld, read them with data_dumper_read.\n");
+    fprintf(stderr, "\t-p = publish the tags in shared memory for other local programs to read with tags like\n");
+    fprintf(stderr, "\t     protocol=shm&region=<region>&name=<name>.\n");
+    fprintf(stderr, "\t     Without -b or -p every value read is logged as text to log-<date>.log.\n");
     fprintf(stderr, "The config file must contain tab-delimited rows in the following format:\n");
     fprintf(stderr, "\t<name>\\t<type>\\t<rpi>\\t<tag string>\n");
     fprintf(stderr, "\t<name> = a name used when outputting the data.\n");
@@ -492,6 +1043,7 @@ void usage(void)
 int main(int argc, char **argv)
 {
     int rc;
+    int arg = 1;
     struct sigaction act;
 
     /* check the library version. */
@@ -506,13 +1058,21 @@ int main(int argc, char **argv)
 
     memset(&tags, 0, sizeof(tags));
 
-    if(argc < 2) {
+    if(argc > 2 && strcmp(argv[1], "-b") == 0) {
+        binary_log_prefix = argv[2];
+        arg = 3;
+    } else if(argc > 2 && strcmp(argv[1], "-p") == 0) {
+        publish_region = argv[2];
+        arg = 3;
+    }
+
+    if(argc <= arg) {
         usage();
 
         return 1;
     }
 
-    if((rc = read_config(argv[1])) != PLCTAG_STATUS_OK) {
+    if((rc = read_config(argv[arg])) != PLCTAG_STATUS_OK) {
         fprintf(stderr,"Unable to read config or set up tags. %s!\n", plc_tag_decode_error(rc));
         destroy_tags();
         return 1;
@@ -529,6 +1089,22 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if(binary_log_prefix) {
+        rc = run_binary_log();
+
+        printf("Terminating!\n");
+
+        return (rc == PLCTAG_STATUS_OK ? 0 : 1);
+    }
+
+    if(publish_region) {
+        rc = run_publisher();
+
+        printf("Terminating!\n");
+
+        return (rc == PLCTAG_STATUS_OK ? 0 : 1);
+    }
+
     while(!terminate) {
         int num_tags_read = 0;
         int64_t start, end;
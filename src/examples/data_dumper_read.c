@@ -0,0 +1,145 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+#include "data_log.h"
+
+/*
+ * Prints the binary logs written by data_dumper -b as text, one sample
+ * per line in the same format as the text log.
+ *
+ * data_dumper_read [-s] <log file>...
+ *
+ * -s prints a summary per file instead of the samples.
+ */
+
+/* the same values as data_dumper.c uses. */
+enum { UNKNOWN = 0, DINT, INT, SINT, REAL };
+
+
+void print_sample(const data_log_tag_t *tag, const data_log_sample_t *sample)
+{
+    time_t epoch = (time_t)(sample->timestamp_ms / 1000);
+    union {
+        uint32_t u;
+        float f;
+    } val;
+    struct tm t;
+
+    localtime_r(&epoch, &t);
+
+    printf("%04d-%02d-%02d %02d:%02d:%02d.%03d,%s", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+           t.tm_hour, t.tm_min, t.tm_sec, (int)(sample->timestamp_ms % 1000), tag->name);
+
+    val.u = sample->value;
+
+    if(tag->data_type == REAL) {
+        printf(",%f\n", val.f);
+    } else {
+        printf(",%d\n", (int32_t)val.u);
+    }
+}
+
+
+int dump_file(const char *file_name, int summary_only)
+{
+    static data_log_sample_t samples[DATA_LOG_MAX_BLOCK_SAMPLES];
+    data_log_reader_p reader = data_log_reader_open(file_name);
+    int64_t total = 0;
+    int64_t first_ms = 0, last_ms = 0;
+    int blocks = 0;
+    int count;
+
+    if(!reader) {
+        return PLCTAG_ERR_OPEN;
+    }
+
+    while((count = data_log_reader_next_block(reader, samples, DATA_LOG_MAX_BLOCK_SAMPLES)) > 0) {
+        if(!summary_only) {
+            for(int i=0; i < count; i++) {
+                print_sample(data_log_reader_tag(reader, (int)samples[i].tag_index), &samples[i]);
+            }
+        }
+
+        if(blocks == 0) {
+            first_ms = samples[0].timestamp_ms;
+        }
+
+        last_ms = samples[count - 1].timestamp_ms;
+        total += count;
+        blocks++;
+    }
+
+    if(summary_only) {
+        printf("%s: %d tags, %d blocks, %" PRId64 " samples over %.1fs.\n", file_name,
+               data_log_reader_num_tags(reader), blocks, total, (double)(last_ms - first_ms) / 1000.0);
+    }
+
+    data_log_reader_close(reader);
+
+    return (count < 0 ? count : PLCTAG_STATUS_OK);
+}
+
+
+int main(int argc, char **argv)
+{
+    int summary_only = 0;
+    int arg = 1;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(argc > 1 && strcmp(argv[1], "-s") == 0) {
+        summary_only = 1;
+        arg++;
+    }
+
+    if(arg >= argc) {
+        fprintf(stderr, "Usage: data_dumper_read [-s] <log file>...\n");
+        fprintf(stderr, "\tPrints the logs written by data_dumper -b as text.  -s prints a summary instead.\n");
+        return 1;
+    }
+
+    for(; arg < argc; arg++) {
+        if(dump_file(argv[arg], summary_only) != PLCTAG_STATUS_OK) {
+            rc = 1;
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,588 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../lib/libplctag.h"
+#include "data_log.h"
+
+/*
+ * Writer and reader for the data_dumper binary log.  See data_log.h for
+ * the format.
+ */
+
+
+/* the file grows by this much each time the map runs out. */
+#define MAP_CHUNK_SIZE (8 * 1024 * 1024)
+
+#define BLOCK_HEADER_SIZE (4 + 4 + 8 + 3*4)
+
+/* worst case is a 10 byte varint per timestamp and 5 each for tag and value. */
+#define MAX_BLOCK_SIZE (BLOCK_HEADER_SIZE + DATA_LOG_MAX_BLOCK_SAMPLES * (10 + 5 + 5))
+
+
+struct data_log_writer_t {
+    int fd;
+    int num_tags;
+
+    /* file offset where the next block goes. */
+    int64_t file_end;
+
+    /* current map of [map_offset, map_offset + map_size) */
+    uint8_t *map;
+    int64_t map_offset;
+    int64_t map_size;
+
+    /* per-tag previous value while encoding a block. */
+    uint32_t *last_value;
+
+    uint8_t ts_col[DATA_LOG_MAX_BLOCK_SAMPLES * 10];
+    uint8_t tag_col[DATA_LOG_MAX_BLOCK_SAMPLES * 5];
+    uint8_t val_col[DATA_LOG_MAX_BLOCK_SAMPLES * 5];
+};
+
+
+struct data_log_reader_t {
+    int fd;
+    uint8_t *data;
+    int64_t size;
+    int64_t pos;
+
+    int num_tags;
+    data_log_tag_t *tags;
+    uint32_t *last_value;
+};
+
+
+static int encode_varint(uint8_t *buf, uint64_t val);
+static int decode_varint(const uint8_t *buf, int64_t len, int64_t *pos, uint64_t *val);
+static void put_u16(uint8_t *buf, uint16_t val);
+static void put_u32(uint8_t *buf, uint32_t val);
+static void put_u64(uint8_t *buf, uint64_t val);
+static uint16_t get_u16(const uint8_t *buf);
+static uint32_t get_u32(const uint8_t *buf);
+static uint64_t get_u64(const uint8_t *buf);
+static int writer_reserve(data_log_writer_p writer, int64_t size);
+static int writer_append_block(data_log_writer_p writer, const data_log_sample_t *samples, int num_samples);
+
+
+
+data_log_writer_p data_log_writer_open(const char *file_name, const data_log_tag_t *tags, int num_tags)
+{
+    data_log_writer_p writer = NULL;
+    uint8_t *header = NULL;
+    int64_t header_size = 8 + 4;
+    int64_t pos = 0;
+    int fd = -1;
+
+    for(int i=0; i < num_tags; i++) {
+        header_size += 1 + 2 + (int64_t)strlen(tags[i].name);
+    }
+
+    writer = calloc(1, sizeof(*writer));
+    header = malloc((size_t)header_size);
+    if(writer) {
+        writer->last_value = calloc((size_t)(num_tags > 0 ? num_tags : 1), sizeof(uint32_t));
+    }
+
+    if(!writer || !header || !writer->last_value) {
+        fprintf(stderr, "Unable to allocate memory for log file %s!\n", file_name);
+        goto error;
+    }
+
+    /* build the header */
+    memcpy(header, DATA_LOG_FILE_MAGIC, 8);
+    put_u32(header + 8, (uint32_t)num_tags);
+    pos = 12;
+
+    for(int i=0; i < num_tags; i++) {
+        uint16_t name_len = (uint16_t)strlen(tags[i].name);
+
+        header[pos] = tags[i].data_type;
+        put_u16(header + pos + 1, name_len);
+        memcpy(header + pos + 3, tags[i].name, name_len);
+
+        pos += 3 + name_len;
+    }
+
+    /* always a new file, appending to an old one could mix tag tables. */
+    fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "Unable to open log file %s!\n", file_name);
+        goto error;
+    }
+
+    if(write(fd, header, (size_t)header_size) != (ssize_t)header_size) {
+        fprintf(stderr, "Unable to write the header of log file %s!\n", file_name);
+        goto error;
+    }
+
+    free(header);
+
+    writer->fd = fd;
+    writer->num_tags = num_tags;
+    writer->file_end = header_size;
+
+    return writer;
+
+error:
+    if(fd >= 0) {
+        close(fd);
+    }
+
+    free(header);
+
+    if(writer) {
+        free(writer->last_value);
+        free(writer);
+    }
+
+    return NULL;
+}
+
+
+
+int data_log_writer_append(data_log_writer_p writer, const data_log_sample_t *samples, int num_samples)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    while(num_samples > 0) {
+        int count = (num_samples > DATA_LOG_MAX_BLOCK_SAMPLES ? DATA_LOG_MAX_BLOCK_SAMPLES : num_samples);
+
+        if((rc = writer_append_block(writer, samples, count)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        samples += count;
+        num_samples -= count;
+    }
+
+    return rc;
+}
+
+
+
+int data_log_writer_close(data_log_writer_p writer)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!writer) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(writer->map) {
+        msync(writer->map, (size_t)writer->map_size, MS_SYNC);
+        munmap(writer->map, (size_t)writer->map_size);
+    }
+
+    /* drop the unused part of the last chunk. */
+    if(ftruncate(writer->fd, (off_t)writer->file_end) != 0) {
+        rc = PLCTAG_ERR_WRITE;
+    }
+
+    close(writer->fd);
+
+    free(writer->last_value);
+    free(writer);
+
+    return rc;
+}
+
+
+
+data_log_reader_p data_log_reader_open(const char *file_name)
+{
+    data_log_reader_p reader = NULL;
+    struct stat st;
+    int64_t pos = 0;
+
+    reader = calloc(1, sizeof(*reader));
+    if(!reader) {
+        return NULL;
+    }
+
+    reader->fd = open(file_name, O_RDONLY);
+    if(reader->fd < 0 || fstat(reader->fd, &st) != 0 || st.st_size < 12) {
+        fprintf(stderr, "Unable to open log file %s or it is too short!\n", file_name);
+        goto error;
+    }
+
+    reader->size = (int64_t)st.st_size;
+    reader->data = mmap(NULL, (size_t)reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if(reader->data == MAP_FAILED) {
+        reader->data = NULL;
+        fprintf(stderr, "Unable to map log file %s!\n", file_name);
+        goto error;
+    }
+
+    if(memcmp(reader->data, DATA_LOG_FILE_MAGIC, 8) != 0) {
+        fprintf(stderr, "File %s is not a data_dumper log!\n", file_name);
+        goto error;
+    }
+
+    reader->num_tags = (int)get_u32(reader->data + 8);
+    reader->tags = calloc((size_t)(reader->num_tags > 0 ? reader->num_tags : 1), sizeof(data_log_tag_t));
+    reader->last_value = calloc((size_t)(reader->num_tags > 0 ? reader->num_tags : 1), sizeof(uint32_t));
+    if(!reader->tags || !reader->last_value) {
+        goto error;
+    }
+
+    pos = 12;
+
+    for(int i=0; i < reader->num_tags; i++) {
+        uint16_t name_len;
+        char *name;
+
+        if(pos + 3 > reader->size) {
+            fprintf(stderr, "Tag table of log file %s is truncated!\n", file_name);
+            goto error;
+        }
+
+        name_len = get_u16(reader->data + pos + 1);
+
+        if(pos + 3 + name_len > reader->size || !(name = malloc((size_t)name_len + 1))) {
+            fprintf(stderr, "Tag table of log file %s is truncated!\n", file_name);
+            goto error;
+        }
+
+        memcpy(name, reader->data + pos + 3, name_len);
+        name[name_len] = 0;
+
+        reader->tags[i].data_type = reader->data[pos];
+        reader->tags[i].name = name;
+
+        pos += 3 + name_len;
+    }
+
+    reader->pos = pos;
+
+    return reader;
+
+error:
+    data_log_reader_close(reader);
+
+    return NULL;
+}
+
+
+int data_log_reader_num_tags(data_log_reader_p reader)
+{
+    return reader->num_tags;
+}
+
+
+const data_log_tag_t *data_log_reader_tag(data_log_reader_p reader, int index)
+{
+    if(index < 0 || index >= reader->num_tags) {
+        return NULL;
+    }
+
+    return &reader->tags[index];
+}
+
+
+int data_log_reader_next_block(data_log_reader_p reader, data_log_sample_t *samples, int max_samples)
+{
+    const uint8_t *block = NULL;
+    uint32_t count = 0;
+    int64_t timestamp = 0;
+    int64_t col_len[3];
+    int64_t col_start[3];
+    int64_t ts_pos = 0, tag_pos = 0, val_pos = 0;
+
+    /* end of the data, or the zero filled tail left by a crash. */
+    if(reader->pos + BLOCK_HEADER_SIZE > reader->size || get_u32(reader->data + reader->pos) != DATA_LOG_BLOCK_MAGIC) {
+        return 0;
+    }
+
+    block = reader->data + reader->pos;
+    count = get_u32(block + 4);
+    timestamp = (int64_t)get_u64(block + 8);
+
+    col_start[0] = reader->pos + BLOCK_HEADER_SIZE;
+
+    for(int i=0; i < 3; i++) {
+        col_len[i] = (int64_t)get_u32(block + 16 + 4*i);
+
+        if(i > 0) {
+            col_start[i] = col_start[i-1] + col_len[i-1];
+        }
+    }
+
+    if(count > (uint32_t)max_samples || col_start[2] + col_len[2] > reader->size) {
+        fprintf(stderr, "Corrupt or truncated block at offset %" PRId64 "!\n", reader->pos);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    memset(reader->last_value, 0, sizeof(uint32_t) * (size_t)reader->num_tags);
+
+    for(uint32_t i=0; i < count; i++) {
+        uint64_t delta, tag_index, value;
+
+        if(decode_varint(reader->data + col_start[0], col_len[0], &ts_pos, &delta) != PLCTAG_STATUS_OK
+           || decode_varint(reader->data + col_start[1], col_len[1], &tag_pos, &tag_index) != PLCTAG_STATUS_OK
+           || decode_varint(reader->data + col_start[2], col_len[2], &val_pos, &value) != PLCTAG_STATUS_OK
+           || tag_index >= (uint64_t)reader->num_tags) {
+            fprintf(stderr, "Corrupt block at offset %" PRId64 "!\n", reader->pos);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        /* undo the zigzag encoding. */
+        timestamp += (int64_t)(delta >> 1) ^ -(int64_t)(delta & 1);
+
+        samples[i].timestamp_ms = timestamp;
+        samples[i].tag_index = (uint32_t)tag_index;
+        samples[i].value = reader->last_value[tag_index] ^ (uint32_t)value;
+
+        reader->last_value[tag_index] = samples[i].value;
+    }
+
+    reader->pos = col_start[2] + col_len[2];
+
+    return (int)count;
+}
+
+
+void data_log_reader_close(data_log_reader_p reader)
+{
+    if(!reader) {
+        return;
+    }
+
+    if(reader->tags) {
+        for(int i=0; i < reader->num_tags; i++) {
+            free((char *)reader->tags[i].name);
+        }
+
+        free(reader->tags);
+    }
+
+    if(reader->data) {
+        munmap(reader->data, (size_t)reader->size);
+    }
+
+    if(reader->fd >= 0) {
+        close(reader->fd);
+    }
+
+    free(reader->last_value);
+    free(reader);
+}
+
+
+
+
+/***** helpers *****/
+
+
+/* make sure [file_end, file_end + size) is mapped, growing the file if needed. */
+int writer_reserve(data_log_writer_p writer, int64_t size)
+{
+    int64_t page_size = (int64_t)sysconf(_SC_PAGESIZE);
+    int64_t new_offset;
+
+    if(writer->map && writer->file_end + size <= writer->map_offset + writer->map_size) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(writer->map) {
+        munmap(writer->map, (size_t)writer->map_size);
+        writer->map = NULL;
+    }
+
+    /* maps must start on a page boundary. */
+    new_offset = writer->file_end - (writer->file_end % page_size);
+
+    if(ftruncate(writer->fd, (off_t)(new_offset + MAP_CHUNK_SIZE)) != 0) {
+        fprintf(stderr, "Unable to grow the log file!\n");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    writer->map = mmap(NULL, MAP_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, (off_t)new_offset);
+    if(writer->map == MAP_FAILED) {
+        writer->map = NULL;
+        fprintf(stderr, "Unable to map the log file!\n");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    writer->map_offset = new_offset;
+    writer->map_size = MAP_CHUNK_SIZE;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int writer_append_block(data_log_writer_p writer, const data_log_sample_t *samples, int num_samples)
+{
+    int ts_len = 0, tag_len = 0, val_len = 0;
+    int64_t prev_ts = samples[0].timestamp_ms;
+    int64_t block_size;
+    uint8_t *out;
+    int rc;
+
+    memset(writer->last_value, 0, sizeof(uint32_t) * (size_t)writer->num_tags);
+
+    for(int i=0; i < num_samples; i++) {
+        int64_t delta = samples[i].timestamp_ms - prev_ts;
+        uint32_t tag_index = samples[i].tag_index;
+
+        /* zigzag so that a clock step backwards stays small. */
+        ts_len += encode_varint(writer->ts_col + ts_len, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+        tag_len += encode_varint(writer->tag_col + tag_len, tag_index);
+        val_len += encode_varint(writer->val_col + val_len, writer->last_value[tag_index] ^ samples[i].value);
+
+        writer->last_value[tag_index] = samples[i].value;
+        prev_ts = samples[i].timestamp_ms;
+    }
+
+    block_size = BLOCK_HEADER_SIZE + ts_len + tag_len + val_len;
+
+    if((rc = writer_reserve(writer, block_size)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    out = writer->map + (writer->file_end - writer->map_offset);
+
+    /* the magic goes in last, so a block cut off part way is not taken for a whole one. */
+    memcpy(out + BLOCK_HEADER_SIZE, writer->ts_col, (size_t)ts_len);
+    memcpy(out + BLOCK_HEADER_SIZE + ts_len, writer->tag_col, (size_t)tag_len);
+    memcpy(out + BLOCK_HEADER_SIZE + ts_len + tag_len, writer->val_col, (size_t)val_len);
+
+    put_u32(out + 4, (uint32_t)num_samples);
+    put_u64(out + 8, (uint64_t)samples[0].timestamp_ms);
+    put_u32(out + 16, (uint32_t)ts_len);
+    put_u32(out + 20, (uint32_t)tag_len);
+    put_u32(out + 24, (uint32_t)val_len);
+    put_u32(out, DATA_LOG_BLOCK_MAGIC);
+
+    writer->file_end += block_size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int encode_varint(uint8_t *buf, uint64_t val)
+{
+    int len = 0;
+
+    while(val >= 0x80) {
+        buf[len++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+
+    buf[len++] = (uint8_t)val;
+
+    return len;
+}
+
+
+int decode_varint(const uint8_t *buf, int64_t len, int64_t *pos, uint64_t *val)
+{
+    uint64_t res = 0;
+    int shift = 0;
+
+    while(*pos < len && shift < 64) {
+        uint8_t b = buf[(*pos)++];
+
+        res |= (uint64_t)(b & 0x7F) << shift;
+
+        if(!(b & 0x80)) {
+            *val = res;
+            return PLCTAG_STATUS_OK;
+        }
+
+        shift += 7;
+    }
+
+    return PLCTAG_ERR_BAD_DATA;
+}
+
+
+void put_u16(uint8_t *buf, uint16_t val)
+{
+    buf[0] = (uint8_t)(val & 0xFF);
+    buf[1] = (uint8_t)(val >> 8);
+}
+
+
+void put_u32(uint8_t *buf, uint32_t val)
+{
+    for(int i=0; i < 4; i++) {
+        buf[i] = (uint8_t)((val >> (8*i)) & 0xFF);
+    }
+}
+
+
+void put_u64(uint8_t *buf, uint64_t val)
+{
+    for(int i=0; i < 8; i++) {
+        buf[i] = (uint8_t)((val >> (8*i)) & 0xFF);
+    }
+}
+
+
+uint16_t get_u16(const uint8_t *buf)
+{
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+
+uint32_t get_u32(const uint8_t *buf)
+{
+    uint32_t res = 0;
+
+    for(int i=0; i < 4; i++) {
+        res |= (uint32_t)buf[i] << (8*i);
+    }
+
+    return res;
+}
+
+
+uint64_t get_u64(const uint8_t *buf)
+{
+    uint64_t res = 0;
+
+    for(int i=0; i < 8; i++) {
+        res |= (uint64_t)buf[i] << (8*i);
+    }
+
+    return res;
+}
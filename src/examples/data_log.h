@@ -0,0 +1,95 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef __EXAMPLE_DATA_LOG_H__
+#define __EXAMPLE_DATA_LOG_H__
+
+#include <stdint.h>
+
+/*
+ * Binary log format used by data_dumper -b and read by data_dumper_read.
+ *
+ * All integers are little endian.  A file is a header followed by blocks:
+ *
+ *  header:  "PLCTLOG1", uint32 tag count, then per tag:
+ *           uint8 data type, uint16 name length, name bytes.
+ *
+ *  block:   uint32 DATA_LOG_BLOCK_MAGIC, uint32 sample count,
+ *           int64 first timestamp (epoch ms),
+ *           uint32 length of each of the three columns, then the columns.
+ *
+ * The columns hold the samples of the block:
+ *
+ *  timestamps: zigzag varint deltas from the previous sample.
+ *  tags:       varint tag indexes into the header table.
+ *  values:     varint of the 32-bit value XORed with the previous value
+ *              of the same tag in this block (0 at the start of a block).
+ *
+ * Blocks are independent.  The file is appended through a memory map that
+ * grows in chunks and is cut to size on close.  After a crash the tail is
+ * zero filled, so readers stop at the first block without the magic.
+ */
+
+#define DATA_LOG_FILE_MAGIC "PLCTLOG1"
+#define DATA_LOG_BLOCK_MAGIC (0x31424C50) /* "PLB1" */
+
+#define DATA_LOG_MAX_BLOCK_SAMPLES (4096)
+
+typedef struct {
+    int64_t timestamp_ms;
+    uint32_t tag_index;
+    uint32_t value;
+} data_log_sample_t;
+
+typedef struct {
+    uint8_t data_type;
+    const char *name;
+} data_log_tag_t;
+
+typedef struct data_log_writer_t *data_log_writer_p;
+typedef struct data_log_reader_t *data_log_reader_p;
+
+extern data_log_writer_p data_log_writer_open(const char *file_name, const data_log_tag_t *tags, int num_tags);
+extern int data_log_writer_append(data_log_writer_p writer, const data_log_sample_t *samples, int num_samples);
+extern int data_log_writer_close(data_log_writer_p writer);
+
+extern data_log_reader_p data_log_reader_open(const char *file_name);
+extern int data_log_reader_num_tags(data_log_reader_p reader);
+extern const data_log_tag_t *data_log_reader_tag(data_log_reader_p reader, int index);
+
+/* decodes the next block into samples.  Returns the sample count, 0 at the end or < 0 on error. */
+extern int data_log_reader_next_block(data_log_reader_p reader, data_log_sample_t *samples, int max_samples);
+extern void data_log_reader_close(data_log_reader_p reader);
+
+#endif
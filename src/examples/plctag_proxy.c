@@ -0,0 +1,1145 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../lib/libplctag.h"
+#include "../protocols/proxy/proxy_wire.h"
+#include "utils.h"
+
+/*
+ * A daemon that does tag operations for other local programs, which use
+ * tags with protocol=proxy.  See proxy_wire.h for the messages.
+ *
+ * plctag_proxy [-s <socket path>] [-v] [-d <debug level>]
+ *
+ * Tags with the same attributes, in any order, are created once and
+ * shared by all clients.  A read asked for while a read of the same tag is
+ * in flight gets that read's data, so many clients polling a tag cost one
+ * PLC read.  Reads of different tags started together go out in packed
+ * requests where the PLC supports that.  Operations on one tag run in the
+ * order they arrive.
+ *
+ * Everything runs in one thread.  Tag callbacks only pass completions to
+ * it through a pipe.
+ */
+
+#define REQUIRED_VERSION 2,1,0
+
+#define MAX_CLIENTS (1024)
+#define TAG_TABLE_SIZE (16384) /* must be a power of two */
+#define CLIENT_BUF_INITIAL_SIZE (4096)
+#define CLIENT_OUT_LIMIT (64 * 1024 * 1024) /* clients this far behind are dropped. */
+#define CREATE_POLL_MS (5)
+#define STATS_INTERVAL_MS (10000)
+
+
+typedef struct client_t client_t;
+
+/* a request waiting for a tag operation. */
+typedef struct waiter_t {
+    struct waiter_t *next;
+    client_t *client; /* NULL once the client is gone. */
+    uint32_t request_id;
+    proxy_command_t command;
+    uint8_t *data; /* the data to write. */
+    int size;
+} waiter_t;
+
+typedef struct proxy_tag_t {
+    struct proxy_tag_t *next_by_key;
+    struct proxy_tag_t *next_by_id;
+    struct proxy_tag_t *next_creating;
+    char *key;
+    uint32_t key_hash;
+    int32_t tag_id;
+    int ref_count;
+    int ready;
+
+    /* the operation in flight and who gets its result, the creators until the tag is ready. */
+    proxy_command_t op;
+    waiter_t *op_waiters;
+
+    /* operations waiting to start. */
+    waiter_t *queue_head;
+    waiter_t *queue_tail;
+} proxy_tag_t;
+
+struct client_t {
+    int fd;
+    uint8_t *in;
+    int in_size;
+    int in_used;
+    uint8_t *out;
+    int out_size;
+    int out_used;
+
+    /* one entry per reference this client holds. */
+    int32_t *handles;
+    int num_handles;
+    int handles_capacity;
+};
+
+typedef struct {
+    int32_t tag_id;
+    int32_t event;
+    int32_t status;
+} completion_t;
+
+
+proxy_tag_t *tags_by_key[TAG_TABLE_SIZE];
+proxy_tag_t *tags_by_id[TAG_TABLE_SIZE];
+proxy_tag_t *creating = NULL;
+int num_tags = 0;
+
+client_t *clients[MAX_CLIENTS];
+int num_clients = 0;
+
+int completion_pipe[2] = { -1, -1 };
+int completions_lost = 0;
+
+int verbose = 0;
+uint64_t client_reads = 0;
+uint64_t plc_reads = 0;
+
+volatile sig_atomic_t terminate = 0;
+
+
+void start_next_op(proxy_tag_t *tag);
+
+
+
+/***** tag tables *****/
+
+uint32_t hash_key(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    for(; *key; key++) {
+        hash = (hash ^ (uint8_t)*key) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+
+/* the attributes sorted by name, so the same tag always gets the same key. */
+char *make_key(const uint8_t *attribs, int size)
+{
+    char *copy = NULL;
+    char *key = NULL;
+    char **parts = NULL;
+    int num_parts = 0;
+    int len = 0;
+
+    if(!(copy = malloc((size_t)size + 1)) || !(key = malloc((size_t)size + 1)) || !(parts = calloc((size_t)size / 2 + 1, sizeof(char *)))) {
+        free(copy);
+        free(key);
+        return NULL;
+    }
+
+    memcpy(copy, attribs, (size_t)size);
+    copy[size] = 0;
+
+    for(char *part = strtok(copy, "&"); part; part = strtok(NULL, "&")) {
+        parts[num_parts++] = part;
+    }
+
+    qsort(parts, (size_t)num_parts, sizeof(char *), compare_strings);
+
+    key[0] = 0;
+
+    for(int i = 0; i < num_parts; i++) {
+        len += sprintf(key + len, "%s%s", (i ? "&" : ""), parts[i]);
+    }
+
+    free(parts);
+    free(copy);
+
+    return key;
+}
+
+
+proxy_tag_t *find_tag_by_key(const char *key, uint32_t hash)
+{
+    proxy_tag_t *tag = tags_by_key[hash & (TAG_TABLE_SIZE - 1)];
+
+    while(tag && (tag->key_hash != hash || strcmp(tag->key, key) != 0)) {
+        tag = tag->next_by_key;
+    }
+
+    return tag;
+}
+
+
+proxy_tag_t *find_tag_by_id(int32_t tag_id)
+{
+    proxy_tag_t *tag = tags_by_id[(uint32_t)tag_id & (TAG_TABLE_SIZE - 1)];
+
+    while(tag && tag->tag_id != tag_id) {
+        tag = tag->next_by_id;
+    }
+
+    return tag;
+}
+
+
+void free_waiters(waiter_t *waiter)
+{
+    while(waiter) {
+        waiter_t *next = waiter->next;
+
+        free(waiter->data);
+        free(waiter);
+
+        waiter = next;
+    }
+}
+
+
+void remove_tag(proxy_tag_t *tag)
+{
+    proxy_tag_t **walker;
+
+    for(walker = &tags_by_key[tag->key_hash & (TAG_TABLE_SIZE - 1)]; *walker != tag; walker = &(*walker)->next_by_key);
+    *walker = tag->next_by_key;
+
+    for(walker = &tags_by_id[(uint32_t)tag->tag_id & (TAG_TABLE_SIZE - 1)]; *walker != tag; walker = &(*walker)->next_by_id);
+    *walker = tag->next_by_id;
+
+    if(!tag->ready) {
+        for(walker = &creating; *walker && *walker != tag; walker = &(*walker)->next_creating);
+
+        if(*walker) {
+            *walker = tag->next_creating;
+        }
+    }
+
+    /* later completions for the ID are ignored. */
+    plc_tag_destroy(tag->tag_id);
+
+    free_waiters(tag->op_waiters);
+    free_waiters(tag->queue_head);
+    free(tag->key);
+    free(tag);
+
+    num_tags--;
+}
+
+
+void release_tag(proxy_tag_t *tag)
+{
+    if(--tag->ref_count <= 0) {
+        if(verbose) {
+            printf("Destroying tag %s.\n", tag->key);
+        }
+
+        remove_tag(tag);
+    }
+}
+
+
+
+/***** clients *****/
+
+int ensure_space(uint8_t **buf, int *size, int needed)
+{
+    int new_size = (*size ? *size : CLIENT_BUF_INITIAL_SIZE);
+    uint8_t *new_buf;
+
+    if(needed <= *size) {
+        return 1;
+    }
+
+    while(new_size < needed) {
+        new_size *= 2;
+    }
+
+    if(!(new_buf = realloc(*buf, (size_t)new_size))) {
+        return 0;
+    }
+
+    *buf = new_buf;
+    *size = new_size;
+
+    return 1;
+}
+
+
+void send_reply(client_t *client, proxy_command_t command, uint32_t request_id, int32_t handle, int32_t status, const uint8_t *payload, int payload_size)
+{
+    proxy_msg_header_t header;
+
+    if(!client) {
+        return;
+    }
+
+    if(client->out_used + (int)sizeof(header) + payload_size > CLIENT_OUT_LIMIT
+       || !ensure_space(&client->out, &client->out_size, client->out_used + (int)sizeof(header) + payload_size)) {
+        /* poll() notices and drops the client. */
+        fprintf(stderr, "Client on fd %d is too far behind, dropping it!\n", client->fd);
+        shutdown(client->fd, SHUT_RDWR);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.length = (uint32_t)(sizeof(header) + (size_t)payload_size);
+    header.command = (uint8_t)command;
+    header.version = PROXY_WIRE_VERSION;
+    header.request_id = request_id;
+    header.handle = handle;
+    header.status = status;
+
+    memcpy(client->out + client->out_used, &header, sizeof(header));
+    client->out_used += (int)sizeof(header);
+
+    if(payload_size > 0) {
+        memcpy(client->out + client->out_used, payload, (size_t)payload_size);
+        client->out_used += payload_size;
+    }
+}
+
+
+/* reply with the tag's current data. */
+void send_data_reply(client_t *client, proxy_command_t command, uint32_t request_id, proxy_tag_t *tag)
+{
+    static uint8_t *buf = NULL;
+    static int buf_size = 0;
+    int size = plc_tag_get_size(tag->tag_id);
+    int rc = PLCTAG_STATUS_OK;
+
+    if(size < 0 || !ensure_space(&buf, &buf_size, size)) {
+        send_reply(client, command, request_id, tag->tag_id, (size < 0 ? size : PLCTAG_ERR_NO_MEM), NULL, 0);
+        return;
+    }
+
+    if(size > (int)(PROXY_MAX_MESSAGE_SIZE - sizeof(proxy_msg_header_t))) {
+        send_reply(client, command, request_id, tag->tag_id, PLCTAG_ERR_TOO_LARGE, NULL, 0);
+        return;
+    }
+
+    if(size > 0 && (rc = plc_tag_get_raw_bytes(tag->tag_id, 0, buf, size)) != PLCTAG_STATUS_OK) {
+        send_reply(client, command, request_id, tag->tag_id, rc, NULL, 0);
+        return;
+    }
+
+    send_reply(client, command, request_id, tag->tag_id, PLCTAG_STATUS_OK, buf, size);
+}
+
+
+void add_handle(client_t *client, int32_t handle)
+{
+    if(client->num_handles == client->handles_capacity) {
+        int new_capacity = (client->handles_capacity ? client->handles_capacity * 2 : 16);
+        int32_t *new_handles = realloc(client->handles, (size_t)new_capacity * sizeof(int32_t));
+
+        if(!new_handles) {
+            /* the reference then lives until the daemon exits. */
+            fprintf(stderr, "Unable to track tag handle %d!\n", handle);
+            return;
+        }
+
+        client->handles = new_handles;
+        client->handles_capacity = new_capacity;
+    }
+
+    client->handles[client->num_handles++] = handle;
+}
+
+
+/* returns zero if the client does not hold the handle. */
+int remove_handle(client_t *client, int32_t handle)
+{
+    for(int i = client->num_handles - 1; i >= 0; i--) {
+        if(client->handles[i] == handle) {
+            client->handles[i] = client->handles[--client->num_handles];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void close_client(int index)
+{
+    client_t *client = clients[index];
+
+    if(verbose) {
+        printf("Client on fd %d disconnected.\n", client->fd);
+    }
+
+    /* forget the client's requests. */
+    for(int i = 0; i < TAG_TABLE_SIZE; i++) {
+        for(proxy_tag_t *tag = tags_by_id[i]; tag; tag = tag->next_by_id) {
+            for(waiter_t *waiter = tag->op_waiters; waiter; waiter = waiter->next) {
+                if(waiter->client == client) {
+                    waiter->client = NULL;
+                }
+            }
+
+            for(waiter_t *waiter = tag->queue_head; waiter; waiter = waiter->next) {
+                if(waiter->client == client) {
+                    waiter->client = NULL;
+                }
+            }
+        }
+    }
+
+    for(int i = 0; i < client->num_handles; i++) {
+        proxy_tag_t *tag = find_tag_by_id(client->handles[i]);
+
+        if(tag) {
+            release_tag(tag);
+        }
+    }
+
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+    free(client->handles);
+    free(client);
+
+    clients[index] = clients[--num_clients];
+    clients[num_clients] = NULL;
+}
+
+
+
+/***** tag operations *****/
+
+/* called in the library's helper thread, so only pass the completion on. */
+void tag_callback(int32_t tag_id, int event, int status)
+{
+    completion_t completion;
+
+    if(event != PLCTAG_EVENT_READ_COMPLETED && event != PLCTAG_EVENT_WRITE_COMPLETED) {
+        return;
+    }
+
+    completion.tag_id = tag_id;
+    completion.event = event;
+    completion.status = status;
+
+    if(write(completion_pipe[1], &completion, sizeof(completion)) != (ssize_t)sizeof(completion)) {
+        /* the main loop checks all the tags instead. */
+        __atomic_store_n(&completions_lost, 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+void finish_create(proxy_tag_t *tag, int status)
+{
+    waiter_t *waiters = tag->op_waiters;
+
+    tag->op_waiters = NULL;
+
+    if(status == PLCTAG_STATUS_OK) {
+        tag->ready = 1;
+
+        for(waiter_t *waiter = waiters; waiter; waiter = waiter->next) {
+            send_data_reply(waiter->client, PROXY_CMD_CREATE, waiter->request_id, tag);
+        }
+
+        free_waiters(waiters);
+
+        if(verbose) {
+            printf("Created tag %s.\n", tag->key);
+        }
+
+        /* operations may have queued up while the tag was created. */
+        start_next_op(tag);
+
+        return;
+    }
+
+    fprintf(stderr, "Error %s creating tag %s!\n", plc_tag_decode_error(status), tag->key);
+
+    /* every creator holds a reference, give them back. */
+    for(waiter_t *waiter = waiters; waiter; waiter = waiter->next) {
+        send_reply(waiter->client, PROXY_CMD_CREATE, waiter->request_id, 0, status, NULL, 0);
+
+        if(waiter->client) {
+            remove_handle(waiter->client, tag->tag_id);
+        }
+    }
+
+    free_waiters(waiters);
+
+    remove_tag(tag);
+}
+
+
+void check_creating(void)
+{
+    proxy_tag_t **walker = &creating;
+
+    while(*walker) {
+        proxy_tag_t *tag = *walker;
+        int status = plc_tag_status(tag->tag_id);
+
+        if(status == PLCTAG_STATUS_PENDING) {
+            walker = &tag->next_creating;
+            continue;
+        }
+
+        *walker = tag->next_creating;
+        tag->next_creating = NULL;
+
+        finish_create(tag, status);
+    }
+}
+
+
+void finish_op(proxy_tag_t *tag, int status)
+{
+    waiter_t *waiters = tag->op_waiters;
+    proxy_command_t op = tag->op;
+
+    tag->op = 0;
+    tag->op_waiters = NULL;
+
+    for(waiter_t *waiter = waiters; waiter; waiter = waiter->next) {
+        if(op == PROXY_CMD_READ && status == PLCTAG_STATUS_OK) {
+            send_data_reply(waiter->client, PROXY_CMD_READ, waiter->request_id, tag);
+        } else {
+            send_reply(waiter->client, op, waiter->request_id, tag->tag_id, status, NULL, 0);
+        }
+    }
+
+    free_waiters(waiters);
+
+    start_next_op(tag);
+}
+
+
+void start_next_op(proxy_tag_t *tag)
+{
+    while(!tag->op && tag->ready && tag->queue_head) {
+        waiter_t *waiter = tag->queue_head;
+
+        if(waiter->command == PROXY_CMD_READ) {
+            waiter_t *last = waiter;
+
+            /* consecutive reads share one PLC read. */
+            while(last->next && last->next->command == PROXY_CMD_READ) {
+                last = last->next;
+            }
+
+            tag->op_waiters = tag->queue_head;
+            tag->queue_head = last->next;
+            last->next = NULL;
+
+            tag->op = PROXY_CMD_READ;
+            plc_reads++;
+
+            /* the callback reports the result, even if it is immediate. */
+            plc_tag_read(tag->tag_id, 0);
+        } else {
+            int rc = PLCTAG_STATUS_OK;
+
+            tag->queue_head = waiter->next;
+            waiter->next = NULL;
+
+            if(waiter->size != plc_tag_get_size(tag->tag_id)) {
+                rc = PLCTAG_ERR_BAD_PARAM;
+            } else if(waiter->size > 0) {
+                rc = plc_tag_set_raw_bytes(tag->tag_id, 0, waiter->data, waiter->size);
+            }
+
+            if(rc != PLCTAG_STATUS_OK) {
+                send_reply(waiter->client, PROXY_CMD_WRITE, waiter->request_id, tag->tag_id, rc, NULL, 0);
+                free_waiters(waiter);
+                continue;
+            }
+
+            tag->op_waiters = waiter;
+            tag->op = PROXY_CMD_WRITE;
+
+            plc_tag_write(tag->tag_id, 0);
+        }
+    }
+
+    if(!tag->queue_head) {
+        tag->queue_tail = NULL;
+    }
+}
+
+
+void handle_completions(void)
+{
+    completion_t completions[64];
+    ssize_t size;
+
+    while((size = read(completion_pipe[0], completions, sizeof(completions))) > 0) {
+        for(int i = 0; i < (int)(size / (ssize_t)sizeof(completion_t)); i++) {
+            proxy_tag_t *tag = find_tag_by_id(completions[i].tag_id);
+
+            if(!tag || !tag->op) {
+                continue;
+            }
+
+            if((completions[i].event == PLCTAG_EVENT_READ_COMPLETED) != (tag->op == PROXY_CMD_READ)) {
+                continue;
+            }
+
+            finish_op(tag, completions[i].status);
+        }
+    }
+
+    /* the pipe was full at some point, look at every tag with an operation in flight. */
+    if(__atomic_exchange_n(&completions_lost, 0, __ATOMIC_ACQUIRE)) {
+        for(int i = 0; i < TAG_TABLE_SIZE; i++) {
+            proxy_tag_t *tag = tags_by_id[i];
+
+            while(tag) {
+                proxy_tag_t *next = tag->next_by_id;
+                int status;
+
+                if(tag->op && (status = plc_tag_status(tag->tag_id)) != PLCTAG_STATUS_PENDING) {
+                    finish_op(tag, status);
+                }
+
+                tag = next;
+            }
+        }
+    }
+}
+
+
+
+/***** requests *****/
+
+waiter_t *new_waiter(client_t *client, const proxy_msg_header_t *header, const uint8_t *payload, int payload_size)
+{
+    waiter_t *waiter = calloc(1, sizeof(waiter_t));
+
+    if(!waiter) {
+        return NULL;
+    }
+
+    waiter->client = client;
+    waiter->request_id = header->request_id;
+    waiter->command = (proxy_command_t)header->command;
+
+    if(header->command == PROXY_CMD_WRITE && payload_size > 0) {
+        if(!(waiter->data = malloc((size_t)payload_size))) {
+            free(waiter);
+            return NULL;
+        }
+
+        memcpy(waiter->data, payload, (size_t)payload_size);
+        waiter->size = payload_size;
+    }
+
+    return waiter;
+}
+
+
+void handle_create(client_t *client, const proxy_msg_header_t *header, const uint8_t *payload, int payload_size)
+{
+    proxy_tag_t *tag = NULL;
+    waiter_t *waiter = NULL;
+    char *key = make_key(payload, payload_size);
+    uint32_t hash;
+    int32_t tag_id;
+
+    if(!key) {
+        send_reply(client, PROXY_CMD_CREATE, header->request_id, 0, PLCTAG_ERR_NO_MEM, NULL, 0);
+        return;
+    }
+
+    hash = hash_key(key);
+
+    if((tag = find_tag_by_key(key, hash))) {
+        free(key);
+
+        tag->ref_count++;
+        add_handle(client, tag->tag_id);
+
+        if(tag->ready) {
+            send_data_reply(client, PROXY_CMD_CREATE, header->request_id, tag);
+        } else if((waiter = new_waiter(client, header, NULL, 0))) {
+            waiter->next = tag->op_waiters;
+            tag->op_waiters = waiter;
+        } else {
+            remove_handle(client, tag->tag_id);
+            release_tag(tag);
+            send_reply(client, PROXY_CMD_CREATE, header->request_id, 0, PLCTAG_ERR_NO_MEM, NULL, 0);
+        }
+
+        return;
+    }
+
+    if(num_tags >= TAG_TABLE_SIZE * 4) {
+        free(key);
+        send_reply(client, PROXY_CMD_CREATE, header->request_id, 0, PLCTAG_ERR_NO_RESOURCES, NULL, 0);
+        return;
+    }
+
+    tag_id = plc_tag_create(key, 0);
+
+    if(tag_id < 0) {
+        fprintf(stderr, "Error %s creating tag %s!\n", plc_tag_decode_error(tag_id), key);
+        free(key);
+        send_reply(client, PROXY_CMD_CREATE, header->request_id, 0, tag_id, NULL, 0);
+        return;
+    }
+
+    if(!(tag = calloc(1, sizeof(proxy_tag_t))) || !(waiter = new_waiter(client, header, NULL, 0))) {
+        free(tag);
+        free(key);
+        plc_tag_destroy(tag_id);
+        send_reply(client, PROXY_CMD_CREATE, header->request_id, 0, PLCTAG_ERR_NO_MEM, NULL, 0);
+        return;
+    }
+
+    tag->key = key;
+    tag->key_hash = hash;
+    tag->tag_id = tag_id;
+    tag->ref_count = 1;
+    tag->op_waiters = waiter;
+
+    tag->next_by_key = tags_by_key[hash & (TAG_TABLE_SIZE - 1)];
+    tags_by_key[hash & (TAG_TABLE_SIZE - 1)] = tag;
+
+    tag->next_by_id = tags_by_id[(uint32_t)tag_id & (TAG_TABLE_SIZE - 1)];
+    tags_by_id[(uint32_t)tag_id & (TAG_TABLE_SIZE - 1)] = tag;
+
+    tag->next_creating = creating;
+    creating = tag;
+
+    num_tags++;
+
+    add_handle(client, tag_id);
+    plc_tag_register_callback(tag_id, tag_callback);
+}
+
+
+void handle_destroy(client_t *client, const proxy_msg_header_t *header, const uint8_t *payload, int payload_size)
+{
+    proxy_tag_t *tag = NULL;
+    uint32_t create_request_id = 0;
+
+    if(header->handle) {
+        if((tag = find_tag_by_id(header->handle)) && remove_handle(client, header->handle)) {
+            release_tag(tag);
+        }
+
+        return;
+    }
+
+    /* the client gave up on a tag it is still creating. */
+    if(payload_size != (int)sizeof(create_request_id)) {
+        return;
+    }
+
+    memcpy(&create_request_id, payload, sizeof(create_request_id));
+
+    for(tag = creating; tag; tag = tag->next_creating) {
+        for(waiter_t **walker = &tag->op_waiters; *walker; walker = &(*walker)->next) {
+            waiter_t *waiter = *walker;
+
+            if(waiter->client == client && waiter->request_id == create_request_id) {
+                *walker = waiter->next;
+                free_waiters((waiter->next = NULL, waiter));
+
+                remove_handle(client, tag->tag_id);
+                release_tag(tag);
+
+                return;
+            }
+        }
+    }
+}
+
+
+void handle_request(client_t *client, const proxy_msg_header_t *header, const uint8_t *payload, int payload_size)
+{
+    proxy_tag_t *tag = NULL;
+    waiter_t *waiter = NULL;
+
+    switch(header->command) {
+    case PROXY_CMD_CREATE:
+        handle_create(client, header, payload, payload_size);
+        return;
+
+    case PROXY_CMD_DESTROY:
+        handle_destroy(client, header, payload, payload_size);
+        return;
+
+    case PROXY_CMD_READ:
+    case PROXY_CMD_WRITE:
+        break;
+
+    default:
+        send_reply(client, (proxy_command_t)header->command, header->request_id, header->handle, PLCTAG_ERR_UNSUPPORTED, NULL, 0);
+        return;
+    }
+
+    if(!(tag = find_tag_by_id(header->handle))) {
+        send_reply(client, (proxy_command_t)header->command, header->request_id, header->handle, PLCTAG_ERR_NOT_FOUND, NULL, 0);
+        return;
+    }
+
+    if(header->command == PROXY_CMD_READ) {
+        client_reads++;
+
+        /* join the read in flight if nothing is queued behind it. */
+        if(tag->op == PROXY_CMD_READ && !tag->queue_head && (waiter = new_waiter(client, header, NULL, 0))) {
+            waiter->next = tag->op_waiters;
+            tag->op_waiters = waiter;
+            return;
+        }
+    }
+
+    if(!(waiter = new_waiter(client, header, payload, payload_size))) {
+        send_reply(client, (proxy_command_t)header->command, header->request_id, header->handle, PLCTAG_ERR_NO_MEM, NULL, 0);
+        return;
+    }
+
+    if(tag->queue_tail) {
+        tag->queue_tail->next = waiter;
+    } else {
+        tag->queue_head = waiter;
+    }
+
+    tag->queue_tail = waiter;
+
+    start_next_op(tag);
+}
+
+
+/* returns zero when the client should be dropped. */
+int read_client(client_t *client)
+{
+    int offset = 0;
+    ssize_t rc;
+
+    if(!ensure_space(&client->in, &client->in_size, client->in_used + CLIENT_BUF_INITIAL_SIZE)) {
+        return 0;
+    }
+
+    rc = read(client->fd, client->in + client->in_used, (size_t)(client->in_size - client->in_used));
+
+    if(rc <= 0) {
+        return (rc < 0 && (errno == EAGAIN || errno == EINTR));
+    }
+
+    client->in_used += (int)rc;
+
+    while(client->in_used - offset >= (int)sizeof(proxy_msg_header_t)) {
+        proxy_msg_header_t header;
+
+        memcpy(&header, client->in + offset, sizeof(header));
+
+        if(header.length < sizeof(header) || header.length > PROXY_MAX_MESSAGE_SIZE || header.version != PROXY_WIRE_VERSION) {
+            fprintf(stderr, "Bad message from the client on fd %d, dropping it!\n", client->fd);
+            return 0;
+        }
+
+        if(client->in_used - offset < (int)header.length) {
+            if(!ensure_space(&client->in, &client->in_size, (int)header.length)) {
+                return 0;
+            }
+
+            break;
+        }
+
+        handle_request(client, &header, client->in + offset + sizeof(header), (int)(header.length - sizeof(header)));
+
+        offset += (int)header.length;
+    }
+
+    memmove(client->in, client->in + offset, (size_t)(client->in_used - offset));
+    client->in_used -= offset;
+
+    return 1;
+}
+
+
+/* returns zero when the client should be dropped. */
+int write_client(client_t *client)
+{
+    ssize_t rc;
+
+    if(client->out_used == 0) {
+        return 1;
+    }
+
+    rc = send(client->fd, client->out, (size_t)client->out_used, MSG_NOSIGNAL);
+
+    if(rc < 0) {
+        return (errno == EAGAIN || errno == EINTR);
+    }
+
+    memmove(client->out, client->out + rc, (size_t)(client->out_used - (int)rc));
+    client->out_used -= (int)rc;
+
+    return 1;
+}
+
+
+
+/***** main loop *****/
+
+int open_listener(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long!\n", path);
+        return -1;
+    }
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("Unable to create the socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    /* a socket file left by an earlier run is in the way. */
+    unlink(path);
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        perror("Unable to listen on the socket");
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    return fd;
+}
+
+
+void accept_clients(int listen_fd)
+{
+    int fd;
+
+    while((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        client_t *client;
+
+        if(num_clients >= MAX_CLIENTS || !(client = calloc(1, sizeof(client_t)))) {
+            fprintf(stderr, "Too many clients, refusing a connection!\n");
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+        client->fd = fd;
+        clients[num_clients++] = client;
+
+        if(verbose) {
+            printf("Client on fd %d connected.\n", fd);
+        }
+    }
+}
+
+
+void SIGINT_handler(int not_used)
+{
+    (void)not_used;
+
+    terminate = 1;
+}
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_proxy [-s <socket path>] [-v] [-d <debug level>]\n");
+    fprintf(stderr, "\t-s = the socket clients connect to, default %s.\n", PROXY_DEFAULT_SOCKET_PATH);
+    fprintf(stderr, "\t-v = print clients and tags as they come and go, and read statistics.\n");
+    fprintf(stderr, "\t-d = the library debug level, 1 to 5.\n");
+    fprintf(stderr, "Clients use tags with protocol=proxy, see src/protocols/proxy/proxy.c.\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    static struct pollfd fds[MAX_CLIENTS + 2];
+    const char *path = PROXY_DEFAULT_SOCKET_PATH;
+    struct sigaction act;
+    int64_t last_stats = util_time_ms();
+    uint64_t last_client_reads = 0;
+    uint64_t last_plc_reads = 0;
+    int listen_fd;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            plc_tag_set_debug_level(atoi(argv[++i]));
+        } else if(strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGINT_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
+
+    if(pipe(completion_pipe) != 0) {
+        perror("Unable to create the completion pipe");
+        return 1;
+    }
+
+    fcntl(completion_pipe[0], F_SETFL, fcntl(completion_pipe[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(completion_pipe[1], F_SETFL, fcntl(completion_pipe[1], F_GETFL, 0) | O_NONBLOCK);
+
+    if((listen_fd = open_listener(path)) < 0) {
+        return 1;
+    }
+
+    /* the output is often redirected to a log. */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    printf("Listening on %s.\n", path);
+
+    while(!terminate) {
+        int num_fds = 0;
+        int64_t now;
+
+        fds[num_fds].fd = listen_fd;
+        fds[num_fds++].events = POLLIN;
+
+        fds[num_fds].fd = completion_pipe[0];
+        fds[num_fds++].events = POLLIN;
+
+        for(int i = 0; i < num_clients; i++) {
+            fds[num_fds].fd = clients[i]->fd;
+            fds[num_fds++].events = (short)(POLLIN | (clients[i]->out_used ? POLLOUT : 0));
+        }
+
+        /* tag creation has no callback, so poll for it. */
+        if(poll(fds, (nfds_t)num_fds, (creating ? CREATE_POLL_MS : 1000)) < 0 && errno != EINTR) {
+            perror("poll() failed");
+            break;
+        }
+
+        if(fds[0].revents & POLLIN) {
+            accept_clients(listen_fd);
+        }
+
+        handle_completions();
+
+        if(creating) {
+            check_creating();
+        }
+
+        /* clients accepted above are not in fds yet, so walk down from the end of the old list. */
+        for(int i = num_fds - 3; i >= 0; i--) {
+            short revents = fds[i + 2].revents;
+            int keep = 1;
+
+            if(revents & POLLIN) {
+                keep = read_client(clients[i]);
+            } else if(revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                keep = 0;
+            }
+
+            if(keep) {
+                keep = write_client(clients[i]);
+            }
+
+            if(!keep) {
+                close_client(i);
+            }
+        }
+
+        /* replies for clients that had no event. */
+        for(int i = 0; i < num_clients; i++) {
+            if(clients[i]->out_used && !write_client(clients[i])) {
+                close_client(i);
+                i--;
+            }
+        }
+
+        now = util_time_ms();
+
+        if(verbose && now - last_stats >= STATS_INTERVAL_MS) {
+            printf("%d clients, %d tags, %.0f client reads/s, %.0f PLC reads/s.\n", num_clients, num_tags,
+                   (double)(client_reads - last_client_reads) * 1000.0 / (double)(now - last_stats),
+                   (double)(plc_reads - last_plc_reads) * 1000.0 / (double)(now - last_stats));
+
+            last_client_reads = client_reads;
+            last_plc_reads = plc_reads;
+            last_stats = now;
+        }
+    }
+
+    printf("Terminating!\n");
+
+    close(listen_fd);
+    unlink(path);
+
+    while(num_clients > 0) {
+        close_client(num_clients - 1);
+    }
+
+    return 0;
+}
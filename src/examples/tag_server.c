@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+/*
+ * Serves two tags from this program's memory to any EtherNet/IP client:
+ *
+ *   TestDINTArray - DINT[10], element 0 counts up every second.
+ *   TestREAL - REAL.
+ *
+ * Run it, then from another shell:
+ *
+ *   ./tag_rw -t sint32 -p 'protocol=ab-eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_size=4&elem_count=10&name=TestDINTArray'
+ *
+ * Usage: tag_server [seconds to run, default forever]
+ */
+
+#define SERVER_ATTRIBS "listen=0.0.0.0:44818&path=1,0"
+
+#define CIP_TYPE_DINT (0xC4)
+#define CIP_TYPE_REAL (0xCA)
+
+static int32_t dint_array[10];
+static float real_val = 0.0f;
+
+
+static void on_write(int32_t server, const char *name, int offset, int length)
+{
+    (void)server;
+
+    printf("Client wrote %d bytes at offset %d of %s.\n", length, offset, name);
+}
+
+
+int main(int argc, char **argv)
+{
+    int32_t server = 0;
+    int run_secs = (argc > 1 ? atoi(argv[1]) : -1);
+    int rc;
+    int i;
+
+    server = plc_tag_server_create(SERVER_ATTRIBS);
+    if(server < 0) {
+        fprintf(stderr, "ERROR %s: Could not create server!\n", plc_tag_decode_error(server));
+        return 1;
+    }
+
+    rc = plc_tag_server_add_tag(server, "TestDINTArray", CIP_TYPE_DINT, 4, 10, dint_array);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = plc_tag_server_add_tag(server, "TestREAL", CIP_TYPE_REAL, 4, 1, &real_val);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = plc_tag_server_register_callback(server, on_write);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR %s: Could not set up tags!\n", plc_tag_decode_error(rc));
+        plc_tag_server_destroy(server);
+        return 1;
+    }
+
+    printf("Serving tags on %s.\n", SERVER_ATTRIBS);
+    fflush(stdout);
+
+    for(i = 0; run_secs < 0 || i < run_secs; i++) {
+        util_sleep_ms(1000);
+
+        /* the server thread reads the data too, so change it under the lock. */
+        plc_tag_server_lock(server);
+        dint_array[0]++;
+        plc_tag_server_unlock(server);
+    }
+
+    plc_tag_server_destroy(server);
+
+    return 0;
+}
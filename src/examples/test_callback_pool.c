@@ -0,0 +1,208 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Check the callback thread pool.  Slow callbacks fill a small queue so
+ * that events are dropped.  Then half of the tags unregister their
+ * callback and every tag is aborted and destroyed.  The ABORTED and
+ * DESTROYED events of the other half must all arrive, no tag may run two
+ * callbacks at once, no event may follow DESTROYED and no callback may
+ * run after it was unregistered.
+ *
+ * No PLC is needed, the tags use the loopback protocol.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,4
+
+#define NUM_TAGS (32)
+#define NUM_ROUNDS (20)
+#define NUM_THREADS (4)
+#define QUEUE_SIZE (16)
+#define DATA_TIMEOUT (5000)
+#define RUN_TIMEOUT (20000)
+
+
+static int32_t tags[NUM_TAGS] = {0};
+static volatile int running[NUM_TAGS] = {0};
+static volatile int destroyed[NUM_TAGS] = {0};
+static volatile int unregistered[NUM_TAGS] = {0};
+static volatile int num_aborted = 0;
+static volatile int num_destroyed = 0;
+static volatile int errors = 0;
+
+
+static void tag_callback(int32_t tag_id, int event, int status)
+{
+    int index = -1;
+
+    (void)status;
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(tags[i] == tag_id) {
+            index = i;
+            break;
+        }
+    }
+
+    if(index < 0) {
+        fprintf(stderr, "Callback for unknown tag %d!\n", tag_id);
+        __sync_fetch_and_add(&errors, 1);
+        return;
+    }
+
+    if(__sync_fetch_and_add(&running[index], 1) != 0) {
+        fprintf(stderr, "Two callbacks at once for tag %d!\n", tag_id);
+        __sync_fetch_and_add(&errors, 1);
+    }
+
+    if(unregistered[index]) {
+        fprintf(stderr, "Event %d after the callback was unregistered for tag %d!\n", event, tag_id);
+        __sync_fetch_and_add(&errors, 1);
+    }
+
+    if(destroyed[index]) {
+        fprintf(stderr, "Event %d after PLCTAG_EVENT_DESTROYED for tag %d!\n", event, tag_id);
+        __sync_fetch_and_add(&errors, 1);
+    }
+
+    switch(event) {
+        case PLCTAG_EVENT_READ_COMPLETED:
+            /* slow enough that the queue fills up. */
+            util_sleep_ms(1);
+            break;
+
+        case PLCTAG_EVENT_ABORTED:
+            __sync_fetch_and_add(&num_aborted, 1);
+            break;
+
+        case PLCTAG_EVENT_DESTROYED:
+            destroyed[index] = 1;
+            __sync_fetch_and_add(&num_destroyed, 1);
+            break;
+
+        default:
+            break;
+    }
+
+    __sync_fetch_and_sub(&running[index], 1);
+}
+
+
+int main(void)
+{
+    int64_t timeout_time = 0;
+    int dropped = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    if(plc_tag_set_int_attribute(0, "callback_queue_size", QUEUE_SIZE) != PLCTAG_STATUS_OK || plc_tag_set_int_attribute(0, "callback_threads", NUM_THREADS) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to start the callback threads!\n");
+        exit(1);
+    }
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        char path[128];
+
+        snprintf(path, sizeof(path), "protocol=loopback&name=PoolTest%d&elem_size=4&elem_count=1", i);
+
+        if((tags[i] = plc_tag_create(path, DATA_TIMEOUT)) < 0) {
+            fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            exit(1);
+        }
+
+        plc_tag_register_callback(tags[i], tag_callback);
+    }
+
+    for(int round=0; round < NUM_ROUNDS; round++) {
+        for(int i=0; i < NUM_TAGS; i++) {
+            plc_tag_read(tags[i], DATA_TIMEOUT);
+        }
+    }
+
+    /* the queue is still full, the odd tags have events in it. */
+    for(int i=1; i < NUM_TAGS; i += 2) {
+        int rc = plc_tag_unregister_callback(tags[i]);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Error %s unregistering the callback of tag %d!\n", plc_tag_decode_error(rc), i);
+            errors++;
+        }
+
+        unregistered[i] = 1;
+    }
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        plc_tag_abort(tags[i]);
+        plc_tag_destroy(tags[i]);
+    }
+
+    timeout_time = util_time_ms() + RUN_TIMEOUT;
+
+    while(num_destroyed < NUM_TAGS/2 && timeout_time > util_time_ms()) {
+        util_sleep_ms(10);
+    }
+
+    dropped = plc_tag_get_int_attribute(0, "callback_events_dropped", -1);
+
+    printf("Dropped %d events, got %d of %d aborted and %d of %d destroyed events.\n", dropped, num_aborted, NUM_TAGS/2, num_destroyed, NUM_TAGS/2);
+
+    if(dropped <= 0) {
+        fprintf(stderr, "FAILED: the queue never filled up, the test proves nothing!\n");
+        errors++;
+    }
+
+    if(num_aborted != NUM_TAGS/2 || num_destroyed != NUM_TAGS/2) {
+        fprintf(stderr, "FAILED: terminal events were lost!\n");
+        errors++;
+    }
+
+    if(errors) {
+        fprintf(stderr, "FAILED with %d errors.\n", errors);
+        exit(1);
+    }
+
+    printf("SUCCESS!\n");
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Check that a tag created with delta_write=1 only writes the ranges
+ * its setters changed.  A second, plain tag on the same array changes
+ * an element behind the delta tag's back.  After the delta tag writes
+ * some scattered elements, that element must still hold the value the
+ * plain tag wrote, and everything else must match what the delta tag
+ * holds.
+ *
+ * ./ab_server --plc=ControlLogix --path=1,0 --tag=TestDeltaArray:DINT[1000] &
+ * ./test_delta_write
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,4
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1000&name=TestDeltaArray"
+#define NUM_ELEMS (1000)
+#define UNTOUCHED_ELEM (500)
+#define DATA_TIMEOUT (5000)
+
+/* a few ranges, then more than the tag can track so that some are joined. */
+static const int few_elems[] = { 10, 11, 300, 900, -1 };
+static const int many_elems[] = { 0, 40, 80, 120, 160, 200, 240, 280, 320, 360, 400, 440, 950, -1 };
+
+
+static int check_round(int32_t delta, int32_t plain, const int *elems, int32_t base)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+    int32_t untouched = -(base + UNTOUCHED_ELEM);
+
+    /* both tags start from the same data. */
+    for(int i=0; i < NUM_ELEMS; i++) {
+        plc_tag_set_int32(plain, i * 4, base + i);
+    }
+
+    if((rc = plc_tag_write(plain, DATA_TIMEOUT)) != PLCTAG_STATUS_OK || (rc = plc_tag_read(delta, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to set up the array, %s!\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* change one element that the delta tag does not know about. */
+    plc_tag_set_int32(plain, UNTOUCHED_ELEM * 4, untouched);
+
+    if((rc = plc_tag_write(plain, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to write the untouched element, %s!\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    for(int i=0; elems[i] >= 0; i++) {
+        plc_tag_set_int32(delta, elems[i] * 4, -(base + elems[i]));
+    }
+
+    if((rc = plc_tag_write(delta, DATA_TIMEOUT)) != PLCTAG_STATUS_OK || (rc = plc_tag_read(plain, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to write the scattered elements, %s!\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    for(int i=0; i < NUM_ELEMS; i++) {
+        int32_t expected = (i == UNTOUCHED_ELEM ? untouched : plc_tag_get_int32(delta, i * 4));
+
+        if(plc_tag_get_int32(plain, i * 4) != expected) {
+            fprintf(stderr, "Element %d is %d, expected %d!\n", i, plc_tag_get_int32(plain, i * 4), expected);
+            errors++;
+        }
+    }
+
+    for(int i=0; elems[i] >= 0; i++) {
+        if(plc_tag_get_int32(plain, elems[i] * 4) != -(base + elems[i])) {
+            fprintf(stderr, "Element %d was not written!\n", elems[i]);
+            errors++;
+        }
+    }
+
+    return (errors ? PLCTAG_ERR_BAD_DATA : PLCTAG_STATUS_OK);
+}
+
+
+int main(void)
+{
+    int32_t delta = 0;
+    int32_t plain = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    if((delta = plc_tag_create(TAG_PATH "&delta_write=1", DATA_TIMEOUT)) < 0) {
+        fprintf(stderr, "Error %s creating the delta write tag!\n", plc_tag_decode_error(delta));
+        exit(1);
+    }
+
+    if((plain = plc_tag_create(TAG_PATH, DATA_TIMEOUT)) < 0) {
+        fprintf(stderr, "Error %s creating the plain tag!\n", plc_tag_decode_error(plain));
+        exit(1);
+    }
+
+    rc = check_round(delta, plain, few_elems, 1000);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = check_round(delta, plain, many_elems, 2000);
+    }
+
+    plc_tag_destroy(delta);
+    plc_tag_destroy(plain);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "FAILED: %s\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    fprintf(stderr, "Done.\n");
+
+    return 0;
+}
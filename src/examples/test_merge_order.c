@@ -0,0 +1,254 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Check that the session keeps the order of requests when it merges
+ * them.  Each round starts a read of element 0, a write of element 3
+ * and then reads of elements 1 to 9, all at once.  The reads may go out
+ * as one merged read, but the read of element 3 must see the value that
+ * was just written.
+ *
+ * Bit writes to one word are merged too.  A read started between two
+ * bit writes must only see the first, and a bit that is cleared and
+ * then set must end up set.
+ *
+ * ./ab_server --plc=ControlLogix --path=1,0 --tag=TestDINTArray:DINT[10] &
+ * ./test_merge_order
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,4
+
+#define TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestDINTArray[%d]"
+#define BIT_TAG_PATH "protocol=ab-eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestDINTArray[%d].%d"
+#define NUM_ELEMS (10)
+#define WRITE_ELEM (3)
+#define BIT_ELEM (5)
+#define NUM_BIT_TAGS (4)
+#define NUM_ROUNDS (50)
+#define DATA_TIMEOUT (5000)
+
+
+static int wait_for_tags(int32_t *tags, int num_tags)
+{
+    int64_t timeout_time = util_time_ms() + DATA_TIMEOUT;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i=0; i < num_tags; i++) {
+        while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && timeout_time > util_time_ms()) {
+            util_sleep_ms(1);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Tag %d finished with status %s!\n", tags[i], plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int test_read_after_write(int32_t *readers, int32_t writer)
+{
+    int stale = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int round=1; round <= NUM_ROUNDS; round++) {
+        int32_t value = (round * 1000) + WRITE_ELEM;
+
+        plc_tag_set_int32(writer, 0, value);
+
+        /* one read before the write and the rest after it. */
+        plc_tag_read(readers[0], 0);
+        plc_tag_write(writer, 0);
+
+        for(int i=1; i < NUM_ELEMS; i++) {
+            plc_tag_read(readers[i], 0);
+        }
+
+        if((rc = wait_for_tags(readers, NUM_ELEMS)) != PLCTAG_STATUS_OK || (rc = wait_for_tags(&writer, 1)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        if(plc_tag_get_int32(readers[WRITE_ELEM], 0) != value) {
+            fprintf(stderr, "Round %d: read of element %d got %d, expected %d!\n", round, WRITE_ELEM, plc_tag_get_int32(readers[WRITE_ELEM], 0), value);
+            stale++;
+        }
+    }
+
+    fprintf(stderr, "Read after write: %d of %d rounds read stale data.\n", stale, NUM_ROUNDS);
+
+    return (stale ? PLCTAG_ERR_BAD_DATA : PLCTAG_STATUS_OK);
+}
+
+
+static int test_bit_writes(int32_t word, int32_t *bits)
+{
+    int errors = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int round=1; round <= NUM_ROUNDS; round++) {
+        int32_t ops[3];
+
+        plc_tag_set_int32(word, 0, 0);
+
+        if((rc = plc_tag_write(word, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to clear the word, %s!\n", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        /* set bit 0, read the word, set bit 1. */
+        plc_tag_set_bit(bits[0], 0, 1);
+        plc_tag_set_bit(bits[1], 0, 1);
+
+        plc_tag_write(bits[0], 0);
+        plc_tag_read(word, 0);
+        plc_tag_write(bits[1], 0);
+
+        ops[0] = bits[0];
+        ops[1] = word;
+        ops[2] = bits[1];
+
+        if((rc = wait_for_tags(ops, 3)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        if(plc_tag_get_int32(word, 0) != 0x01) {
+            fprintf(stderr, "Round %d: read between bit writes got %08x, expected 00000001!\n", round, (unsigned)plc_tag_get_int32(word, 0));
+            errors++;
+        }
+
+        /* clear bit 2 then set it again. */
+        plc_tag_set_bit(bits[2], 0, 0);
+        plc_tag_set_bit(bits[3], 0, 1);
+
+        plc_tag_write(bits[2], 0);
+        plc_tag_write(bits[3], 0);
+
+        if((rc = wait_for_tags(&bits[2], 2)) != PLCTAG_STATUS_OK || (rc = plc_tag_read(word, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        if(plc_tag_get_int32(word, 0) != 0x07) {
+            fprintf(stderr, "Round %d: bit writes left %08x, expected 00000007!\n", round, (unsigned)plc_tag_get_int32(word, 0));
+            errors++;
+        }
+    }
+
+    fprintf(stderr, "Bit writes: %d errors in %d rounds.\n", errors, NUM_ROUNDS);
+
+    return (errors ? PLCTAG_ERR_BAD_DATA : PLCTAG_STATUS_OK);
+}
+
+
+int main(void)
+{
+    int32_t readers[NUM_ELEMS];
+    int32_t writer = 0;
+    int32_t word = 0;
+    int32_t bits[NUM_BIT_TAGS];
+    char tag_path[256];
+    int rc = PLCTAG_STATUS_OK;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    for(int i=0; i < NUM_ELEMS; i++) {
+        snprintf_platform(tag_path, sizeof(tag_path), TAG_PATH, i);
+
+        if((readers[i] = plc_tag_create(tag_path, DATA_TIMEOUT)) < 0) {
+            fprintf(stderr, "Error %s creating tag for element %d!\n", plc_tag_decode_error(readers[i]), i);
+            exit(1);
+        }
+    }
+
+    snprintf_platform(tag_path, sizeof(tag_path), TAG_PATH, WRITE_ELEM);
+
+    if((writer = plc_tag_create(tag_path, DATA_TIMEOUT)) < 0) {
+        fprintf(stderr, "Error %s creating the write tag!\n", plc_tag_decode_error(writer));
+        exit(1);
+    }
+
+    snprintf_platform(tag_path, sizeof(tag_path), TAG_PATH, BIT_ELEM);
+
+    if((word = plc_tag_create(tag_path, DATA_TIMEOUT)) < 0) {
+        fprintf(stderr, "Error %s creating the word tag!\n", plc_tag_decode_error(word));
+        exit(1);
+    }
+
+    /* bits 0, 1 and two tags for bit 2. */
+    for(int i=0; i < NUM_BIT_TAGS; i++) {
+        snprintf_platform(tag_path, sizeof(tag_path), BIT_TAG_PATH, BIT_ELEM, (i < 2 ? i : 2));
+
+        if((bits[i] = plc_tag_create(tag_path, DATA_TIMEOUT)) < 0) {
+            fprintf(stderr, "Error %s creating bit tag %d!\n", plc_tag_decode_error(bits[i]), i);
+            exit(1);
+        }
+    }
+
+    rc = test_read_after_write(readers, writer);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = test_bit_writes(word, bits);
+    }
+
+    for(int i=0; i < NUM_ELEMS; i++) {
+        plc_tag_destroy(readers[i]);
+    }
+
+    for(int i=0; i < NUM_BIT_TAGS; i++) {
+        plc_tag_destroy(bits[i]);
+    }
+
+    plc_tag_destroy(writer);
+    plc_tag_destroy(word);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "FAILED: %s\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    fprintf(stderr, "Done.\n");
+
+    return 0;
+}
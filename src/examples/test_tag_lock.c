@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+/*
+ * Check that plc_tag_lock() does not block other API calls.  Several
+ * threads take the lock, read and increment the value with the getter
+ * and setter, and release the lock.  A thread waiting for the lock
+ * must not stop the thread holding it from calling the getter.  The
+ * final count also checks that the lock keeps the increments apart.
+ *
+ * No PLC is needed, the tag uses the loopback protocol.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define REQUIRED_VERSION 2,1,4
+
+#define TAG_PATH "protocol=loopback&name=LockTest&elem_size=4&elem_count=1"
+#define NUM_THREADS (4)
+#define NUM_ITERATIONS (20000)
+#define DATA_TIMEOUT (5000)
+#define RUN_TIMEOUT (20000)
+
+
+static int32_t tag = 0;
+static volatile int threads_done = 0;
+static volatile int errors = 0;
+
+
+static void *lock_thread(void *arg)
+{
+    (void)arg;
+
+    for(int i=0; i < NUM_ITERATIONS; i++) {
+        int rc = plc_tag_lock(tag);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to lock the tag, %s!\n", plc_tag_decode_error(rc));
+            errors++;
+            break;
+        }
+
+        plc_tag_set_int32(tag, 0, plc_tag_get_int32(tag, 0) + 1);
+
+        plc_tag_unlock(tag);
+    }
+
+    __sync_fetch_and_add(&threads_done, 1);
+
+    return NULL;
+}
+
+
+int main(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int64_t timeout_time = 0;
+    int32_t count = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    if((tag = plc_tag_create(TAG_PATH, DATA_TIMEOUT)) < 0) {
+        fprintf(stderr, "Error %s creating the tag!\n", plc_tag_decode_error(tag));
+        exit(1);
+    }
+
+    plc_tag_set_int32(tag, 0, 0);
+
+    for(int i=0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, lock_thread, NULL);
+    }
+
+    timeout_time = util_time_ms() + RUN_TIMEOUT;
+
+    while(threads_done < NUM_THREADS && timeout_time > util_time_ms()) {
+        util_sleep_ms(10);
+    }
+
+    /* the threads are stuck.  Skip the library cleanup too, it would wait for them. */
+    if(threads_done < NUM_THREADS) {
+        fprintf(stderr, "FAILED: only %d of %d threads finished, the lock is deadlocked!\n", threads_done, NUM_THREADS);
+        _exit(1);
+    }
+
+    for(int i=0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    count = plc_tag_get_int32(tag, 0);
+
+    plc_tag_destroy(tag);
+
+    if(errors || count != NUM_THREADS * NUM_ITERATIONS) {
+        fprintf(stderr, "FAILED: count is %d, expected %d.\n", count, NUM_THREADS * NUM_ITERATIONS);
+        return 1;
+    }
+
+    fprintf(stderr, "Done, count is %d.\n", count);
+
+    return 0;
+}
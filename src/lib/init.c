@@ -38,7 +38,11 @@
 #include <util/attr.h>
 #include <util/debug.h>
 #include <ab/ab.h>
+#include <ab/cip_server.h>
+#include <loopback/loopback.h>
 #include <mb/modbus.h>
+#include <proxy/proxy.h>
+#include <shm/shm.h>
 #include <system/system.h>
 #include <lib/init.h>
 
@@ -63,7 +67,13 @@ struct {
     {"ab-eip", NULL, NULL, NULL, ab_tag_create},
     {"ab_eip", NULL, NULL, NULL, ab_tag_create},
     {"modbus-tcp", NULL, NULL, NULL, mb_tag_create},
-    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create}
+    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create},
+    /* In-memory tags for testing */
+    {"loopback", NULL, NULL, NULL, loopback_tag_create},
+    /* Tags published by another local process */
+    {"shm", NULL, NULL, NULL, shm_tag_create},
+    /* Tags served by the plctag_proxy daemon */
+    {"proxy", NULL, NULL, NULL, proxy_tag_create}
 };
 
 static lock_t library_initialization_lock = LOCK_INIT;
@@ -146,6 +156,14 @@ void destroy_modules(void)
 
     mb_teardown();
 
+    loopback_teardown();
+
+    shm_teardown();
+
+    proxy_teardown();
+
+    cip_server_teardown();
+
     lib_teardown();
 
     spin_block(&library_initialization_lock) {
@@ -217,6 +235,26 @@ int initialize_modules(void)
                     rc = mb_init();
                 }
 
+                pdebug(DEBUG_INFO,"Initializing loopback module.");
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = loopback_init();
+                }
+
+                pdebug(DEBUG_INFO,"Initializing shared memory module.");
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = shm_init();
+                }
+
+                pdebug(DEBUG_INFO,"Initializing proxy module.");
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = proxy_init();
+                }
+
+                pdebug(DEBUG_INFO,"Initializing CIP server module.");
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = cip_server_init();
+                }
+
                 /* hook the destructor */
                 atexit(destroy_modules);
 
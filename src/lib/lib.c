@@ -37,6 +37,7 @@
 #include <float.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <string.h>
 #include <lib/libplctag.h>
 #include <lib/tag.h>
 #include <lib/init.h>
@@ -49,6 +50,7 @@
 #include <util/rc.h>
 #include <util/vector.h>
 #include <ab/ab.h>
+#include <ab/cip_server.h>
 #include <mb/modbus.h>
 
 
@@ -58,6 +60,10 @@
 
 #define MAX_TAG_MAP_ATTEMPTS (50)
 
+#define MAX_CALLBACK_THREADS (64)
+#define DEFAULT_CALLBACK_QUEUE_SIZE (1024)
+#define CALLBACK_IDLE_WAIT_MS (100)
+
 /* these are only internal to the file */
 
 static volatile int32_t next_tag_id = 10; /* MAGIC */
@@ -69,6 +75,46 @@ static thread_p tag_tickler_thread = NULL;
 
 //static mutex_p global_library_mutex = NULL;
 
+/*
+ * Tag events can be handed to a pool of callback threads instead of being
+ * called in the tickler thread.  Each tag keeps its own list of queued
+ * events.  A tag with events that is not in a callback thread sits in the
+ * ready list.  A thread takes the first ready tag and runs one event, then
+ * puts the tag back at the end if it has more.  So events for one tag are
+ * never run at the same time by two threads and each tag sees its events
+ * in order.  The events come from a fixed pool, the queue size.  When the
+ * pool is empty, other events are dropped but ABORTED and DESTROYED get an
+ * allocated event, the application may be waiting for them.
+ */
+struct tag_event_t {
+    struct tag_event_t *next;
+    int is_allocated;
+    int event;
+    int status;
+    void (*callback)(int32_t tag_id, int event, int status);
+};
+
+#define CALLBACK_STATE_IDLE (0)
+#define CALLBACK_STATE_READY (1)
+#define CALLBACK_STATE_RUNNING (2)
+
+static mutex_p callback_mutex = NULL;
+static mutex_p callback_config_mutex = NULL;
+static cond_p callback_cond = NULL;
+static struct tag_event_t *callback_events = NULL;
+static struct tag_event_t *callback_free_events = NULL;
+static plc_tag_p callback_ready_first = NULL;
+static plc_tag_p callback_ready_last = NULL;
+static int callback_queue_depth = 0;
+static int callback_queue_max_depth = 0;
+static int callback_events_dropped = 0;
+static int callback_pool_running = 0;
+static volatile int callback_pool_terminating = 0;
+static thread_p callback_threads[MAX_CALLBACK_THREADS] = {NULL};
+static int num_callback_threads = 0;
+static int callback_queue_size = DEFAULT_CALLBACK_QUEUE_SIZE;
+static THREAD_LOCAL int callback_thread = 0;
+
 
 
 /* helper functions. */
@@ -76,10 +122,29 @@ static plc_tag_p lookup_tag(int32_t id);
 static int add_tag_lookup(plc_tag_p tag);
 static int tag_id_inc(int id);
 static THREAD_FUNC(tag_tickler_func);
+static void tag_raise_event(plc_tag_p tag, int event, int status);
+static int callback_pool_start(int num_threads, int queue_size);
+static void callback_pool_stop(void);
+static void callback_ready_tag_unsafe(plc_tag_p tag);
+static struct tag_event_t *callback_alloc_event_unsafe(int event);
+static void callback_free_event_unsafe(struct tag_event_t *tag_event);
+static int callback_drop_events_unsafe(plc_tag_p tag);
+static THREAD_FUNC(callback_worker_func);
 static int set_tag_byte_order(plc_tag_p tag, attr attribs);
 static int check_byte_order_str(const char *byte_order, int length);
+static int byte_order_to_int(const int *byte_order, int length);
 // static int get_string_count_size_unsafe(plc_tag_p tag, int offset);
 static int get_string_length_unsafe(plc_tag_p tag, int offset);
+static int set_string_length_unsafe(plc_tag_p tag, int offset, int string_length);
+static int get_string_total_length_unsafe(plc_tag_p tag, int offset, int string_length);
+static void string_copy_from_tag(uint8_t *dst, const uint8_t *src, int length, int is_byte_swapped);
+static void string_copy_to_tag(uint8_t *dst, const uint8_t *src, int length, int is_byte_swapped);
+static void mark_dirty_range_unsafe(plc_tag_p tag, int offset, int length);
+static plc_tag_p lookup_bit_range_tag(int32_t id, int start_bit, int num_bits, int *rc);
+static uint64_t load_tag_bits_unsafe(plc_tag_p tag, int bit_pos, int num_bits);
+static uint8_t bitmap_get8(const uint64_t *bitmap, int bit_pos, int num_bits);
+static int popcount64(uint64_t val);
+static int lowest_bit64(uint64_t val);
 // static int get_string_capacity_unsafe(plc_tag_p tag, int offset);
 // static int get_string_padding_unsafe(plc_tag_p tag, int offset);
 // static int get_string_total_length_unsafe(plc_tag_p tag, int offset);
@@ -141,6 +206,22 @@ int lib_init(void)
         pdebug(DEBUG_ERROR, "Unable to create tag hashtable mutex!");
     }
 
+    pdebug(DEBUG_INFO,"Creating callback pool mutexes.");
+    rc = mutex_create((mutex_p *)&callback_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create callback queue mutex!");
+    }
+
+    rc = mutex_create((mutex_p *)&callback_config_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create callback configuration mutex!");
+    }
+
+    rc = cond_create((cond_p *)&callback_cond);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create callback condition var!");
+    }
+
     pdebug(DEBUG_INFO,"Creating tag tickler thread.");
     rc = thread_create(&tag_tickler_thread, tag_tickler_func, 32*1024, NULL);
     if (rc != PLCTAG_STATUS_OK) {
@@ -168,6 +249,26 @@ void lib_teardown(void)
         tag_tickler_thread = NULL;
     }
 
+    /* deliver whatever is still queued. */
+    if(callback_config_mutex) {
+        critical_block(callback_config_mutex) {
+            callback_pool_stop();
+        }
+
+        mutex_destroy(&callback_config_mutex);
+        callback_config_mutex = NULL;
+    }
+
+    if(callback_cond) {
+        cond_destroy(&callback_cond);
+        callback_cond = NULL;
+    }
+
+    if(callback_mutex) {
+        mutex_destroy(&callback_mutex);
+        callback_mutex = NULL;
+    }
+
     if(tag_lookup_mutex) {
         pdebug(DEBUG_INFO,"Tearing down tag lookup mutex.");
         mutex_destroy(&tag_lookup_mutex);
@@ -225,6 +326,7 @@ THREAD_FUNC(tag_tickler_func)
 
             if(tag) {
                 int events[PLCTAG_EVENT_DESTROYED+1] =  {0};
+                int event_status[PLCTAG_EVENT_DESTROYED+1] = {0};
 
                 debug_set_tag_id(tag->tag_id);
 
@@ -265,6 +367,7 @@ THREAD_FUNC(tag_tickler_func)
                                 }
 
                                 tag->tag_is_dirty = 0;
+                                tag->write_complete = 0;
                                 tag->write_in_flight = 1;
                                 tag->auto_sync_next_write = 0;
 
@@ -272,6 +375,9 @@ THREAD_FUNC(tag_tickler_func)
                                     tag->status = (int8_t)tag->vtable->write(tag);
                                 }
 
+                                /* the protocol has taken what it needs of the changed ranges. */
+                                tag->num_dirty_ranges = 0;
+
                                 events[PLCTAG_EVENT_WRITE_STARTED] = 1;
                             }
                         }
@@ -289,7 +395,9 @@ THREAD_FUNC(tag_tickler_func)
 
                                 pdebug(DEBUG_DETAIL, "Triggering automatic read start.");
 
+                                tag->read_complete = 0;
                                 tag->read_in_flight = 1;
+                                tag->num_dirty_ranges = 0;
 
                                 if(tag->vtable->read) {
                                     tag->status = (int8_t)tag->vtable->read(tag);
@@ -323,11 +431,17 @@ THREAD_FUNC(tag_tickler_func)
                         /* call the tickler on the tag. */
                         tag->vtable->tickler(tag);
 
+                        /*
+                         * capture the final status now.  Once the mutex is released
+                         * another thread can start a new operation and the status
+                         * would show that instead.
+                         */
                         if(tag->read_complete) {
                             tag->read_complete = 0;
                             tag->read_in_flight = 0;
 
                             events[PLCTAG_EVENT_READ_COMPLETED] = 1;
+                            event_status[PLCTAG_EVENT_READ_COMPLETED] = tag->vtable->status(tag);
                         }
 
                         if(tag->write_complete) {
@@ -336,7 +450,25 @@ THREAD_FUNC(tag_tickler_func)
                             tag->auto_sync_next_write = 0;
 
                             events[PLCTAG_EVENT_WRITE_COMPLETED] = 1;
+                            event_status[PLCTAG_EVENT_WRITE_COMPLETED] = tag->vtable->status(tag);
+                        }
+                    }
+
+                    /*
+                     * the status for the start and abort events is what
+                     * plc_tag_status() would return.  Get it now rather
+                     * than looking the tag up again outside the mutex.
+                     */
+                    if(events[PLCTAG_EVENT_READ_STARTED] || events[PLCTAG_EVENT_WRITE_STARTED] || events[PLCTAG_EVENT_ABORTED]) {
+                        int status = tag->vtable->status(tag);
+
+                        if(status == PLCTAG_STATUS_OK && (tag->read_in_flight || tag->write_in_flight)) {
+                            status = PLCTAG_STATUS_PENDING;
                         }
+
+                        event_status[PLCTAG_EVENT_READ_STARTED] = status;
+                        event_status[PLCTAG_EVENT_WRITE_STARTED] = status;
+                        event_status[PLCTAG_EVENT_ABORTED] = status;
                     }
 
                     /* we are done with the tag API mutex now. */
@@ -347,31 +479,31 @@ THREAD_FUNC(tag_tickler_func)
                         /* was there a read start? */
                         if(events[PLCTAG_EVENT_READ_STARTED]) {
                             pdebug(DEBUG_DETAIL, "Tag read started.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_READ_STARTED, plc_tag_status(tag->tag_id));
+                            tag_raise_event(tag, PLCTAG_EVENT_READ_STARTED, event_status[PLCTAG_EVENT_READ_STARTED]);
                         }
 
                         /* was there a write start? */
                         if(events[PLCTAG_EVENT_WRITE_STARTED]) {
                             pdebug(DEBUG_DETAIL, "Tag write started.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_WRITE_STARTED, plc_tag_status(tag->tag_id));
+                            tag_raise_event(tag, PLCTAG_EVENT_WRITE_STARTED, event_status[PLCTAG_EVENT_WRITE_STARTED]);
                         }
 
                         /* was there an abort? */
                         if(events[PLCTAG_EVENT_ABORTED]) {
                             pdebug(DEBUG_DETAIL, "Tag operation aborted.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_ABORTED, plc_tag_status(tag->tag_id));
+                            tag_raise_event(tag, PLCTAG_EVENT_ABORTED, event_status[PLCTAG_EVENT_ABORTED]);
                         }
 
                         /* was there a read completion? */
                         if(events[PLCTAG_EVENT_READ_COMPLETED]) {
                             pdebug(DEBUG_DETAIL, "Tag read completed.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_READ_COMPLETED, plc_tag_status(tag->tag_id));
+                            tag_raise_event(tag, PLCTAG_EVENT_READ_COMPLETED, event_status[PLCTAG_EVENT_READ_COMPLETED]);
                         }
 
                         /* was there a write completion? */
                         if(events[PLCTAG_EVENT_WRITE_COMPLETED]) {
                             pdebug(DEBUG_DETAIL, "Tag write completed.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_WRITE_COMPLETED, plc_tag_status(tag->tag_id));
+                            tag_raise_event(tag, PLCTAG_EVENT_WRITE_COMPLETED, event_status[PLCTAG_EVENT_WRITE_COMPLETED]);
                         }
                     }
                 }
@@ -396,6 +528,391 @@ THREAD_FUNC(tag_tickler_func)
 }
 
 
+
+/*
+ * tag_raise_event
+ *
+ * Call the tag's callback, or queue the event for the callback threads
+ * if there are any.  The tickler must never wait for a slow callback, so
+ * an event that does not fit in a full queue is dropped and counted.
+ * ABORTED and DESTROYED are never dropped.
+ */
+void tag_raise_event(plc_tag_p tag, int event, int status)
+{
+    void (*callback)(int32_t tag_id, int event, int status) = tag->callback;
+    int queued = 0;
+    int wake = 0;
+
+    if(!callback) {
+        return;
+    }
+
+    if(callback_mutex) {
+        critical_block(callback_mutex) {
+            struct tag_event_t *tag_event = NULL;
+
+            if(!callback_pool_running) {
+                break;
+            }
+
+            queued = 1;
+
+            /* unregistered since we looked, nothing to deliver. */
+            if(!tag->callback) {
+                break;
+            }
+
+            callback = tag->callback;
+
+            if(!(tag_event = callback_alloc_event_unsafe(event))) {
+                callback_events_dropped++;
+                pdebug(DEBUG_WARN, "Callback queue is full, dropping event %d!", event);
+                break;
+            }
+
+            tag_event->event = event;
+            tag_event->status = status;
+            tag_event->callback = callback;
+
+            if(tag->callback_events_last) {
+                tag->callback_events_last->next = tag_event;
+            } else {
+                tag->callback_events = tag_event;
+            }
+
+            tag->callback_events_last = tag_event;
+
+            callback_queue_depth++;
+
+            if(callback_queue_depth > callback_queue_max_depth) {
+                callback_queue_max_depth = callback_queue_depth;
+            }
+
+            /* a ready or running tag already has a thread coming. */
+            if(tag->callback_state == CALLBACK_STATE_IDLE) {
+                /* the pool holds a reference while the tag has events. */
+                rc_inc(tag);
+                callback_ready_tag_unsafe(tag);
+                wake = 1;
+            }
+        }
+    }
+
+    if(wake) {
+        cond_signal(callback_cond);
+    }
+
+    if(!queued) {
+        callback(tag->tag_id, event, status);
+    }
+}
+
+
+
+/* must be called with the callback configuration mutex held. */
+int callback_pool_start(int num_threads, int queue_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(num_threads <= 0) {
+        pdebug(DEBUG_INFO, "Callbacks will be called in the tickler thread.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(callback_mutex) {
+        callback_events = mem_alloc((int)(sizeof(*callback_events) * (size_t)queue_size));
+        if(!callback_events) {
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        callback_free_events = NULL;
+
+        for(int i = queue_size - 1; i >= 0; i--) {
+            callback_events[i].next = callback_free_events;
+            callback_free_events = &callback_events[i];
+        }
+
+        callback_ready_first = NULL;
+        callback_ready_last = NULL;
+        callback_queue_depth = 0;
+        callback_pool_running = 1;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to allocate callback queue!");
+        return rc;
+    }
+
+    callback_pool_terminating = 0;
+
+    for(num_callback_threads = 0; num_callback_threads < num_threads; num_callback_threads++) {
+        rc = thread_create(&callback_threads[num_callback_threads], callback_worker_func, 32*1024, (void *)(intptr_t)num_callback_threads);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create callback thread %d!", num_callback_threads);
+            callback_pool_stop();
+            return rc;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done with %d callback threads.", num_callback_threads);
+
+    return rc;
+}
+
+
+
+/*
+ * must be called with the callback configuration mutex held.  New events
+ * are called directly from here on.  The threads run the queued ones
+ * before they exit.
+ */
+void callback_pool_stop(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(callback_mutex) {
+        critical_block(callback_mutex) {
+            callback_pool_running = 0;
+        }
+    }
+
+    callback_pool_terminating = 1;
+
+    /* each thread wakes the next one as it leaves. */
+    if(num_callback_threads > 0) {
+        cond_signal(callback_cond);
+    }
+
+    for(int i=0; i < num_callback_threads; i++) {
+        thread_join(callback_threads[i]);
+        thread_destroy(&callback_threads[i]);
+        callback_threads[i] = NULL;
+    }
+
+    num_callback_threads = 0;
+
+    /* the threads emptied the ready list before they left. */
+    if(callback_events) {
+        mem_free(callback_events);
+        callback_events = NULL;
+    }
+
+    callback_free_events = NULL;
+    callback_queue_depth = 0;
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/* must be called with the callback mutex held. */
+void callback_ready_tag_unsafe(plc_tag_p tag)
+{
+    tag->callback_next = NULL;
+    tag->callback_state = CALLBACK_STATE_READY;
+
+    if(callback_ready_last) {
+        callback_ready_last->callback_next = tag;
+    } else {
+        callback_ready_first = tag;
+    }
+
+    callback_ready_last = tag;
+}
+
+
+
+/* must be called with the callback mutex held.  Returns NULL to drop the event. */
+struct tag_event_t *callback_alloc_event_unsafe(int event)
+{
+    struct tag_event_t *tag_event = callback_free_events;
+
+    if(tag_event) {
+        callback_free_events = tag_event->next;
+        tag_event->next = NULL;
+        tag_event->is_allocated = 0;
+    } else if(event == PLCTAG_EVENT_ABORTED || event == PLCTAG_EVENT_DESTROYED) {
+        pdebug(DEBUG_DETAIL, "Callback queue is full, allocating event %d.", event);
+
+        tag_event = mem_alloc((int)sizeof(*tag_event));
+        if(tag_event) {
+            tag_event->is_allocated = 1;
+        } else {
+            pdebug(DEBUG_ERROR, "Unable to allocate event %d!", event);
+        }
+    }
+
+    return tag_event;
+}
+
+
+
+/* must be called with the callback mutex held. */
+void callback_free_event_unsafe(struct tag_event_t *tag_event)
+{
+    if(tag_event->is_allocated) {
+        mem_free(tag_event);
+    } else {
+        tag_event->next = callback_free_events;
+        callback_free_events = tag_event;
+    }
+}
+
+
+
+/*
+ * must be called with the callback mutex held.  Throws away the tag's
+ * queued events and takes it off the ready list.  Returns 1 if the pool's
+ * reference to the tag must be released, outside the mutex.  A running
+ * tag keeps its reference, its thread releases it.
+ */
+int callback_drop_events_unsafe(plc_tag_p tag)
+{
+    plc_tag_p prev = NULL;
+    plc_tag_p cur = NULL;
+
+    while(tag->callback_events) {
+        struct tag_event_t *tag_event = tag->callback_events;
+
+        tag->callback_events = tag_event->next;
+
+        callback_free_event_unsafe(tag_event);
+
+        callback_queue_depth--;
+    }
+
+    tag->callback_events_last = NULL;
+
+    if(tag->callback_state != CALLBACK_STATE_READY) {
+        return 0;
+    }
+
+    for(cur = callback_ready_first; cur && cur != tag; cur = cur->callback_next) {
+        prev = cur;
+    }
+
+    if(cur) {
+        if(prev) {
+            prev->callback_next = tag->callback_next;
+        } else {
+            callback_ready_first = tag->callback_next;
+        }
+
+        if(callback_ready_last == tag) {
+            callback_ready_last = prev;
+        }
+    }
+
+    tag->callback_next = NULL;
+    tag->callback_state = CALLBACK_STATE_IDLE;
+
+    return 1;
+}
+
+
+
+THREAD_FUNC(callback_worker_func)
+{
+    int self = (int)(intptr_t)arg;
+
+    debug_set_tag_id(0);
+
+    callback_thread = 1;
+
+    pdebug(DEBUG_INFO, "Starting callback thread %d.", self);
+
+    while(1) {
+        plc_tag_p tag = NULL;
+        struct tag_event_t ev = {0};
+        int more = 0;
+        int done = 0;
+        int release = 0;
+
+        critical_block(callback_mutex) {
+            struct tag_event_t *tag_event = NULL;
+
+            /* ready tags are not in another thread. */
+            tag = callback_ready_first;
+
+            if(!tag) {
+                done = callback_pool_terminating;
+                break;
+            }
+
+            callback_ready_first = tag->callback_next;
+
+            if(!callback_ready_first) {
+                callback_ready_last = NULL;
+            }
+
+            tag->callback_next = NULL;
+            tag->callback_state = CALLBACK_STATE_RUNNING;
+
+            tag_event = tag->callback_events;
+            tag->callback_events = tag_event->next;
+
+            if(!tag->callback_events) {
+                tag->callback_events_last = NULL;
+            }
+
+            ev = *tag_event;
+
+            callback_free_event_unsafe(tag_event);
+
+            callback_queue_depth--;
+
+            more = (callback_ready_first != NULL);
+        }
+
+        /* running tags are finished by their own threads. */
+        if(done) {
+            cond_signal(callback_cond);
+            break;
+        }
+
+        /*
+         * one signal wakes one thread.  Pass it on while other tags are
+         * ready.  The timeout is only a safety net.
+         */
+        if(!tag) {
+            cond_wait(callback_cond, CALLBACK_IDLE_WAIT_MS);
+            continue;
+        }
+
+        if(more) {
+            cond_signal(callback_cond);
+        }
+
+        debug_set_tag_id(tag->tag_id);
+
+        ev.callback(tag->tag_id, ev.event, ev.status);
+
+        debug_set_tag_id(0);
+
+        critical_block(callback_mutex) {
+            if(tag->callback_events) {
+                callback_ready_tag_unsafe(tag);
+            } else {
+                tag->callback_state = CALLBACK_STATE_IDLE;
+                release = 1;
+            }
+        }
+
+        /* outside the mutex, this may be the last reference. */
+        if(release) {
+            rc_dec(tag);
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Terminating callback thread %d.", self);
+
+    THREAD_RETURN(0);
+}
+
+
 /**************************************************************************
  ***************************  API Functions  ******************************
  **************************************************************************/
@@ -855,6 +1372,12 @@ LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_fun
  *
  * This function removes the callback already registered on the tag.
  *
+ * Events queued for the callback threads are thrown away.  If one of the
+ * threads is in the callback, this waits for it to return, so the old
+ * callback is not running and will not be called once this returns.
+ * Called from a callback thread it does not wait, as that thread could be
+ * the one running the callback or one it is waiting on.
+ *
  * Return values:
  *
  * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
@@ -864,6 +1387,8 @@ LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_fun
 LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
 {
     int rc = PLCTAG_STATUS_OK;
+    int release = 0;
+    int running = 0;
     plc_tag_p tag = lookup_tag(tag_id);
 
     pdebug(DEBUG_INFO, "Starting.");
@@ -874,11 +1399,35 @@ LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
     }
 
     critical_block(tag->api_mutex) {
-        if(tag->callback) {
-            rc = PLCTAG_STATUS_OK;
-            tag->callback = NULL;
-        } else {
+        if(!tag->callback) {
             rc = PLCTAG_ERR_NOT_FOUND;
+            break;
+        }
+
+        rc = PLCTAG_STATUS_OK;
+
+        if(callback_mutex) {
+            /* tag_raise_event() checks the callback under this mutex. */
+            critical_block(callback_mutex) {
+                tag->callback = NULL;
+                release = callback_drop_events_unsafe(tag);
+                running = (tag->callback_state == CALLBACK_STATE_RUNNING);
+            }
+        } else {
+            tag->callback = NULL;
+        }
+    }
+
+    /* the pool's reference, ours keeps the tag alive. */
+    if(release) {
+        rc_dec(tag);
+    }
+
+    while(running && !callback_thread) {
+        sleep_ms(1);
+
+        critical_block(callback_mutex) {
+            running = (tag->callback_state == CALLBACK_STATE_RUNNING);
         }
     }
 
@@ -978,9 +1527,12 @@ LIB_EXPORT int plc_tag_lock(int32_t id)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
-        rc = mutex_lock(tag->ext_mutex);
-    }
+    /*
+     * Do not hold the API mutex while waiting.  The thread holding the
+     * external lock needs the API mutex to make progress and release it.
+     * Our reference keeps the tag alive.
+     */
+    rc = mutex_lock(tag->ext_mutex);
 
     rc_dec(tag);
 
@@ -1011,9 +1563,7 @@ LIB_EXPORT int plc_tag_unlock(int32_t id)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
-        rc = mutex_unlock(tag->ext_mutex);
-    }
+    rc = mutex_unlock(tag->ext_mutex);
 
     rc_dec(tag);
 
@@ -1070,7 +1620,7 @@ LIB_EXPORT int plc_tag_abort(int32_t id)
 
     if(tag->callback) {
         pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_ABORTED.");
-        tag->callback(id, PLCTAG_EVENT_ABORTED, PLCTAG_STATUS_OK);
+        tag_raise_event(tag, PLCTAG_EVENT_ABORTED, PLCTAG_STATUS_OK);
     }
 
     rc_dec(tag);
@@ -1125,7 +1675,7 @@ LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
 
     if(tag->callback) {
         pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_DESTROYED.");
-        tag->callback(tag_id, PLCTAG_EVENT_DESTROYED, PLCTAG_STATUS_OK);
+        tag_raise_event(tag, PLCTAG_EVENT_DESTROYED, PLCTAG_STATUS_OK);
     }
 
     /* release the reference outside the mutex. */
@@ -1174,7 +1724,7 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
 
     if(tag->callback) {
         pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_READ_STARTED.");
-        tag->callback(id, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
+        tag_raise_event(tag, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
     }
 
     critical_block(tag->api_mutex) {
@@ -1200,9 +1750,18 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
             break;
         }
 
+        /*
+         * a completion left over from an operation nobody waited on, such as
+         * the read done when the tag was created, must not be reported as the
+         * completion of this one.
+         */
+        tag->read_complete = 0;
         tag->read_in_flight = 1;
         tag->status = PLCTAG_STATUS_PENDING;
 
+        /* the read replaces whatever was changed locally. */
+        tag->num_dirty_ranges = 0;
+
         /* the protocol implementation does not do the timeout. */
         rc = tag->vtable->read(tag);
 
@@ -1218,6 +1777,8 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
                 }
             }
 
+            /* the completion is reported below, not again by the tickler. */
+            tag->read_complete = 0;
             tag->read_in_flight = 0;
             is_done = 1;
             break;
@@ -1286,7 +1847,7 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
     if(tag->callback) {
         if(is_done) {
             pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_READ_COMPLETED.");
-            tag->callback(id, PLCTAG_EVENT_READ_COMPLETED, rc);
+            tag_raise_event(tag, PLCTAG_EVENT_READ_COMPLETED, rc);
         }
     }
 
@@ -1388,7 +1949,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
 
     if(tag->callback) {
         pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_WRITE_STARTED.");
-        tag->callback(id, PLCTAG_EVENT_WRITE_STARTED, PLCTAG_STATUS_OK);
+        tag_raise_event(tag, PLCTAG_EVENT_WRITE_STARTED, PLCTAG_STATUS_OK);
     }
 
     critical_block(tag->api_mutex) {
@@ -1400,12 +1961,18 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
         }
 
         /* a write is now in flight. */
+        tag->write_complete = 0;
         tag->write_in_flight = 1;
         tag->status = PLCTAG_STATUS_OK;
 
         /* the protocol implementation does not do the timeout. */
         rc = tag->vtable->write(tag);
 
+        /* the protocol has taken what it needs of the changed ranges. */
+        if(rc == PLCTAG_STATUS_PENDING || rc == PLCTAG_STATUS_OK) {
+            tag->num_dirty_ranges = 0;
+        }
+
         /* if not pending then check for success or error. */
         if(rc != PLCTAG_STATUS_PENDING) {
             if(rc != PLCTAG_STATUS_OK) {
@@ -1481,7 +2048,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
     if(tag->callback) {
         if(is_done) {
             pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_WRITE_COMPLETED.");
-            tag->callback(id, PLCTAG_EVENT_WRITE_COMPLETED, rc);
+            tag_raise_event(tag, PLCTAG_EVENT_WRITE_COMPLETED, rc);
         }
     }
 
@@ -1529,8 +2096,25 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
         } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
             pdebug(DEBUG_WARN, "Deprecated attribute \"debug_level\" used, use \"debug\" instead.");
             res = (int)get_debug_level();
-        } else {
-            pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!");
+        } else if(str_cmp_i_n(attrib_name, "callback_", 9) == 0 && initialize_modules() == PLCTAG_STATUS_OK) {
+            critical_block(callback_mutex) {
+                if(str_cmp_i(attrib_name, "callback_threads") == 0) {
+                    res = num_callback_threads;
+                } else if(str_cmp_i(attrib_name, "callback_queue_size") == 0) {
+                    res = callback_queue_size;
+                } else if(str_cmp_i(attrib_name, "callback_queue_depth") == 0) {
+                    res = callback_queue_depth;
+                } else if(str_cmp_i(attrib_name, "callback_queue_max_depth") == 0) {
+                    res = callback_queue_max_depth;
+                } else if(str_cmp_i(attrib_name, "callback_events_dropped") == 0) {
+                    res = callback_events_dropped;
+                } else {
+                    pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!", attrib_name);
+                    res = default_value;
+                }
+            }
+        } else {
+            pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!");
             res = default_value;
         }
     } else {
@@ -1559,6 +2143,21 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
             } else if(str_cmp_i(attrib_name, "bit_num") == 0) {
                 tag->status = PLCTAG_STATUS_OK;
                 res = (int)(unsigned int)(tag->bit);
+            } else if(str_cmp_i(attrib_name, "int16_byte_order") == 0 && tag->byte_order) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = byte_order_to_int(tag->byte_order->int16_order, 2);
+            } else if(str_cmp_i(attrib_name, "int32_byte_order") == 0 && tag->byte_order) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = byte_order_to_int(tag->byte_order->int32_order, 4);
+            } else if(str_cmp_i(attrib_name, "int64_byte_order") == 0 && tag->byte_order) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = byte_order_to_int(tag->byte_order->int64_order, 8);
+            } else if(str_cmp_i(attrib_name, "float32_byte_order") == 0 && tag->byte_order) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = byte_order_to_int(tag->byte_order->float32_order, 4);
+            } else if(str_cmp_i(attrib_name, "float64_byte_order") == 0 && tag->byte_order) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = byte_order_to_int(tag->byte_order->float64_order, 8);
             } else  {
                 if(tag->vtable->get_int_attrib) {
                     res = tag->vtable->get_int_attrib(tag, attrib_name, default_value);
@@ -1605,6 +2204,46 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
             } else {
                 res = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
+        } else if(str_cmp_i(attrib_name, "callback_threads") == 0 || str_cmp_i(attrib_name, "callback_queue_size") == 0) {
+            int is_threads = (str_cmp_i(attrib_name, "callback_threads") == 0);
+
+            if(is_threads ? (new_value < 0 || new_value > MAX_CALLBACK_THREADS) : (new_value <= 0)) {
+                pdebug(DEBUG_WARN, "Value %d is out of bounds for attribute \"%s\"!", new_value, attrib_name);
+                return PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+
+            res = initialize_modules();
+            if(res != PLCTAG_STATUS_OK) {
+                return res;
+            }
+
+            /* restart the pool with the new settings. */
+            critical_block(callback_config_mutex) {
+                int num_threads = (is_threads ? new_value : num_callback_threads);
+
+                callback_pool_stop();
+
+                if(!is_threads) {
+                    callback_queue_size = new_value;
+                }
+
+                res = callback_pool_start(num_threads, callback_queue_size);
+            }
+        } else if(str_cmp_i(attrib_name, "callback_queue_max_depth") == 0 || str_cmp_i(attrib_name, "callback_events_dropped") == 0) {
+            /* only resetting the counters makes sense. */
+            if(new_value != 0 || initialize_modules() != PLCTAG_STATUS_OK) {
+                return PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+
+            critical_block(callback_mutex) {
+                if(str_cmp_i(attrib_name, "callback_queue_max_depth") == 0) {
+                    callback_queue_max_depth = callback_queue_depth;
+                } else {
+                    callback_events_dropped = 0;
+                }
+            }
+
+            res = PLCTAG_STATUS_OK;
         } else {
             pdebug(DEBUG_WARN, "Attribute \"%s\" is not support at the library level!", attrib_name);
             return PLCTAG_ERR_UNSUPPORTED;
@@ -1778,6 +2417,8 @@ LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
                 tag->tag_is_dirty = 1;
             }
 
+            mark_dirty_range_unsafe(tag, real_offset / 8, 1);
+
             if(val) {
                 tag->data[real_offset / 8] |= (uint8_t)(1 << (real_offset % 8));
             } else {
@@ -1799,6 +2440,209 @@ LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
 
 
 
+/*
+ * Bulk bit access.
+ *
+ * Tag bit n is bit n % 8 of byte n / 8, as for plc_tag_get_bit().  In the
+ * caller's bitmap, bit i of the range is bit i % 64 of word i / 64.  Tag
+ * data is taken 64 bits at a time, so scanning a BOOL[4096] array for
+ * set bits is a few dozen word operations.
+ */
+
+LIB_EXPORT int plc_tag_get_bits(int32_t id, int start_bit, int num_bits, uint64_t *bitmap)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_bit_range_tag(id, start_bit, num_bits, &rc);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        return rc;
+    }
+
+    if(!bitmap) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Bitmap pointer is null!");
+        tag->status = PLCTAG_ERR_NULL_PTR;
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(tag->api_mutex) {
+        for(int i=0; i < num_bits; i += 64) {
+            bitmap[i / 64] = load_tag_bits_unsafe(tag, start_bit + i, (num_bits - i < 64 ? num_bits - i : 64));
+        }
+
+        tag->status = PLCTAG_STATUS_OK;
+    }
+
+    rc_dec(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+LIB_EXPORT int plc_tag_set_bits(int32_t id, int start_bit, int num_bits, const uint64_t *bitmap)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_bit_range_tag(id, start_bit, num_bits, &rc);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        return rc;
+    }
+
+    if(!bitmap) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Bitmap pointer is null!");
+        tag->status = PLCTAG_ERR_NULL_PTR;
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(tag->api_mutex) {
+        int end_bit = start_bit + num_bits;
+
+        /* a byte at a time, masking the partial bytes at either end. */
+        for(int byte_index = start_bit / 8; byte_index * 8 < end_bit; byte_index++) {
+            int first = (byte_index * 8 < start_bit ? start_bit - byte_index * 8 : 0);
+            int last = ((byte_index + 1) * 8 > end_bit ? end_bit - byte_index * 8 : 8);
+            uint8_t mask = (uint8_t)((0xFF << first) & (0xFF >> (8 - last)));
+            uint8_t val = bitmap_get8(bitmap, byte_index * 8 - start_bit, num_bits);
+
+            tag->data[byte_index] = (uint8_t)((tag->data[byte_index] & ~mask) | (val & mask));
+        }
+
+        if(tag->auto_sync_write_ms > 0 && num_bits > 0) {
+            tag->tag_is_dirty = 1;
+        }
+
+        if(num_bits > 0) {
+            mark_dirty_range_unsafe(tag, start_bit / 8, ((start_bit + num_bits + 7) / 8) - (start_bit / 8));
+        }
+
+        tag->status = PLCTAG_STATUS_OK;
+    }
+
+    rc_dec(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* returns the index of the first set bit in the range, or PLCTAG_ERR_NO_MATCH. */
+LIB_EXPORT int plc_tag_find_next_bit(int32_t id, int start_bit, int num_bits)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_bit_range_tag(id, start_bit, num_bits, &rc);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        return rc;
+    }
+
+    rc = PLCTAG_ERR_NO_MATCH;
+
+    critical_block(tag->api_mutex) {
+        for(int i=0; i < num_bits; i += 64) {
+            uint64_t word = load_tag_bits_unsafe(tag, start_bit + i, (num_bits - i < 64 ? num_bits - i : 64));
+
+            if(word) {
+                rc = start_bit + i + lowest_bit64(word);
+                break;
+            }
+        }
+
+        tag->status = PLCTAG_STATUS_OK;
+    }
+
+    rc_dec(tag);
+
+    return rc;
+}
+
+
+/* returns the number of set bits in the range. */
+LIB_EXPORT int plc_tag_count_bits(int32_t id, int start_bit, int num_bits)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_bit_range_tag(id, start_bit, num_bits, &rc);
+    int count = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        return rc;
+    }
+
+    critical_block(tag->api_mutex) {
+        for(int i=0; i < num_bits; i += 64) {
+            count += popcount64(load_tag_bits_unsafe(tag, start_bit + i, (num_bits - i < 64 ? num_bits - i : 64)));
+        }
+
+        tag->status = PLCTAG_STATUS_OK;
+    }
+
+    rc_dec(tag);
+
+    return count;
+}
+
+
+/*
+ * Compare the range with prev_bitmap.  The changed bits are set in
+ * changed_bitmap if it is not NULL, and prev_bitmap is updated to the
+ * current bits.  Returns the number of changed bits.
+ */
+LIB_EXPORT int plc_tag_diff_bits(int32_t id, int start_bit, int num_bits, uint64_t *prev_bitmap, uint64_t *changed_bitmap)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_bit_range_tag(id, start_bit, num_bits, &rc);
+    int count = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        return rc;
+    }
+
+    if(!prev_bitmap) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Previous bitmap pointer is null!");
+        tag->status = PLCTAG_ERR_NULL_PTR;
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(tag->api_mutex) {
+        for(int i=0; i < num_bits; i += 64) {
+            int word_bits = (num_bits - i < 64 ? num_bits - i : 64);
+            uint64_t word = load_tag_bits_unsafe(tag, start_bit + i, word_bits);
+            uint64_t changed = word ^ prev_bitmap[i / 64];
+
+            /* ignore whatever the caller has past the end of the range. */
+            if(word_bits < 64) {
+                changed &= ((UINT64_C(1) << word_bits) - 1);
+            }
+
+            count += popcount64(changed);
+
+            if(changed_bitmap) {
+                changed_bitmap[i / 64] = changed;
+            }
+
+            prev_bitmap[i / 64] = word;
+        }
+
+        tag->status = PLCTAG_STATUS_OK;
+    }
+
+    rc_dec(tag);
+
+    return count;
+}
+
+
+
 LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
 {
     uint64_t res = UINT64_MAX;
@@ -1880,6 +2724,8 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(uint64_t));
+
                 tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -1994,6 +2840,8 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(int64_t));
+
                 tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2100,6 +2948,8 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(uint32_t));
+
                 tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2206,6 +3056,8 @@ LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(int32_t));
+
                 tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2313,6 +3165,8 @@ LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(uint16_t));
+
                 tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
 
@@ -2420,6 +3274,8 @@ LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(int16_t));
+
                 tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
                 tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
 
@@ -2524,6 +3380,8 @@ LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(uint8_t));
+
                 tag->data[offset] = val;
 
                 tag->status = PLCTAG_STATUS_OK;
@@ -2625,6 +3483,8 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
                     tag->tag_is_dirty = 1;
                 }
 
+                mark_dirty_range_unsafe(tag, offset, (int)sizeof(int8_t));
+
                 tag->data[offset] = val;
 
                 tag->status = PLCTAG_STATUS_OK;
@@ -2751,6 +3611,8 @@ LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval)
                 tag->tag_is_dirty = 1;
             }
 
+            mark_dirty_range_unsafe(tag, offset, (int)sizeof(uint64_t));
+
             tag->data[offset + tag->byte_order->float64_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
             tag->data[offset + tag->byte_order->float64_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
             tag->data[offset + tag->byte_order->float64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2870,6 +3732,8 @@ LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float fval)
                 tag->tag_is_dirty = 1;
             }
 
+            mark_dirty_range_unsafe(tag, offset, (int)sizeof(float));
+
             tag->data[offset + tag->byte_order->float32_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
             tag->data[offset + tag->byte_order->float32_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
             tag->data[offset + tag->byte_order->float32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
@@ -2939,13 +3803,11 @@ LIB_EXPORT int plc_tag_get_string(int32_t tag_id, int string_start_offset, char
         }
 
         /* check the amount of space. */
-        if(string_start_offset + (int)tag->byte_order->str_count_word_bytes + max_len <= tag->size) {
-            for(int i = 0; i < max_len; i++) {
-                size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
-                                  + (size_t)(unsigned int)string_start_offset
-                                  + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
-                buffer[i] = (char)tag->data[char_index];
-            }
+        if(string_start_offset + (int)tag->byte_order->str_count_word_bytes + max_len + (int)(max_len & (int)tag->byte_order->str_is_byte_swapped) <= tag->size) {
+            string_copy_from_tag((uint8_t *)buffer,
+                                 tag->data + string_start_offset + tag->byte_order->str_count_word_bytes,
+                                 max_len,
+                                 tag->byte_order->str_is_byte_swapped);
 
             tag->status = PLCTAG_STATUS_OK;
             rc = PLCTAG_STATUS_OK;
@@ -3023,12 +3885,10 @@ LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const
                 tag->status = (int8_t)rc;
 
                 /* copy the string data into the tag. */
-                for(int i = 0; i < string_length; i++) {
-                    size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
-                                    + (size_t)(unsigned int)string_start_offset
-                                    + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
-                    tag->data[char_index] = (uint8_t)string_val[i];
-                }
+                string_copy_to_tag(tag->data + string_start_offset + tag->byte_order->str_count_word_bytes,
+                                   (const uint8_t *)string_val,
+                                   string_length,
+                                   tag->byte_order->str_is_byte_swapped);
 
                 /* zero pad the rest. */
                 for(int i = string_length; i < string_capacity; i++) {
@@ -3039,34 +3899,15 @@ LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const
                 }
 
                 /* if the string is counted, set the length */
-                if(tag->byte_order->str_is_counted) {
-                    switch(tag->byte_order->str_count_word_bytes) {
-                        case 1:
-                            tag->data[string_start_offset] = (uint8_t)(unsigned int)string_length;
-                            break;
-
-                        case 2:
-                            tag->data[string_start_offset + tag->byte_order->int16_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int16_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
-                            break;
-
-                        case 4:
-                            tag->data[string_start_offset + tag->byte_order->int32_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int32_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int32_order[2]] = (uint8_t)((((unsigned int)string_length) >> 16) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int32_order[3]] = (uint8_t)((((unsigned int)string_length) >> 24) & 0xFF);
-                            break;
-
-                        default:
-                            pdebug(DEBUG_WARN, "Unsupported string count size, %d!", tag->byte_order->str_count_word_bytes);
-                            rc = PLCTAG_ERR_UNSUPPORTED;
-                            tag->status = (int8_t)rc;
-                            break;
-                    }
-                }
+                rc = set_string_length_unsafe(tag, string_start_offset, string_length);
+                tag->status = (int8_t)rc;
 
-                if(rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
+                if(rc == PLCTAG_STATUS_OK) {
+                    mark_dirty_range_unsafe(tag, string_start_offset, get_string_total_length_unsafe(tag, string_start_offset, string_capacity));
+
+                    if(tag->auto_sync_write_ms > 0) {
+                        tag->tag_is_dirty = 1;
+                    }
                 }
             } else {
                 pdebug(DEBUG_WARN, "Writing the full string would go out of bounds in the tag buffer!");
@@ -3238,10 +4079,20 @@ LIB_EXPORT int plc_tag_get_string_total_length(int32_t id, int string_start_offs
 
 
 
-LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
+/*
+ * plc_tag_get_strings
+ *
+ * Decode string_count strings, laid out one after another from
+ * string_start_offset, into the arena.  Each string is zero terminated
+ * in the arena.  If string_offsets is not NULL, the arena offset of each
+ * string is stored there.  Returns the number of arena bytes used.
+ */
+
+LIB_EXPORT int plc_tag_get_strings(int32_t id, int string_start_offset, int string_count, char *arena, int arena_size, int *string_offsets)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
+    int arena_used = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -3250,6 +4101,14 @@ LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, in
         return PLCTAG_ERR_NOT_FOUND;
     }
 
+    /* are strings defined for this tag? */
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
     /* is there data? */
     if(!tag->data) {
         rc_dec(tag);
@@ -3258,53 +4117,285 @@ LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, in
         return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!buffer) {
-        pdebug(DEBUG_WARN,"Buffer is null!");
-        return PLCTAG_ERR_NULL_PTR;
+    if(tag->is_bit) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Getting string values from a bit tag is not supported!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    if(buffer_size <= 0) {
-        pdebug(DEBUG_WARN,"The buffer must have some capacity for data.");
+    if(!arena || string_count < 0 || arena_size < 0 || string_start_offset < 0) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Bad arena, count or offset!");
+        tag->status = PLCTAG_ERR_BAD_PARAM;
         return PLCTAG_ERR_BAD_PARAM;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
+    critical_block(tag->api_mutex) {
+        int offset = string_start_offset;
+        int count_bytes = (int)(tag->byte_order->str_count_word_bytes);
+        int is_byte_swapped = (int)(tag->byte_order->str_is_byte_swapped);
 
-                int i;
-                for (i=0;i<buffer_size;i++) {
-                    tag->data[offset + i] = buffer[i];
-                }
+        for(int i=0; i < string_count; i++) {
+            int string_length = 0;
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            if(offset + count_bytes > tag->size) {
+                pdebug(DEBUG_WARN, "String %d starts out of bounds!", i);
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                break;
+            }
+
+            string_length = get_string_length_unsafe(tag, offset);
+
+            if(string_length < 0 || (tag->byte_order->str_max_capacity && string_length > (int)(tag->byte_order->str_max_capacity))) {
+                pdebug(DEBUG_WARN, "String %d has a bad length, %d!", i, string_length);
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
+
+            if(offset + count_bytes + string_length + (string_length & is_byte_swapped) > tag->size) {
+                pdebug(DEBUG_WARN, "String %d runs out of bounds!", i);
                 rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                break;
+            }
+
+            if(arena_used + string_length + 1 > arena_size) {
+                pdebug(DEBUG_WARN, "Arena of %d bytes is too small for string %d!", arena_size, i);
+                rc = PLCTAG_ERR_TOO_SMALL;
+                break;
+            }
+
+            string_copy_from_tag((uint8_t *)arena + arena_used, tag->data + offset + count_bytes, string_length, is_byte_swapped);
+            arena[arena_used + string_length] = 0;
+
+            if(string_offsets) {
+                string_offsets[i] = arena_used;
             }
+
+            arena_used += string_length + 1;
+            offset += get_string_total_length_unsafe(tag, offset, string_length);
         }
-    } else {
-        pdebug(DEBUG_WARN,"Trying to write a list of value on a Tag bit.");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        rc=PLCTAG_ERR_UNSUPPORTED;
+
+        tag->status = (int8_t)rc;
     }
 
     rc_dec(tag);
 
-    return rc;
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return (rc == PLCTAG_STATUS_OK ? arena_used : rc);
 }
 
 
-LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
-{
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_SPEW, "Starting.");
+/*
+ * plc_tag_set_strings
+ *
+ * Store string_count zero-terminated strings, packed one after another
+ * in the arena, into consecutive strings of the tag from
+ * string_start_offset.  Nothing is changed unless all of them fit.
+ */
+
+LIB_EXPORT int plc_tag_set_strings(int32_t id, int string_start_offset, int string_count, const char *arena, int arena_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    /* are strings defined for this tag? */
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->is_bit) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Setting string values on a bit tag is not supported!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(!arena || string_count < 0 || arena_size < 0 || string_start_offset < 0) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Bad arena, count or offset!");
+        tag->status = PLCTAG_ERR_BAD_PARAM;
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(tag->api_mutex) {
+        int count_bytes = (int)(tag->byte_order->str_count_word_bytes);
+        int is_byte_swapped = (int)(tag->byte_order->str_is_byte_swapped);
+        int term_bytes = (tag->byte_order->str_is_zero_terminated ? 1 : 0);
+
+        /* set_string_length_unsafe() would fail part way through on this. */
+        if(tag->byte_order->str_is_counted && count_bytes != 1 && count_bytes != 2 && count_bytes != 4) {
+            pdebug(DEBUG_WARN, "Unsupported string count size, %d!", count_bytes);
+            rc = PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        /* check everything first so a bad string does not leave the tag half written. */
+        for(int pass=0; pass < 2 && rc == PLCTAG_STATUS_OK; pass++) {
+            int offset = string_start_offset;
+            int arena_pos = 0;
+
+            for(int i=0; i < string_count; i++) {
+                const char *string_val = arena + arena_pos;
+                const char *end = (arena_pos < arena_size ? memchr(string_val, 0, (size_t)(unsigned int)(arena_size - arena_pos)) : NULL);
+                int string_length = 0;
+                int string_capacity = 0;
+
+                if(!end) {
+                    pdebug(DEBUG_WARN, "String %d is not terminated inside the arena!", i);
+                    rc = PLCTAG_ERR_BAD_PARAM;
+                    break;
+                }
+
+                string_length = (int)(end - string_val);
+
+                if(offset + count_bytes > tag->size) {
+                    pdebug(DEBUG_WARN, "String %d starts out of bounds!", i);
+                    rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    break;
+                }
+
+                string_capacity = (tag->byte_order->str_max_capacity ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, offset));
+
+                if(string_capacity < string_length) {
+                    pdebug(DEBUG_WARN, "String %d capacity, %d, is less than its length, %d!", i, string_capacity, string_length);
+                    rc = PLCTAG_ERR_TOO_LARGE;
+                    break;
+                }
+
+                if(offset + count_bytes + string_length + term_bytes + (string_length & is_byte_swapped) > tag->size) {
+                    pdebug(DEBUG_WARN, "Writing string %d would go out of bounds in the tag buffer!", i);
+                    rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    break;
+                }
+
+                if(pass == 1) {
+                    uint8_t *chars = tag->data + offset + count_bytes;
+
+                    string_copy_to_tag(chars, (const uint8_t *)string_val, string_length, is_byte_swapped);
+
+                    /* zero pad the rest. */
+                    for(int c = string_length; c < string_capacity; c++) {
+                        chars[c ^ is_byte_swapped] = (uint8_t)0;
+                    }
+
+                    rc = set_string_length_unsafe(tag, offset, string_length);
+                    if(rc != PLCTAG_STATUS_OK) {
+                        break;
+                    }
+
+                    mark_dirty_range_unsafe(tag, offset, get_string_total_length_unsafe(tag, offset, string_capacity));
+                }
+
+                arena_pos += string_length + 1;
+                offset += get_string_total_length_unsafe(tag, offset, string_length);
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ms > 0) {
+            tag->tag_is_dirty = 1;
+        }
+
+        tag->status = (int8_t)rc;
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(!buffer) {
+        pdebug(DEBUG_WARN,"Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(buffer_size <= 0) {
+        pdebug(DEBUG_WARN,"The buffer must have some capacity for data.");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag->tag_is_dirty = 1;
+                }
+
+                mark_dirty_range_unsafe(tag, offset, buffer_size);
+
+                int i;
+                for (i=0;i<buffer_size;i++) {
+                    tag->data[offset + i] = buffer[i];
+                }
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        pdebug(DEBUG_WARN,"Trying to write a list of value on a Tag bit.");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        rc=PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    rc_dec(tag);
+
+    return rc;
+}
+
+
+LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
@@ -3358,6 +4449,56 @@ LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, in
 
 
 
+/*
+ * CIP server functions.
+ *
+ * These serve application memory as Logix tags.  See ab/cip_server.c.
+ */
+
+LIB_EXPORT int32_t plc_tag_server_create(const char *attrib_str)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    return cip_server_create(attrib_str);
+}
+
+
+LIB_EXPORT int plc_tag_server_add_tag(int32_t server, const char *name, int cip_type, int elem_size, int elem_count, void *data)
+{
+    return cip_server_add_tag(server, name, cip_type, elem_size, elem_count, data);
+}
+
+
+LIB_EXPORT int plc_tag_server_register_callback(int32_t server, void (*write_callback)(int32_t server, const char *name, int offset, int length))
+{
+    return cip_server_register_callback(server, write_callback);
+}
+
+
+LIB_EXPORT int plc_tag_server_lock(int32_t server)
+{
+    return cip_server_lock(server);
+}
+
+
+LIB_EXPORT int plc_tag_server_unlock(int32_t server)
+{
+    return cip_server_unlock(server);
+}
+
+
+LIB_EXPORT int plc_tag_server_destroy(int32_t server)
+{
+    return cip_server_destroy(server);
+}
+
+
+
 /*****************************************************************************************************
  *****************************  Support routines for extra indirection *******************************
  ****************************************************************************************************/
@@ -3673,6 +4814,22 @@ int set_tag_byte_order(plc_tag_p tag, attr attribs)
     return PLCTAG_STATUS_OK;
 }
 
+/*
+ * The byte order as a number with the digits of the string attribute, so
+ * "1032" is 1032.  Leading zeros are lost, "0123" is 123.
+ */
+int byte_order_to_int(const int *byte_order, int length)
+{
+    int res = 0;
+
+    for(int i=0; i < length; i++) {
+        res = (res * 10) + byte_order[i];
+    }
+
+    return res;
+}
+
+
 int check_byte_order_str(const char *byte_order, int length)
 {
     int taken[8] = {0, 0, 0, 0, 0, 0, 0, 0};
@@ -3928,6 +5085,354 @@ int get_string_length_unsafe(plc_tag_p tag, int offset)
 }
 
 
+
+/*
+ * note that the setters changed length bytes at offset.
+ *
+ * This must be called with the tag API mutex held!
+ */
+void mark_dirty_range_unsafe(plc_tag_p tag, int offset, int length)
+{
+    int start = offset;
+    int end = offset + length;
+    int first = 0;
+    int last = 0;
+
+    if(length <= 0) {
+        return;
+    }
+
+    /* skip the ranges that end well before this one. */
+    while(first < tag->num_dirty_ranges && tag->dirty_range_end[first] + TAG_DIRTY_RANGE_GAP < start) {
+        first++;
+    }
+
+    /* take in the ranges that overlap it or nearly touch it. */
+    for(last = first; last < tag->num_dirty_ranges && tag->dirty_range_start[last] <= end + TAG_DIRTY_RANGE_GAP; last++) {
+        start = (tag->dirty_range_start[last] < start ? tag->dirty_range_start[last] : start);
+        end = (tag->dirty_range_end[last] > end ? tag->dirty_range_end[last] : end);
+    }
+
+    if(last > first) {
+        /* replace ranges first to last-1 with the joined one. */
+        int removed = last - first - 1;
+
+        tag->dirty_range_start[first] = start;
+        tag->dirty_range_end[first] = end;
+
+        for(int i = first + 1; i + removed < tag->num_dirty_ranges; i++) {
+            tag->dirty_range_start[i] = tag->dirty_range_start[i + removed];
+            tag->dirty_range_end[i] = tag->dirty_range_end[i + removed];
+        }
+
+        tag->num_dirty_ranges -= removed;
+
+        return;
+    }
+
+    if(tag->num_dirty_ranges >= TAG_MAX_DIRTY_RANGES) {
+        /*
+         * no room.  Join whichever two neighbours are closest, this range
+         * and one next to it or two of the existing ranges, so that the
+         * fewest unchanged bytes are written.
+         */
+        int prev_gap = (first > 0 ? start - tag->dirty_range_end[first - 1] : INT_MAX);
+        int next_gap = (first < tag->num_dirty_ranges ? tag->dirty_range_start[first] - end : INT_MAX);
+        int best = 0;
+        int best_gap = INT_MAX;
+
+        for(int i=0; i + 1 < tag->num_dirty_ranges; i++) {
+            int gap = tag->dirty_range_start[i + 1] - tag->dirty_range_end[i];
+
+            if(gap < best_gap) {
+                best_gap = gap;
+                best = i;
+            }
+        }
+
+        if(prev_gap <= best_gap || next_gap <= best_gap) {
+            if(prev_gap < next_gap) {
+                tag->dirty_range_end[first - 1] = end;
+            } else {
+                tag->dirty_range_start[first] = start;
+            }
+
+            return;
+        }
+
+        tag->dirty_range_end[best] = tag->dirty_range_end[best + 1];
+
+        for(int i = best + 1; i + 1 < tag->num_dirty_ranges; i++) {
+            tag->dirty_range_start[i] = tag->dirty_range_start[i + 1];
+            tag->dirty_range_end[i] = tag->dirty_range_end[i + 1];
+        }
+
+        tag->num_dirty_ranges--;
+
+        if(first > best) {
+            first--;
+        }
+    }
+
+    /* a new range, it goes before the first one after it. */
+    for(int i = tag->num_dirty_ranges; i > first; i--) {
+        tag->dirty_range_start[i] = tag->dirty_range_start[i - 1];
+        tag->dirty_range_end[i] = tag->dirty_range_end[i - 1];
+    }
+
+    tag->dirty_range_start[first] = start;
+    tag->dirty_range_end[first] = end;
+    tag->num_dirty_ranges++;
+}
+
+
+
+/*
+ * look up a tag for the bulk bit functions and check that the bit range
+ * is inside the tag data.  Sets rc and returns NULL on error.
+ */
+plc_tag_p lookup_bit_range_tag(int32_t id, int start_bit, int num_bits, int *rc)
+{
+    plc_tag_p tag = lookup_tag(id);
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Tag not found.");
+        *rc = PLCTAG_ERR_NOT_FOUND;
+        return NULL;
+    }
+
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Tag has no data!");
+        *rc = PLCTAG_ERR_NO_DATA;
+    } else if(tag->is_bit) {
+        pdebug(DEBUG_WARN, "Bulk bit access on a bit tag is not supported!");
+        *rc = PLCTAG_ERR_UNSUPPORTED;
+    } else if(start_bit < 0 || num_bits < 0 || (int64_t)start_bit + (int64_t)num_bits > (int64_t)tag->size * 8) {
+        pdebug(DEBUG_WARN, "Bit range %d to %d is out of bounds!", start_bit, start_bit + num_bits);
+        *rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+    } else {
+        *rc = PLCTAG_STATUS_OK;
+        return tag;
+    }
+
+    tag->status = (int8_t)*rc;
+    rc_dec(tag);
+
+    return NULL;
+}
+
+
+
+/*
+ * get up to 64 bits of tag data starting at any bit.  The bytes are put
+ * together in little endian order, so bit n of the result is tag bit
+ * bit_pos + n on any host.
+ *
+ * This must be called with the tag API mutex held!
+ */
+uint64_t load_tag_bits_unsafe(plc_tag_p tag, int bit_pos, int num_bits)
+{
+    int byte_index = bit_pos / 8;
+    int shift = bit_pos % 8;
+    uint64_t val = 0;
+
+    if(byte_index + 8 <= tag->size) {
+        uint8_t *data = tag->data + byte_index;
+
+        val = ((uint64_t)data[0]      ) | ((uint64_t)data[1] << 8 ) | ((uint64_t)data[2] << 16) | ((uint64_t)data[3] << 24) |
+              ((uint64_t)data[4] << 32) | ((uint64_t)data[5] << 40) | ((uint64_t)data[6] << 48) | ((uint64_t)data[7] << 56);
+    } else {
+        for(int i=0; byte_index + i < tag->size && i < 8; i++) {
+            val |= (uint64_t)tag->data[byte_index + i] << (8 * i);
+        }
+    }
+
+    if(shift) {
+        val >>= shift;
+
+        /* the range ends in the ninth byte. */
+        if(shift + num_bits > 64) {
+            val |= (uint64_t)tag->data[byte_index + 8] << (64 - shift);
+        }
+    }
+
+    if(num_bits < 64) {
+        val &= ((UINT64_C(1) << num_bits) - 1);
+    }
+
+    return val;
+}
+
+
+/* get 8 bits of a caller's bitmap starting at bit_pos, which may be as low as -7. */
+uint8_t bitmap_get8(const uint64_t *bitmap, int bit_pos, int num_bits)
+{
+    uint64_t val = 0;
+    int word_index = 0;
+    int shift = 0;
+
+    if(bit_pos < 0) {
+        return (uint8_t)((bitmap[0] << (-bit_pos)) & 0xFF);
+    }
+
+    word_index = bit_pos / 64;
+    shift = bit_pos % 64;
+
+    val = bitmap[word_index] >> shift;
+
+    /* do not read a word past the end of the range. */
+    if(shift > 56 && (word_index + 1) * 64 < num_bits) {
+        val |= bitmap[word_index + 1] << (64 - shift);
+    }
+
+    return (uint8_t)(val & 0xFF);
+}
+
+
+int popcount64(uint64_t val)
+{
+    val = val - ((val >> 1) & UINT64_C(0x5555555555555555));
+    val = (val & UINT64_C(0x3333333333333333)) + ((val >> 2) & UINT64_C(0x3333333333333333));
+    val = (val + (val >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+
+    return (int)((val * UINT64_C(0x0101010101010101)) >> 56);
+}
+
+
+/* the index of the lowest set bit.  val must not be zero. */
+int lowest_bit64(uint64_t val)
+{
+    int index = 0;
+
+    if(!(val & UINT64_C(0xFFFFFFFF))) { val >>= 32; index += 32; }
+    if(!(val & UINT64_C(0xFFFF))) { val >>= 16; index += 16; }
+    if(!(val & UINT64_C(0xFF))) { val >>= 8; index += 8; }
+    if(!(val & UINT64_C(0xF))) { val >>= 4; index += 4; }
+    if(!(val & UINT64_C(0x3))) { val >>= 2; index += 2; }
+    if(!(val & UINT64_C(0x1))) { index += 1; }
+
+    return index;
+}
+
+
+
+/*
+ * set the count word of a counted string.  Other string types need nothing.
+ *
+ * This must be called with the tag API mutex held!
+ */
+int set_string_length_unsafe(plc_tag_p tag, int offset, int string_length)
+{
+    if(!tag->byte_order->str_is_counted) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    switch(tag->byte_order->str_count_word_bytes) {
+        case 1:
+            tag->data[offset] = (uint8_t)(unsigned int)string_length;
+            break;
+
+        case 2:
+            tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
+            tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
+            break;
+
+        case 4:
+            tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
+            tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
+            tag->data[offset + tag->byte_order->int32_order[2]] = (uint8_t)((((unsigned int)string_length) >> 16) & 0xFF);
+            tag->data[offset + tag->byte_order->int32_order[3]] = (uint8_t)((((unsigned int)string_length) >> 24) & 0xFF);
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported string count size, %d!", tag->byte_order->str_count_word_bytes);
+            return PLCTAG_ERR_UNSUPPORTED;
+            break;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * the number of bytes the string at offset takes in the tag, the same
+ * as plc_tag_get_string_total_length() but with the length already known.
+ *
+ * This must be called with the tag API mutex held!
+ */
+int get_string_total_length_unsafe(plc_tag_p tag, int offset, int string_length)
+{
+    (void)offset;
+
+    return (int)(tag->byte_order->str_count_word_bytes)
+         + (tag->byte_order->str_is_fixed_length ? (int)(tag->byte_order->str_max_capacity) : string_length)
+         + (tag->byte_order->str_is_zero_terminated ? (int)1 : (int)0)
+         + (int)(tag->byte_order->str_pad_bytes);
+}
+
+
+
+/*
+ * Copy string characters out of and into tag data.  Most strings are
+ * plain bytes and this is a mem_copy.  PCCC strings have each pair of
+ * characters swapped.  Those are swapped eight bytes at a time with
+ * masks and shifts, which compilers turn into vector code.
+ *
+ * A swapped string of odd length uses the byte after its last character.
+ */
+
+#define STRING_SWAP_MASK (UINT64_C(0x00FF00FF00FF00FF))
+
+static void string_swap_pairs(uint8_t *dst, const uint8_t *src, int length)
+{
+    int i = 0;
+
+    for(; i + 8 <= length; i += 8) {
+        uint64_t chunk;
+
+        memcpy(&chunk, src + i, sizeof(chunk));
+        chunk = ((chunk & STRING_SWAP_MASK) << 8) | ((chunk >> 8) & STRING_SWAP_MASK);
+        memcpy(dst + i, &chunk, sizeof(chunk));
+    }
+
+    for(; i + 2 <= length; i += 2) {
+        dst[i] = src[i + 1];
+        dst[i + 1] = src[i];
+    }
+}
+
+
+void string_copy_from_tag(uint8_t *dst, const uint8_t *src, int length, int is_byte_swapped)
+{
+    if(!is_byte_swapped) {
+        mem_copy(dst, (void *)src, length);
+        return;
+    }
+
+    string_swap_pairs(dst, src, length);
+
+    if(length & 0x01) {
+        dst[length - 1] = src[length];
+    }
+}
+
+
+void string_copy_to_tag(uint8_t *dst, const uint8_t *src, int length, int is_byte_swapped)
+{
+    if(!is_byte_swapped) {
+        mem_copy(dst, (void *)src, length);
+        return;
+    }
+
+    string_swap_pairs(dst, src, length);
+
+    if(length & 0x01) {
+        dst[length] = src[length - 1];
+    }
+}
+
+
 /*
  * get the string capacity depending on the PLC string type.
  *
@@ -241,6 +241,13 @@ LIB_EXPORT void plc_tag_shutdown(void);
  * When the callback is called with the PLCTAG_EVENT_DESTROY_STARTED, do not call any tag functions.  It is
  * not guaranteed that they will work and they will possibly hang or fail.
  *
+ * If callbacks may be slow, set the library attribute "callback_threads" with
+ * plc_tag_set_int_attribute(0, "callback_threads", n).  Events are then queued and called by a pool of n
+ * threads, and a slow callback no longer holds up the other tags.  Events for one tag are still called one at
+ * a time and in order.  The queue holds "callback_queue_size" events (1024 by default).  When it is full, new
+ * events are dropped.  The library attributes "callback_queue_depth", "callback_queue_max_depth" and
+ * "callback_events_dropped" show how the queue is doing.  Setting the last two to zero resets them.
+ *
  * Return values:
  *
  * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
@@ -443,6 +450,23 @@ LIB_EXPORT int plc_tag_get_size(int32_t tag);
 LIB_EXPORT int plc_tag_get_bit(int32_t tag, int offset_bit);
 LIB_EXPORT int plc_tag_set_bit(int32_t tag, int offset_bit, int val);
 
+/*
+ * Bulk bit access.  Bits are numbered as for plc_tag_get_bit().  Bit i of a
+ * range is bit i % 64 of word i / 64 of the caller's bitmap, which must hold
+ * (num_bits + 63) / 64 words.
+ *
+ * plc_tag_find_next_bit returns the index of the first set bit in the range,
+ * or PLCTAG_ERR_NO_MATCH.  plc_tag_count_bits returns the number of set bits.
+ * plc_tag_diff_bits compares the range with prev_bitmap, sets the bits that
+ * changed in changed_bitmap (if not NULL), copies the current bits into
+ * prev_bitmap and returns the number of bits that changed.
+ */
+LIB_EXPORT int plc_tag_get_bits(int32_t tag, int start_bit, int num_bits, uint64_t *bitmap);
+LIB_EXPORT int plc_tag_set_bits(int32_t tag, int start_bit, int num_bits, const uint64_t *bitmap);
+LIB_EXPORT int plc_tag_find_next_bit(int32_t tag, int start_bit, int num_bits);
+LIB_EXPORT int plc_tag_count_bits(int32_t tag, int start_bit, int num_bits);
+LIB_EXPORT int plc_tag_diff_bits(int32_t tag, int start_bit, int num_bits, uint64_t *prev_bitmap, uint64_t *changed_bitmap);
+
 LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t tag, int offset);
 LIB_EXPORT int plc_tag_set_uint64(int32_t tag, int offset, uint64_t val);
 
@@ -489,6 +513,57 @@ LIB_EXPORT int plc_tag_get_string_length(int32_t tag_id, int string_start_offset
 LIB_EXPORT int plc_tag_get_string_capacity(int32_t tag_id, int string_start_offset);
 LIB_EXPORT int plc_tag_get_string_total_length(int32_t tag_id, int string_start_offset);
 
+/*
+ * Arrays of strings.  plc_tag_get_strings decodes string_count strings,
+ * one after another from string_start_offset, into arena as zero-terminated
+ * strings.  If string_offsets is not NULL it gets the arena offset of each
+ * string.  It returns the number of arena bytes used, or an error.
+ *
+ * plc_tag_set_strings takes string_count zero-terminated strings packed one
+ * after another in arena, and stores them in consecutive strings of the tag.
+ * Nothing is changed if any of them does not fit.
+ */
+LIB_EXPORT int plc_tag_get_strings(int32_t tag_id, int string_start_offset, int string_count, char *arena, int arena_size, int *string_offsets);
+LIB_EXPORT int plc_tag_set_strings(int32_t tag_id, int string_start_offset, int string_count, const char *arena, int arena_size);
+
+
+
+/*
+ * CIP server
+ *
+ * A server answers EtherNet/IP clients, including other copies of this
+ * library, with tags held in the application's memory.  It supports
+ * connected and unconnected messaging, Multiple Service Packets and the
+ * read, write, fragmented and read-modify-write tag services.
+ *
+ * plc_tag_server_create takes an attribute string like a tag:
+ *   listen - host:port to listen on, default 0.0.0.0:44818.
+ *   path - the route clients must use, like "1,0".  Any route is accepted
+ *          when this is missing.
+ *   max_sessions - TCP clients served at once, default 64.
+ * It returns a server handle or an error.
+ *
+ * plc_tag_server_add_tag serves elem_count elements of elem_size bytes at
+ * data as a tag.  The memory is not copied and must live as long as the
+ * server.  cip_type is the CIP type code, like 0xC4 for DINT.  Structures
+ * use 0x02A0 with the structure handle in the upper 16 bits, for example
+ * 0x0FCE02A0 for a Logix STRING.
+ *
+ * The server reads and writes tag data from its own thread.  Hold the
+ * server lock with plc_tag_server_lock/unlock while touching tag data.
+ * All requests in one client packet are served under a single lock.
+ *
+ * The write callback is called from the server thread, without the lock,
+ * after a client changes length bytes at offset in a tag.
+ */
+
+LIB_EXPORT int32_t plc_tag_server_create(const char *attrib_str);
+LIB_EXPORT int plc_tag_server_add_tag(int32_t server, const char *name, int cip_type, int elem_size, int elem_count, void *data);
+LIB_EXPORT int plc_tag_server_register_callback(int32_t server, void (*write_callback)(int32_t server, const char *name, int offset, int length));
+LIB_EXPORT int plc_tag_server_lock(int32_t server);
+LIB_EXPORT int plc_tag_server_unlock(int32_t server);
+LIB_EXPORT int plc_tag_server_destroy(int32_t server);
+
 #ifdef __cplusplus
 }
 #endif
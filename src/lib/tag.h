@@ -98,6 +98,16 @@ typedef struct tag_byte_order_s tag_byte_order_t;
 
 
 
+/*
+ * The setters keep a short sorted list of the byte ranges they changed
+ * since the last read or write so that protocols can write only those.
+ * Ranges closer than the gap are joined; past the limit, the two closest
+ * neighbouring ranges are joined.
+ */
+#define TAG_MAX_DIRTY_RANGES (8)
+#define TAG_DIRTY_RANGE_GAP (16)
+
+
 /*
  * The base definition of the tag structure.  This is used
  * by the protocol-specific implementations.
@@ -123,10 +133,17 @@ typedef struct tag_byte_order_s tag_byte_order_t;
                         mutex_p api_mutex; \
                         tag_vtable_p vtable; \
                         void (*callback)(int32_t tag_id, int event, int status); \
+                        uint8_t callback_state; \
+                        struct tag_event_t *callback_events; \
+                        struct tag_event_t *callback_events_last; \
+                        struct plc_tag_t *callback_next; \
                         int64_t read_cache_expire; \
                         int64_t read_cache_ms; \
                         int64_t auto_sync_next_read; \
-                        int64_t auto_sync_next_write
+                        int64_t auto_sync_next_write; \
+                        int32_t num_dirty_ranges; \
+                        int32_t dirty_range_start[TAG_MAX_DIRTY_RANGES]; \
+                        int32_t dirty_range_end[TAG_MAX_DIRTY_RANGES]
 
 
 
@@ -51,6 +51,15 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #include <lib/libplctag.h>
 #include <util/debug.h>
@@ -742,6 +751,161 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************* Condition Variables *****************************
+ **************************************************************************/
+
+struct cond_t {
+    pthread_mutex_t p_mutex;
+    pthread_cond_t p_cond;
+    int flag;
+};
+
+int cond_create(cond_p *c)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null pointer to condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(*c) {
+        pdebug(DEBUG_WARN, "Called with non-NULL pointer!");
+    }
+
+    *c = (struct cond_t *)mem_alloc(sizeof(struct cond_t));
+
+    if(! *c) {
+        pdebug(DEBUG_ERROR, "Unable to allocate condition var!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(pthread_mutex_init(&((*c)->p_mutex), NULL)) {
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR, "Error initializing condition var mutex.");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    if(pthread_cond_init(&((*c)->p_cond), NULL)) {
+        pthread_mutex_destroy(&((*c)->p_mutex));
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR, "Error initializing condition var.");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    (*c)->flag = 0;
+
+    pdebug(DEBUG_DETAIL, "Done creating condition var %p.", *c);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout_ms)
+{
+    int rc = PLCTAG_STATUS_OK;
+    struct timeval now;
+    struct timespec deadline;
+    int64_t end_ns = 0;
+
+    pdebug(DEBUG_SPEW, "Waiting on condition var %p, called from %s:%d.", c, func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value but was %d!", timeout_ms);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* pthread_cond_timedwait() takes an absolute CLOCK_REALTIME time. */
+    gettimeofday(&now, NULL);
+    end_ns = ((int64_t)now.tv_sec * 1000000000) + ((int64_t)now.tv_usec * 1000) + ((int64_t)timeout_ms * 1000000);
+    deadline.tv_sec = (time_t)(end_ns / 1000000000);
+    deadline.tv_nsec = (long)(end_ns % 1000000000);
+
+    if(pthread_mutex_lock(&(c->p_mutex))) {
+        pdebug(DEBUG_WARN, "Error locking condition var mutex!");
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    while(!c->flag) {
+        int wait_rc = pthread_cond_timedwait(&(c->p_cond), &(c->p_mutex), &deadline);
+
+        if(wait_rc == ETIMEDOUT) {
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+        }
+    }
+
+    /* take the signal. */
+    if(c->flag) {
+        c->flag = 0;
+        rc = PLCTAG_STATUS_OK;
+    }
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    return rc;
+}
+
+
+int cond_signal_impl(const char *func, int line_num, cond_p c)
+{
+    pdebug(DEBUG_SPEW, "Signaling condition var %p, called from %s:%d.", c, func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(pthread_mutex_lock(&(c->p_mutex))) {
+        pdebug(DEBUG_WARN, "Error locking condition var mutex!");
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    c->flag = 1;
+
+    pthread_cond_signal(&(c->p_cond));
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_DETAIL, "Starting to destroy condition var %p.", c);
+
+    if(!c || !*c) {
+        pdebug(DEBUG_WARN, "Null condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_cond_destroy(&((*c)->p_cond));
+    pthread_mutex_destroy(&((*c)->p_mutex));
+
+    mem_free(*c);
+
+    *c = NULL;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -933,6 +1097,17 @@ extern void lock_release(lock_t *lock)
 }
 
 
+/*
+ * mem_barrier
+ *
+ * No loads or stores move across this, in the compiler or the CPU.
+ */
+extern void mem_barrier(void)
+{
+    __sync_synchronize();
+}
+
+
 /***************************************************************************
  ******************************* Sockets ***********************************
  **************************************************************************/
@@ -941,6 +1116,7 @@ struct sock_t {
     int fd;
     int port;
     int is_open;
+    int eof_is_error; /* Unix domain and accepted sockets report a closed peer as an error. */
 };
 
 
@@ -1142,6 +1318,81 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
 
 
 
+/*
+ * socket_connect_local
+ *
+ * Connect to a Unix domain stream socket on this host.  Like TCP sockets
+ * the socket is non-blocking once connected.  Unlike them, a closed peer
+ * makes socket_read() fail.
+ */
+extern int socket_connect_local(sock_p s, const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+    int flags;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s || !path) {
+        pdebug(DEBUG_WARN, "Called with null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(str_length(path) >= (int)sizeof(addr.sun_path)) {
+        pdebug(DEBUG_WARN, "Socket path %s is too long!", path);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR, "Socket creation failed, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+#ifdef BSD_OS_TYPE
+    {
+        int sock_opt = 1;
+
+        /* The *BSD family has a different way to suppress SIGPIPE on sockets. */
+        if(setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (char*)&sock_opt, sizeof(sock_opt))) {
+            close(fd);
+            pdebug(DEBUG_ERROR, "Error setting socket SIGPIPE suppression option, errno: %d", errno);
+            return PLCTAG_ERR_OPEN;
+        }
+    }
+#endif
+
+    mem_set(&addr, 0, (int)sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    mem_copy(addr.sun_path, (void *)path, str_length(path) + 1);
+
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        pdebug(DEBUG_WARN, "Unable to connect to %s, errno: %d", path, errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    flags = fcntl(fd, F_GETFL, 0);
+
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = 0;
+    s->is_open = 1;
+    s->eof_is_error = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
 extern int socket_read(sock_p s, uint8_t *buf, int size)
 {
     int rc;
@@ -1158,6 +1409,11 @@ extern int socket_read(sock_p s, uint8_t *buf, int size)
     /* The socket is non-blocking. */
     rc = (int)read(s->fd,buf,(size_t)size);
 
+    if(rc == 0 && size > 0 && s->eof_is_error) {
+        pdebug(DEBUG_WARN, "Socket closed by the other end.");
+        return PLCTAG_ERR_READ;
+    }
+
     if(rc < 0) {
         if(errno == EAGAIN || errno == EWOULDBLOCK) {
             return 0;
@@ -1245,6 +1501,489 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/*
+ * socket_listen_tcp
+ *
+ * Listen for TCP connections on the given local address.  A NULL or empty
+ * host listens on all interfaces.  Use socket_accept() to get the clients.
+ */
+extern int socket_listen_tcp(sock_p s, const char *host, int port)
+{
+    struct sockaddr_in addr;
+    int sock_opt = 1;
+    int fd;
+    int flags;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s) {
+        pdebug(DEBUG_WARN, "Called with null socket pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_set(&addr, 0, (int)sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+
+    if(!host || str_length(host) == 0) {
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    } else if(inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
+        struct addrinfo hints;
+        struct addrinfo *res = NULL;
+
+        mem_set(&hints, 0, (int)sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_family = AF_INET;
+
+        if(getaddrinfo(host, NULL, &hints, &res) != 0 || !res) {
+            pdebug(DEBUG_WARN, "Unable to look up listen address %s!", host);
+
+            if(res) {
+                freeaddrinfo(res);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        addr.sin_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr;
+
+        freeaddrinfo(res);
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR, "Socket creation failed, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* restarting a server should not have to wait for old connections to time out. */
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&sock_opt, sizeof(sock_opt))) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket reuse option, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        pdebug(DEBUG_WARN, "Unable to listen on port %d, errno: %d", port, errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    flags = fcntl(fd, F_GETFL, 0);
+
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = port;
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * socket_accept
+ *
+ * Accept one waiting client.  Returns PLCTAG_ERR_NO_DATA if there is none.
+ * The client socket reports a closed peer as a read error.
+ */
+extern int socket_accept(sock_p listener, sock_p *client)
+{
+    int sock_opt = 1;
+    int fd;
+    int flags;
+    int rc;
+
+    if(!listener || !client) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!listener->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_READ;
+    }
+
+    fd = accept(listener->fd, NULL, NULL);
+
+    if(fd < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) {
+            return PLCTAG_ERR_NO_DATA;
+        }
+
+        pdebug(DEBUG_WARN, "Error accepting connection, errno: %d", errno);
+        return PLCTAG_ERR_READ;
+    }
+
+#ifdef BSD_OS_TYPE
+    /* The *BSD family has a different way to suppress SIGPIPE on sockets. */
+    if(setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (char*)&sock_opt, sizeof(sock_opt))) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket SIGPIPE suppression option, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+#endif
+
+    /* responses are whole packets, do not hold them back. */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt));
+
+    flags = fcntl(fd, F_GETFL, 0);
+
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if((rc = socket_create(client)) != PLCTAG_STATUS_OK) {
+        close(fd);
+        return rc;
+    }
+
+    (*client)->fd = fd;
+    (*client)->port = listener->port;
+    (*client)->is_open = 1;
+    (*client)->eof_is_error = 1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Socket sets
+ *
+ * A socket set waits until any of its sockets is readable.  Linux uses
+ * epoll, so the cost of a wait does not grow with the number of idle
+ * sockets.  Other systems fall back to poll().
+ */
+
+#define SOCK_SET_INITIAL_SIZE (16)
+
+struct sock_set_t {
+#ifdef __linux__
+    int epoll_fd;
+#else
+    struct pollfd *fds;
+    void **contexts;
+    int count;
+    int capacity;
+#endif
+};
+
+
+extern int sock_set_create(sock_set_p *set)
+{
+    if(!set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *set = (sock_set_p)mem_alloc((int)sizeof(struct sock_set_t));
+    if(! *set) {
+        pdebug(DEBUG_ERROR, "Unable to allocate socket set!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+#ifdef __linux__
+    (*set)->epoll_fd = epoll_create1(0);
+
+    if((*set)->epoll_fd < 0) {
+        pdebug(DEBUG_ERROR, "Unable to create epoll instance, errno: %d", errno);
+        mem_free(*set);
+        *set = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+#endif
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_add(sock_set_p set, sock_p s, void *context)
+{
+    if(!set || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+#ifdef __linux__
+    {
+        struct epoll_event event;
+
+        mem_set(&event, 0, (int)sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = context;
+
+        if(epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, s->fd, &event) < 0) {
+            pdebug(DEBUG_WARN, "Unable to add socket to epoll, errno: %d", errno);
+            return PLCTAG_ERR_CREATE;
+        }
+    }
+#else
+    if(set->count == set->capacity) {
+        int new_capacity = (set->capacity ? set->capacity * 2 : SOCK_SET_INITIAL_SIZE);
+        struct pollfd *new_fds = (struct pollfd *)mem_realloc(set->fds, new_capacity * (int)sizeof(struct pollfd));
+        void **new_contexts = NULL;
+
+        if(new_fds) {
+            set->fds = new_fds;
+            new_contexts = (void **)mem_realloc(set->contexts, new_capacity * (int)sizeof(void *));
+        }
+
+        if(!new_contexts) {
+            pdebug(DEBUG_ERROR, "Unable to grow socket set!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        set->contexts = new_contexts;
+        set->capacity = new_capacity;
+    }
+
+    set->fds[set->count].fd = s->fd;
+    set->fds[set->count].events = POLLIN;
+    set->fds[set->count].revents = 0;
+    set->contexts[set->count] = context;
+    set->count++;
+#endif
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_remove(sock_set_p set, sock_p s)
+{
+    if(!set || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+#ifdef __linux__
+    epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+#else
+    for(int i = 0; i < set->count; i++) {
+        if(set->fds[i].fd == s->fd) {
+            set->count--;
+            set->fds[i] = set->fds[set->count];
+            set->contexts[i] = set->contexts[set->count];
+            break;
+        }
+    }
+#endif
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * sock_set_wait
+ *
+ * Wait up to timeout_ms for sockets in the set to become readable.  The
+ * contexts of at most max_ready of them are put in ready.  Returns the
+ * number of ready sockets, zero on timeout.  A closed or failed socket
+ * counts as readable, the read returns the error.
+ */
+extern int sock_set_wait(sock_set_p set, int timeout_ms, void **ready, int max_ready)
+{
+    int num_ready = 0;
+
+    if(!set || !ready) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+#ifdef __linux__
+    {
+        struct epoll_event events[64];
+        int rc;
+
+        if(max_ready > 64) {
+            max_ready = 64;
+        }
+
+        rc = epoll_wait(set->epoll_fd, events, max_ready, timeout_ms);
+
+        if(rc < 0) {
+            if(errno == EINTR) {
+                return 0;
+            }
+
+            pdebug(DEBUG_WARN, "Error waiting for sockets, errno: %d", errno);
+            return PLCTAG_ERR_READ;
+        }
+
+        for(int i = 0; i < rc; i++) {
+            ready[num_ready++] = events[i].data.ptr;
+        }
+    }
+#else
+    {
+        int rc = poll(set->fds, (nfds_t)set->count, timeout_ms);
+
+        if(rc < 0) {
+            if(errno == EINTR) {
+                return 0;
+            }
+
+            pdebug(DEBUG_WARN, "Error waiting for sockets, errno: %d", errno);
+            return PLCTAG_ERR_READ;
+        }
+
+        for(int i = 0; i < set->count && num_ready < max_ready && rc > 0; i++) {
+            if(set->fds[i].revents) {
+                ready[num_ready++] = set->contexts[i];
+                rc--;
+            }
+        }
+    }
+#endif
+
+    return num_ready;
+}
+
+
+extern int sock_set_destroy(sock_set_p *set)
+{
+    if(!set || !*set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+#ifdef __linux__
+    close((*set)->epoll_fd);
+#else
+    if((*set)->fds) {
+        mem_free((*set)->fds);
+    }
+
+    if((*set)->contexts) {
+        mem_free((*set)->contexts);
+    }
+#endif
+
+    mem_free(*set);
+    *set = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
+
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
+
+struct shared_mem_t {
+    void *data;
+    int size;
+};
+
+
+/*
+ * shared_mem_open
+ *
+ * Map an existing POSIX shared memory object read-only.  The name does
+ * not include the leading slash.  Once mapped, reading the memory takes
+ * no system calls.
+ */
+extern int shared_mem_open(shared_mem_p *shm, const char *name)
+{
+    char os_name[256];
+    struct stat info;
+    int fd = -1;
+    void *data = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!shm || !name) {
+        pdebug(DEBUG_WARN, "Called with null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *shm = NULL;
+
+    if(snprintf(os_name, sizeof(os_name), "/%s", name) >= (int)sizeof(os_name)) {
+        pdebug(DEBUG_WARN, "Shared memory name %s is too long!", name);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    fd = shm_open(os_name, O_RDONLY, 0);
+    if(fd < 0) {
+        pdebug(DEBUG_WARN, "Unable to open shared memory %s, errno %d!", os_name, errno);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(fstat(fd, &info) != 0 || info.st_size <= 0 || info.st_size > INT_MAX) {
+        pdebug(DEBUG_WARN, "Shared memory %s has no usable size!", os_name);
+        close(fd);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    /* the mapping stays valid without the descriptor. */
+    close(fd);
+
+    if(data == MAP_FAILED) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory %s, errno %d!", os_name, errno);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    *shm = mem_alloc((int)sizeof(struct shared_mem_t));
+    if(!*shm) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory struct!");
+        munmap(data, (size_t)info.st_size);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*shm)->data = data;
+    (*shm)->size = (int)info.st_size;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern const void *shared_mem_data(shared_mem_p shm)
+{
+    return (shm ? shm->data : NULL);
+}
+
+
+extern int shared_mem_size(shared_mem_p shm)
+{
+    return (shm ? shm->size : 0);
+}
+
+
+extern int shared_mem_close(shared_mem_p *shm)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!shm || !*shm) {
+        pdebug(DEBUG_WARN, "Called with null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    munmap((*shm)->data, (size_t)(unsigned int)(*shm)->size);
+
+    mem_free(*shm);
+    *shm = NULL;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 
 
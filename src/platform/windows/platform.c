@@ -767,6 +767,141 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************* Condition Variables *****************************
+ **************************************************************************/
+
+/* condition variables need Vista or later. */
+struct cond_t {
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cond;
+    int flag;
+};
+
+int cond_create(cond_p *c)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null pointer to condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(*c) {
+        pdebug(DEBUG_WARN, "Called with non-NULL pointer!");
+    }
+
+    *c = (struct cond_t *)mem_alloc(sizeof(struct cond_t));
+
+    if(! *c) {
+        pdebug(DEBUG_ERROR, "Unable to allocate condition var!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    InitializeCriticalSection(&((*c)->cs));
+    InitializeConditionVariable(&((*c)->cond));
+
+    (*c)->flag = 0;
+
+    pdebug(DEBUG_DETAIL, "Done creating condition var %p.", *c);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout_ms)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t end_time = time_ms() + timeout_ms;
+
+    pdebug(DEBUG_SPEW, "Waiting on condition var %p, called from %s:%d.", c, func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value but was %d!", timeout_ms);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    EnterCriticalSection(&(c->cs));
+
+    while(!c->flag) {
+        int64_t time_left = end_time - time_ms();
+
+        if(time_left <= 0) {
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+        }
+
+        if(!SleepConditionVariableCS(&(c->cond), &(c->cs), (DWORD)time_left)) {
+            if(GetLastError() == ERROR_TIMEOUT) {
+                rc = PLCTAG_ERR_TIMEOUT;
+                break;
+            }
+        }
+    }
+
+    /* take the signal. */
+    if(c->flag) {
+        c->flag = 0;
+        rc = PLCTAG_STATUS_OK;
+    }
+
+    LeaveCriticalSection(&(c->cs));
+
+    return rc;
+}
+
+
+int cond_signal_impl(const char *func, int line_num, cond_p c)
+{
+    pdebug(DEBUG_SPEW, "Signaling condition var %p, called from %s:%d.", c, func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    EnterCriticalSection(&(c->cs));
+
+    c->flag = 1;
+
+    LeaveCriticalSection(&(c->cs));
+
+    WakeConditionVariable(&(c->cond));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_DETAIL, "Starting to destroy condition var %p.", c);
+
+    if(!c || !*c) {
+        pdebug(DEBUG_WARN, "Null condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* Windows condition variables do not need to be destroyed. */
+    DeleteCriticalSection(&((*c)->cs));
+
+    mem_free(*c);
+
+    *c = NULL;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -974,6 +1109,17 @@ extern void lock_release(lock_t *lock)
 }
 
 
+/*
+ * mem_barrier
+ *
+ * No loads or stores move across this, in the compiler or the CPU.
+ */
+extern void mem_barrier(void)
+{
+    MemoryBarrier();
+}
+
+
 
 
 
@@ -990,6 +1136,7 @@ struct sock_t {
     SOCKET fd;
     int port;
     int is_open;
+    int eof_is_error; /* accepted sockets report a closed peer as an error. */
 };
 
 
@@ -1037,6 +1184,22 @@ extern int socket_create(sock_p *s)
 
 
 
+/*
+ * socket_connect_local
+ *
+ * Unix domain sockets are not supported on Windows.
+ */
+extern int socket_connect_local(sock_p s, const char *path)
+{
+    (void)s;
+
+    pdebug(DEBUG_WARN, "Local sockets like %s are not supported on Windows!", (path ? path : "NULL"));
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
 extern int socket_connect_tcp(sock_p s, const char *host, int port)
 {
     IN_ADDR ips[MAX_IPS];
@@ -1221,6 +1384,11 @@ extern int socket_read(sock_p s, uint8_t *buf, int size)
     /* The socket is non-blocking. */
     rc = recv(s->fd, (char *)buf, size, 0);
 
+    if(rc == 0 && size > 0 && s->eof_is_error) {
+        pdebug(DEBUG_WARN, "Socket closed by the other end.");
+        return PLCTAG_ERR_READ;
+    }
+
     if(rc < 0) {
         int err = WSAGetLastError();
 
@@ -1309,6 +1477,315 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/*
+ * socket_listen_tcp
+ *
+ * Listen for TCP connections on the given local address.  A NULL or empty
+ * host listens on all interfaces.  Use socket_accept() to get the clients.
+ */
+extern int socket_listen_tcp(sock_p s, const char *host, int port)
+{
+    struct sockaddr_in addr;
+    int sock_opt = 1;
+    u_long non_blocking = 1;
+    SOCKET fd;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s) {
+        pdebug(DEBUG_WARN, "Called with null socket pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_set(&addr, 0, (int)sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+
+    if(!host || str_length(host) == 0) {
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    } else if(inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
+        struct addrinfo hints;
+        struct addrinfo *res = NULL;
+
+        mem_set(&hints, 0, (int)sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_family = AF_INET;
+
+        if(getaddrinfo(host, NULL, &hints, &res) != 0 || !res) {
+            pdebug(DEBUG_WARN, "Unable to look up listen address %s!", host);
+
+            if(res) {
+                freeaddrinfo(res);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        addr.sin_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr;
+
+        freeaddrinfo(res);
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(fd == INVALID_SOCKET) {
+        pdebug(DEBUG_ERROR, "Socket creation failed, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* restarting a server should not have to wait for old connections to time out. */
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&sock_opt, sizeof(sock_opt))) {
+        closesocket(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket reuse option, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        pdebug(DEBUG_WARN, "Unable to listen on port %d, error: %d", port, WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(ioctlsocket(fd, FIONBIO, &non_blocking)) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, error: %d", WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = port;
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * socket_accept
+ *
+ * Accept one waiting client.  Returns PLCTAG_ERR_NO_DATA if there is none.
+ * The client socket reports a closed peer as a read error.
+ */
+extern int socket_accept(sock_p listener, sock_p *client)
+{
+    int sock_opt = 1;
+    u_long non_blocking = 1;
+    SOCKET fd;
+    int rc;
+
+    if(!listener || !client) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!listener->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_READ;
+    }
+
+    fd = accept(listener->fd, NULL, NULL);
+
+    if(fd == INVALID_SOCKET) {
+        int err = WSAGetLastError();
+
+        if(err == WSAEWOULDBLOCK || err == WSAECONNRESET) {
+            return PLCTAG_ERR_NO_DATA;
+        }
+
+        pdebug(DEBUG_WARN, "Error accepting connection, error: %d", err);
+        return PLCTAG_ERR_READ;
+    }
+
+    /* responses are whole packets, do not hold them back. */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt));
+
+    if(ioctlsocket(fd, FIONBIO, &non_blocking)) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, error: %d", WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if((rc = socket_create(client)) != PLCTAG_STATUS_OK) {
+        closesocket(fd);
+        return rc;
+    }
+
+    (*client)->fd = fd;
+    (*client)->port = listener->port;
+    (*client)->is_open = 1;
+    (*client)->eof_is_error = 1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Socket sets
+ *
+ * A socket set waits until any of its sockets is readable.  Windows only
+ * has select(), which takes FD_SETSIZE sockets at a time, so large sets
+ * are checked in several calls and only the first one waits.
+ */
+
+#define SOCK_SET_INITIAL_SIZE (16)
+
+struct sock_set_t {
+    SOCKET *fds;
+    void **contexts;
+    int count;
+    int capacity;
+};
+
+
+extern int sock_set_create(sock_set_p *set)
+{
+    if(!set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *set = (sock_set_p)mem_alloc((int)sizeof(struct sock_set_t));
+    if(! *set) {
+        pdebug(DEBUG_ERROR, "Unable to allocate socket set!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_add(sock_set_p set, sock_p s, void *context)
+{
+    if(!set || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(set->count == set->capacity) {
+        int new_capacity = (set->capacity ? set->capacity * 2 : SOCK_SET_INITIAL_SIZE);
+        SOCKET *new_fds = (SOCKET *)mem_realloc(set->fds, new_capacity * (int)sizeof(SOCKET));
+        void **new_contexts = NULL;
+
+        if(new_fds) {
+            set->fds = new_fds;
+            new_contexts = (void **)mem_realloc(set->contexts, new_capacity * (int)sizeof(void *));
+        }
+
+        if(!new_contexts) {
+            pdebug(DEBUG_ERROR, "Unable to grow socket set!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        set->contexts = new_contexts;
+        set->capacity = new_capacity;
+    }
+
+    set->fds[set->count] = s->fd;
+    set->contexts[set->count] = context;
+    set->count++;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_set_remove(sock_set_p set, sock_p s)
+{
+    if(!set || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    for(int i = 0; i < set->count; i++) {
+        if(set->fds[i] == s->fd) {
+            set->count--;
+            set->fds[i] = set->fds[set->count];
+            set->contexts[i] = set->contexts[set->count];
+            break;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * sock_set_wait
+ *
+ * Wait up to timeout_ms for sockets in the set to become readable.  The
+ * contexts of at most max_ready of them are put in ready.  Returns the
+ * number of ready sockets, zero on timeout.  A closed or failed socket
+ * counts as readable, the read returns the error.
+ */
+extern int sock_set_wait(sock_set_p set, int timeout_ms, void **ready, int max_ready)
+{
+    int num_ready = 0;
+
+    if(!set || !ready) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* select() fails on an empty set. */
+    if(set->count == 0) {
+        sleep_ms(timeout_ms);
+        return 0;
+    }
+
+    for(int start = 0; start < set->count && num_ready < max_ready; start += FD_SETSIZE) {
+        fd_set read_fds;
+        struct timeval timeout;
+        int end = (set->count - start > FD_SETSIZE ? start + FD_SETSIZE : set->count);
+        int rc;
+
+        FD_ZERO(&read_fds);
+
+        for(int i = start; i < end; i++) {
+            FD_SET(set->fds[i], &read_fds);
+        }
+
+        /* only the first group waits. */
+        timeout.tv_sec = (start == 0 ? timeout_ms / 1000 : 0);
+        timeout.tv_usec = (start == 0 ? (timeout_ms % 1000) * 1000 : 0);
+
+        rc = select(0, &read_fds, NULL, NULL, &timeout);
+
+        if(rc == SOCKET_ERROR) {
+            pdebug(DEBUG_WARN, "Error waiting for sockets, error: %d", WSAGetLastError());
+            return PLCTAG_ERR_READ;
+        }
+
+        for(int i = start; i < end && num_ready < max_ready && rc > 0; i++) {
+            if(FD_ISSET(set->fds[i], &read_fds)) {
+                ready[num_ready++] = set->contexts[i];
+                rc--;
+            }
+        }
+    }
+
+    return num_ready;
+}
+
+
+extern int sock_set_destroy(sock_set_p *set)
+{
+    if(!set || !*set) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if((*set)->fds) {
+        mem_free((*set)->fds);
+    }
+
+    if((*set)->contexts) {
+        mem_free((*set)->contexts);
+    }
+
+    mem_free(*set);
+    *set = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 
 
@@ -1580,6 +2057,124 @@ int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size
 
 
 
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
+
+struct shared_mem_t {
+    HANDLE mapping;
+    const void *data;
+    int size;
+};
+
+
+/*
+ * shared_mem_open
+ *
+ * Map an existing named file mapping in the session namespace read-only.
+ * Once mapped, reading the memory takes no system calls.
+ */
+extern int shared_mem_open(shared_mem_p *shm, const char *name)
+{
+    char os_name[256];
+    MEMORY_BASIC_INFORMATION info;
+    HANDLE mapping = NULL;
+    const void *data = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!shm || !name) {
+        pdebug(DEBUG_WARN, "Called with null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *shm = NULL;
+
+    if(str_length(name) + 7 >= (int)sizeof(os_name)) {
+        pdebug(DEBUG_WARN, "Shared memory name %s is too long!", name);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    snprintf_platform(os_name, sizeof(os_name), "Local\\%s", name);
+
+    mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, os_name);
+    if(!mapping) {
+        pdebug(DEBUG_WARN, "Unable to open shared memory %s, error %d!", os_name, (int)GetLastError());
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!data) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory %s, error %d!", os_name, (int)GetLastError());
+        CloseHandle(mapping);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    /* the view covers the whole mapping, rounded up to a page. */
+    if(!VirtualQuery(data, &info, sizeof(info)) || info.RegionSize > INT32_MAX) {
+        pdebug(DEBUG_WARN, "Shared memory %s has no usable size!", os_name);
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    *shm = mem_alloc((int)sizeof(struct shared_mem_t));
+    if(!*shm) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory struct!");
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*shm)->mapping = mapping;
+    (*shm)->data = data;
+    (*shm)->size = (int)info.RegionSize;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern const void *shared_mem_data(shared_mem_p shm)
+{
+    return (shm ? shm->data : NULL);
+}
+
+
+extern int shared_mem_size(shared_mem_p shm)
+{
+    return (shm ? shm->size : 0);
+}
+
+
+extern int shared_mem_close(shared_mem_p *shm)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!shm || !*shm) {
+        pdebug(DEBUG_WARN, "Called with null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    UnmapViewOfFile((*shm)->data);
+    CloseHandle((*shm)->mapping);
+
+    mem_free(*shm);
+    *shm = NULL;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
+
 /***************************************************************************
  ***************************** Miscellaneous *******************************
  **************************************************************************/
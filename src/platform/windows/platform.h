@@ -207,6 +207,22 @@ extern int mutex_unlock_impl(const char *func, int line_num, mutex_p m);
 #define critical_block(lock) \
 for(int LINE_ID(__sync_flag_nargle_) = 1; LINE_ID(__sync_flag_nargle_); LINE_ID(__sync_flag_nargle_) = 0, mutex_unlock(lock))  for(int LINE_ID(__sync_rc_nargle_) = mutex_lock(lock); LINE_ID(__sync_rc_nargle_) == PLCTAG_STATUS_OK && LINE_ID(__sync_flag_nargle_) ; LINE_ID(__sync_flag_nargle_) = 0)
 
+/*
+ * condition variable functions/defs
+ *
+ * A condition is a signalled flag.  cond_wait() returns as soon as the flag
+ * is set, clearing it, or with PLCTAG_ERR_TIMEOUT.  A signal with no waiter
+ * is not lost, the next wait returns at once.  One signal wakes one waiter.
+ */
+typedef struct cond_t *cond_p;
+extern int cond_create(cond_p *c);
+extern int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout_ms);
+extern int cond_signal_impl(const char *func, int line_num, cond_p c);
+extern int cond_destroy(cond_p *c);
+
+#define cond_wait(c, t) cond_wait_impl(__func__, __LINE__, c, t)
+#define cond_signal(c) cond_signal_impl(__func__, __LINE__, c)
+
 /* thread functions/defs */
 typedef struct thread_t *thread_p;
 //typedef PTHREAD_START_ROUTINE thread_func_t;
@@ -236,15 +252,31 @@ extern int lock_acquire_try(lock_t *lock);
 extern int lock_acquire(lock_t *lock);
 extern void lock_release(lock_t *lock);
 
+/* full memory barrier, for data shared without a lock. */
+extern void mem_barrier(void);
+
 /* socket functions */
 typedef struct sock_t *sock_p;
 extern int socket_create(sock_p *s);
 extern int socket_connect_tcp(sock_p s, const char *host, int port);
+extern int socket_connect_local(sock_p s, const char *path);
 extern int socket_read(sock_p s, uint8_t *buf, int size);
 extern int socket_write(sock_p s, uint8_t *buf, int size);
 extern int socket_close(sock_p s);
 extern int socket_destroy(sock_p *s);
 
+/* listening sockets, both ends are non-blocking. */
+extern int socket_listen_tcp(sock_p s, const char *host, int port);
+extern int socket_accept(sock_p listener, sock_p *client);
+
+/* waiting on many sockets at once */
+typedef struct sock_set_t *sock_set_p;
+extern int sock_set_create(sock_set_p *set);
+extern int sock_set_add(sock_set_p set, sock_p s, void *context);
+extern int sock_set_remove(sock_set_p set, sock_p s);
+extern int sock_set_wait(sock_set_p set, int timeout_ms, void **ready, int max_ready);
+extern int sock_set_destroy(sock_set_p *set);
+
 /* serial handling */
 typedef struct serial_port_t *serial_port_p;
 #define PLC_SERIAL_PORT_NULL ((plc_serial_port)NULL)
@@ -253,6 +285,13 @@ extern int plc_lib_close_serial_port(serial_port_p serial_port);
 extern int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size);
 extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size);
 
+/* shared memory, mapped read-only */
+typedef struct shared_mem_t *shared_mem_p;
+extern int shared_mem_open(shared_mem_p *shm, const char *name);
+extern const void *shared_mem_data(shared_mem_p shm);
+extern int shared_mem_size(shared_mem_p shm);
+extern int shared_mem_close(shared_mem_p *shm);
+
 
 /* time functions */
 extern int sleep_ms(int ms);
@@ -353,6 +353,7 @@ plc_tag_p ab_tag_create(attr attribs)
         /* default to requiring a connection. */
         tag->use_connected_msg = attr_get_int(attribs,"use_connected_msg", 1);
         tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
+        tag->delta_write = attr_get_int(attribs, "delta_write", 0);
         tag->vtable = &eip_cip_vtable;
 
         break;
@@ -752,6 +753,7 @@ int ab_tag_abort(ab_tag_p tag)
     tag->read_in_progress = 0;
     tag->write_in_progress = 0;
     tag->offset = 0;
+    tag->delta_write_active = 0;
 
     pdebug(DEBUG_DETAIL, "Done.");
 
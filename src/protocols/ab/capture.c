@@ -0,0 +1,139 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <platform.h>
+#include <ab/capture.h>
+#include <util/debug.h>
+
+
+struct capture_t {
+    FILE *file;
+    char *path;
+    int failed;
+};
+
+
+capture_p capture_open(const char *path)
+{
+    capture_p capture = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    capture = mem_alloc((int)sizeof(*capture));
+    if(!capture) {
+        pdebug(DEBUG_ERROR, "Unable to allocate capture struct!");
+        return NULL;
+    }
+
+    capture->path = str_dup(path);
+    if(!capture->path) {
+        pdebug(DEBUG_ERROR, "Unable to copy capture file name!");
+        mem_free(capture);
+        return NULL;
+    }
+
+    capture->file = fopen(path, "wb");
+    if(!capture->file) {
+        pdebug(DEBUG_WARN, "Unable to open capture file %s!", path);
+        mem_free(capture->path);
+        mem_free(capture);
+        return NULL;
+    }
+
+    if(fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_SIZE, capture->file) != CAPTURE_MAGIC_SIZE) {
+        pdebug(DEBUG_WARN, "Unable to write capture file header to %s!", path);
+        fclose(capture->file);
+        mem_free(capture->path);
+        mem_free(capture);
+        return NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Capturing session traffic to %s.", path);
+
+    return capture;
+}
+
+
+/* only the session thread writes records, so no locking is needed. */
+void capture_record(capture_p capture, uint8_t record_type, uint8_t *data, int data_size)
+{
+    uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+    uint64_t timestamp = (uint64_t)time_ms();
+
+    if(!capture || capture->failed || data_size < 0) {
+        return;
+    }
+
+    for(int i=0; i < 8; i++) {
+        header[i] = (uint8_t)((timestamp >> (i * 8)) & 0xFF);
+    }
+
+    header[8] = record_type;
+
+    for(int i=0; i < 4; i++) {
+        header[9 + i] = (uint8_t)(((uint32_t)data_size >> (i * 8)) & 0xFF);
+    }
+
+    /* flush each record so that the capture survives the process going away. */
+    if(fwrite(header, 1, sizeof(header), capture->file) != sizeof(header)
+       || fwrite(data, 1, (size_t)(unsigned int)data_size, capture->file) != (size_t)(unsigned int)data_size
+       || fflush(capture->file) != 0) {
+        pdebug(DEBUG_WARN, "Error writing to capture file %s, capture stopped!", capture->path);
+        capture->failed = 1;
+    }
+}
+
+
+void capture_close(capture_p capture)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!capture) {
+        return;
+    }
+
+    if(capture->file) {
+        fclose(capture->file);
+        capture->file = NULL;
+    }
+
+    if(capture->path) {
+        mem_free(capture->path);
+        capture->path = NULL;
+    }
+
+    mem_free(capture);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PLCTAG_AB_CAPTURE_H__
+#define __PLCTAG_AB_CAPTURE_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Session traffic capture.
+ *
+ * When a tag that creates a session has the attribute capture_file=<path>,
+ * every EIP frame the session sends or receives is written to <path> so
+ * the traffic can be replayed later with ab_replay.
+ *
+ * The file starts with the 8 byte magic CAPTURE_MAGIC, followed by records:
+ *
+ *    uint64 little-endian  timestamp, milliseconds since the epoch.
+ *    uint8                 record type, see below.
+ *    uint32 little-endian  payload length.
+ *    payload               the whole EIP frame, or the gateway for a connect record.
+ */
+
+#define CAPTURE_MAGIC "PLCTCAP1"
+#define CAPTURE_MAGIC_SIZE (8)
+#define CAPTURE_RECORD_HEADER_SIZE (13)
+
+#define CAPTURE_RECORD_CONNECT (1)
+#define CAPTURE_RECORD_SENT (2)
+#define CAPTURE_RECORD_RECEIVED (3)
+
+typedef struct capture_t *capture_p;
+
+extern capture_p capture_open(const char *path);
+extern void capture_record(capture_p capture, uint8_t record_type, uint8_t *data, int data_size);
+extern void capture_close(capture_p capture);
+
+#endif
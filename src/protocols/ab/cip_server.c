@@ -0,0 +1,1908 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * CIP server
+ *
+ * This is the adapter side of EtherNet/IP.  A server listens for TCP
+ * sessions and answers Logix-style tag requests out of memory owned by
+ * the application.  One thread per server waits on all of its sockets at
+ * once through a socket set, so idle sessions cost nothing.
+ *
+ * Supported:
+ *   - RegisterSession, UnRegisterSession, SendRRData and SendUnitData.
+ *   - Forward Open, Large Forward Open and Forward Close.
+ *   - Unconnected Send to the Connection Manager.
+ *   - Read Tag, Read Tag Fragmented, Write Tag, Write Tag Fragmented and
+ *     Read-Modify-Write Tag.
+ *   - Multiple Service Packet, with all requests in one packet served from
+ *     one consistent snapshot of the tag data.
+ *
+ * Tag listing and UDT template reads are not supported.  Tags can be
+ * arrays with one dimension.  Names may contain dots, so a client path of
+ * "Motor.Speed" finds a tag added as "Motor.Speed".
+ *
+ * The application must hold the server lock while it touches tag data.
+ */
+
+#include <platform.h>
+#include <ab/cip_server.h>
+#include <ab/defs.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define CIP_SERVER_DEFAULT_MAX_SESSIONS (64)
+#define CIP_SERVER_MAX_CONNECTIONS (8)      /* CIP connections per TCP session */
+#define CIP_SERVER_MAX_TAG_NAME (256)
+#define CIP_SERVER_INITIAL_BUCKETS (64)
+#define CIP_SERVER_MAX_READY (64)
+#define CIP_SERVER_MAX_BACKLOG (1024 * 1024) /* unsent response bytes before we drop a session */
+
+/* largest CIP replies, these match what the client side of the library uses. */
+#define CIP_SERVER_UC_MAX_REPLY (504)
+#define CIP_SERVER_MAX_CONN_SIZE (0x01FF & 508)
+#define CIP_SERVER_MAX_CONN_SIZE_EX (0xFFFF & 4002)
+
+/* an EIP packet is the header and up to 64k of payload. */
+#define EIP_HEADER_SIZE ((int)sizeof(eip_encap))
+#define EIP_MAX_PACKET (EIP_HEADER_SIZE + 0xFFFF)
+
+/* EIP encapsulation status values. */
+#define EIP_STATUS_OK (0x0000)
+#define EIP_STATUS_BAD_COMMAND (0x0001)
+#define EIP_STATUS_BAD_DATA (0x0003)
+#define EIP_STATUS_BAD_SESSION (0x0064)
+#define EIP_STATUS_BAD_LENGTH (0x0065)
+
+#define EIP_NOP (0x0000)
+
+/* CIP status, the extended status is kept in the upper bits. */
+#define CIP_STATUS(general, extended) ((int)(((extended) << 8) | (general)))
+
+#define CIP_ERR_CONN_DUPLICATE CIP_STATUS(0x01, 0x0100)
+#define CIP_ERR_CONN_NOT_FOUND CIP_STATUS(0x01, 0x0107)
+#define CIP_ERR_CONN_SIZE CIP_STATUS(0x01, 0x0109)
+#define CIP_ERR_CONN_NO_RESOURCES CIP_STATUS(0x01, 0x0113)
+#define CIP_ERR_CONN_BAD_PATH CIP_STATUS(0x01, 0x0315)
+#define CIP_ERR_PATH_SEGMENT CIP_STATUS(0x04, 0)
+#define CIP_ERR_PATH_DEST CIP_STATUS(0x05, 0)
+#define CIP_ERR_UNSUPPORTED CIP_STATUS(AB_CIP_ERR_UNSUPPORTED_SERVICE, 0)
+#define CIP_ERR_REPLY_TOO_LARGE CIP_STATUS(0x11, 0)
+#define CIP_ERR_NOT_ENOUGH_DATA CIP_STATUS(0x13, 0)
+#define CIP_ERR_TOO_MUCH_DATA CIP_STATUS(0x15, 0)
+#define CIP_ERR_OUT_OF_BOUNDS CIP_STATUS(0xFF, 0x2105)
+#define CIP_ERR_BAD_TYPE CIP_STATUS(0xFF, 0x2107)
+
+#define CIP_TYPE_STRUCT (0x02A0)
+
+/* byte offsets within the CM request and response bodies, taken from the client's structures. */
+#define FO_REQ(field) ((int)(offsetof(eip_forward_open_request_t, field) - offsetof(eip_forward_open_request_t, cm_service_code)))
+#define FO_EX_REQ(field) ((int)(offsetof(eip_forward_open_request_ex_t, field) - offsetof(eip_forward_open_request_ex_t, cm_service_code)))
+#define FO_RESP(field) ((int)(offsetof(eip_forward_open_response_t, field) - offsetof(eip_forward_open_response_t, resp_service_code)))
+#define FO_RESP_SIZE ((int)(sizeof(eip_forward_open_response_t) - offsetof(eip_forward_open_response_t, resp_service_code)))
+#define FC_REQ(field) ((int)(offsetof(eip_forward_close_req_t, field) - offsetof(eip_forward_close_req_t, cm_service_code)))
+
+/* where the CIP payload starts in the two kinds of EIP packets. */
+#define UC_CIP_OFFSET ((int)offsetof(eip_cip_uc_req, cm_service_code))
+#define CO_CIP_OFFSET ((int)sizeof(eip_cip_co_req))
+
+#define GET_U16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+#define GET_U32(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+static const uint8_t CM_PATH[] = { 0x20, 0x06, 0x24, 0x01 };
+static const uint8_t ROUTER_PATH[] = { 0x20, 0x02, 0x24, 0x01 };
+
+
+typedef struct cip_server_tag_t *cip_server_tag_p;
+
+struct cip_server_tag_t {
+    cip_server_tag_p next;
+    uint16_t type;
+    uint16_t handle;        /* structure handle when type is CIP_TYPE_STRUCT */
+    int elem_size;
+    int elem_count;
+    int size;
+    uint8_t *data;
+    char *name;
+};
+
+struct cip_connection_t {
+    int in_use;
+    uint32_t server_conn_id;
+    uint32_t client_conn_id;
+    uint16_t conn_serial_number;
+    uint16_t orig_vendor_id;
+    uint32_t orig_serial_number;
+    int max_reply;
+};
+
+typedef struct cip_server_t *cip_server_p;
+typedef struct cip_session_t *cip_session_p;
+
+struct cip_session_t {
+    cip_session_p next;
+    cip_server_p server;
+    sock_p sock;
+    int closing;
+
+    uint32_t session_handle;
+
+    uint8_t *in;
+    int in_len;
+
+    uint8_t *out;
+    int out_len;
+    int out_capacity;
+
+    struct cip_connection_t conns[CIP_SERVER_MAX_CONNECTIONS];
+};
+
+struct cip_write_notice_t {
+    cip_server_tag_p tag;
+    int offset;
+    int length;
+};
+
+struct cip_server_t {
+    cip_server_p next;
+    int32_t id;
+
+    sock_p listener;
+    sock_set_p socks;
+    thread_p thread;
+    volatile int terminate;
+
+    /* protects the tags and their data. */
+    mutex_p data_mutex;
+    cip_server_tag_p *buckets;
+    int num_buckets;
+    int num_tags;
+    void (*write_callback)(int32_t server_id, const char *name, int offset, int length);
+
+    /* writes done by the current packet, reported after the lock is released. */
+    struct cip_write_notice_t *notices;
+    int num_notices;
+    int notice_capacity;
+
+    /* Forward Open must name this route to the router, -1 accepts any. */
+    uint8_t route[64];
+    int route_len;
+
+    cip_session_p sessions;
+    int num_sessions;
+    int max_sessions;
+    uint32_t next_conn_id;
+};
+
+
+static int cip_server_parse_listen(const char *listen, char **host, int *port);
+static int cip_server_parse_route(cip_server_p server, const char *path);
+static cip_server_p cip_server_lookup(int32_t server_id);
+static void cip_server_free(cip_server_p server);
+static uint32_t tag_name_hash(const char *name);
+static cip_server_tag_p tag_find(cip_server_p server, const char *name);
+static int tag_table_grow(cip_server_p server);
+static THREAD_FUNC(cip_server_handler);
+static void server_accept(cip_server_p server);
+static void session_destroy(cip_session_p session);
+static void session_read(cip_session_p session);
+static void session_flush(cip_session_p session);
+static uint8_t *session_reserve(cip_session_p session, int size);
+static void session_handle_packet(cip_session_p session, uint8_t *packet, int packet_len);
+static void session_eip_reply(cip_session_p session, uint8_t *packet, uint32_t status);
+static void session_register(cip_session_p session, uint8_t *packet, int packet_len);
+static void session_rr_data(cip_session_p session, uint8_t *packet, int packet_len);
+static void session_unit_data(cip_session_p session, uint8_t *packet, int packet_len);
+static void server_report_writes(cip_server_p server);
+static int path_is(uint8_t *req, int req_len, const uint8_t *path);
+static int error_reply(uint8_t *req, uint8_t *out, int out_capacity, int status);
+static int handle_cm_request(cip_session_p session, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int handle_forward_open(cip_session_p session, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int handle_forward_close(cip_session_p session, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int handle_router_request(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int handle_multi(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int handle_tag_service(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int parse_tag_path(cip_server_p server, uint8_t *req, cip_server_tag_p *tag, int *elem_index);
+static int handle_read(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int handle_write(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int handle_rmw(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity);
+static int add_write_notice(cip_server_p server, cip_server_tag_p tag, int offset, int length);
+
+
+static mutex_p server_mutex = NULL;
+static cip_server_p servers = NULL;
+static int32_t next_server_id = 1;
+
+
+
+int cip_server_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Initializing CIP server module.");
+
+    if((rc = mutex_create(&server_mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create CIP server mutex!");
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+void cip_server_teardown(void)
+{
+    cip_server_p server = NULL;
+
+    pdebug(DEBUG_INFO, "Tearing down CIP server module.");
+
+    if(!server_mutex) {
+        return;
+    }
+
+    /* stop any servers the application left running. */
+    do {
+        server = NULL;
+
+        critical_block(server_mutex) {
+            server = servers;
+
+            if(server) {
+                servers = server->next;
+            }
+        }
+
+        if(server) {
+            cip_server_free(server);
+        }
+    } while(server);
+
+    mutex_destroy(&server_mutex);
+    server_mutex = NULL;
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * cip_server_create
+ *
+ * Attributes:
+ *   listen - host and port to listen on, default 0.0.0.0:44818.
+ *   path - route a Forward Open must use to reach us, like "1,0".  Any
+ *          route is accepted when this is missing.
+ *   max_sessions - TCP sessions served at once, default 64.
+ */
+int32_t cip_server_create(const char *attrib_str)
+{
+    attr attribs = NULL;
+    cip_server_p server = NULL;
+    char *host = NULL;
+    int port = AB_EIP_DEFAULT_PORT;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(str_length(attrib_str) > 0) {
+        attribs = attr_create_from_str(attrib_str);
+
+        if(!attribs) {
+            pdebug(DEBUG_WARN, "Unable to parse attribute string!");
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    server = (cip_server_p)mem_alloc((int)sizeof(struct cip_server_t));
+    if(!server) {
+        pdebug(DEBUG_ERROR, "Unable to allocate server!");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    server->max_sessions = attr_get_int(attribs, "max_sessions", CIP_SERVER_DEFAULT_MAX_SESSIONS);
+    server->next_conn_id = (uint32_t)rand();
+
+    rc = cip_server_parse_listen(attr_get_str(attribs, "listen", NULL), &host, &port);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = cip_server_parse_route(server, attr_get_str(attribs, "path", NULL));
+    }
+
+    attr_destroy(attribs);
+
+    if(rc == PLCTAG_STATUS_OK && server->max_sessions <= 0) {
+        pdebug(DEBUG_WARN, "The max_sessions attribute must be positive!");
+        rc = PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        server->num_buckets = CIP_SERVER_INITIAL_BUCKETS;
+        server->buckets = (cip_server_tag_p *)mem_alloc(server->num_buckets * (int)sizeof(cip_server_tag_p));
+
+        if(!server->buckets) {
+            pdebug(DEBUG_ERROR, "Unable to allocate tag table!");
+            rc = PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = mutex_create(&server->data_mutex);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = sock_set_create(&server->socks);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = socket_create(&server->listener);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = socket_listen_tcp(server->listener, host, port);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        /* the server itself is the context of the listening socket. */
+        rc = sock_set_add(server->socks, server->listener, server);
+    }
+
+    if(host) {
+        mem_free(host);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        critical_block(server_mutex) {
+            server->id = next_server_id++;
+
+            if(next_server_id <= 0) {
+                next_server_id = 1;
+            }
+
+            server->next = servers;
+            servers = server;
+        }
+
+        rc = thread_create(&server->thread, cip_server_handler, 32*1024, server);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            critical_block(server_mutex) {
+                cip_server_p *walker = &servers;
+
+                while(*walker && *walker != server) {
+                    walker = &((*walker)->next);
+                }
+
+                if(*walker) {
+                    *walker = server->next;
+                }
+            }
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create CIP server, error %s!", plc_tag_decode_error(rc));
+        cip_server_free(server);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done, created server %d on port %d.", server->id, port);
+
+    return server->id;
+}
+
+
+
+/*
+ * cip_server_add_tag
+ *
+ * Serve elem_count elements of elem_size bytes at data as the tag name.
+ * The memory stays owned by the caller and must live as long as the
+ * server.  Atomic types are given by their CIP type code.  Structures
+ * use 0x02A0 with the structure handle in the upper 16 bits.
+ */
+int cip_server_add_tag(int32_t server_id, const char *name, int cip_type, int elem_size, int elem_count, void *data)
+{
+    cip_server_p server = cip_server_lookup(server_id);
+    cip_server_tag_p tag = NULL;
+    uint16_t type = (uint16_t)(cip_type & 0xFFFF);
+    uint16_t handle = (uint16_t)(((uint32_t)cip_type >> 16) & 0xFFFF);
+    int name_len = str_length(name);
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!server) {
+        pdebug(DEBUG_WARN, "Server %d not found!", server_id);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(!data) {
+        pdebug(DEBUG_WARN, "Tag data pointer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(name_len <= 0 || name_len >= CIP_SERVER_MAX_TAG_NAME || strchr(name, '[')) {
+        pdebug(DEBUG_WARN, "Tag name must be a plain Logix name without array indexes!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(elem_size <= 0 || elem_count <= 0 || elem_count > 0xFFFF || (int64_t)elem_size * (int64_t)elem_count > INT_MAX) {
+        pdebug(DEBUG_WARN, "Bad element size %d or count %d!", elem_size, elem_count);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(type != CIP_TYPE_STRUCT && (handle != 0 || type > 0xFF)) {
+        pdebug(DEBUG_WARN, "Unsupported CIP type %x!", cip_type);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag = (cip_server_tag_p)mem_alloc((int)sizeof(struct cip_server_tag_t));
+    if(!tag) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->name = str_dup(name);
+    if(!tag->name) {
+        pdebug(DEBUG_ERROR, "Unable to copy tag name!");
+        mem_free(tag);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->type = type;
+    tag->handle = handle;
+    tag->elem_size = elem_size;
+    tag->elem_count = elem_count;
+    tag->size = elem_size * elem_count;
+    tag->data = (uint8_t *)data;
+
+    critical_block(server->data_mutex) {
+        uint32_t bucket;
+
+        if(tag_find(server, name)) {
+            pdebug(DEBUG_WARN, "Tag %s already exists!", name);
+            rc = PLCTAG_ERR_DUPLICATE;
+            break;
+        }
+
+        if(server->num_tags >= server->num_buckets && (rc = tag_table_grow(server)) != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        bucket = tag_name_hash(name) % (uint32_t)server->num_buckets;
+        tag->next = server->buckets[bucket];
+        server->buckets[bucket] = tag;
+        server->num_tags++;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(tag->name);
+        mem_free(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done, added tag %s.", name);
+
+    return rc;
+}
+
+
+
+int cip_server_register_callback(int32_t server_id, void (*write_callback)(int32_t server_id, const char *name, int offset, int length))
+{
+    cip_server_p server = cip_server_lookup(server_id);
+
+    if(!server) {
+        pdebug(DEBUG_WARN, "Server %d not found!", server_id);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(server->data_mutex) {
+        server->write_callback = write_callback;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cip_server_lock(int32_t server_id)
+{
+    cip_server_p server = cip_server_lookup(server_id);
+
+    if(!server) {
+        pdebug(DEBUG_WARN, "Server %d not found!", server_id);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    return mutex_lock(server->data_mutex);
+}
+
+
+int cip_server_unlock(int32_t server_id)
+{
+    cip_server_p server = cip_server_lookup(server_id);
+
+    if(!server) {
+        pdebug(DEBUG_WARN, "Server %d not found!", server_id);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    return mutex_unlock(server->data_mutex);
+}
+
+
+int cip_server_destroy(int32_t server_id)
+{
+    cip_server_p server = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(server_mutex) {
+        cip_server_p *walker = &servers;
+
+        while(*walker && (*walker)->id != server_id) {
+            walker = &((*walker)->next);
+        }
+
+        if(*walker) {
+            server = *walker;
+            *walker = server->next;
+        }
+    }
+
+    if(!server) {
+        pdebug(DEBUG_WARN, "Server %d not found!", server_id);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    cip_server_free(server);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/***********************************************************************
+ *************************** Helper Functions **************************
+ **********************************************************************/
+
+
+int cip_server_parse_listen(const char *listen, char **host, int *port)
+{
+    char **parts = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    *host = NULL;
+    *port = AB_EIP_DEFAULT_PORT;
+
+    if(str_length(listen) == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    parts = str_split(listen, ":");
+    if(!parts || !parts[0]) {
+        pdebug(DEBUG_WARN, "Unable to parse listen address %s!", listen);
+        if(parts) mem_free(parts);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(parts[1]) {
+        if(str_to_int(parts[1], port) != 0 || *port <= 0 || *port > 0xFFFF || parts[2]) {
+            pdebug(DEBUG_WARN, "Bad port in listen address %s!", listen);
+            rc = PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    /* ":44818" listens on every interface. */
+    if(rc == PLCTAG_STATUS_OK && str_length(parts[0]) > 0 && listen[0] != ':') {
+        *host = str_dup(parts[0]);
+
+        if(!*host) {
+            rc = PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    mem_free(parts);
+
+    return rc;
+}
+
+
+int cip_server_parse_route(cip_server_p server, const char *path)
+{
+    char **links = NULL;
+    int i;
+
+    server->route_len = -1;
+
+    if(!path) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    server->route_len = 0;
+
+    if(str_length(path) == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    links = str_split(path, ",");
+    if(!links) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    for(i = 0; links[i]; i++) {
+        int val = 0;
+
+        if(i >= (int)sizeof(server->route) || str_to_int(links[i], &val) != 0 || val < 0 || val > 255) {
+            pdebug(DEBUG_WARN, "Bad route %s, only numeric port and slot pairs are supported!", path);
+            mem_free(links);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        server->route[i] = (uint8_t)val;
+    }
+
+    server->route_len = i;
+
+    mem_free(links);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+cip_server_p cip_server_lookup(int32_t server_id)
+{
+    cip_server_p server = NULL;
+
+    if(!server_mutex) {
+        return NULL;
+    }
+
+    critical_block(server_mutex) {
+        for(server = servers; server && server->id != server_id; server = server->next) { }
+    }
+
+    return server;
+}
+
+
+/* stop the thread and release everything, the server is already off the list. */
+void cip_server_free(cip_server_p server)
+{
+    int i;
+
+    if(server->thread) {
+        server->terminate = 1;
+        thread_join(server->thread);
+        thread_destroy(&server->thread);
+    }
+
+    while(server->sessions) {
+        cip_session_p session = server->sessions;
+
+        server->sessions = session->next;
+        session_destroy(session);
+    }
+
+    if(server->listener) {
+        if(server->socks) {
+            sock_set_remove(server->socks, server->listener);
+        }
+
+        socket_destroy(&server->listener);
+    }
+
+    if(server->socks) {
+        sock_set_destroy(&server->socks);
+    }
+
+    for(i = 0; i < server->num_buckets; i++) {
+        while(server->buckets[i]) {
+            cip_server_tag_p tag = server->buckets[i];
+
+            server->buckets[i] = tag->next;
+            mem_free(tag->name);
+            mem_free(tag);
+        }
+    }
+
+    if(server->buckets) {
+        mem_free(server->buckets);
+    }
+
+    if(server->notices) {
+        mem_free(server->notices);
+    }
+
+    if(server->data_mutex) {
+        mutex_destroy(&server->data_mutex);
+    }
+
+    mem_free(server);
+}
+
+
+/* FNV-1a over the lower cased name, Logix names are not case sensitive. */
+uint32_t tag_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for(; *name; name++) {
+        char c = *name;
+
+        if(c >= 'A' && c <= 'Z') {
+            c = (char)(c - 'A' + 'a');
+        }
+
+        hash ^= (uint8_t)c;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+cip_server_tag_p tag_find(cip_server_p server, const char *name)
+{
+    cip_server_tag_p tag = server->buckets[tag_name_hash(name) % (uint32_t)server->num_buckets];
+
+    while(tag && str_cmp_i(tag->name, name) != 0) {
+        tag = tag->next;
+    }
+
+    return tag;
+}
+
+
+int tag_table_grow(cip_server_p server)
+{
+    int new_num_buckets = server->num_buckets * 2;
+    cip_server_tag_p *new_buckets = (cip_server_tag_p *)mem_alloc(new_num_buckets * (int)sizeof(cip_server_tag_p));
+    int i;
+
+    if(!new_buckets) {
+        pdebug(DEBUG_ERROR, "Unable to grow tag table!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    for(i = 0; i < server->num_buckets; i++) {
+        while(server->buckets[i]) {
+            cip_server_tag_p tag = server->buckets[i];
+            uint32_t bucket = tag_name_hash(tag->name) % (uint32_t)new_num_buckets;
+
+            server->buckets[i] = tag->next;
+            tag->next = new_buckets[bucket];
+            new_buckets[bucket] = tag;
+        }
+    }
+
+    mem_free(server->buckets);
+    server->buckets = new_buckets;
+    server->num_buckets = new_num_buckets;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/***********************************************************************
+ ************************ Server and Session I/O ***********************
+ **********************************************************************/
+
+
+THREAD_FUNC(cip_server_handler)
+{
+    cip_server_p server = (cip_server_p)arg;
+    void *ready[CIP_SERVER_MAX_READY];
+    int backlog = 0;
+
+    pdebug(DEBUG_INFO, "Starting server %d.", server->id);
+
+    while(!server->terminate) {
+        cip_session_p *walker = NULL;
+        int num_ready = 0;
+        int i;
+
+        /* poll quickly while a client is slow to take its responses. */
+        num_ready = sock_set_wait(server->socks, (backlog ? 1 : 100), ready, CIP_SERVER_MAX_READY);
+
+        if(num_ready < 0) {
+            pdebug(DEBUG_WARN, "Error %s waiting on sockets!", plc_tag_decode_error(num_ready));
+            sleep_ms(10);
+            continue;
+        }
+
+        for(i = 0; i < num_ready; i++) {
+            if(ready[i] == server) {
+                server_accept(server);
+            } else {
+                session_read((cip_session_p)ready[i]);
+            }
+        }
+
+        backlog = 0;
+        walker = &server->sessions;
+
+        while(*walker) {
+            cip_session_p session = *walker;
+
+            session_flush(session);
+
+            if(session->closing) {
+                *walker = session->next;
+                server->num_sessions--;
+                session_destroy(session);
+            } else {
+                backlog |= (session->out_len > 0);
+                walker = &session->next;
+            }
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done with server %d.", server->id);
+
+    THREAD_RETURN(0);
+}
+
+
+void server_accept(cip_server_p server)
+{
+    while(1) {
+        cip_session_p session = NULL;
+        sock_p client = NULL;
+        int rc = socket_accept(server->listener, &client);
+
+        if(rc == PLCTAG_ERR_NO_DATA) {
+            break;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s accepting a client!", plc_tag_decode_error(rc));
+            break;
+        }
+
+        if(server->num_sessions >= server->max_sessions) {
+            pdebug(DEBUG_WARN, "Already serving %d sessions, refusing a new client.", server->num_sessions);
+            socket_destroy(&client);
+            continue;
+        }
+
+        session = (cip_session_p)mem_alloc((int)sizeof(struct cip_session_t));
+        if(session) {
+            session->in = (uint8_t *)mem_alloc(EIP_MAX_PACKET);
+        }
+
+        if(!session || !session->in || sock_set_add(server->socks, client, session) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to set up a session for a new client!");
+            socket_destroy(&client);
+
+            if(session) {
+                if(session->in) mem_free(session->in);
+                mem_free(session);
+            }
+
+            continue;
+        }
+
+        session->server = server;
+        session->sock = client;
+        session->next = server->sessions;
+        server->sessions = session;
+        server->num_sessions++;
+
+        pdebug(DEBUG_INFO, "Accepted a client, now serving %d sessions.", server->num_sessions);
+    }
+}
+
+
+void session_destroy(cip_session_p session)
+{
+    sock_set_remove(session->server->socks, session->sock);
+    socket_destroy(&session->sock);
+
+    if(session->in) {
+        mem_free(session->in);
+    }
+
+    if(session->out) {
+        mem_free(session->out);
+    }
+
+    mem_free(session);
+}
+
+
+void session_read(cip_session_p session)
+{
+    while(!session->closing) {
+        int pos = 0;
+        int rc = socket_read(session->sock, session->in + session->in_len, EIP_MAX_PACKET - session->in_len);
+
+        if(rc < 0) {
+            pdebug(DEBUG_INFO, "Client went away.");
+            session->closing = 1;
+            break;
+        }
+
+        if(rc == 0) {
+            break;
+        }
+
+        session->in_len += rc;
+
+        /* handle each complete packet. */
+        while(!session->closing && session->in_len - pos >= EIP_HEADER_SIZE) {
+            eip_encap *encap = (eip_encap *)(session->in + pos);
+            int packet_len = EIP_HEADER_SIZE + le2h16(encap->encap_length);
+
+            if(session->in_len - pos < packet_len) {
+                break;
+            }
+
+            session_handle_packet(session, session->in + pos, packet_len);
+
+            pos += packet_len;
+        }
+
+        if(pos > 0) {
+            mem_move(session->in, session->in + pos, session->in_len - pos);
+            session->in_len -= pos;
+        }
+    }
+}
+
+
+void session_flush(cip_session_p session)
+{
+    while(!session->closing && session->out_len > 0) {
+        int rc = socket_write(session->sock, session->out, session->out_len);
+
+        if(rc == PLCTAG_ERR_NO_DATA || rc == 0) {
+            break;
+        }
+
+        if(rc < 0) {
+            pdebug(DEBUG_INFO, "Error %s writing to client.", plc_tag_decode_error(rc));
+            session->closing = 1;
+            break;
+        }
+
+        mem_move(session->out, session->out + rc, session->out_len - rc);
+        session->out_len -= rc;
+    }
+
+    if(session->out_len > CIP_SERVER_MAX_BACKLOG) {
+        pdebug(DEBUG_WARN, "Client is not reading its responses, dropping it.");
+        session->closing = 1;
+    }
+}
+
+
+/* make room for size more bytes of output and return where they go. */
+uint8_t *session_reserve(cip_session_p session, int size)
+{
+    if(session->out_len + size > session->out_capacity) {
+        int new_capacity = (session->out_capacity ? session->out_capacity : EIP_MAX_PACKET);
+        uint8_t *new_out = NULL;
+
+        while(session->out_len + size > new_capacity) {
+            new_capacity *= 2;
+        }
+
+        new_out = (uint8_t *)mem_realloc(session->out, new_capacity);
+        if(!new_out) {
+            pdebug(DEBUG_ERROR, "Unable to grow output buffer!");
+            return NULL;
+        }
+
+        session->out = new_out;
+        session->out_capacity = new_capacity;
+    }
+
+    return session->out + session->out_len;
+}
+
+
+void session_handle_packet(cip_session_p session, uint8_t *packet, int packet_len)
+{
+    eip_encap *encap = (eip_encap *)packet;
+    uint16_t command = le2h16(encap->encap_command);
+
+    pdebug(DEBUG_DETAIL, "Got EIP command %x with %d bytes.", command, packet_len);
+
+    switch(command) {
+        case EIP_NOP:
+            break;
+
+        case AB_EIP_REGISTER_SESSION:
+            session_register(session, packet, packet_len);
+            break;
+
+        case AB_EIP_UNREGISTER_SESSION:
+            pdebug(DEBUG_INFO, "Client unregistered its session.");
+            session->closing = 1;
+            break;
+
+        case AB_EIP_UNCONNECTED_SEND:
+        case AB_EIP_CONNECTED_SEND:
+            if(session->session_handle == 0 || le2h32(encap->encap_session_handle) != session->session_handle) {
+                pdebug(DEBUG_WARN, "Request with bad session handle %x.", le2h32(encap->encap_session_handle));
+                session_eip_reply(session, packet, EIP_STATUS_BAD_SESSION);
+            } else if(command == AB_EIP_UNCONNECTED_SEND) {
+                session_rr_data(session, packet, packet_len);
+            } else {
+                session_unit_data(session, packet, packet_len);
+            }
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported EIP command %x.", command);
+            session_eip_reply(session, packet, EIP_STATUS_BAD_COMMAND);
+            break;
+    }
+
+    server_report_writes(session->server);
+}
+
+
+/* a reply that is only the encapsulation header. */
+void session_eip_reply(cip_session_p session, uint8_t *packet, uint32_t status)
+{
+    eip_encap *resp = (eip_encap *)session_reserve(session, EIP_HEADER_SIZE);
+
+    if(!resp) {
+        session->closing = 1;
+        return;
+    }
+
+    mem_copy(resp, packet, EIP_HEADER_SIZE);
+    resp->encap_length = h2le16(0);
+    resp->encap_status = h2le32(status);
+
+    session->out_len += EIP_HEADER_SIZE;
+}
+
+
+void session_register(cip_session_p session, uint8_t *packet, int packet_len)
+{
+    eip_session_reg_req *req = (eip_session_reg_req *)packet;
+    eip_session_reg_req *resp = NULL;
+
+    if(packet_len != (int)sizeof(eip_session_reg_req) || le2h16(req->eip_version) != AB_EIP_VERSION) {
+        pdebug(DEBUG_WARN, "Bad session registration request!");
+        session_eip_reply(session, packet, EIP_STATUS_BAD_DATA);
+        return;
+    }
+
+    if(session->session_handle == 0) {
+        do {
+            session->session_handle = (uint32_t)rand();
+        } while(session->session_handle == 0);
+    }
+
+    resp = (eip_session_reg_req *)session_reserve(session, (int)sizeof(eip_session_reg_req));
+    if(!resp) {
+        session->closing = 1;
+        return;
+    }
+
+    mem_copy(resp, packet, (int)sizeof(eip_session_reg_req));
+    resp->encap_session_handle = h2le32(session->session_handle);
+    resp->encap_status = h2le32(EIP_STATUS_OK);
+    resp->option_flags = h2le16(0);
+
+    session->out_len += (int)sizeof(eip_session_reg_req);
+
+    pdebug(DEBUG_INFO, "Registered session %x.", session->session_handle);
+}
+
+
+/* SendRRData, unconnected requests. */
+void session_rr_data(cip_session_p session, uint8_t *packet, int packet_len)
+{
+    eip_cip_uc_req *req = (eip_cip_uc_req *)packet;
+    eip_cip_uc_resp *resp = NULL;
+    int reply_offset = (int)offsetof(eip_cip_uc_resp, reply_service);
+    int cip_len = 0;
+    int reply_len = 0;
+
+    if(packet_len < UC_CIP_OFFSET
+       || le2h16(req->cpf_item_count) != 2
+       || le2h16(req->cpf_nai_item_type) != AB_EIP_ITEM_NAI
+       || le2h16(req->cpf_nai_item_length) != 0
+       || le2h16(req->cpf_udi_item_type) != AB_EIP_ITEM_UDI
+       || UC_CIP_OFFSET + le2h16(req->cpf_udi_item_length) != packet_len) {
+        pdebug(DEBUG_WARN, "Malformed unconnected request!");
+        session_eip_reply(session, packet, EIP_STATUS_BAD_LENGTH);
+        return;
+    }
+
+    cip_len = le2h16(req->cpf_udi_item_length);
+
+    resp = (eip_cip_uc_resp *)session_reserve(session, reply_offset + CIP_SERVER_UC_MAX_REPLY);
+    if(!resp) {
+        session->closing = 1;
+        return;
+    }
+
+    reply_len = handle_cm_request(session, packet + UC_CIP_OFFSET, cip_len, (uint8_t *)resp + reply_offset, CIP_SERVER_UC_MAX_REPLY);
+
+    mem_copy(resp, packet, EIP_HEADER_SIZE);
+    resp->encap_length = h2le16((uint16_t)(reply_offset - EIP_HEADER_SIZE + reply_len));
+    resp->encap_status = h2le32(EIP_STATUS_OK);
+    resp->encap_options = h2le32(0);
+    resp->interface_handle = h2le32(0);
+    resp->router_timeout = h2le16(0);
+    resp->cpf_item_count = h2le16(2);
+    resp->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    resp->cpf_nai_item_length = h2le16(0);
+    resp->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    resp->cpf_udi_item_length = h2le16((uint16_t)reply_len);
+
+    session->out_len += reply_offset + reply_len;
+}
+
+
+/* SendUnitData, requests on a CIP connection. */
+void session_unit_data(cip_session_p session, uint8_t *packet, int packet_len)
+{
+    eip_cip_co_req *req = (eip_cip_co_req *)packet;
+    eip_cip_co_generic_response *resp = NULL;
+    struct cip_connection_t *conn = NULL;
+    int reply_offset = (int)sizeof(eip_cip_co_generic_response);
+    uint32_t conn_id = 0;
+    int reply_len = 0;
+    int i;
+
+    if(packet_len < CO_CIP_OFFSET
+       || le2h16(req->cpf_item_count) != 2
+       || le2h16(req->cpf_cai_item_type) != AB_EIP_ITEM_CAI
+       || le2h16(req->cpf_cai_item_length) != 4
+       || le2h16(req->cpf_cdi_item_type) != AB_EIP_ITEM_CDI
+       || (int)offsetof(eip_cip_co_req, cpf_conn_seq_num) + le2h16(req->cpf_cdi_item_length) != packet_len) {
+        pdebug(DEBUG_WARN, "Malformed connected request!");
+        session_eip_reply(session, packet, EIP_STATUS_BAD_LENGTH);
+        return;
+    }
+
+    conn_id = le2h32(req->cpf_targ_conn_id);
+
+    for(i = 0; i < CIP_SERVER_MAX_CONNECTIONS && !conn; i++) {
+        if(session->conns[i].in_use && session->conns[i].server_conn_id == conn_id) {
+            conn = &session->conns[i];
+        }
+    }
+
+    if(!conn) {
+        /* there is nobody to answer on a connection that does not exist. */
+        pdebug(DEBUG_WARN, "Request on unknown connection %x dropped.", conn_id);
+        return;
+    }
+
+    resp = (eip_cip_co_generic_response *)session_reserve(session, reply_offset + conn->max_reply);
+    if(!resp) {
+        session->closing = 1;
+        return;
+    }
+
+    reply_len = handle_router_request(session->server, packet + CO_CIP_OFFSET, packet_len - CO_CIP_OFFSET, (uint8_t *)resp + reply_offset, conn->max_reply);
+
+    mem_copy(resp, packet, EIP_HEADER_SIZE);
+    resp->encap_length = h2le16((uint16_t)(reply_offset - EIP_HEADER_SIZE + reply_len));
+    resp->encap_status = h2le32(EIP_STATUS_OK);
+    resp->options = h2le32(0);
+    resp->interface_handle = h2le32(0);
+    resp->router_timeout = h2le16(0);
+    resp->cpf_item_count = h2le16(2);
+    resp->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+    resp->cpf_cai_item_length = h2le16(4);
+    resp->cpf_targ_conn_id = h2le32(conn->client_conn_id);
+    resp->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+    resp->cpf_cdi_item_length = h2le16((uint16_t)(reply_len + 2));
+    resp->cpf_conn_seq_num = req->cpf_conn_seq_num;
+
+    session->out_len += reply_offset + reply_len;
+}
+
+
+/* tell the application about the writes of the last packet, outside the data lock. */
+void server_report_writes(cip_server_p server)
+{
+    void (*write_callback)(int32_t server_id, const char *name, int offset, int length) = NULL;
+    int i;
+
+    if(server->num_notices == 0) {
+        return;
+    }
+
+    critical_block(server->data_mutex) {
+        write_callback = server->write_callback;
+    }
+
+    for(i = 0; write_callback && i < server->num_notices; i++) {
+        write_callback(server->id, server->notices[i].tag->name, server->notices[i].offset, server->notices[i].length);
+    }
+
+    server->num_notices = 0;
+}
+
+
+
+
+/***********************************************************************
+ **************************** CIP Services *****************************
+ **********************************************************************/
+
+
+/* check that the request is addressed to the given class 1 instance path. */
+int path_is(uint8_t *req, int req_len, const uint8_t *path)
+{
+    return (req_len >= 6 && req[1] == 2 && req[2] == path[0] && req[3] == path[1] && req[4] == path[2] && req[5] == path[3]);
+}
+
+
+int error_reply(uint8_t *req, uint8_t *out, int out_capacity, int status)
+{
+    int extended = (status >> 8) & 0xFFFF;
+    int size = (extended ? 6 : 4);
+
+    /* a tight slot in a Multiple Service Packet only has room for the general status. */
+    if(out_capacity < size) {
+        extended = 0;
+        size = 4;
+    }
+
+    out[0] = (uint8_t)(req[0] | AB_EIP_CMD_CIP_OK);
+    out[1] = 0;
+    out[2] = (uint8_t)(status & 0xFF);
+    out[3] = (uint8_t)(extended ? 1 : 0);
+
+    if(extended) {
+        out[4] = (uint8_t)(extended & 0xFF);
+        out[5] = (uint8_t)((extended >> 8) & 0xFF);
+    }
+
+    return size;
+}
+
+
+/* unconnected requests, the Connection Manager services or a plain router request. */
+int handle_cm_request(cip_session_p session, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    if(req_len < 2) {
+        pdebug(DEBUG_WARN, "Request too short!");
+        return (req_len > 0 ? error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA) : 0);
+    }
+
+    if(!path_is(req, req_len, CM_PATH)) {
+        return handle_router_request(session->server, req, req_len, out, out_capacity);
+    }
+
+    switch(req[0]) {
+        case AB_EIP_CMD_FORWARD_OPEN:
+        case AB_EIP_CMD_FORWARD_OPEN_EX:
+            return handle_forward_open(session, req, req_len, out, out_capacity);
+
+        case AB_EIP_CMD_FORWARD_CLOSE:
+            return handle_forward_close(session, req, req_len, out, out_capacity);
+
+        case AB_EIP_CMD_UNCONNECTED_SEND: {
+                /* service, path, ticks, then the embedded request and the route. */
+                int embedded_len = (req_len >= 10 ? GET_U16(req + 8) : -1);
+
+                if(embedded_len < 2 || 10 + embedded_len > req_len) {
+                    pdebug(DEBUG_WARN, "Malformed Unconnected Send!");
+                    return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+                }
+
+                return handle_router_request(session->server, req + 10, embedded_len, out, out_capacity);
+            }
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported Connection Manager service %x.", req[0]);
+            return error_reply(req, out, out_capacity, CIP_ERR_UNSUPPORTED);
+    }
+}
+
+
+int handle_forward_open(cip_session_p session, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    cip_server_p server = session->server;
+    struct cip_connection_t *conn = NULL;
+    int is_ex = (req[0] == AB_EIP_CMD_FORWARD_OPEN_EX);
+    int path_offset = (is_ex ? FO_EX_REQ(path_size) : FO_REQ(path_size)) + 1;
+    uint16_t conn_serial_number;
+    uint16_t orig_vendor_id;
+    uint32_t orig_serial_number;
+    int max_reply;
+    int path_len;
+    int i;
+
+    if(req_len < path_offset || req_len < path_offset + 2 * req[path_offset - 1]) {
+        pdebug(DEBUG_WARN, "Forward Open request too short!");
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    conn_serial_number = GET_U16(req + FO_REQ(conn_serial_number));
+    orig_vendor_id = GET_U16(req + FO_REQ(orig_vendor_id));
+    orig_serial_number = GET_U32(req + FO_REQ(orig_serial_number));
+
+    /* our replies are bounded by the target to originator size. */
+    if(is_ex) {
+        max_reply = (int)(GET_U32(req + FO_EX_REQ(targ_to_orig_conn_params_ex)) & 0xFFFF);
+
+        if(max_reply > CIP_SERVER_MAX_CONN_SIZE_EX) {
+            pdebug(DEBUG_WARN, "Requested connection size %d is too large.", max_reply);
+            return error_reply(req, out, out_capacity, CIP_ERR_CONN_SIZE);
+        }
+    } else {
+        max_reply = GET_U16(req + FO_REQ(targ_to_orig_conn_params)) & 0x01FF;
+
+        if(max_reply > CIP_SERVER_MAX_CONN_SIZE) {
+            pdebug(DEBUG_WARN, "Requested connection size %d is too large.", max_reply);
+            return error_reply(req, out, out_capacity, CIP_ERR_CONN_SIZE);
+        }
+    }
+
+    /* the sequence number goes in front of every reply. */
+    max_reply -= 2;
+
+    if(max_reply < 32) {
+        pdebug(DEBUG_WARN, "Requested connection size %d is too small.", max_reply);
+        return error_reply(req, out, out_capacity, CIP_ERR_CONN_SIZE);
+    }
+
+    /* the path must be our route, if we have one, then the Message Router. */
+    path_len = 2 * req[path_offset - 1];
+
+    if(server->route_len >= 0) {
+        int route_len = server->route_len + (server->route_len & 1);
+
+        if(path_len != route_len + (int)sizeof(ROUTER_PATH)
+           || mem_cmp(req + path_offset, server->route_len, server->route, server->route_len) != 0
+           || ((server->route_len & 1) && req[path_offset + server->route_len] != 0)
+           || mem_cmp(req + path_offset + route_len, (int)sizeof(ROUTER_PATH), (void *)ROUTER_PATH, (int)sizeof(ROUTER_PATH)) != 0) {
+            pdebug(DEBUG_WARN, "Forward Open for a different route.");
+            return error_reply(req, out, out_capacity, CIP_ERR_CONN_BAD_PATH);
+        }
+    }
+
+    for(i = 0; i < CIP_SERVER_MAX_CONNECTIONS; i++) {
+        if(session->conns[i].in_use) {
+            if(session->conns[i].conn_serial_number == conn_serial_number
+               && session->conns[i].orig_vendor_id == orig_vendor_id
+               && session->conns[i].orig_serial_number == orig_serial_number) {
+                pdebug(DEBUG_WARN, "Duplicate Forward Open.");
+                return error_reply(req, out, out_capacity, CIP_ERR_CONN_DUPLICATE);
+            }
+        } else if(!conn) {
+            conn = &session->conns[i];
+        }
+    }
+
+    if(!conn) {
+        pdebug(DEBUG_WARN, "No free connections in this session.");
+        return error_reply(req, out, out_capacity, CIP_ERR_CONN_NO_RESOURCES);
+    }
+
+    if(out_capacity < FO_RESP_SIZE) {
+        return error_reply(req, out, out_capacity, CIP_ERR_REPLY_TOO_LARGE);
+    }
+
+    conn->in_use = 1;
+    conn->server_conn_id = server->next_conn_id++;
+    conn->client_conn_id = GET_U32(req + FO_REQ(targ_to_orig_conn_id));
+    conn->conn_serial_number = conn_serial_number;
+    conn->orig_vendor_id = orig_vendor_id;
+    conn->orig_serial_number = orig_serial_number;
+    conn->max_reply = max_reply;
+
+    /* the reply echoes most of the request. */
+    mem_set(out, 0, FO_RESP_SIZE);
+    out[0] = (uint8_t)(req[0] | AB_EIP_CMD_CIP_OK);
+    *(uint32_le *)(out + FO_RESP(orig_to_targ_conn_id)) = h2le32(conn->server_conn_id);
+    *(uint32_le *)(out + FO_RESP(targ_to_orig_conn_id)) = h2le32(conn->client_conn_id);
+    *(uint16_le *)(out + FO_RESP(conn_serial_number)) = h2le16(conn_serial_number);
+    *(uint16_le *)(out + FO_RESP(orig_vendor_id)) = h2le16(orig_vendor_id);
+    *(uint32_le *)(out + FO_RESP(orig_serial_number)) = h2le32(orig_serial_number);
+    mem_copy(out + FO_RESP(orig_to_targ_api), req + FO_REQ(orig_to_targ_rpi), 4);
+    mem_copy(out + FO_RESP(targ_to_orig_api), req + (is_ex ? FO_EX_REQ(targ_to_orig_rpi) : FO_REQ(targ_to_orig_rpi)), 4);
+
+    pdebug(DEBUG_INFO, "Opened connection %x with reply size %d.", conn->server_conn_id, max_reply);
+
+    return FO_RESP_SIZE;
+}
+
+
+int handle_forward_close(cip_session_p session, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    uint16_t conn_serial_number;
+    uint16_t orig_vendor_id;
+    uint32_t orig_serial_number;
+    int i;
+
+    if(req_len < FC_REQ(path_size) || out_capacity < 14) {
+        pdebug(DEBUG_WARN, "Forward Close request too short!");
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    conn_serial_number = GET_U16(req + FC_REQ(conn_serial_number));
+    orig_vendor_id = GET_U16(req + FC_REQ(orig_vendor_id));
+    orig_serial_number = GET_U32(req + FC_REQ(orig_serial_number));
+
+    for(i = 0; i < CIP_SERVER_MAX_CONNECTIONS; i++) {
+        struct cip_connection_t *conn = &session->conns[i];
+
+        if(conn->in_use
+           && conn->conn_serial_number == conn_serial_number
+           && conn->orig_vendor_id == orig_vendor_id
+           && conn->orig_serial_number == orig_serial_number) {
+            pdebug(DEBUG_INFO, "Closed connection %x.", conn->server_conn_id);
+
+            conn->in_use = 0;
+
+            /* reply, status, then the connection triad and no application data. */
+            mem_set(out, 0, 14);
+            out[0] = (uint8_t)(req[0] | AB_EIP_CMD_CIP_OK);
+            mem_copy(out + 4, req + FC_REQ(conn_serial_number), 8);
+
+            return 14;
+        }
+    }
+
+    pdebug(DEBUG_WARN, "Forward Close for an unknown connection.");
+
+    return error_reply(req, out, out_capacity, CIP_ERR_CONN_NOT_FOUND);
+}
+
+
+/* Message Router requests, served under the data lock. */
+int handle_router_request(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    int rc = 0;
+
+    if(req_len < 2 || req_len < 2 + 2 * req[1]) {
+        pdebug(DEBUG_WARN, "Request path is truncated!");
+        return (req_len > 0 ? error_reply(req, out, out_capacity, CIP_ERR_PATH_SEGMENT) : 0);
+    }
+
+    critical_block(server->data_mutex) {
+        if(req[0] == AB_EIP_CMD_CIP_MULTI && path_is(req, req_len, ROUTER_PATH)) {
+            rc = handle_multi(server, req, req_len, out, out_capacity);
+        } else {
+            rc = handle_tag_service(server, req, req_len, out, out_capacity);
+        }
+    }
+
+    return rc;
+}
+
+
+int handle_multi(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    uint8_t *body = req + 6;    /* offsets are from the request count. */
+    int body_len = req_len - 6;
+    int count;
+    int resp_pos;
+    int partial = 0;
+    int i;
+
+    if(body_len < 2 || body_len < 2 + 2 * GET_U16(body)) {
+        pdebug(DEBUG_WARN, "Malformed Multiple Service Packet!");
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    count = GET_U16(body);
+    resp_pos = 2 + 2 * count;
+
+    /* every request needs at least a 4 byte reply. */
+    if(4 + resp_pos + 4 * count > out_capacity) {
+        return error_reply(req, out, out_capacity, CIP_ERR_REPLY_TOO_LARGE);
+    }
+
+    out[0] = (uint8_t)(req[0] | AB_EIP_CMD_CIP_OK);
+    out[1] = 0;
+    out[2] = AB_CIP_STATUS_OK;
+    out[3] = 0;
+    out[4] = (uint8_t)(count & 0xFF);
+    out[5] = (uint8_t)((count >> 8) & 0xFF);
+
+    for(i = 0; i < count; i++) {
+        int start = GET_U16(body + 2 + 2 * i);
+        int end = (i + 1 < count ? GET_U16(body + 4 + 2 * i) : body_len);
+        int room = out_capacity - 4 - resp_pos - 4 * (count - i - 1);
+        uint8_t *reply = out + 4 + resp_pos;
+        int reply_len;
+
+        if(start < 2 + 2 * count || end > body_len || start >= end) {
+            pdebug(DEBUG_WARN, "Bad offset in Multiple Service Packet!");
+            return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+        }
+
+        if(end - start < 2 + 2 * body[start + 1]) {
+            reply_len = error_reply(body + start, reply, room, CIP_ERR_PATH_SEGMENT);
+        } else if(body[start] == AB_EIP_CMD_CIP_MULTI) {
+            reply_len = error_reply(body + start, reply, room, CIP_ERR_UNSUPPORTED);
+        } else {
+            reply_len = handle_tag_service(server, body + start, end - start, reply, room);
+        }
+
+        if(reply[2] != AB_CIP_STATUS_OK && reply[2] != AB_CIP_STATUS_FRAG) {
+            partial = 1;
+        }
+
+        out[6 + 2 * i] = (uint8_t)(resp_pos & 0xFF);
+        out[7 + 2 * i] = (uint8_t)((resp_pos >> 8) & 0xFF);
+
+        resp_pos += reply_len;
+    }
+
+    if(partial) {
+        out[2] = AB_CIP_ERR_PARTIAL_ERROR;
+    }
+
+    return 4 + resp_pos;
+}
+
+
+int handle_tag_service(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    switch(req[0]) {
+        case AB_EIP_CMD_CIP_READ:
+        case AB_EIP_CMD_CIP_READ_FRAG:
+            return handle_read(server, req, req_len, out, out_capacity);
+
+        case AB_EIP_CMD_CIP_WRITE:
+        case AB_EIP_CMD_CIP_WRITE_FRAG:
+            return handle_write(server, req, req_len, out, out_capacity);
+
+        case AB_EIP_CMD_CIP_RMW:
+            return handle_rmw(server, req, req_len, out, out_capacity);
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported service %x.", req[0]);
+            return error_reply(req, out, out_capacity, CIP_ERR_UNSUPPORTED);
+    }
+}
+
+
+/*
+ * Symbolic segments are joined with dots to form the tag name.  One
+ * numeric segment may follow as the element index.
+ */
+int parse_tag_path(cip_server_p server, uint8_t *req, cip_server_tag_p *tag, int *elem_index)
+{
+    char name[CIP_SERVER_MAX_TAG_NAME];
+    uint8_t *path = req + 2;
+    int path_len = 2 * req[1];
+    int name_len = 0;
+    int have_index = 0;
+    int i = 0;
+
+    *tag = NULL;
+    *elem_index = 0;
+
+    while(i < path_len) {
+        int seg_len = 0;
+
+        switch(path[i]) {
+            case 0x91:
+                seg_len = (i + 1 < path_len ? path[i + 1] : path_len);
+
+                if(have_index || i + 2 + seg_len > path_len || name_len + seg_len + 1 >= (int)sizeof(name)) {
+                    return CIP_ERR_PATH_SEGMENT;
+                }
+
+                if(name_len > 0) {
+                    name[name_len++] = '.';
+                }
+
+                mem_copy(name + name_len, path + i + 2, seg_len);
+                name_len += seg_len;
+                i += 2 + seg_len + (seg_len & 1);
+                break;
+
+            case 0x28:
+                if(have_index || i + 2 > path_len) {
+                    return CIP_ERR_PATH_SEGMENT;
+                }
+
+                *elem_index = path[i + 1];
+                i += 2;
+                have_index = 1;
+                break;
+
+            case 0x29:
+                if(have_index || i + 4 > path_len) {
+                    return CIP_ERR_PATH_SEGMENT;
+                }
+
+                *elem_index = GET_U16(path + i + 2);
+                i += 4;
+                have_index = 1;
+                break;
+
+            case 0x2A:
+                if(have_index || i + 6 > path_len || GET_U32(path + i + 2) > 0xFFFF) {
+                    return CIP_ERR_PATH_SEGMENT;
+                }
+
+                *elem_index = (int)GET_U32(path + i + 2);
+                i += 6;
+                have_index = 1;
+                break;
+
+            default:
+                return CIP_ERR_PATH_SEGMENT;
+        }
+    }
+
+    if(name_len == 0) {
+        return CIP_ERR_PATH_SEGMENT;
+    }
+
+    name[name_len] = 0;
+
+    *tag = tag_find(server, name);
+
+    if(!*tag) {
+        pdebug(DEBUG_DETAIL, "Tag %s not found.", name);
+        return CIP_ERR_PATH_SEGMENT;
+    }
+
+    if(*elem_index >= (*tag)->elem_count) {
+        return CIP_ERR_OUT_OF_BOUNDS;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* request: path, element count and, when fragmented, a byte offset. */
+int handle_read(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    cip_server_tag_p tag = NULL;
+    int is_frag = (req[0] == AB_EIP_CMD_CIP_READ_FRAG);
+    uint8_t *args = req + 2 + 2 * req[1];
+    int header_len = 0;
+    int elem_index = 0;
+    int elem_count = 0;
+    int offset = 0;
+    int total = 0;
+    int amount = 0;
+    int status = 0;
+
+    if((status = parse_tag_path(server, req, &tag, &elem_index)) != PLCTAG_STATUS_OK) {
+        return error_reply(req, out, out_capacity, status);
+    }
+
+    if((int)(args - req) + (is_frag ? 6 : 2) > req_len) {
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    elem_count = GET_U16(args);
+
+    if(is_frag) {
+        offset = (int)GET_U32(args + 2);
+    }
+
+    total = elem_count * tag->elem_size;
+
+    if(elem_count < 1 || elem_index + elem_count > tag->elem_count || offset < 0 || offset >= total) {
+        return error_reply(req, out, out_capacity, CIP_ERR_OUT_OF_BOUNDS);
+    }
+
+    header_len = 4 + (tag->type == CIP_TYPE_STRUCT ? 4 : 2);
+    amount = total - offset;
+
+    /* send what fits, the client asks for the rest with a fragmented read. */
+    if(header_len + amount > out_capacity) {
+        amount = (out_capacity - header_len) & ~3;
+        status = AB_CIP_STATUS_FRAG;
+
+        if(amount <= 0) {
+            return error_reply(req, out, out_capacity, CIP_ERR_REPLY_TOO_LARGE);
+        }
+    }
+
+    out[0] = (uint8_t)(req[0] | AB_EIP_CMD_CIP_OK);
+    out[1] = 0;
+    out[2] = (uint8_t)status;
+    out[3] = 0;
+    out[4] = (uint8_t)(tag->type & 0xFF);
+    out[5] = (uint8_t)((tag->type >> 8) & 0xFF);
+
+    if(tag->type == CIP_TYPE_STRUCT) {
+        out[6] = (uint8_t)(tag->handle & 0xFF);
+        out[7] = (uint8_t)((tag->handle >> 8) & 0xFF);
+    }
+
+    mem_copy(out + header_len, tag->data + (elem_index * tag->elem_size) + offset, amount);
+
+    return header_len + amount;
+}
+
+
+/* request: path, type, element count, a byte offset when fragmented, then the data. */
+int handle_write(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    cip_server_tag_p tag = NULL;
+    int is_frag = (req[0] == AB_EIP_CMD_CIP_WRITE_FRAG);
+    int pos = 2 + 2 * req[1];
+    uint16_t type = 0;
+    uint16_t handle = 0;
+    int elem_index = 0;
+    int elem_count = 0;
+    int offset = 0;
+    int total = 0;
+    int data_len = 0;
+    int start = 0;
+    int status = 0;
+
+    if((status = parse_tag_path(server, req, &tag, &elem_index)) != PLCTAG_STATUS_OK) {
+        return error_reply(req, out, out_capacity, status);
+    }
+
+    if(pos + 2 > req_len) {
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    type = GET_U16(req + pos);
+    pos += 2;
+
+    if(type == CIP_TYPE_STRUCT) {
+        if(pos + 2 > req_len) {
+            return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+        }
+
+        handle = GET_U16(req + pos);
+        pos += 2;
+    }
+
+    if(pos + (is_frag ? 6 : 2) > req_len) {
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    elem_count = GET_U16(req + pos);
+    pos += 2;
+
+    if(is_frag) {
+        offset = (int)GET_U32(req + pos);
+        pos += 4;
+    }
+
+    if(type != tag->type || handle != tag->handle) {
+        pdebug(DEBUG_DETAIL, "Write to %s with the wrong type %x.", tag->name, type);
+        return error_reply(req, out, out_capacity, CIP_ERR_BAD_TYPE);
+    }
+
+    total = elem_count * tag->elem_size;
+    data_len = req_len - pos;
+
+    if(elem_count < 1 || elem_index + elem_count > tag->elem_count || offset < 0 || offset > total) {
+        return error_reply(req, out, out_capacity, CIP_ERR_OUT_OF_BOUNDS);
+    }
+
+    if(offset + data_len > total) {
+        return error_reply(req, out, out_capacity, CIP_ERR_TOO_MUCH_DATA);
+    }
+
+    if(!is_frag && data_len < total) {
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    start = (elem_index * tag->elem_size) + offset;
+
+    mem_copy(tag->data + start, req + pos, data_len);
+    add_write_notice(server, tag, start, data_len);
+
+    return error_reply(req, out, out_capacity, AB_CIP_STATUS_OK);
+}
+
+
+/* request: path, mask size, OR mask then AND mask.  The element becomes (old | OR) & AND. */
+int handle_rmw(cip_server_p server, uint8_t *req, int req_len, uint8_t *out, int out_capacity)
+{
+    cip_server_tag_p tag = NULL;
+    int pos = 2 + 2 * req[1];
+    int elem_index = 0;
+    int mask_size = 0;
+    int start = 0;
+    int status = 0;
+    int i;
+
+    if((status = parse_tag_path(server, req, &tag, &elem_index)) != PLCTAG_STATUS_OK) {
+        return error_reply(req, out, out_capacity, status);
+    }
+
+    if(pos + 2 > req_len) {
+        return error_reply(req, out, out_capacity, CIP_ERR_NOT_ENOUGH_DATA);
+    }
+
+    mask_size = GET_U16(req + pos);
+    pos += 2;
+
+    if(pos + 2 * mask_size != req_len) {
+        return error_reply(req, out, out_capacity, (pos + 2 * mask_size > req_len ? CIP_ERR_NOT_ENOUGH_DATA : CIP_ERR_TOO_MUCH_DATA));
+    }
+
+    start = elem_index * tag->elem_size;
+
+    if(mask_size < 1 || start + mask_size > tag->size) {
+        return error_reply(req, out, out_capacity, CIP_ERR_OUT_OF_BOUNDS);
+    }
+
+    for(i = 0; i < mask_size; i++) {
+        tag->data[start + i] = (uint8_t)((tag->data[start + i] | req[pos + i]) & req[pos + mask_size + i]);
+    }
+
+    add_write_notice(server, tag, start, mask_size);
+
+    return error_reply(req, out, out_capacity, AB_CIP_STATUS_OK);
+}
+
+
+int add_write_notice(cip_server_p server, cip_server_tag_p tag, int offset, int length)
+{
+    if(server->num_notices == server->notice_capacity) {
+        int new_capacity = (server->notice_capacity ? server->notice_capacity * 2 : 16);
+        struct cip_write_notice_t *new_notices = (struct cip_write_notice_t *)mem_realloc(server->notices, new_capacity * (int)sizeof(struct cip_write_notice_t));
+
+        if(!new_notices) {
+            pdebug(DEBUG_ERROR, "Unable to record a write for the callback!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        server->notices = new_notices;
+        server->notice_capacity = new_capacity;
+    }
+
+    server->notices[server->num_notices].tag = tag;
+    server->notices[server->num_notices].offset = offset;
+    server->notices[server->num_notices].length = length;
+    server->num_notices++;
+
+    return PLCTAG_STATUS_OK;
+}
@@ -0,0 +1,51 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <lib/libplctag.h>
+
+/*
+ * The CIP server serves in-process memory as Logix-style tags to any
+ * EtherNet/IP client.  These are definitions used outside of the server.
+ */
+
+extern int cip_server_init(void);
+extern void cip_server_teardown(void);
+
+extern int32_t cip_server_create(const char *attrib_str);
+extern int cip_server_add_tag(int32_t server_id, const char *name, int cip_type, int elem_size, int elem_count, void *data);
+extern int cip_server_register_callback(int32_t server_id, void (*write_callback)(int32_t server_id, const char *name, int offset, int length));
+extern int cip_server_lock(int32_t server_id);
+extern int cip_server_unlock(int32_t server_id);
+extern int cip_server_destroy(int32_t server_id);
@@ -132,6 +132,8 @@ static int build_read_request_connected(ab_tag_p tag, int byte_offset);
 static int build_tag_list_request_connected(ab_tag_p tag);
 static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_request_connected(ab_tag_p tag, int byte_offset);
+static void start_delta_write(ab_tag_p tag);
+static void next_delta_range(ab_tag_p tag);
 static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_bit_request_connected(ab_tag_p tag);
 static int build_write_bit_request_unconnected(ab_tag_p tag);
@@ -362,6 +364,11 @@ int tag_write_start(ab_tag_p tag)
         return tag_read_start(tag);
     }
 
+    /* only send the changed ranges if asked to. */
+    if(tag->delta_write && !tag->is_bit && !tag->delta_write_active && tag->offset == 0) {
+        start_delta_write(tag);
+    }
+
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to calculate write sizes!");
         tag->write_in_progress = 0;
@@ -389,6 +396,67 @@ int tag_write_start(ab_tag_p tag)
 
 
 
+/*
+ * start_delta_write
+ *
+ * Take the ranges the setters changed.  They are widened to 32-bit
+ * boundaries, the same alignment the PLC uses for fragments when it
+ * answers a read.  With nothing changed, the whole tag is written.
+ */
+void start_delta_write(ab_tag_p tag)
+{
+    int num_ranges = 0;
+
+    for(int i=0; i < tag->num_dirty_ranges; i++) {
+        int start = tag->dirty_range_start[i] & ~3;
+        int end = (tag->dirty_range_end[i] + 3) & ~3;
+
+        if(end > tag->size) {
+            end = tag->size;
+        }
+
+        /* widening can make neighbours meet. */
+        if(num_ranges > 0 && start <= tag->delta_range_end[num_ranges - 1]) {
+            tag->delta_range_end[num_ranges - 1] = end;
+        } else {
+            tag->delta_range_start[num_ranges] = start;
+            tag->delta_range_end[num_ranges] = end;
+            num_ranges++;
+        }
+    }
+
+    if(num_ranges == 0) {
+        pdebug(DEBUG_DETAIL, "No changed ranges, writing the whole tag.");
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Writing %d changed ranges.", num_ranges);
+
+    tag->num_delta_ranges = num_ranges;
+    tag->delta_range_index = 0;
+    tag->delta_write_active = 1;
+    tag->offset = tag->delta_range_start[0];
+}
+
+
+/* move on to the next range once this one is sent.  The end of the tag means done. */
+void next_delta_range(ab_tag_p tag)
+{
+    if(tag->offset < tag->delta_range_end[tag->delta_range_index]) {
+        return;
+    }
+
+    tag->delta_range_index++;
+
+    if(tag->delta_range_index < tag->num_delta_ranges) {
+        tag->offset = tag->delta_range_start[tag->delta_range_index];
+    } else {
+        tag->offset = tag->size;
+    }
+}
+
+
+
 int build_read_request_connected(ab_tag_p tag, int byte_offset)
 {
     eip_cip_co_req* cip = NULL;
@@ -469,6 +537,7 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     //req->session = tag->session;
 
     req->allow_packing = tag->allow_packing;
+    req->elem_size = tag->elem_size;
 
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
@@ -497,6 +566,8 @@ int build_tag_list_request_connected(ab_tag_p tag)
     uint8_t *data_start = NULL;
     uint8_t *data = NULL;
     uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+    int need_32_bit_id = (tag->next_id > (uint32_t)0xFFFF);
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -535,7 +606,7 @@ int build_tag_list_request_connected(ab_tag_p tag)
     data++;
 
     /* request path size, in 16-bit words */
-    *data = (uint8_t)(3 + ((tag->encoded_name_size-1)/2)); /* size in words of routing header + routing and instance ID. */
+    *data = (uint8_t)((need_32_bit_id ? 4 : 3) + ((tag->encoded_name_size-1)/2)); /* size in words of routing header + routing and instance ID. */
     data++;
 
     /* add in the encoded name, but without the leading word count byte! */
@@ -549,14 +620,20 @@ int build_tag_list_request_connected(ab_tag_p tag)
     /* first the fixed part. */
     data[0] = 0x20; /* class type */
     data[1] = 0x6B; /* tag info/symbol class */
-    data[2] = 0x25; /* 16-bit instance ID type */
+    data[2] = (need_32_bit_id ? 0x26 : 0x25); /* 32 or 16-bit instance ID type */
     data[3] = 0x00; /* padding */
     data += 4;
 
-    /* now the instance ID */
-    tmp_u16 = h2le16((uint16_t)tag->next_id);
-    mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
-    data += (int)sizeof(tmp_u16);
+    /* now the instance ID, large tag directories go past 16 bits. */
+    if(need_32_bit_id) {
+        tmp_u32 = h2le32(tag->next_id);
+        mem_copy(data, &tmp_u32, (int)sizeof(tmp_u32));
+        data += (int)sizeof(tmp_u32);
+    } else {
+        tmp_u16 = h2le16((uint16_t)tag->next_id);
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+    }
 
     /* set up the request itself.  We are asking for a number of attributes. */
 
@@ -1130,7 +1207,8 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* delta writes need the byte offset of the fragmented write. */
+    if(tag->write_data_per_packet < tag->size || tag->delta_write_active) {
         multiple_requests = 1;
     }
 
@@ -1189,7 +1267,7 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = (tag->delta_write_active ? tag->delta_range_end[tag->delta_range_index] : tag->size) - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
@@ -1200,6 +1278,10 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     data += write_size;
     tag->offset += write_size;
 
+    if(tag->delta_write_active) {
+        next_delta_range(tag);
+    }
+
     /* need to pad data to multiple of 16-bits */
     if (write_size & 0x01) {
         *data = 0;
@@ -1277,7 +1359,8 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* delta writes need the byte offset of the fragmented write. */
+    if(tag->write_data_per_packet < tag->size || tag->delta_write_active) {
         multiple_requests = 1;
     }
 
@@ -1338,7 +1421,7 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = (tag->delta_write_active ? tag->delta_range_end[tag->delta_range_index] : tag->size) - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
@@ -1349,6 +1432,10 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     data += write_size;
     tag->offset += write_size;
 
+    if(tag->delta_write_active) {
+        next_delta_range(tag);
+    }
+
     /* need to pad data to multiple of 16-bits */
     if (write_size & 0x01) {
         *data = 0;
@@ -1829,7 +1916,7 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
                 tag_list_entry *current_entry = (tag_list_entry*)current_entry_data;
 
                 /* first element is the symbol instance ID */
-                tag->next_id = (uint16_t)(le2h32(current_entry->instance_id) + 1);
+                tag->next_id = le2h32(current_entry->instance_id) + 1;
 
                 pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
 
@@ -2155,6 +2242,7 @@ static int check_write_status_connected(ab_tag_p tag)
     if (!tag->req) {
         tag->write_in_progress = 0;
         tag->offset = 0;
+        tag->delta_write_active = 0;
 
         pdebug(DEBUG_WARN,"Write in progress, but no request in flight!");
 
@@ -2177,6 +2265,7 @@ static int check_write_status_connected(ab_tag_p tag)
 
             tag->write_in_progress = 0;
             tag->offset = 0;
+            tag->delta_write_active = 0;
 
             break;
         }
@@ -2240,11 +2329,13 @@ static int check_write_status_connected(ab_tag_p tag)
         } else {
             /* only clear this if we are done. */
             tag->offset = 0;
+            tag->delta_write_active = 0;
         }
     } else {
         pdebug(DEBUG_WARN,"Write failed!");
 
         tag->offset = 0;
+        tag->delta_write_active = 0;
     }
 
     pdebug(DEBUG_SPEW, "Done.");
@@ -2271,6 +2362,7 @@ static int check_write_status_unconnected(ab_tag_p tag)
     if (!tag->req) {
         tag->write_in_progress = 0;
         tag->offset = 0;
+        tag->delta_write_active = 0;
 
         pdebug(DEBUG_WARN,"Write in progress, but no request in flight!");
 
@@ -2293,6 +2385,7 @@ static int check_write_status_unconnected(ab_tag_p tag)
 
             tag->write_in_progress = 0;
             tag->offset = 0;
+            tag->delta_write_active = 0;
 
             break;
         }
@@ -2313,7 +2406,7 @@ static int check_write_status_unconnected(ab_tag_p tag)
     cip_resp = (eip_cip_uc_resp*)(tag->req->data);
 
     do {
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        if (le2h16(cip_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
             pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
             rc = PLCTAG_ERR_BAD_DATA;
             break;
@@ -2357,10 +2450,12 @@ static int check_write_status_unconnected(ab_tag_p tag)
         } else {
             /* only clear this if we are done. */
             tag->offset = 0;
+            tag->delta_write_active = 0;
         }
     } else {
         pdebug(DEBUG_WARN,"Write failed!");
         tag->offset = 0;
+        tag->delta_write_active = 0;
     }
 
     pdebug(DEBUG_SPEW, "Done.");
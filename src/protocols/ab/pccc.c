@@ -510,7 +510,8 @@ const char *pccc_decode_error(uint8_t *error_ptr)
 
 
 /*
- * FIXME This does not check for data overruns!
+ * Returns a pointer past the type/size header or NULL if the header is
+ * malformed or does not fit in data_size bytes.
  */
 
 uint8_t *pccc_decode_dt_byte(uint8_t *data,int data_size, int *pccc_res_type, int *pccc_res_length)
@@ -544,10 +545,12 @@ uint8_t *pccc_decode_dt_byte(uint8_t *data,int data_size, int *pccc_res_type, in
     if(d_type & 0x08) {
         int size_bytes = d_type & 0x07;
 
-        if(size_bytes > 4) {
+        /* the DT byte and the extra bytes must fit in the data. */
+        if(size_bytes > 4 || size_bytes >= data_size) {
             return NULL;
         }
 
+        data_size -= size_bytes;
         d_type = 0;
 
         while(size_bytes--) {
@@ -561,10 +564,11 @@ uint8_t *pccc_decode_dt_byte(uint8_t *data,int data_size, int *pccc_res_type, in
     if(d_size & 0x08) {
         int size_bytes = d_size & 0x07;
 
-        if(size_bytes > 4) {
+        if(size_bytes > 4 || size_bytes >= data_size) {
             return NULL;
         }
 
+        data_size -= size_bytes;
         d_size = 0;
 
         while(size_bytes--) {
@@ -45,6 +45,18 @@
 
 #define MAX_REQUESTS (200)
 
+/*
+ * Reads of elements of the same array are merged into one read.  A group
+ * is merged only if the elements it spans are at most twice those asked
+ * for plus this slack, so scattered indexes do not become huge reads.
+ * Bit writes to the same word are merged into one read-modify-write.
+ */
+#define MAX_MERGED_REQUESTS (32)
+#define MERGE_SPAN_SLACK (8)
+
+/* multi-service offset, reply header and type bytes around a merged read's data. */
+#define MERGED_READ_REPLY_OVERHEAD ((int)sizeof(cip_multi_resp_header) + 2 + 4 + 4)
+
 #define EIP_CIP_PREFIX_SIZE (44) /* bytes of encap header and CFP connected header */
 
 /* WARNING: this must fit within 9 bits! */
@@ -87,11 +99,36 @@ static int purge_aborted_requests_unsafe(ab_session_p session);
 static int process_requests(ab_session_p session);
 //static int check_packing(ab_session_p session, ab_request_p request);
 static int get_payload_size(ab_request_p request);
+
+/* one entry per bundled request for the element read planner. */
+struct merge_plan_t {
+    int16_t group;          /* merged read this request is part of, -1 if none */
+    uint16_t base_len;      /* path bytes before the element index, 0 if the request cannot be merged */
+    uint32_t elem_index;
+    uint16_t elem_count;
+};
+
+struct merged_request_t {
+    ab_request_p req;
+    int is_rmw;             /* merged bit writes rather than a merged read */
+    uint32_t first_index;
+    uint32_t span;
+};
+
+static int get_request_tag_name(ab_request_p request, uint8_t **name);
+static int request_touches_tag(ab_request_p request, uint8_t *name, int name_len, int writes_only);
+static int parse_element_read(ab_request_p request, struct merge_plan_t *plan);
+static int plan_merged_reads(ab_session_p session, ab_request_p *requests, struct merge_plan_t *plan, int num_requests, struct merged_request_t *merged);
+static int build_merged_read(ab_session_p session, ab_request_p first, struct merge_plan_t *first_plan, struct merged_request_t *merged);
+static void split_merged_read(ab_session_p session, struct merged_request_t *merged, int group, ab_request_p *requests, struct merge_plan_t *plan, int num_requests);
+static int parse_rmw_request(ab_request_p request);
+static int plan_merged_rmw(ab_session_p session, ab_request_p *requests, struct merge_plan_t *plan, int num_requests, struct merged_request_t *merged, int num_merged);
+static void split_merged_rmw(struct merged_request_t *merged, int group, ab_request_p *requests, struct merge_plan_t *plan, int num_requests);
+static int requeue_request_unsafe(ab_session_p session, ab_request_p request);
 static int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests);
 static int prepare_request(ab_session_p session);
 static int send_eip_request(ab_session_p session, int timeout);
 static int recv_eip_response(ab_session_p session, int timeout);
-static int unpack_response(ab_session_p session, ab_request_p request, int sub_packet);
 // static int perform_forward_open(ab_session_p session);
 static int perform_forward_close(ab_session_p session);
 // static int try_forward_open_ex(ab_session_p session, int *max_payload_size_guess);
@@ -226,6 +263,7 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     int rc = PLCTAG_STATUS_OK;
     int auto_disconnect_enabled = 0;
     int auto_disconnect_timeout_ms = INT_MAX;
+    const char *capture_file = attr_get_str(attribs, "capture_file", NULL);
 
     pdebug(DEBUG_DETAIL, "Starting");
 
@@ -261,6 +299,15 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
                 session->auto_disconnect_enabled = auto_disconnect_enabled;
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
 
+                /* this must be set up before the session thread starts talking to the PLC. */
+                if(capture_file && str_length(capture_file) > 0) {
+                    session->capture = capture_open(capture_file);
+                    if(!session->capture) {
+                        pdebug(DEBUG_WARN, "Unable to open capture file %s!", capture_file);
+                        rc = PLCTAG_ERR_OPEN;
+                    }
+                }
+
                 new_session = 1;
             }
         } else {
@@ -274,6 +321,10 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
             }
 
+            if(capture_file && !session->capture) {
+                pdebug(DEBUG_WARN, "Existing session is not being captured, capture_file is ignored.  Use share_session=0 to capture this tag's traffic.");
+            }
+
             pdebug(DEBUG_DETAIL, "Reusing existing session.");
         }
     }
@@ -284,7 +335,10 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
      */
 
     if(new_session) {
-        rc = session_init(session);
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = session_init(session);
+        }
+
         if(rc != PLCTAG_STATUS_OK) {
             rc_dec(session);
             session = AB_SESSION_NULL;
@@ -648,6 +702,8 @@ int session_open_socket(ab_session_p session)
         mem_free(server_port);
     }
 
+    capture_record(session->capture, CAPTURE_RECORD_CONNECT, (uint8_t *)session->host, str_length(session->host));
+
     pdebug(DEBUG_INFO, "Done.");
 
     return rc;
@@ -841,6 +897,11 @@ void session_destroy(void *session_arg)
         session->mutex = NULL;
     }
 
+    if(session->capture) {
+        capture_close(session->capture);
+        session->capture = NULL;
+    }
+
     pdebug(DEBUG_DETAIL, "Cleaning up allocated memory for paths and host name.");
     if(session->conn_path) {
         mem_free(session->conn_path);
@@ -1277,6 +1338,11 @@ int process_requests(ab_session_p session)
     ab_request_p request = NULL;
     ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
     int num_bundled_requests = 0;
+    ab_request_p send_requests[MAX_REQUESTS] = {NULL};
+    int num_send_requests = 0;
+    struct merge_plan_t plan[MAX_REQUESTS];
+    struct merged_request_t merged[MAX_MERGED_REQUESTS];
+    int num_merged = 0;
     int remaining_space = 0;
 
     debug_set_tag_id(0);
@@ -1340,9 +1406,33 @@ int process_requests(ab_session_p session)
 
         pdebug(DEBUG_INFO, "%d requests to process.", num_bundled_requests);
 
+        /* reads of neighbouring elements of one array become one read. */
+        num_merged = plan_merged_reads(session, bundled_requests, plan, num_bundled_requests, merged);
+
+        /* so do bit writes to the same word. */
+        num_merged = plan_merged_rmw(session, bundled_requests, plan, num_bundled_requests, merged, num_merged);
+
+        /* a merged read goes out in the place of its first member. */
+        for(int i=0; i < num_bundled_requests; i++) {
+            int first_member = 1;
+
+            for(int j=0; j < i && plan[i].group >= 0; j++) {
+                if(plan[j].group == plan[i].group) {
+                    first_member = 0;
+                    break;
+                }
+            }
+
+            if(plan[i].group < 0) {
+                send_requests[num_send_requests++] = bundled_requests[i];
+            } else if(first_member) {
+                send_requests[num_send_requests++] = merged[plan[i].group].req;
+            }
+        }
+
         do {
             /* copy and pack the requests into the session buffer. */
-            rc = pack_requests(session, bundled_requests, num_bundled_requests);
+            rc = pack_requests(session, send_requests, num_send_requests);
             if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
                 break;
@@ -1371,7 +1461,7 @@ int process_requests(ab_session_p session)
              * response.   If it is a singleton, then we pass the
              * status back to the tag.
              */
-            if(num_bundled_requests > 1) {
+            if(num_send_requests > 1) {
                 if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
                     eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
                     pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
@@ -1396,22 +1486,41 @@ int process_requests(ab_session_p session)
             }
 
             /* copy the results back out. Every request gets a copy. */
-            for(int i=0; i < num_bundled_requests; i++) {
-                debug_set_tag_id(bundled_requests[i]->tag_id);
+            for(int i=0; i < num_send_requests; i++) {
+                debug_set_tag_id(send_requests[i]->tag_id);
 
-                rc = unpack_response(session, bundled_requests[i], i);
+                rc = session_unpack_response(session, send_requests[i], i);
                 if(rc != PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_WARN, "Unable to unpack response!");
                     break;
                 }
+            }
+
+            if(rc != PLCTAG_STATUS_OK) {
+                break;
+            }
 
-                /* release our reference */
-                bundled_requests[i] = rc_dec(bundled_requests[i]);
+            /* hand each member of a merged request its part of the response. */
+            for(int g=0; g < num_merged; g++) {
+                if(merged[g].is_rmw) {
+                    split_merged_rmw(&merged[g], g, bundled_requests, plan, num_bundled_requests);
+                } else {
+                    split_merged_read(session, &merged[g], g, bundled_requests, plan, num_bundled_requests);
+                }
             }
 
-            rc = PLCTAG_STATUS_OK;
+            /* release our references */
+            for(int i=0; i < num_bundled_requests; i++) {
+                if(bundled_requests[i]) {
+                    bundled_requests[i] = rc_dec(bundled_requests[i]);
+                }
+            }
         } while(0);
 
+        for(int g=0; g < num_merged; g++) {
+            merged[g].req = rc_dec(merged[g].req);
+        }
+
         /* problem? clean up the pending requests and dump everything. */
         if(rc != PLCTAG_STATUS_OK) {
             for(int i=0; i < num_bundled_requests; i++) {
@@ -1433,7 +1542,7 @@ int process_requests(ab_session_p session)
 }
 
 
-int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
+int session_unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_co_resp *packed_resp = (eip_cip_co_resp *)(session->data);
@@ -1585,6 +1694,566 @@ int get_payload_size(ab_request_p request)
 
 
 
+/*
+ * get_request_tag_name
+ *
+ * Point at the path of a connected CIP request and return the number of
+ * path bytes before the first element index.  Those bytes name the tag
+ * the request touches.  Returns -1 if the request is not a connected CIP
+ * request.
+ */
+int get_request_tag_name(ab_request_p request, uint8_t **name)
+{
+    eip_cip_co_req *co_req = (eip_cip_co_req *)(request->data);
+    uint8_t *path = request->data + sizeof(eip_cip_co_req) + 2;
+    int path_len = 0;
+    int pos = 0;
+
+    if(request->request_size < (int)sizeof(eip_cip_co_req) + 2 || le2h16(co_req->encap_command) != AB_EIP_CONNECTED_SEND) {
+        return -1;
+    }
+
+    path_len = path[-1] * 2;
+
+    if(request->request_size < (int)sizeof(eip_cip_co_req) + 2 + path_len) {
+        return -1;
+    }
+
+    /* symbolic segments, padded to an even length. */
+    while(pos < path_len && path[pos] == 0x91) {
+        pos += 2 + path[pos + 1] + (path[pos + 1] & 0x01);
+    }
+
+    *name = path;
+
+    return (pos < path_len ? pos : path_len);
+}
+
+
+/*
+ * request_touches_tag
+ *
+ * Returns non-zero if the request reads or writes the tag named by the
+ * path bytes.  Elements are not told apart, any index of the tag counts.
+ * With writes_only set, only writes and read-modify-writes count.  A
+ * request that cannot be parsed counts, so nothing is moved past it.
+ */
+int request_touches_tag(ab_request_p request, uint8_t *name, int name_len, int writes_only)
+{
+    uint8_t *other = NULL;
+    int other_len = get_request_tag_name(request, &other);
+    uint8_t service = 0;
+
+    if(other_len < 0) {
+        return 1;
+    }
+
+    service = other[-2];
+
+    if(writes_only && service != AB_EIP_CMD_CIP_WRITE && service != AB_EIP_CMD_CIP_WRITE_FRAG && service != AB_EIP_CMD_CIP_RMW) {
+        return 0;
+    }
+
+    return (other_len == name_len && mem_cmp(name, name_len, other, other_len) == 0);
+}
+
+
+/*
+ * parse_element_read
+ *
+ * Check for a connected fragmented read, at byte offset zero, whose path
+ * ends with an element index.  Fill in the plan with the length of the
+ * path before the index, the index and the element count.  Returns
+ * non-zero if the request can be merged.
+ */
+int parse_element_read(ab_request_p request, struct merge_plan_t *plan)
+{
+    eip_cip_co_req *co_req = (eip_cip_co_req *)(request->data);
+    uint8_t *cip = request->data + sizeof(eip_cip_co_req);
+    uint8_t *path = cip + 2;
+    int cip_len = 0;
+    int path_len = 0;
+    int index_pos = -1;
+    uint32_t elem_index = 0;
+    int pos = 0;
+
+    plan->group = -1;
+    plan->base_len = 0;
+
+    if(request->merge_failed || request->request_size < (int)sizeof(eip_cip_co_req) + 2 || le2h16(co_req->encap_command) != AB_EIP_CONNECTED_SEND) {
+        return 0;
+    }
+
+    cip_len = (int)le2h16(co_req->cpf_cdi_item_length) - (int)sizeof(co_req->cpf_conn_seq_num);
+    path_len = cip[1] * 2;
+
+    /* service, path, element count and byte offset. */
+    if(cip[0] != AB_EIP_CMD_CIP_READ_FRAG || cip_len != 2 + path_len + 2 + 4) {
+        return 0;
+    }
+
+    if(path[path_len + 2] || path[path_len + 3] || path[path_len + 4] || path[path_len + 5]) {
+        return 0;
+    }
+
+    while(pos < path_len) {
+        int seg_len = 0;
+
+        switch(path[pos]) {
+            case 0x91: /* symbolic segment, padded to an even length. */
+                seg_len = 2 + path[pos + 1] + (path[pos + 1] & 0x01);
+                index_pos = -1;
+                break;
+
+            case 0x28: /* 8-bit element index */
+                seg_len = 2;
+                index_pos = pos;
+                elem_index = path[pos + 1];
+                break;
+
+            case 0x29: /* 16-bit element index */
+                seg_len = 4;
+                index_pos = pos;
+                elem_index = (uint32_t)path[pos + 2] | ((uint32_t)path[pos + 3] << 8);
+                break;
+
+            case 0x2A: /* 32-bit element index */
+                seg_len = 6;
+                index_pos = pos;
+                elem_index = (uint32_t)path[pos + 2] | ((uint32_t)path[pos + 3] << 8) | ((uint32_t)path[pos + 4] << 16) | ((uint32_t)path[pos + 5] << 24);
+                break;
+
+            default:
+                return 0;
+        }
+
+        pos += seg_len;
+    }
+
+    if(pos != path_len || index_pos <= 0) {
+        return 0;
+    }
+
+    plan->base_len = (uint16_t)index_pos;
+    plan->elem_index = elem_index;
+    plan->elem_count = (uint16_t)(path[path_len] | (path[path_len + 1] << 8));
+
+    return (plan->elem_count > 0);
+}
+
+
+/*
+ * plan_merged_reads
+ *
+ * Users often make one tag per array element.  Each would be a separate
+ * read and a separate symbol lookup in the PLC.  Find the reads of
+ * elements of the same array and build one read per array that covers
+ * all of them.  The merged read goes out in the place of its first
+ * member, so a group ends at any write to the same tag and a later read
+ * still sees that write.  The span is limited to what fits in one reply.
+ * Returns the number of merged reads.
+ */
+int plan_merged_reads(ab_session_p session, ab_request_p *requests, struct merge_plan_t *plan, int num_requests, struct merged_request_t *merged)
+{
+    int num_merged = 0;
+
+    for(int i=0; i < num_requests; i++) {
+        parse_element_read(requests[i], &plan[i]);
+    }
+
+    for(int i=0; i < num_requests && num_merged < MAX_MERGED_REQUESTS; i++) {
+        uint8_t *base = requests[i]->data + sizeof(eip_cip_co_req) + 2;
+        uint8_t *name = NULL;
+        int name_len = 0;
+        uint32_t first_index = plan[i].elem_index;
+        uint32_t end_index = plan[i].elem_index + plan[i].elem_count;
+        uint32_t total_count = plan[i].elem_count;
+        int elem_size = requests[i]->elem_size;
+        int allow_packing = requests[i]->allow_packing;
+        int num_members = 1;
+        int end = i + 1;
+
+        if(plan[i].base_len == 0 || plan[i].group >= 0 || elem_size <= 0) {
+            continue;
+        }
+
+        name_len = get_request_tag_name(requests[i], &name);
+
+        for(end = i + 1; end < num_requests; end++) {
+            if(plan[end].group < 0 && plan[end].base_len == plan[i].base_len && requests[end]->elem_size == elem_size
+               && mem_cmp(base, plan[i].base_len, requests[end]->data + sizeof(eip_cip_co_req) + 2, plan[end].base_len) == 0) {
+                first_index = (plan[end].elem_index < first_index ? plan[end].elem_index : first_index);
+                end_index = (plan[end].elem_index + plan[end].elem_count > end_index ? plan[end].elem_index + plan[end].elem_count : end_index);
+                total_count += plan[end].elem_count;
+                allow_packing = allow_packing && requests[end]->allow_packing;
+                num_members++;
+            } else if(request_touches_tag(requests[end], name, name_len, 1)) {
+                break;
+            }
+        }
+
+        if(num_members < 2 || end_index - first_index > 0xFFFF || end_index - first_index > (2 * total_count) + MERGE_SPAN_SLACK) {
+            continue;
+        }
+
+        /* the PLC would answer a larger read in fragments. */
+        if((int64_t)(end_index - first_index) * elem_size > session->max_payload_size - MERGED_READ_REPLY_OVERHEAD) {
+            continue;
+        }
+
+        merged[num_merged].first_index = first_index;
+        merged[num_merged].span = end_index - first_index;
+
+        if(build_merged_read(session, requests[i], &plan[i], &merged[num_merged]) != PLCTAG_STATUS_OK) {
+            continue;
+        }
+
+        merged[num_merged].req->allow_packing = allow_packing;
+
+        pdebug(DEBUG_DETAIL, "Merged %d element reads into one read of %u elements.", num_members, merged[num_merged].span);
+
+        plan[i].group = (int16_t)num_merged;
+
+        for(int j=i+1; j < end; j++) {
+            if(plan[j].group < 0 && plan[j].base_len == plan[i].base_len && requests[j]->elem_size == elem_size
+               && mem_cmp(base, plan[i].base_len, requests[j]->data + sizeof(eip_cip_co_req) + 2, plan[j].base_len) == 0) {
+                plan[j].group = (int16_t)num_merged;
+            }
+        }
+
+        num_merged++;
+    }
+
+    return num_merged;
+}
+
+
+/* a read of the whole span, built from the first member's request. */
+int build_merged_read(ab_session_p session, ab_request_p first, struct merge_plan_t *first_plan, struct merged_request_t *merged)
+{
+    eip_cip_co_req *cip = NULL;
+    uint8_t *data = NULL;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = session_create_request(session, first->tag_id, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create merged read request!");
+        return rc;
+    }
+
+    /* the encapsulation and CPF headers are the same. */
+    mem_copy(req->data, first->data, (int)sizeof(eip_cip_co_req));
+
+    cip = (eip_cip_co_req *)(req->data);
+    data = req->data + sizeof(eip_cip_co_req);
+
+    *data = AB_EIP_CMD_CIP_READ_FRAG;
+    data += 2; /* fill in the path size below. */
+
+    mem_copy(data, first->data + sizeof(eip_cip_co_req) + 2, first_plan->base_len);
+    data += first_plan->base_len;
+
+    /* the index of the first element. */
+    if(merged->first_index <= 0xFF) {
+        *data++ = 0x28;
+        *data++ = (uint8_t)(merged->first_index);
+    } else if(merged->first_index <= 0xFFFF) {
+        *data++ = 0x29;
+        *data++ = 0;
+        *data++ = (uint8_t)(merged->first_index & 0xFF);
+        *data++ = (uint8_t)((merged->first_index >> 8) & 0xFF);
+    } else {
+        *data++ = 0x2A;
+        *data++ = 0;
+        *data++ = (uint8_t)(merged->first_index & 0xFF);
+        *data++ = (uint8_t)((merged->first_index >> 8) & 0xFF);
+        *data++ = (uint8_t)((merged->first_index >> 16) & 0xFF);
+        *data++ = (uint8_t)((merged->first_index >> 24) & 0xFF);
+    }
+
+    req->data[sizeof(eip_cip_co_req) + 1] = (uint8_t)((data - (req->data + sizeof(eip_cip_co_req) + 2)) / 2);
+
+    /* element count and a zero byte offset. */
+    *((uint16_le *)data) = h2le16((uint16_t)merged->span);
+    data += sizeof(uint16_le);
+
+    *((uint32_le *)data) = h2le32(0);
+    data += sizeof(uint32_le);
+
+    cip->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&cip->cpf_conn_seq_num)));
+
+    req->request_size = (int)(data - req->data);
+
+    merged->req = req;
+    merged->is_rmw = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * split_merged_read
+ *
+ * Copy each member's elements out of the merged response into a response
+ * of its own, as if it had been read alone.  If the merged read failed or
+ * did not fit in one response, put the members back at the front of the
+ * queue to be read one by one.  That also gets each tag its own error.
+ */
+void split_merged_read(ab_session_p session, struct merged_request_t *merged, int group, ab_request_p *requests, struct merge_plan_t *plan, int num_requests)
+{
+    eip_cip_co_resp *resp = (eip_cip_co_resp *)(merged->req->data);
+    uint8_t *data = merged->req->data + sizeof(eip_cip_co_resp);
+    uint8_t *data_end = merged->req->data + merged->req->request_size;
+    int type_len = 0;
+    int elem_size = 0;
+    int ok = 0;
+
+    if(merged->req->request_size > (int)sizeof(eip_cip_co_resp)
+       && le2h16(resp->encap_command) == AB_EIP_CONNECTED_SEND
+       && resp->reply_service == (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)
+       && resp->status == AB_CIP_STATUS_OK && resp->num_status_words == 0) {
+        if(*data >= AB_CIP_DATA_BIT && *data <= AB_CIP_DATA_STRINGI) {
+            type_len = 2;
+        } else if(*data == AB_CIP_DATA_ABREV_STRUCT || *data == AB_CIP_DATA_ABREV_ARRAY ||
+                  *data == AB_CIP_DATA_FULL_STRUCT || *data == AB_CIP_DATA_FULL_ARRAY) {
+            type_len = data[1] + 2;
+        }
+
+        if(type_len > 0 && data + type_len < data_end && (int)(data_end - data - type_len) % (int)merged->span == 0) {
+            elem_size = (int)(data_end - data - type_len) / (int)merged->span;
+            ok = 1;
+        }
+    }
+
+    if(!ok) {
+        pdebug(DEBUG_DETAIL, "Merged read failed, reading its members one by one.");
+    }
+
+    /* walk backward so the requeued members keep their order. */
+    for(int i=num_requests-1; i >= 0; i--) {
+        ab_request_p request = requests[i];
+        eip_cip_co_resp *member_resp = NULL;
+        int slice_len = 0;
+        int new_eip_len = 0;
+
+        if(plan[i].group != group || !request) {
+            continue;
+        }
+
+        slice_len = plan[i].elem_count * elem_size;
+        new_eip_len = (int)sizeof(eip_cip_co_resp) + type_len + slice_len;
+
+        if(ok && new_eip_len > request->request_capacity) {
+            ok = (session_request_increase_buffer(request, new_eip_len) == PLCTAG_STATUS_OK);
+        }
+
+        if(!ok) {
+            request->merge_failed = 1;
+
+            critical_block(session->mutex) {
+                requeue_request_unsafe(session, request);
+            }
+
+            /* the queue has our reference now. */
+            requests[i] = NULL;
+
+            continue;
+        }
+
+        member_resp = (eip_cip_co_resp *)(request->data);
+
+        mem_copy(request->data, merged->req->data, (int)sizeof(eip_cip_co_resp) + type_len);
+        mem_copy(request->data + sizeof(eip_cip_co_resp) + type_len,
+                 data + type_len + (int)(plan[i].elem_index - merged->first_index) * elem_size,
+                 slice_len);
+
+        member_resp->cpf_cdi_item_length = h2le16((uint16_t)(new_eip_len - (int)((uint8_t *)(&member_resp->cpf_conn_seq_num) - request->data)));
+        member_resp->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
+
+        spin_block(&request->lock) {
+            request->status = PLCTAG_STATUS_OK;
+            request->request_size = new_eip_len;
+            request->resp_received = 1;
+        }
+    }
+}
+
+
+/*
+ * parse_rmw_request
+ *
+ * Returns the mask size of a connected read-modify-write request, or 0
+ * if the request is something else.
+ */
+int parse_rmw_request(ab_request_p request)
+{
+    eip_cip_co_req *co_req = (eip_cip_co_req *)(request->data);
+    uint8_t *cip = request->data + sizeof(eip_cip_co_req);
+    int cip_len = 0;
+    int path_len = 0;
+    int mask_size = 0;
+
+    if(request->request_size < (int)sizeof(eip_cip_co_req) + 4 || le2h16(co_req->encap_command) != AB_EIP_CONNECTED_SEND) {
+        return 0;
+    }
+
+    cip_len = (int)le2h16(co_req->cpf_cdi_item_length) - (int)sizeof(co_req->cpf_conn_seq_num);
+    path_len = cip[1] * 2;
+
+    if(cip[0] != AB_EIP_CMD_CIP_RMW || cip_len < 2 + path_len + 2) {
+        return 0;
+    }
+
+    mask_size = cip[2 + path_len] | (cip[3 + path_len] << 8);
+
+    /* an OR mask and an AND mask follow the mask size. */
+    if(mask_size <= 0 || cip_len != 2 + path_len + 2 + (2 * mask_size)) {
+        return 0;
+    }
+
+    return mask_size;
+}
+
+
+/*
+ * plan_merged_rmw
+ *
+ * Setting several bits of one DINT makes one read-modify-write per bit.
+ * Fold the bit writes to the same word into one request.  The PLC
+ * computes (old | OR) & AND.  Applying (OR1, AND1) then (OR2, AND2) is
+ * the same as applying (C, (AND1 & AND2) | C) with
+ * C = ((OR1 & AND1) | OR2) & AND2, so the masks are combined in queue
+ * order.  The merged request goes out in the place of the first bit
+ * write, so a group ends at any other read or write of the same tag.
+ * Returns the new number of merged requests.
+ */
+int plan_merged_rmw(ab_session_p session, ab_request_p *requests, struct merge_plan_t *plan, int num_requests, struct merged_request_t *merged, int num_merged)
+{
+    for(int i=0; i < num_requests && num_merged < MAX_MERGED_REQUESTS; i++) {
+        uint8_t *first_cip = requests[i]->data + sizeof(eip_cip_co_req);
+        uint8_t *name = NULL;
+        int name_len = 0;
+        int mask_size = 0;
+        int key_len = 0;
+        uint8_t *or_mask = NULL;
+        uint8_t *and_mask = NULL;
+        int num_members = 1;
+        int end = i + 1;
+        ab_request_p req = NULL;
+
+        if(plan[i].group >= 0 || (mask_size = parse_rmw_request(requests[i])) == 0) {
+            continue;
+        }
+
+        name_len = get_request_tag_name(requests[i], &name);
+
+        /* service, path and mask size must all match. */
+        key_len = 2 + (first_cip[1] * 2) + 2;
+
+        for(end = i + 1; end < num_requests; end++) {
+            if(plan[end].group < 0 && parse_rmw_request(requests[end]) == mask_size
+               && mem_cmp(first_cip, key_len, requests[end]->data + sizeof(eip_cip_co_req), key_len) == 0) {
+                num_members++;
+            } else if(request_touches_tag(requests[end], name, name_len, 0)) {
+                break;
+            }
+        }
+
+        if(num_members < 2) {
+            continue;
+        }
+
+        if(session_create_request(session, requests[i]->tag_id, &req) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create merged read-modify-write request!");
+            continue;
+        }
+
+        /* start from the first bit write and fold in the rest. */
+        mem_copy(req->data, requests[i]->data, requests[i]->request_size);
+        req->request_size = requests[i]->request_size;
+        req->allow_packing = requests[i]->allow_packing;
+
+        or_mask = req->data + sizeof(eip_cip_co_req) + key_len;
+        and_mask = or_mask + mask_size;
+
+        plan[i].group = (int16_t)num_merged;
+
+        for(int j=i+1; j < end; j++) {
+            uint8_t *cip = requests[j]->data + sizeof(eip_cip_co_req);
+
+            if(plan[j].group < 0 && parse_rmw_request(requests[j]) == mask_size && mem_cmp(first_cip, key_len, cip, key_len) == 0) {
+                uint8_t *next_or = cip + key_len;
+                uint8_t *next_and = next_or + mask_size;
+
+                for(int b=0; b < mask_size; b++) {
+                    uint8_t forced = (uint8_t)(((or_mask[b] & and_mask[b]) | next_or[b]) & next_and[b]);
+
+                    or_mask[b] = forced;
+                    and_mask[b] = (uint8_t)((and_mask[b] & next_and[b]) | forced);
+                }
+
+                req->allow_packing = req->allow_packing && requests[j]->allow_packing;
+
+                plan[j].group = (int16_t)num_merged;
+            }
+        }
+
+        pdebug(DEBUG_DETAIL, "Merged %d bit writes into one read-modify-write.", num_members);
+
+        merged[num_merged].req = req;
+        merged[num_merged].is_rmw = 1;
+        merged[num_merged].first_index = 0;
+        merged[num_merged].span = 0;
+
+        num_merged++;
+    }
+
+    return num_merged;
+}
+
+
+/* every bit write in the group gets the one response, good or bad. */
+void split_merged_rmw(struct merged_request_t *merged, int group, ab_request_p *requests, struct merge_plan_t *plan, int num_requests)
+{
+    for(int i=0; i < num_requests; i++) {
+        ab_request_p request = requests[i];
+        int rc = PLCTAG_STATUS_OK;
+
+        if(plan[i].group != group || !request) {
+            continue;
+        }
+
+        if(merged->req->request_size > request->request_capacity) {
+            rc = session_request_increase_buffer(request, merged->req->request_size);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            mem_copy(request->data, merged->req->data, merged->req->request_size);
+        }
+
+        spin_block(&request->lock) {
+            request->status = rc;
+            request->request_size = (rc == PLCTAG_STATUS_OK ? merged->req->request_size : 0);
+            request->resp_received = 1;
+        }
+    }
+}
+
+
+/* put a request back at the front of the queue. */
+int requeue_request_unsafe(ab_session_p session, ab_request_p request)
+{
+    for(int i = vector_length(session->requests); i > 0; i--) {
+        vector_put(session->requests, i, vector_get(session->requests, i - 1));
+    }
+
+    return vector_put(session->requests, 0, request);
+}
+
+
+
+
 int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests)
 {
     eip_cip_co_req *new_req = NULL;
@@ -1808,6 +2477,8 @@ int send_eip_request(ab_session_p session, int timeout)
         return PLCTAG_ERR_TIMEOUT;
     }
 
+    capture_record(session->capture, CAPTURE_RECORD_SENT, session->data, (int)session->data_size);
+
     pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -1896,6 +2567,8 @@ int recv_eip_response(ab_session_p session, int timeout)
 
     pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_offset));
 
+    capture_record(session->capture, CAPTURE_RECORD_RECEIVED, session->data, (int)session->data_size);
+
     /* check status. */
     if(le2h32(((eip_encap *)(session->data))->encap_status) != AB_EIP_OK) {
         rc = PLCTAG_ERR_BAD_STATUS;
@@ -35,6 +35,7 @@
 #define __PLCTAG_AB_SESSION_H__ 1
 
 #include <ab/ab_common.h>
+#include <ab/capture.h>
 #include <ab/defs.h>
 #include <util/rc.h>
 #include <util/vector.h>
@@ -101,6 +102,9 @@ struct ab_session_t {
     /* disconnect handling */
     int auto_disconnect_enabled;
     int auto_disconnect_timeout_ms;
+
+    /* traffic capture, NULL unless capture_file is set. */
+    capture_p capture;
 };
 
 struct ab_request_t {
@@ -120,6 +124,12 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
+    /* set when a merged element read failed, the request is then sent on its own. */
+    int merge_failed;
+
+    /* element size of a read, used to keep merged reads within one reply.  0 if unknown. */
+    int elem_size;
+
     /* time stamp for debugging output */
     int64_t time_sent;
 
@@ -142,4 +152,7 @@ extern int session_get_max_payload(ab_session_p session);
 extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
 
+/* copies one response, or one part of a multi-service response, out of the session buffer. */
+extern int session_unpack_response(ab_session_p session, ab_request_p request, int sub_packet);
+
 #endif
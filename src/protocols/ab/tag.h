@@ -109,6 +109,14 @@ struct ab_tag_t {
 
     int allow_packing;
 
+    /* delta writes send only the byte ranges changed since the last read or write. */
+    int delta_write;
+    int delta_write_active;
+    int delta_range_index;
+    int num_delta_ranges;
+    int delta_range_start[TAG_MAX_DIRTY_RANGES];
+    int delta_range_end[TAG_MAX_DIRTY_RANGES];
+
     /* flags for operations */
     int read_in_progress;
     int write_in_progress;
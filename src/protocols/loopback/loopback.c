@@ -0,0 +1,617 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Loopback protocol.
+ *
+ * Tags live entirely in memory.  All tags with the same name share one
+ * backing store, so a write through one tag is seen by a read through
+ * another.  Reads and writes are completed by the tickler after a
+ * configurable delay and can be made to fail at random, so that the core
+ * library (tickler, callbacks, auto sync, locking) can be exercised and
+ * profiled without any network traffic.
+ *
+ * Attributes:
+ *    name           - the store to use, required.
+ *    elem_size      - size of an element in bytes, default 1.
+ *    elem_count     - number of elements, default 1.
+ *    read_delay_ms  - time a read takes to complete, default 0.
+ *    write_delay_ms - time a write takes to complete, default 0.
+ *    fail_percent   - chance in percent that a read or write fails, default 0.
+ *
+ * Tags sharing a store must have the same size.
+ */
+
+#include <stdlib.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <loopback/loopback.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/hash.h>
+#include <util/hashtable.h>
+#include <util/rc.h>
+
+
+#define LOOPBACK_STORE_TABLE_SIZE (1024)
+
+
+/* shared backing store, one per tag name. */
+struct loopback_store_t {
+    struct loopback_store_t *next; /* other stores with the same name hash. */
+    int64_t key;
+    int ref_count;
+    int size;
+    uint8_t *data;
+    char *name;
+};
+
+typedef struct loopback_store_t *loopback_store_p;
+
+
+typedef enum { LOOPBACK_OP_NONE, LOOPBACK_OP_READ, LOOPBACK_OP_WRITE } loopback_op_t;
+
+struct loopback_tag_t {
+    /* base tag parts. */
+    TAG_BASE_STRUCT;
+
+    loopback_store_p store;
+
+    int elem_size;
+    int elem_count;
+
+    /* simulated behavior. */
+    int read_delay_ms;
+    int write_delay_ms;
+    int fail_percent;
+
+    /* the operation in flight, if any, and when it completes. */
+    loopback_op_t op;
+    int64_t op_done_time;
+};
+
+typedef struct loopback_tag_t *loopback_tag_p;
+
+
+static int loopback_tag_abort(plc_tag_p tag);
+static int loopback_tag_read(plc_tag_p tag);
+static int loopback_tag_status(plc_tag_p tag);
+static int loopback_tag_tickler(plc_tag_p tag);
+static int loopback_tag_write(plc_tag_p tag);
+static int loopback_get_int_attrib(plc_tag_p tag, const char *attrib_name, int default_value);
+static int loopback_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value);
+static void loopback_tag_destroy(void *tag_arg);
+
+static loopback_store_p store_get(const char *name, int size);
+static void store_release(loopback_store_p store);
+static int64_t store_key(const char *name);
+
+
+struct tag_vtable_t loopback_tag_vtable = {
+    /* abort */     loopback_tag_abort,
+    /* read */      loopback_tag_read,
+    /* status */    loopback_tag_status,
+    /* tickler */   loopback_tag_tickler,
+    /* write */     loopback_tag_write,
+
+    /* data accessors */
+
+    /* get_int_attrib */ loopback_get_int_attrib,
+    /* set_int_attrib */ loopback_set_int_attrib
+};
+
+
+tag_byte_order_t loopback_tag_byte_order = {
+    .is_allocated = 0,
+
+    .int16_order = {0,1},
+    .int32_order = {0,1,2,3},
+    .int64_order = {0,1,2,3,4,5,6,7},
+    .float32_order = {0,1,2,3},
+    .float64_order = {0,1,2,3,4,5,6,7},
+
+    .str_is_defined = 1,
+    .str_is_counted = 0,
+    .str_is_fixed_length = 0,
+    .str_is_zero_terminated = 1, /* C-style string. */
+    .str_is_byte_swapped = 0,
+
+    .str_count_word_bytes = 0,
+    .str_max_capacity = 0,
+    .str_total_length = 0,
+    .str_pad_bytes = 0
+};
+
+
+/* loopback module globals. */
+static mutex_p loopback_mutex = NULL;
+static hashtable_p stores = NULL;
+
+
+
+plc_tag_p loopback_tag_create(attr attribs)
+{
+    loopback_tag_p tag = NULL;
+    const char *name = attr_get_str(attribs, "name", NULL);
+    int elem_size = attr_get_int(attribs, "elem_size", 1);
+    int elem_count = attr_get_int(attribs, "elem_count", 1);
+    int read_delay_ms = attr_get_int(attribs, "read_delay_ms", 0);
+    int write_delay_ms = attr_get_int(attribs, "write_delay_ms", 0);
+    int fail_percent = attr_get_int(attribs, "fail_percent", 0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* check the attributes. */
+    if(!name || str_length(name) < 1) {
+        pdebug(DEBUG_WARN, "Loopback tag name is empty or missing!");
+        return PLC_TAG_P_NULL;
+    }
+
+    if(elem_size <= 0 || elem_count <= 0 || elem_count > (INT32_MAX / elem_size)) {
+        pdebug(DEBUG_WARN, "Element size and count must be positive and the tag must not be too large!");
+        return PLC_TAG_P_NULL;
+    }
+
+    if(read_delay_ms < 0 || write_delay_ms < 0) {
+        pdebug(DEBUG_WARN, "Read and write delays must not be negative!");
+        return PLC_TAG_P_NULL;
+    }
+
+    if(fail_percent < 0 || fail_percent > 100) {
+        pdebug(DEBUG_WARN, "The failure percentage must be between 0 and 100!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag = (loopback_tag_p)rc_alloc((int)sizeof(struct loopback_tag_t), loopback_tag_destroy);
+    if(!tag) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for loopback tag!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->vtable = &loopback_tag_vtable;
+    tag->byte_order = &loopback_tag_byte_order;
+
+    tag->elem_size = elem_size;
+    tag->elem_count = elem_count;
+    tag->read_delay_ms = read_delay_ms;
+    tag->write_delay_ms = write_delay_ms;
+    tag->fail_percent = fail_percent;
+    tag->op = LOOPBACK_OP_NONE;
+
+    tag->size = elem_size * elem_count;
+    tag->data = mem_alloc(tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag data!");
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    critical_block(loopback_mutex) {
+        tag->store = store_get(name, tag->size);
+    }
+
+    if(!tag->store) {
+        pdebug(DEBUG_WARN, "Unable to get the backing store for tag %s!", name);
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return (plc_tag_p)tag;
+}
+
+
+
+void loopback_tag_destroy(void *tag_arg)
+{
+    loopback_tag_p tag = (loopback_tag_p)tag_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Destructor called with null pointer!");
+        return;
+    }
+
+    if(tag->store) {
+        critical_block(loopback_mutex) {
+            store_release(tag->store);
+        }
+
+        tag->store = NULL;
+    }
+
+    if(tag->ext_mutex) {
+        mutex_destroy(&(tag->ext_mutex));
+    }
+
+    if(tag->api_mutex) {
+        mutex_destroy(&(tag->api_mutex));
+    }
+
+    if(tag->data) {
+        mem_free(tag->data);
+        tag->data = NULL;
+    }
+
+    if(tag->byte_order && tag->byte_order->is_allocated) {
+        mem_free(tag->byte_order);
+        tag->byte_order = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/****** Tag vtable functions. ******/
+
+/* the tag API mutex is held by the caller for all of these. */
+
+int loopback_tag_abort(plc_tag_p raw_tag)
+{
+    loopback_tag_p tag = (loopback_tag_p)raw_tag;
+
+    tag->op = LOOPBACK_OP_NONE;
+    tag->status = PLCTAG_STATUS_OK;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int loopback_tag_read(plc_tag_p raw_tag)
+{
+    loopback_tag_p tag = (loopback_tag_p)raw_tag;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(tag->op != LOOPBACK_OP_NONE) {
+        pdebug(DEBUG_WARN, "An operation is already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    /* the tickler completes the read, even with no delay, so that the normal completion path is used. */
+    tag->op = LOOPBACK_OP_READ;
+    tag->op_done_time = time_ms() + tag->read_delay_ms;
+    tag->status = PLCTAG_STATUS_PENDING;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+int loopback_tag_status(plc_tag_p tag)
+{
+    return tag->status;
+}
+
+
+int loopback_tag_tickler(plc_tag_p raw_tag)
+{
+    loopback_tag_p tag = (loopback_tag_p)raw_tag;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag->op == LOOPBACK_OP_NONE || tag->op_done_time > time_ms()) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    critical_block(loopback_mutex) {
+        if(tag->fail_percent > 0 && (rand() % 100) < tag->fail_percent) {
+            pdebug(DEBUG_DETAIL, "Simulating %s failure.", (tag->op == LOOPBACK_OP_READ ? "read" : "write"));
+            rc = (tag->op == LOOPBACK_OP_READ ? PLCTAG_ERR_READ : PLCTAG_ERR_WRITE);
+            break;
+        }
+
+        if(tag->op == LOOPBACK_OP_READ) {
+            mem_copy(tag->data, tag->store->data, tag->size);
+        } else {
+            mem_copy(tag->store->data, tag->data, tag->size);
+        }
+    }
+
+    if(tag->op == LOOPBACK_OP_READ) {
+        tag->read_complete = 1;
+    } else {
+        tag->write_complete = 1;
+    }
+
+    tag->op = LOOPBACK_OP_NONE;
+    tag->status = (int8_t)rc;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+int loopback_tag_write(plc_tag_p raw_tag)
+{
+    loopback_tag_p tag = (loopback_tag_p)raw_tag;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(tag->op != LOOPBACK_OP_NONE) {
+        pdebug(DEBUG_WARN, "An operation is already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    tag->op = LOOPBACK_OP_WRITE;
+    tag->op_done_time = time_ms() + tag->write_delay_ms;
+    tag->status = PLCTAG_STATUS_PENDING;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+int loopback_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_value)
+{
+    int res = default_value;
+    loopback_tag_p tag = (loopback_tag_p)raw_tag;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    /* match the attribute. */
+    if(str_cmp_i(attrib_name, "elem_size") == 0) {
+        res = tag->elem_size;
+    } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
+        res = tag->elem_count;
+    } else if(str_cmp_i(attrib_name, "read_delay_ms") == 0) {
+        res = tag->read_delay_ms;
+    } else if(str_cmp_i(attrib_name, "write_delay_ms") == 0) {
+        res = tag->write_delay_ms;
+    } else if(str_cmp_i(attrib_name, "fail_percent") == 0) {
+        res = tag->fail_percent;
+    } else {
+        pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported.", attrib_name);
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return res;
+}
+
+
+/* the simulated behavior can be changed on the fly. */
+int loopback_set_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int new_value)
+{
+    loopback_tag_p tag = (loopback_tag_p)raw_tag;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(str_cmp_i(attrib_name, "read_delay_ms") == 0) {
+        if(new_value >= 0) {
+            tag->read_delay_ms = new_value;
+        } else {
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    } else if(str_cmp_i(attrib_name, "write_delay_ms") == 0) {
+        if(new_value >= 0) {
+            tag->write_delay_ms = new_value;
+        } else {
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    } else if(str_cmp_i(attrib_name, "fail_percent") == 0) {
+        if(new_value >= 0 && new_value <= 100) {
+            tag->fail_percent = new_value;
+        } else {
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    } else {
+        pdebug(DEBUG_WARN, "Attribute \"%s\" is unsupported!", attrib_name);
+        rc = PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    tag->status = (int8_t)rc;
+
+    return rc;
+}
+
+
+
+
+/****** Backing store helpers, call these with the loopback mutex held. ******/
+
+int64_t store_key(const char *name)
+{
+    return (int64_t)hash((uint8_t *)name, (size_t)(unsigned int)str_length(name), 0);
+}
+
+
+loopback_store_p store_get(const char *name, int size)
+{
+    int64_t key = store_key(name);
+    loopback_store_p head = hashtable_get(stores, key);
+    loopback_store_p store = head;
+
+    /* different names can hash to the same key, find ours. */
+    while(store && str_cmp(store->name, name) != 0) {
+        store = store->next;
+    }
+
+    if(store) {
+        if(store->size != size) {
+            pdebug(DEBUG_WARN, "Tag %s already exists with size %d, not %d!", name, store->size, size);
+            return NULL;
+        }
+
+        store->ref_count++;
+
+        return store;
+    }
+
+    pdebug(DEBUG_DETAIL, "Creating new backing store for tag %s.", name);
+
+    store = mem_alloc((int)sizeof(struct loopback_store_t));
+    if(!store) {
+        pdebug(DEBUG_ERROR, "Unable to allocate backing store!");
+        return NULL;
+    }
+
+    store->key = key;
+    store->ref_count = 1;
+    store->size = size;
+    store->data = mem_alloc(size);
+    store->name = str_dup(name);
+
+    if(!store->data || !store->name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate backing store data!");
+        mem_free(store->data);
+        mem_free(store->name);
+        mem_free(store);
+        return NULL;
+    }
+
+    /* put the new store at the head of the chain. */
+    if(head) {
+        hashtable_remove(stores, key);
+    }
+
+    store->next = head;
+
+    if(hashtable_put(stores, key, store) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add the backing store to the table!");
+
+        if(head) {
+            hashtable_put(stores, key, head);
+        }
+
+        mem_free(store->data);
+        mem_free(store->name);
+        mem_free(store);
+        return NULL;
+    }
+
+    return store;
+}
+
+
+void store_release(loopback_store_p store)
+{
+    loopback_store_p head = NULL;
+
+    store->ref_count--;
+
+    if(store->ref_count > 0) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Freeing backing store for tag %s.", store->name);
+
+    /* unlink it from its chain. */
+    head = hashtable_get(stores, store->key);
+
+    if(head == store) {
+        hashtable_remove(stores, store->key);
+
+        if(store->next) {
+            hashtable_put(stores, store->key, store->next);
+        }
+    } else {
+        while(head && head->next != store) {
+            head = head->next;
+        }
+
+        if(head) {
+            head->next = store->next;
+        }
+    }
+
+    mem_free(store->data);
+    mem_free(store->name);
+    mem_free(store);
+}
+
+
+
+
+/****** Library level functions. *******/
+
+void loopback_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* all tags are gone by now, so are all the stores. */
+    if(stores) {
+        hashtable_destroy(stores);
+        stores = NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Destroying loopback mutex.");
+    if(loopback_mutex) {
+        mutex_destroy(&loopback_mutex);
+        loopback_mutex = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int loopback_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    pdebug(DEBUG_DETAIL, "Setting up mutex.");
+    if(!loopback_mutex) {
+        rc = mutex_create(&loopback_mutex);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s creating mutex!", plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    if(!stores) {
+        stores = hashtable_create(LOOPBACK_STORE_TABLE_SIZE);
+        if(!stores) {
+            pdebug(DEBUG_ERROR, "Unable to create backing store table!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
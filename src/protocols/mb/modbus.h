@@ -42,3 +42,6 @@
 extern void mb_teardown(void);
 extern int mb_init();
 extern plc_tag_p mb_tag_create(attr attribs);
+
+/* the default byte order of Modbus tags. */
+extern tag_byte_order_t modbus_tag_byte_order;
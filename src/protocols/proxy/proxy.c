@@ -0,0 +1,901 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Proxy protocol.
+ *
+ * Tags are created, read and written by the plctag_proxy daemon on this
+ * host.  The daemon shares identical tags between all its clients and
+ * runs one read for all the clients that ask while a read is in flight,
+ * so the PLC sees one set of connections however many processes use it.
+ * The messages are in proxy_wire.h.
+ *
+ * Attributes:
+ *    proxy_path     - the daemon's socket, default PROXY_DEFAULT_SOCKET_PATH.
+ *    proxy_protocol - the protocol the daemon uses, default ab-eip.
+ *
+ * All other attributes are passed to the daemon, except the ones the
+ * library handles itself here, like auto_sync_read_ms and read_cache_ms.
+ * Changing protocol=ab-eip to protocol=proxy is enough to move a program
+ * onto the daemon.
+ *
+ * All tags using the same socket share one connection.  A thread per
+ * connection hands the replies to the tags.  If the daemon goes away,
+ * operations fail with PLCTAG_ERR_BAD_CONNECTION and the tags need to
+ * be recreated.
+ */
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/ab_common.h>
+#include <ab/defs.h>
+#include <ab/eip_cip.h>
+#include <ab/eip_plc5_pccc.h>
+#include <ab/eip_slc_pccc.h>
+#include <mb/modbus.h>
+#include <proxy/proxy.h>
+#include <proxy/proxy_wire.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/hashtable.h>
+#include <util/rc.h>
+
+
+#define PROXY_REQUEST_TABLE_SIZE (1024)
+#define PROXY_BUF_INITIAL_SIZE (4096)
+#define PROXY_SEND_TIMEOUT_MS (1000)
+
+
+/* one connection to the daemon per socket path. */
+struct proxy_conn_t {
+    struct proxy_conn_t *next;
+    int ref_count;
+    char *path;
+    sock_p sock;
+
+    /* guards socket writes, the request table and the tags' replies. */
+    mutex_p mutex;
+    hashtable_p requests; /* request ID to the waiting tag. */
+    uint32_t last_request_id;
+    volatile int failed;
+
+    thread_p thread;
+    volatile int terminate;
+
+    /* only used by the connection thread. */
+    uint8_t *buf;
+    int buf_size;
+    int buf_used;
+};
+
+typedef struct proxy_conn_t *proxy_conn_p;
+
+
+struct proxy_tag_t {
+    /* base tag parts. */
+    TAG_BASE_STRUCT;
+
+    proxy_conn_p conn;
+    int32_t handle; /* the daemon's handle, zero until the tag is created. */
+
+    int elem_size;
+    int elem_count;
+
+    /* the request in flight, if any. */
+    proxy_command_t op;
+    uint32_t request_id;
+
+    /* filled in by the connection thread with the connection mutex held. */
+    int reply_ready;
+    int32_t reply_status;
+    int32_t reply_handle;
+    uint8_t *reply_data;
+    int reply_size;
+};
+
+typedef struct proxy_tag_t *proxy_tag_p;
+
+
+static int proxy_tag_abort(plc_tag_p tag);
+static int proxy_tag_read(plc_tag_p tag);
+static int proxy_tag_status(plc_tag_p tag);
+static int proxy_tag_tickler(plc_tag_p tag);
+static int proxy_tag_write(plc_tag_p tag);
+static int proxy_get_int_attrib(plc_tag_p tag, const char *attrib_name, int default_value);
+static int proxy_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value);
+static void proxy_tag_destroy(void *tag_arg);
+
+static tag_byte_order_t *target_byte_order(attr attribs, const char *target_protocol);
+static int send_request(proxy_tag_p tag, proxy_command_t command, uint8_t *payload, int payload_size);
+static void cancel_request(proxy_tag_p tag);
+static proxy_conn_p conn_get(const char *path);
+static void conn_release(proxy_conn_p conn);
+static int conn_write(proxy_conn_p conn, uint8_t *data, int size);
+static int conn_dispatch(proxy_conn_p conn);
+static THREAD_FUNC(conn_handler);
+
+
+struct tag_vtable_t proxy_tag_vtable = {
+    /* abort */     proxy_tag_abort,
+    /* read */      proxy_tag_read,
+    /* status */    proxy_tag_status,
+    /* tickler */   proxy_tag_tickler,
+    /* write */     proxy_tag_write,
+
+    /* data accessors */
+
+    /* get_int_attrib */ proxy_get_int_attrib,
+    /* set_int_attrib */ proxy_set_int_attrib
+};
+
+
+/* for protocols not known here, little endian with C strings. */
+tag_byte_order_t proxy_tag_byte_order = {
+    .is_allocated = 0,
+
+    .int16_order = {0,1},
+    .int32_order = {0,1,2,3},
+    .int64_order = {0,1,2,3,4,5,6,7},
+    .float32_order = {0,1,2,3},
+    .float64_order = {0,1,2,3,4,5,6,7},
+
+    .str_is_defined = 1,
+    .str_is_counted = 0,
+    .str_is_fixed_length = 0,
+    .str_is_zero_terminated = 1, /* C-style string. */
+    .str_is_byte_swapped = 0,
+
+    .str_count_word_bytes = 0,
+    .str_max_capacity = 0,
+    .str_total_length = 0,
+    .str_pad_bytes = 0
+};
+
+
+/* attributes that are not passed on to the daemon. */
+static const char *local_attribs[] = {
+    "protocol", "proxy_path", "proxy_protocol",
+    "auto_sync_read_ms", "auto_sync_write_ms", "read_cache_ms", "debug",
+    NULL
+};
+
+
+/* proxy module globals. */
+static mutex_p proxy_mutex = NULL;
+static proxy_conn_p conns = NULL;
+
+
+
+plc_tag_p proxy_tag_create(attr attribs)
+{
+    proxy_tag_p tag = NULL;
+    const char *path = attr_get_str(attribs, "proxy_path", PROXY_DEFAULT_SOCKET_PATH);
+    const char *target_protocol = attr_get_str(attribs, "proxy_protocol", "ab-eip");
+    char *forwarded = NULL;
+    char *attrib_str = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    tag = (proxy_tag_p)rc_alloc((int)sizeof(struct proxy_tag_t), proxy_tag_destroy);
+    if(!tag) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for proxy tag!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->vtable = &proxy_tag_vtable;
+    tag->byte_order = target_byte_order(attribs, target_protocol);
+    tag->elem_size = attr_get_int(attribs, "elem_size", 0);
+    tag->elem_count = attr_get_int(attribs, "elem_count", 1);
+
+    critical_block(proxy_mutex) {
+        tag->conn = conn_get(path);
+    }
+
+    if(!tag->conn) {
+        pdebug(DEBUG_WARN, "Unable to connect to the proxy at %s!", path);
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    forwarded = attr_to_str(attribs, local_attribs);
+    attrib_str = (forwarded ? str_concat("protocol=", target_protocol, (str_length(forwarded) ? "&" : ""), forwarded) : NULL);
+    mem_free(forwarded);
+
+    if(!attrib_str) {
+        pdebug(DEBUG_ERROR, "Unable to allocate the attribute string!");
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Creating tag %s through the proxy.", attrib_str);
+
+    /* the tag is pending until the daemon has created its tag. */
+    rc = send_request(tag, PROXY_CMD_CREATE, (uint8_t *)attrib_str, str_length(attrib_str));
+    mem_free(attrib_str);
+
+    tag->status = (int8_t)rc;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return (plc_tag_p)tag;
+}
+
+
+
+void proxy_tag_destroy(void *tag_arg)
+{
+    proxy_tag_p tag = (proxy_tag_p)tag_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Destructor called with null pointer!");
+        return;
+    }
+
+    if(tag->conn) {
+        /* if the tag is still being created, the daemon drops it once it is. */
+        uint32_t create_request_id = (tag->op == PROXY_CMD_CREATE ? tag->request_id : 0);
+
+        cancel_request(tag);
+
+        if(tag->handle) {
+            send_request(tag, PROXY_CMD_DESTROY, NULL, 0);
+        } else if(create_request_id) {
+            send_request(tag, PROXY_CMD_DESTROY, (uint8_t *)&create_request_id, (int)sizeof(create_request_id));
+        }
+
+        critical_block(proxy_mutex) {
+            conn_release(tag->conn);
+        }
+
+        tag->conn = NULL;
+    }
+
+    if(tag->ext_mutex) {
+        mutex_destroy(&(tag->ext_mutex));
+    }
+
+    if(tag->api_mutex) {
+        mutex_destroy(&(tag->api_mutex));
+    }
+
+    if(tag->data) {
+        mem_free(tag->data);
+        tag->data = NULL;
+    }
+
+    if(tag->byte_order && tag->byte_order->is_allocated) {
+        mem_free(tag->byte_order);
+        tag->byte_order = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/****** Tag vtable functions. ******/
+
+/* the tag API mutex is held by the caller for all of these. */
+
+int proxy_tag_abort(plc_tag_p raw_tag)
+{
+    proxy_tag_p tag = (proxy_tag_p)raw_tag;
+
+    /* the daemon finishes the operation, its reply is dropped. */
+    cancel_request(tag);
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int proxy_tag_read(plc_tag_p raw_tag)
+{
+    proxy_tag_p tag = (proxy_tag_p)raw_tag;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(tag->op != 0) {
+        pdebug(DEBUG_WARN, "An operation is already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    rc = send_request(tag, PROXY_CMD_READ, NULL, 0);
+
+    tag->status = (int8_t)rc;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+int proxy_tag_status(plc_tag_p tag)
+{
+    return tag->status;
+}
+
+
+/* pick up the reply to the request in flight, if it is here. */
+int proxy_tag_tickler(plc_tag_p raw_tag)
+{
+    proxy_tag_p tag = (proxy_tag_p)raw_tag;
+    proxy_command_t op = tag->op;
+    int have_reply = 0;
+    int32_t status = PLCTAG_STATUS_OK;
+    int32_t handle = 0;
+    uint8_t *data = NULL;
+    int size = 0;
+
+    if(op == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(tag->conn->mutex) {
+        if(tag->reply_ready) {
+            have_reply = 1;
+            status = tag->reply_status;
+            handle = tag->reply_handle;
+            data = tag->reply_data;
+            size = tag->reply_size;
+
+            tag->reply_ready = 0;
+            tag->reply_data = NULL;
+        } else if(tag->conn->failed) {
+            hashtable_remove(tag->conn->requests, (int64_t)tag->request_id);
+
+            have_reply = 1;
+            status = PLCTAG_ERR_BAD_CONNECTION;
+        }
+    }
+
+    if(!have_reply) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_SPEW, "Got reply with status %s.", plc_tag_decode_error(status));
+
+    tag->op = 0;
+    tag->request_id = 0;
+
+    /* created and read tags take the data from the daemon, it can change size. */
+    if(status == PLCTAG_STATUS_OK && (op == PROXY_CMD_CREATE || op == PROXY_CMD_READ) && data) {
+        if(tag->data) {
+            mem_free(tag->data);
+        }
+
+        tag->data = data;
+        tag->size = size;
+        data = NULL;
+    }
+
+    if(data) {
+        mem_free(data);
+    }
+
+    if(op == PROXY_CMD_CREATE) {
+        if(status == PLCTAG_STATUS_OK) {
+            tag->handle = handle;
+        }
+    } else if(op == PROXY_CMD_READ) {
+        tag->read_complete = 1;
+    } else if(op == PROXY_CMD_WRITE) {
+        tag->write_complete = 1;
+    }
+
+    tag->status = (int8_t)status;
+
+    return status;
+}
+
+
+int proxy_tag_write(plc_tag_p raw_tag)
+{
+    proxy_tag_p tag = (proxy_tag_p)raw_tag;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(tag->op != 0) {
+        pdebug(DEBUG_WARN, "An operation is already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    rc = send_request(tag, PROXY_CMD_WRITE, tag->data, tag->size);
+
+    tag->status = (int8_t)rc;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+int proxy_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_value)
+{
+    int res = default_value;
+    proxy_tag_p tag = (proxy_tag_p)raw_tag;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    /* match the attribute. */
+    if(str_cmp_i(attrib_name, "elem_size") == 0) {
+        res = (tag->elem_size > 0 ? tag->elem_size : (tag->elem_count > 0 ? tag->size / tag->elem_count : 0));
+    } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
+        res = tag->elem_count;
+    } else {
+        pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported.", attrib_name);
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return res;
+}
+
+
+int proxy_set_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int new_value)
+{
+    (void)new_value;
+
+    pdebug(DEBUG_WARN, "Attribute \"%s\" is unsupported!", attrib_name);
+
+    raw_tag->status = PLCTAG_ERR_UNSUPPORTED;
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+
+/****** Helpers. ******/
+
+/* the tag data comes from the daemon untouched, so use the target protocol's byte order. */
+tag_byte_order_t *target_byte_order(attr attribs, const char *target_protocol)
+{
+    const char *name = attr_get_str(attribs, "name", "");
+
+    if(str_cmp_i(target_protocol, "modbus-tcp") == 0 || str_cmp_i(target_protocol, "modbus_tcp") == 0) {
+        return &modbus_tag_byte_order;
+    }
+
+    if(str_cmp_i(target_protocol, "ab-eip") != 0 && str_cmp_i(target_protocol, "ab_eip") != 0) {
+        return &proxy_tag_byte_order;
+    }
+
+    switch(get_plc_type(attribs)) {
+    case AB_PLC_PLC5:
+        return &plc5_tag_byte_order;
+
+    case AB_PLC_SLC:
+    case AB_PLC_MLGX:
+    case AB_PLC_LGX_PCCC:
+        return &slc_tag_byte_order;
+
+    case AB_PLC_LGX:
+        /* tag listings like @tags have their own string format. */
+        return (name[0] == '@' ? &logix_tag_listing_byte_order : &logix_tag_byte_order);
+
+    default:
+        return &logix_tag_byte_order;
+    }
+}
+
+
+/*
+ * Send a request for the tag.  Requests that get a reply are recorded
+ * so that the connection thread can hand the reply to the tag.  Returns
+ * PLCTAG_STATUS_PENDING if a reply is coming.
+ */
+int send_request(proxy_tag_p tag, proxy_command_t command, uint8_t *payload, int payload_size)
+{
+    proxy_conn_p conn = tag->conn;
+    proxy_msg_header_t header;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(payload_size < 0 || payload_size > PROXY_MAX_MESSAGE_SIZE - (int)sizeof(header)) {
+        pdebug(DEBUG_WARN, "Request of %d bytes is too large for the proxy!", payload_size);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    mem_set(&header, 0, (int)sizeof(header));
+
+    header.length = (uint32_t)sizeof(header) + (uint32_t)payload_size;
+    header.command = (uint8_t)command;
+    header.version = PROXY_WIRE_VERSION;
+    header.handle = tag->handle;
+
+    critical_block(conn->mutex) {
+        if(conn->failed) {
+            rc = PLCTAG_ERR_BAD_CONNECTION;
+            break;
+        }
+
+        /* zero is never used, it means no request in flight. */
+        if(++conn->last_request_id == 0) {
+            conn->last_request_id = 1;
+        }
+
+        header.request_id = conn->last_request_id;
+
+        if(command != PROXY_CMD_DESTROY) {
+            if((rc = hashtable_put(conn->requests, (int64_t)header.request_id, tag)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to record the request, error %s!", plc_tag_decode_error(rc));
+                break;
+            }
+        }
+
+        rc = conn_write(conn, (uint8_t *)&header, (int)sizeof(header));
+
+        if(rc == PLCTAG_STATUS_OK && payload_size > 0) {
+            rc = conn_write(conn, payload, payload_size);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            /* part of a message may have gone out, so the stream is unusable. */
+            pdebug(DEBUG_WARN, "Error %s sending to the proxy!", plc_tag_decode_error(rc));
+            hashtable_remove(conn->requests, (int64_t)header.request_id);
+            conn->failed = 1;
+            rc = PLCTAG_ERR_BAD_CONNECTION;
+            break;
+        }
+
+        if(command != PROXY_CMD_DESTROY) {
+            tag->op = command;
+            tag->request_id = header.request_id;
+            rc = PLCTAG_STATUS_PENDING;
+        }
+    }
+
+    return rc;
+}
+
+
+/* forget the request in flight, a reply that comes later is dropped. */
+void cancel_request(proxy_tag_p tag)
+{
+    if(!tag->conn) {
+        return;
+    }
+
+    critical_block(tag->conn->mutex) {
+        if(tag->op != 0) {
+            hashtable_remove(tag->conn->requests, (int64_t)tag->request_id);
+        }
+
+        if(tag->reply_data) {
+            mem_free(tag->reply_data);
+            tag->reply_data = NULL;
+        }
+
+        tag->reply_ready = 0;
+    }
+
+    tag->op = 0;
+    tag->request_id = 0;
+}
+
+
+/* write all the data, call with the connection mutex held. */
+int conn_write(proxy_conn_p conn, uint8_t *data, int size)
+{
+    int64_t timeout_time = time_ms() + PROXY_SEND_TIMEOUT_MS;
+    int written = 0;
+
+    while(written < size) {
+        int rc = socket_write(conn->sock, data + written, size - written);
+
+        if(rc > 0) {
+            written += rc;
+        } else if(rc == PLCTAG_ERR_NO_DATA || rc == 0) {
+            /* the socket buffer is full, the daemon will drain it. */
+            if(time_ms() > timeout_time) {
+                return PLCTAG_ERR_TIMEOUT;
+            }
+
+            sleep_ms(1);
+        } else {
+            return rc;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/****** Connection helpers, call these with the proxy mutex held. ******/
+
+proxy_conn_p conn_get(const char *path)
+{
+    proxy_conn_p conn = conns;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* a failed connection stays with its tags, new tags get a new one. */
+    while(conn && (str_cmp(conn->path, path) != 0 || conn->failed)) {
+        conn = conn->next;
+    }
+
+    if(conn) {
+        conn->ref_count++;
+        return conn;
+    }
+
+    pdebug(DEBUG_DETAIL, "Connecting to the proxy at %s.", path);
+
+    conn = mem_alloc((int)sizeof(struct proxy_conn_t));
+    if(!conn) {
+        pdebug(DEBUG_ERROR, "Unable to allocate proxy connection!");
+        return NULL;
+    }
+
+    conn->ref_count = 1;
+    conn->path = str_dup(path);
+    conn->buf_size = PROXY_BUF_INITIAL_SIZE;
+    conn->buf = mem_alloc(conn->buf_size);
+    conn->requests = hashtable_create(PROXY_REQUEST_TABLE_SIZE);
+
+    if(!conn->path || !conn->buf || !conn->requests) {
+        pdebug(DEBUG_ERROR, "Unable to allocate proxy connection state!");
+        conn_release(conn);
+        return NULL;
+    }
+
+    if((rc = mutex_create(&conn->mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create proxy connection mutex, error %s!", plc_tag_decode_error(rc));
+        conn_release(conn);
+        return NULL;
+    }
+
+    if((rc = socket_create(&conn->sock)) != PLCTAG_STATUS_OK || (rc = socket_connect_local(conn->sock, path)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to connect to the proxy at %s, error %s!", path, plc_tag_decode_error(rc));
+        conn_release(conn);
+        return NULL;
+    }
+
+    if((rc = thread_create(&conn->thread, conn_handler, 32*1024, conn)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create proxy connection thread, error %s!", plc_tag_decode_error(rc));
+        conn_release(conn);
+        return NULL;
+    }
+
+    conn->next = conns;
+    conns = conn;
+
+    return conn;
+}
+
+
+void conn_release(proxy_conn_p conn)
+{
+    proxy_conn_p *walker = &conns;
+
+    conn->ref_count--;
+
+    if(conn->ref_count > 0) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Closing the proxy connection to %s.", (conn->path ? conn->path : "NULL"));
+
+    while(*walker && *walker != conn) {
+        walker = &((*walker)->next);
+    }
+
+    if(*walker) {
+        *walker = conn->next;
+    }
+
+    if(conn->thread) {
+        conn->terminate = 1;
+        thread_join(conn->thread);
+        thread_destroy(&conn->thread);
+    }
+
+    if(conn->sock) {
+        socket_close(conn->sock);
+        socket_destroy(&conn->sock);
+    }
+
+    if(conn->mutex) {
+        mutex_destroy(&conn->mutex);
+    }
+
+    /* all the tags are gone, so no requests are left. */
+    if(conn->requests) {
+        hashtable_destroy(conn->requests);
+    }
+
+    mem_free(conn->buf);
+    mem_free(conn->path);
+    mem_free(conn);
+}
+
+
+
+/****** Connection thread. ******/
+
+/* hand the complete replies in the buffer to their tags. */
+int conn_dispatch(proxy_conn_p conn)
+{
+    int offset = 0;
+
+    while(conn->buf_used - offset >= (int)sizeof(proxy_msg_header_t)) {
+        proxy_msg_header_t header;
+        int payload_size = 0;
+        uint8_t *payload = NULL;
+
+        mem_copy(&header, conn->buf + offset, (int)sizeof(header));
+
+        if(header.length < sizeof(header) || header.length > PROXY_MAX_MESSAGE_SIZE || header.version != PROXY_WIRE_VERSION) {
+            pdebug(DEBUG_WARN, "Bad message from the proxy!");
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        if(conn->buf_used - offset < (int)header.length) {
+            /* make room for the rest of it. */
+            if((int)header.length > conn->buf_size) {
+                uint8_t *new_buf = mem_realloc(conn->buf, (int)header.length);
+
+                if(!new_buf) {
+                    pdebug(DEBUG_ERROR, "Unable to grow the proxy buffer!");
+                    return PLCTAG_ERR_NO_MEM;
+                }
+
+                conn->buf = new_buf;
+                conn->buf_size = (int)header.length;
+            }
+
+            break;
+        }
+
+        payload_size = (int)header.length - (int)sizeof(header);
+
+        if(payload_size > 0) {
+            if(!(payload = mem_alloc(payload_size))) {
+                pdebug(DEBUG_ERROR, "Unable to allocate reply data!");
+                return PLCTAG_ERR_NO_MEM;
+            }
+
+            mem_copy(payload, conn->buf + offset + sizeof(header), payload_size);
+        }
+
+        critical_block(conn->mutex) {
+            proxy_tag_p tag = hashtable_remove(conn->requests, (int64_t)header.request_id);
+
+            if(tag) {
+                tag->reply_status = header.status;
+                tag->reply_handle = header.handle;
+                tag->reply_data = payload;
+                tag->reply_size = payload_size;
+                tag->reply_ready = 1;
+
+                payload = NULL;
+            }
+        }
+
+        /* nobody waits for it any more. */
+        if(payload) {
+            mem_free(payload);
+        }
+
+        offset += (int)header.length;
+    }
+
+    if(offset > 0) {
+        mem_move(conn->buf, conn->buf + offset, conn->buf_used - offset);
+        conn->buf_used -= offset;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+THREAD_FUNC(conn_handler)
+{
+    proxy_conn_p conn = arg;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    while(!conn->terminate && !conn->failed) {
+        rc = socket_read(conn->sock, conn->buf + conn->buf_used, conn->buf_size - conn->buf_used);
+
+        if(rc > 0) {
+            conn->buf_used += rc;
+            rc = conn_dispatch(conn);
+        } else if(rc == 0) {
+            sleep_ms(1);
+        }
+
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Proxy connection failed with error %s!", plc_tag_decode_error(rc));
+
+            critical_block(conn->mutex) {
+                conn->failed = 1;
+            }
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    THREAD_RETURN(0);
+}
+
+
+
+
+/****** Library level functions. *******/
+
+void proxy_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* all tags are gone by now, so are all the connections. */
+
+    pdebug(DEBUG_DETAIL, "Destroying proxy mutex.");
+    if(proxy_mutex) {
+        mutex_destroy(&proxy_mutex);
+        proxy_mutex = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int proxy_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    pdebug(DEBUG_DETAIL, "Setting up mutex.");
+    if(!proxy_mutex) {
+        rc = mutex_create(&proxy_mutex);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s creating mutex!", plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
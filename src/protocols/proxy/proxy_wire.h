@@ -0,0 +1,84 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+/*
+ * Messages between the plctag_proxy daemon and the proxy protocol.
+ *
+ * Clients connect to the daemon over a Unix domain stream socket.  Every
+ * message is a header followed by length - sizeof(header) bytes of
+ * payload.  Both ends are on the same host, so everything is in native
+ * byte order.
+ *
+ *  command  request payload             reply payload
+ *  CREATE   tag attribute string        tag data
+ *  READ     none                        tag data
+ *  WRITE    tag data                    none
+ *  DESTROY  none, or the CREATE          no reply is sent
+ *           request ID if the tag has
+ *           no handle yet
+ *
+ * The client picks the request ID and the daemon copies it into the
+ * reply.  The handle comes from the CREATE reply.  The status is only
+ * used in replies and holds a PLCTAG_STATUS_OK or PLCTAG_ERR_* code.
+ * Replies for different tags can come in any order.
+ *
+ * This file only uses C99 types so that the daemon can include it.
+ */
+
+#include <stdint.h>
+
+#define PROXY_DEFAULT_SOCKET_PATH "/tmp/plctag_proxy.sock"
+
+#define PROXY_WIRE_VERSION (1)
+
+/* the largest message either end accepts. */
+#define PROXY_MAX_MESSAGE_SIZE (1 << 20)
+
+typedef enum {
+    PROXY_CMD_CREATE = 1,
+    PROXY_CMD_READ = 2,
+    PROXY_CMD_WRITE = 3,
+    PROXY_CMD_DESTROY = 4
+} proxy_command_t;
+
+typedef struct {
+    uint32_t length;      /* of the whole message, header included. */
+    uint8_t command;      /* proxy_command_t */
+    uint8_t version;      /* PROXY_WIRE_VERSION */
+    uint16_t reserved;
+    uint32_t request_id;
+    int32_t handle;
+    int32_t status;
+} proxy_msg_header_t;
@@ -0,0 +1,627 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Shared memory protocol.
+ *
+ * Tags read the data that another local process publishes into a shared
+ * memory region, see shm_region.h.  The publisher owns the connections
+ * to the PLC, so the PLC load does not grow with the number of readers.
+ *
+ * A read copies the slot out of the mapped region under its sequence lock
+ * and completes immediately.  It makes no system calls.  The tags are
+ * read only.
+ *
+ * Attributes:
+ *    region    - name of the published region, required.
+ *    name      - name of the published tag, required.
+ *    elem_size - size of an element in bytes, default 1.
+ *    stale_ms  - reads fail with PLCTAG_ERR_TIMEOUT when the publisher
+ *                has not updated its heartbeat for this long.  Default
+ *                5000, zero turns the check off.
+ *
+ * The data is copied as the publisher's protocol returned it.  Use the
+ * byte order attributes (str_is_counted etc.) to match that protocol
+ * when the tag holds strings.
+ *
+ * A region stays mapped while a tag uses it.  If the publisher restarts,
+ * the old region reads as not running and tags need to be recreated.
+ */
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <shm/shm.h>
+#include <shm/shm_region.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/rc.h>
+
+
+#define SHM_DEFAULT_STALE_MS (5000)
+
+/* a publisher crashing in the middle of an update leaves the slot locked. */
+#define SHM_MAX_READ_TRIES (100000)
+
+
+/* one mapping per region, shared by all tags using it. */
+struct shm_region_t {
+    struct shm_region_t *next;
+    int ref_count;
+    char *name;
+    shared_mem_p mem;
+    const shm_region_header_t *header;
+};
+
+typedef struct shm_region_t *shm_region_p;
+
+
+struct shm_tag_t {
+    /* base tag parts. */
+    TAG_BASE_STRUCT;
+
+    shm_region_p region;
+    const shm_region_slot_t *slot;
+    const uint8_t *slot_data;
+
+    int elem_size;
+    int elem_count;
+    int stale_ms;
+
+    /* the slot's change count as of the last read. */
+    uint64_t change_count;
+};
+
+typedef struct shm_tag_t *shm_tag_p;
+
+
+static int shm_tag_abort(plc_tag_p tag);
+static int shm_tag_read(plc_tag_p tag);
+static int shm_tag_status(plc_tag_p tag);
+static int shm_tag_tickler(plc_tag_p tag);
+static int shm_tag_write(plc_tag_p tag);
+static int shm_get_int_attrib(plc_tag_p tag, const char *attrib_name, int default_value);
+static int shm_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value);
+static void shm_tag_destroy(void *tag_arg);
+
+static int copy_slot(shm_tag_p tag);
+static const shm_region_slot_t *find_slot(const shm_region_header_t *header, const char *name);
+static shm_region_p region_get(const char *name);
+static void region_release(shm_region_p region);
+
+
+struct tag_vtable_t shm_tag_vtable = {
+    /* abort */     shm_tag_abort,
+    /* read */      shm_tag_read,
+    /* status */    shm_tag_status,
+    /* tickler */   shm_tag_tickler,
+    /* write */     shm_tag_write,
+
+    /* data accessors */
+
+    /* get_int_attrib */ shm_get_int_attrib,
+    /* set_int_attrib */ shm_set_int_attrib
+};
+
+
+tag_byte_order_t shm_tag_byte_order = {
+    .is_allocated = 0,
+
+    .int16_order = {0,1},
+    .int32_order = {0,1,2,3},
+    .int64_order = {0,1,2,3,4,5,6,7},
+    .float32_order = {0,1,2,3},
+    .float64_order = {0,1,2,3,4,5,6,7},
+
+    .str_is_defined = 1,
+    .str_is_counted = 0,
+    .str_is_fixed_length = 0,
+    .str_is_zero_terminated = 1, /* C-style string. */
+    .str_is_byte_swapped = 0,
+
+    .str_count_word_bytes = 0,
+    .str_max_capacity = 0,
+    .str_total_length = 0,
+    .str_pad_bytes = 0
+};
+
+
+/* shm module globals. */
+static mutex_p shm_mutex = NULL;
+static shm_region_p regions = NULL;
+
+
+
+plc_tag_p shm_tag_create(attr attribs)
+{
+    shm_tag_p tag = NULL;
+    const char *region_name = attr_get_str(attribs, "region", NULL);
+    const char *name = attr_get_str(attribs, "name", NULL);
+    int elem_size = attr_get_int(attribs, "elem_size", 1);
+    int stale_ms = attr_get_int(attribs, "stale_ms", SHM_DEFAULT_STALE_MS);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* check the attributes. */
+    if(!region_name || str_length(region_name) < 1) {
+        pdebug(DEBUG_WARN, "Shared memory region name is empty or missing!");
+        return PLC_TAG_P_NULL;
+    }
+
+    if(!name || str_length(name) < 1) {
+        pdebug(DEBUG_WARN, "Shared memory tag name is empty or missing!");
+        return PLC_TAG_P_NULL;
+    }
+
+    if(elem_size <= 0) {
+        pdebug(DEBUG_WARN, "Element size must be positive!");
+        return PLC_TAG_P_NULL;
+    }
+
+    if(stale_ms < 0) {
+        pdebug(DEBUG_WARN, "The stale time must not be negative!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag = (shm_tag_p)rc_alloc((int)sizeof(struct shm_tag_t), shm_tag_destroy);
+    if(!tag) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for shared memory tag!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->vtable = &shm_tag_vtable;
+    tag->byte_order = &shm_tag_byte_order;
+    tag->elem_size = elem_size;
+    tag->stale_ms = stale_ms;
+
+    critical_block(shm_mutex) {
+        tag->region = region_get(region_name);
+    }
+
+    if(!tag->region) {
+        pdebug(DEBUG_WARN, "Unable to open shared memory region %s!", region_name);
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->slot = find_slot(tag->region->header, name);
+    if(!tag->slot) {
+        pdebug(DEBUG_WARN, "Tag %s is not published in region %s!", name, region_name);
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    if(tag->slot->data_size % (uint32_t)elem_size) {
+        pdebug(DEBUG_WARN, "Tag %s has %u bytes, not a whole number of %d byte elements!", name, (unsigned int)tag->slot->data_size, elem_size);
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->slot_data = (const uint8_t *)tag->region->header + tag->slot->data_offset;
+    tag->size = (int)tag->slot->data_size;
+    tag->elem_count = tag->size / elem_size;
+
+    tag->data = mem_alloc(tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag data!");
+        rc_dec(tag);
+        return PLC_TAG_P_NULL;
+    }
+
+    /* the data is there already, so the tag is ready as soon as it exists. */
+    copy_slot(tag);
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return (plc_tag_p)tag;
+}
+
+
+
+void shm_tag_destroy(void *tag_arg)
+{
+    shm_tag_p tag = (shm_tag_p)tag_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Destructor called with null pointer!");
+        return;
+    }
+
+    if(tag->region) {
+        critical_block(shm_mutex) {
+            region_release(tag->region);
+        }
+
+        tag->region = NULL;
+    }
+
+    if(tag->ext_mutex) {
+        mutex_destroy(&(tag->ext_mutex));
+    }
+
+    if(tag->api_mutex) {
+        mutex_destroy(&(tag->api_mutex));
+    }
+
+    if(tag->data) {
+        mem_free(tag->data);
+        tag->data = NULL;
+    }
+
+    if(tag->byte_order && tag->byte_order->is_allocated) {
+        mem_free(tag->byte_order);
+        tag->byte_order = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/****** Tag vtable functions. ******/
+
+/* the tag API mutex is held by the caller for all of these. */
+
+int shm_tag_abort(plc_tag_p tag)
+{
+    /* reads finish before they return, so there is never anything to abort. */
+    tag->status = PLCTAG_STATUS_OK;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int shm_tag_read(plc_tag_p raw_tag)
+{
+    shm_tag_p tag = (shm_tag_p)raw_tag;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    rc = copy_slot(tag);
+
+    /* the read is done, let automatic reads see the completion. */
+    tag->read_complete = 1;
+    tag->status = (int8_t)rc;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+int shm_tag_status(plc_tag_p tag)
+{
+    return tag->status;
+}
+
+
+int shm_tag_tickler(plc_tag_p tag)
+{
+    /* nothing is ever in flight. */
+    (void)tag;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int shm_tag_write(plc_tag_p tag)
+{
+    pdebug(DEBUG_WARN, "Shared memory tags are read only!");
+
+    tag->status = PLCTAG_ERR_NOT_ALLOWED;
+
+    return PLCTAG_ERR_NOT_ALLOWED;
+}
+
+
+int shm_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_value)
+{
+    int res = default_value;
+    shm_tag_p tag = (shm_tag_p)raw_tag;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    /* match the attribute. */
+    if(str_cmp_i(attrib_name, "elem_size") == 0) {
+        res = tag->elem_size;
+    } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
+        res = tag->elem_count;
+    } else if(str_cmp_i(attrib_name, "stale_ms") == 0) {
+        res = tag->stale_ms;
+    } else if(str_cmp_i(attrib_name, "change_count") == 0) {
+        /* wraps, compare it with the value from the previous read. */
+        res = (int)(tag->change_count & INT32_MAX);
+    } else {
+        pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported.", attrib_name);
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return res;
+}
+
+
+int shm_set_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int new_value)
+{
+    shm_tag_p tag = (shm_tag_p)raw_tag;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(str_cmp_i(attrib_name, "stale_ms") == 0) {
+        if(new_value >= 0) {
+            tag->stale_ms = new_value;
+        } else {
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    } else {
+        pdebug(DEBUG_WARN, "Attribute \"%s\" is unsupported!", attrib_name);
+        rc = PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    tag->status = (int8_t)rc;
+
+    return rc;
+}
+
+
+
+
+/****** Helpers. ******/
+
+/*
+ * Copy the slot into the tag data under the slot's sequence lock.  Returns
+ * the publisher's status for the data or an error if the publisher is gone.
+ */
+int copy_slot(shm_tag_p tag)
+{
+    const shm_region_header_t *header = tag->region->header;
+    const shm_region_slot_t *slot = tag->slot;
+    int32_t status = PLCTAG_STATUS_OK;
+    uint64_t change_count = 0;
+    uint32_t seq_start = 0;
+    uint32_t seq_end = 0;
+    int tries = 0;
+
+    if(!header->publisher_running) {
+        pdebug(DEBUG_DETAIL, "The publisher of region %s has stopped.", tag->region->name);
+        return PLCTAG_ERR_BAD_CONNECTION;
+    }
+
+    if(tag->stale_ms > 0 && time_ms() - header->heartbeat_ms > tag->stale_ms) {
+        pdebug(DEBUG_DETAIL, "The publisher of region %s has not updated for %dms.", tag->region->name, tag->stale_ms);
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    do {
+        if(++tries > SHM_MAX_READ_TRIES) {
+            pdebug(DEBUG_WARN, "The slot stayed locked, the publisher of region %s may have died!", tag->region->name);
+            return PLCTAG_ERR_TIMEOUT;
+        }
+
+        seq_start = slot->seq;
+
+        if(seq_start & 1) {
+            /* an update is in progress. */
+            continue;
+        }
+
+        mem_barrier();
+
+        mem_copy(tag->data, (void *)tag->slot_data, tag->size);
+        status = slot->status;
+        change_count = slot->change_count;
+
+        mem_barrier();
+
+        seq_end = slot->seq;
+    } while((seq_start & 1) || seq_start != seq_end);
+
+    tag->change_count = change_count;
+
+    return (int)status;
+}
+
+
+/* the slot with the name, NULL if there is none. */
+const shm_region_slot_t *find_slot(const shm_region_header_t *header, const char *name)
+{
+    const shm_region_slot_t *slots = SHM_REGION_SLOTS(header);
+
+    for(uint32_t i = 0; i < header->slot_count; i++) {
+        char slot_name[SHM_SLOT_NAME_SIZE + 1] = {0};
+
+        /* the publisher is trusted, but not to terminate the name. */
+        mem_copy(slot_name, (void *)slots[i].name, SHM_SLOT_NAME_SIZE);
+
+        if(str_cmp_i(slot_name, name) == 0) {
+            if((uint64_t)slots[i].data_offset + slots[i].data_size > header->region_size || slots[i].data_size == 0) {
+                pdebug(DEBUG_WARN, "Slot %s lies outside the region!", slot_name);
+                return NULL;
+            }
+
+            return &slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/****** Region helpers, call these with the shm mutex held. ******/
+
+shm_region_p region_get(const char *name)
+{
+    shm_region_p region = regions;
+    const shm_region_header_t *header = NULL;
+    char *os_name = NULL;
+    int size = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* a region whose publisher stopped may have been replaced, so do not reuse it. */
+    while(region && (str_cmp(region->name, name) != 0 || !region->header->publisher_running)) {
+        region = region->next;
+    }
+
+    if(region) {
+        region->ref_count++;
+        return region;
+    }
+
+    pdebug(DEBUG_DETAIL, "Mapping shared memory region %s.", name);
+
+    region = mem_alloc((int)sizeof(struct shm_region_t));
+    if(!region) {
+        pdebug(DEBUG_ERROR, "Unable to allocate region!");
+        return NULL;
+    }
+
+    region->name = str_dup(name);
+    os_name = str_concat(SHM_REGION_NAME_PREFIX, name);
+
+    if(!region->name || !os_name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate region name!");
+        mem_free(os_name);
+        mem_free(region->name);
+        mem_free(region);
+        return NULL;
+    }
+
+    rc = shared_mem_open(&region->mem, os_name);
+    mem_free(os_name);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error %s opening region %s!", plc_tag_decode_error(rc), name);
+        mem_free(region->name);
+        mem_free(region);
+        return NULL;
+    }
+
+    /* check that the region is one we understand. */
+    header = shared_mem_data(region->mem);
+    size = shared_mem_size(region->mem);
+
+    if(size < (int)sizeof(shm_region_header_t)
+       || header->magic != SHM_REGION_MAGIC
+       || header->version != SHM_REGION_VERSION
+       || header->region_size > (uint32_t)size
+       || (uint64_t)header->slot_count * sizeof(shm_region_slot_t) + sizeof(shm_region_header_t) > header->region_size) {
+        pdebug(DEBUG_WARN, "Region %s is not a valid tag region!", name);
+        shared_mem_close(&region->mem);
+        mem_free(region->name);
+        mem_free(region);
+        return NULL;
+    }
+
+    region->header = header;
+    region->ref_count = 1;
+    region->next = regions;
+    regions = region;
+
+    return region;
+}
+
+
+void region_release(shm_region_p region)
+{
+    shm_region_p *walker = &regions;
+
+    region->ref_count--;
+
+    if(region->ref_count > 0) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Unmapping shared memory region %s.", region->name);
+
+    while(*walker && *walker != region) {
+        walker = &((*walker)->next);
+    }
+
+    if(*walker) {
+        *walker = region->next;
+    }
+
+    shared_mem_close(&region->mem);
+    mem_free(region->name);
+    mem_free(region);
+}
+
+
+
+
+/****** Library level functions. *******/
+
+void shm_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* all tags are gone by now, so are all the regions. */
+
+    pdebug(DEBUG_DETAIL, "Destroying shm mutex.");
+    if(shm_mutex) {
+        mutex_destroy(&shm_mutex);
+        shm_mutex = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int shm_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    pdebug(DEBUG_DETAIL, "Setting up mutex.");
+    if(!shm_mutex) {
+        rc = mutex_create(&shm_mutex);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s creating mutex!", plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
@@ -0,0 +1,89 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+/*
+ * Layout of a shared memory region of published tags.
+ *
+ * One publisher process (data_dumper -p) owns the PLC connections and
+ * copies each tag's data into a slot of the region after every read.
+ * Any number of local consumers map the region read-only and copy the
+ * slots out with the shm protocol.
+ *
+ * The region is a header, then the slot table, then the slot data.  Each
+ * slot's data starts on a cache line.  Everything is native byte order.
+ *
+ * Each slot is guarded by a sequence lock.  The publisher makes the
+ * sequence number odd, updates the slot and makes it even again.  A
+ * reader copies the slot between two loads of the sequence number and
+ * retries when they differ or are odd.  Readers never write the region.
+ *
+ * This file only uses C99 types so that publishers outside the library
+ * can include it.
+ */
+
+#include <stdint.h>
+
+#define SHM_REGION_MAGIC (0x4D485350) /* "PSHM" in memory on little endian */
+#define SHM_REGION_VERSION (1)
+
+/* the OS object name is this prefix and the region name. */
+#define SHM_REGION_NAME_PREFIX "plctag_"
+
+#define SHM_SLOT_NAME_SIZE (64)
+#define SHM_DATA_ALIGN (64)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t region_size;
+    int32_t publisher_pid;
+    volatile int32_t publisher_running; /* cleared when the publisher exits. */
+    volatile int64_t heartbeat_ms;      /* epoch ms, updated by the publisher while running. */
+    uint8_t reserved[32];
+} shm_region_header_t;
+
+typedef struct {
+    char name[SHM_SLOT_NAME_SIZE];       /* zero terminated. */
+    uint32_t data_offset;                /* from the start of the region. */
+    uint32_t data_size;
+    volatile uint32_t seq;               /* odd while the publisher updates the slot. */
+    volatile int32_t status;             /* status of the last read, PLCTAG_ERR_NO_DATA before the first. */
+    volatile uint64_t change_count;      /* number of times the data changed. */
+    volatile int64_t timestamp_ms;       /* epoch ms of the last read. */
+    uint8_t reserved[24];
+} shm_region_slot_t;
+
+#define SHM_REGION_SLOTS(region) ((shm_region_slot_t *)((uint8_t *)(region) + sizeof(shm_region_header_t)))
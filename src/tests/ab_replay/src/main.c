@@ -0,0 +1,243 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "../../ab_server/src/compat.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(IS_WINDOWS)
+#include <Windows.h>
+#else
+ /* assume it is POSIX of some sort... */
+#include <signal.h>
+#include <strings.h>
+#endif
+
+#include "replay.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+static void usage(void);
+static void process_args(int argc, const char **argv, replay_s *replay, const char **port, tcp_server_faults_s *faults);
+
+/* the largest EIP packet the library sends or receives is a bit over 4000 bytes. */
+#define CONN_BUFFER_SIZE (8192)
+
+#define DEFAULT_PORT "44818"
+
+
+#ifdef IS_WINDOWS
+
+typedef volatile int sig_flag_t;
+
+sig_flag_t done = 0;
+
+/* straight from MS' web site :-) */
+int WINAPI CtrlHandler(DWORD fdwCtrlType)
+{
+    switch (fdwCtrlType)
+    {
+        // Handle the CTRL-C signal.
+    case CTRL_C_EVENT:
+        info("^C event");
+        done = 1;
+        return TRUE;
+
+        // CTRL-CLOSE: confirm that the user wants to exit.
+    case CTRL_CLOSE_EVENT:
+        info("Close event");
+        done = 1;
+        return TRUE;
+
+        // Pass other signals to the next handler.
+    case CTRL_BREAK_EVENT:
+        info("^Break event");
+        done = 1;
+        return TRUE;
+
+    case CTRL_LOGOFF_EVENT:
+        info("Logoff event");
+        done = 1;
+        return TRUE;
+
+    case CTRL_SHUTDOWN_EVENT:
+        info("Shutdown event");
+        done = 1;
+        return TRUE;
+
+    default:
+        info("Default Event: %d", fdwCtrlType);
+        return FALSE;
+    }
+}
+
+
+void setup_break_handler(void)
+{
+    if (!SetConsoleCtrlHandler(CtrlHandler, TRUE))
+    {
+        printf("\nERROR: Could not set control handler!\n");
+        usage();
+    }
+}
+
+#else
+
+typedef volatile sig_atomic_t sig_flag_t;
+
+sig_flag_t done = 0;
+
+void SIGINT_handler(int not_used)
+{
+    (void)not_used;
+
+    done = 1;
+}
+
+void setup_break_handler(void)
+{
+    struct sigaction act;
+
+
+    /* set up signal handler. */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGINT_handler;
+    sigaction(SIGINT, &act, NULL);
+}
+
+#endif
+
+
+int main(int argc, const char **argv)
+{
+    tcp_server_p tcp_server = NULL;
+    replay_s replay;
+    const char *port = DEFAULT_PORT;
+    tcp_server_faults_s faults;
+
+    /* set up handler for ^C etc. */
+    setup_break_handler();
+
+    debug_off();
+
+    memset(&replay, 0, sizeof(replay));
+    memset(&faults, 0, sizeof(faults));
+
+    /* set the random seed. */
+    srand((unsigned int)time(NULL));
+
+    process_args(argc, argv, &replay, &port, &faults);
+
+    /* open a server connection and listen on the right port. */
+    tcp_server = tcp_server_create("0.0.0.0", port, CONN_BUFFER_SIZE, replay_handle_request, replay_open_conn, NULL, &replay);
+
+    tcp_server_set_request_len(tcp_server, replay_request_len);
+    tcp_server_set_faults(tcp_server, &faults);
+
+    tcp_server_start(tcp_server, &done);
+
+    tcp_server_destroy(tcp_server);
+
+    fprintf(stderr, "Replayed %zu requests, %zu differed from the capture.\n", replay.num_requests, replay.num_mismatches);
+
+    replay_free(&replay);
+
+    return (replay.num_mismatches > 0 ? 1 : 0);
+}
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: ab_replay --capture=<file> [--port=<port>] [--speed=<factor>] [<debugging options>]\n"
+                    "   <file> = capture written by the library with the tag attribute capture_file=<file>.\n"
+                    "   <port> = TCP port to listen on, default 44818.\n"
+                    "   <factor> = divide the captured response times by this, default 1.  Zero replays\n"
+                    "              without any delay.\n"
+                    "\n"
+                    "   Each request is answered with the captured response to the matching captured\n"
+                    "   request.  Requests that differ from the capture are reported.  The exit status\n"
+                    "   is non-zero if any did.\n"
+                    "\n"
+                    "   Debugging options:\n"
+                    "       --debug                turn on debugging output.\n"
+                    "\n"
+                    TCP_SERVER_FAULT_USAGE
+                    "\n"
+                    "Example: ab_replay --capture=plc.cap --speed=10\n");
+
+    exit(1);
+}
+
+
+void process_args(int argc, const char **argv, replay_s *replay, const char **port, tcp_server_faults_s *faults)
+{
+    const char *capture_file = NULL;
+    double speed = 1.0;
+
+    /* skip the program name. */
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i],"--capture=",10) == 0) {
+            capture_file = &argv[i][10];
+        } else if(strncmp(argv[i],"--port=",7) == 0) {
+            *port = &argv[i][7];
+        } else if(strncmp(argv[i],"--speed=",8) == 0) {
+            if(str_scanf(&argv[i][8], "%lf", &speed) != 1 || speed < 0.0) {
+                fprintf(stderr, "Unable to parse speed option \"%s\", it must be zero or more!\n", argv[i]);
+                usage();
+            }
+        } else if(strcmp(argv[i],"--debug") == 0) {
+            debug_on();
+        } else if(!tcp_server_parse_fault_arg(argv[i], faults)) {
+            fprintf(stderr, "Unknown option \"%s\"!\n", argv[i]);
+            usage();
+        }
+    }
+
+    if(!capture_file) {
+        fprintf(stderr, "A capture file must be given!\n");
+        usage();
+    }
+
+    if(!replay_load(replay, capture_file)) {
+        fprintf(stderr, "Unable to load capture file %s!\n", capture_file);
+        exit(1);
+    }
+
+    replay->speed = speed;
+}
@@ -0,0 +1,310 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Replays a session capture made by the library with capture_file=<path>.
+ *
+ * Each request from the client is answered with the response that followed
+ * the matching request in the capture, after the same delay as in the
+ * capture divided by the speed factor.   The sender context is copied from
+ * the live request so that the client can match the response.  Everything
+ * else, including session handles and connection IDs, comes from the
+ * capture and the library picks those up from the replayed responses.
+ *
+ * Requests are compared with the captured ones to spot where the client
+ * has diverged from the capture.   Fields that differ from run to run are
+ * not compared: the sender context, the connection sequence number and the
+ * contents of Forward Open and Forward Close requests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+
+#define EIP_HEADER_SIZE (24)
+#define EIP_SENDER_CONTEXT_OFFSET (12)
+#define EIP_SENDER_CONTEXT_SIZE (8)
+
+#define EIP_UNCONNECTED_SEND ((uint16_t)0x006F)
+#define EIP_CONNECTED_SEND ((uint16_t)0x0070)
+
+/* offsets in unconnected and connected CPF packets. */
+#define UNCONNECTED_SERVICE_OFFSET (40)
+#define CONNECTED_SEQ_NUM_OFFSET (44)
+
+#define CIP_FORWARD_OPEN ((uint8_t)0x54)
+#define CIP_FORWARD_OPEN_EX ((uint8_t)0x5B)
+#define CIP_FORWARD_CLOSE ((uint8_t)0x4E)
+
+
+static uint64_t get_uint_le(const uint8_t *data, size_t size);
+static bool request_matches(slice_s input, replay_record_s *record);
+
+
+
+bool replay_load(replay_s *replay, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    long file_size = 0;
+    size_t offset = REPLAY_CAPTURE_MAGIC_SIZE;
+    size_t capacity = 0;
+
+    memset(replay, 0, sizeof(*replay));
+    replay->speed = 1.0;
+
+    if(!file) {
+        info("WARN: Unable to open capture file %s!", path);
+        return false;
+    }
+
+    if(fseek(file, 0, SEEK_END) != 0 || (file_size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        info("WARN: Unable to get the size of capture file %s!", path);
+        fclose(file);
+        return false;
+    }
+
+    replay->file_data = malloc((size_t)file_size + 1);
+    if(!replay->file_data || fread(replay->file_data, 1, (size_t)file_size, file) != (size_t)file_size) {
+        info("WARN: Unable to read capture file %s!", path);
+        fclose(file);
+        replay_free(replay);
+        return false;
+    }
+
+    fclose(file);
+
+    if((size_t)file_size < REPLAY_CAPTURE_MAGIC_SIZE || memcmp(replay->file_data, REPLAY_CAPTURE_MAGIC, REPLAY_CAPTURE_MAGIC_SIZE) != 0) {
+        info("WARN: %s is not a libplctag capture file!", path);
+        replay_free(replay);
+        return false;
+    }
+
+    /* index the records, a truncated last record is ignored. */
+    while(offset + REPLAY_RECORD_HEADER_SIZE <= (size_t)file_size) {
+        uint8_t *header = replay->file_data + offset;
+        size_t len = (size_t)get_uint_le(header + 9, 4);
+
+        if(offset + REPLAY_RECORD_HEADER_SIZE + len > (size_t)file_size) {
+            info("WARN: Capture file %s ends in the middle of a record.", path);
+            break;
+        }
+
+        if(replay->num_records >= capacity) {
+            size_t new_capacity = (capacity ? capacity * 2 : 1024);
+            replay_record_s *new_records = realloc(replay->records, new_capacity * sizeof(replay_record_s));
+
+            if(!new_records) {
+                info("WARN: Unable to allocate memory for capture records!");
+                replay_free(replay);
+                return false;
+            }
+
+            replay->records = new_records;
+            capacity = new_capacity;
+        }
+
+        replay->records[replay->num_records].timestamp_ms = (int64_t)get_uint_le(header, 8);
+        replay->records[replay->num_records].type = header[8];
+        replay->records[replay->num_records].len = len;
+        replay->records[replay->num_records].data = header + REPLAY_RECORD_HEADER_SIZE;
+        replay->num_records++;
+
+        offset += REPLAY_RECORD_HEADER_SIZE + len;
+    }
+
+    info("Loaded %zu records from %s.", replay->num_records, path);
+
+    return true;
+}
+
+
+void replay_free(replay_s *replay)
+{
+    free(replay->records);
+    free(replay->file_data);
+
+    replay->records = NULL;
+    replay->file_data = NULL;
+    replay->num_records = 0;
+}
+
+
+size_t replay_request_len(slice_s input)
+{
+    if(slice_len(input) < EIP_HEADER_SIZE) {
+        return 0;
+    }
+
+    return EIP_HEADER_SIZE + (size_t)slice_get_uint16_le(input, 2);
+}
+
+
+/*
+ * Each connection in the capture starts with a connect record.   A new
+ * client connection picks up at the next captured connection, unless we
+ * are already at its start.
+ */
+void *replay_open_conn(void *context)
+{
+    replay_s *replay = (replay_s *)context;
+
+    if(replay->next_record > 0) {
+        while(replay->next_record < replay->num_records && replay->records[replay->next_record].type != REPLAY_RECORD_CONNECT) {
+            replay->next_record++;
+        }
+    }
+
+    if(replay->next_record < replay->num_records) {
+        replay_record_s *record = &replay->records[replay->next_record];
+
+        info("New connection, replaying from record %zu (captured connection to %.*s).",
+             replay->next_record, (int)record->len, (const char *)record->data);
+
+        replay->next_record++;
+    } else {
+        info("New connection, but the capture is used up.");
+    }
+
+    return replay;
+}
+
+
+slice_s replay_handle_request(slice_s input, slice_s output, void *context)
+{
+    replay_s *replay = (replay_s *)context;
+    replay_record_s *request = NULL;
+    replay_record_s *response = NULL;
+
+    /* find the next captured request, stop at the end of the captured connection. */
+    while(replay->next_record < replay->num_records && replay->records[replay->next_record].type == REPLAY_RECORD_RECEIVED) {
+        replay->next_record++;
+    }
+
+    if(replay->next_record >= replay->num_records || replay->records[replay->next_record].type != REPLAY_RECORD_SENT) {
+        info("The captured connection has no more requests, closing the connection.");
+        return slice_make_err(TCP_SERVER_DONE);
+    }
+
+    request = &replay->records[replay->next_record];
+    replay->next_record++;
+    replay->num_requests++;
+
+    if(!request_matches(input, request)) {
+        replay->num_mismatches++;
+        info("WARN: Request %zu differs from the capture!", replay->num_requests);
+        slice_dump(input);
+    }
+
+    if(replay->next_record < replay->num_records && replay->records[replay->next_record].type == REPLAY_RECORD_RECEIVED) {
+        response = &replay->records[replay->next_record];
+        replay->next_record++;
+    }
+
+    if(!response) {
+        /* nothing was received for this request, e.g. UnRegister Session. */
+        return slice_make_err(TCP_SERVER_PROCESSED);
+    }
+
+    if(replay->speed > 0.0) {
+        int delay_ms = (int)((double)(response->timestamp_ms - request->timestamp_ms) / replay->speed);
+
+        if(delay_ms > 0) {
+            util_sleep_ms(delay_ms);
+        }
+    }
+
+    if(response->len > slice_len(output) || response->len < EIP_HEADER_SIZE) {
+        info("WARN: Captured response of %zu bytes does not fit or is too short, closing the connection!", response->len);
+        return slice_make_err(TCP_SERVER_DONE);
+    }
+
+    memcpy(output.data, response->data, response->len);
+
+    /* the client matches responses to requests with the sender context. */
+    memcpy(output.data + EIP_SENDER_CONTEXT_OFFSET, input.data + EIP_SENDER_CONTEXT_OFFSET, EIP_SENDER_CONTEXT_SIZE);
+
+    return slice_from_slice(output, 0, response->len);
+}
+
+
+
+uint64_t get_uint_le(const uint8_t *data, size_t size)
+{
+    uint64_t res = 0;
+
+    for(size_t i=0; i < size; i++) {
+        res |= ((uint64_t)data[i]) << (i * 8);
+    }
+
+    return res;
+}
+
+
+bool request_matches(slice_s input, replay_record_s *record)
+{
+    uint16_t command = 0;
+
+    if(slice_len(input) != record->len || record->len < EIP_HEADER_SIZE) {
+        return false;
+    }
+
+    command = slice_get_uint16_le(input, 0);
+
+    if(command != (uint16_t)get_uint_le(record->data, 2)) {
+        return false;
+    }
+
+    for(size_t i=EIP_HEADER_SIZE; i < record->len; i++) {
+        if(command == EIP_CONNECTED_SEND && (i == CONNECTED_SEQ_NUM_OFFSET || i == CONNECTED_SEQ_NUM_OFFSET + 1)) {
+            continue;
+        }
+
+        if(command == EIP_UNCONNECTED_SEND && record->len > UNCONNECTED_SERVICE_OFFSET) {
+            uint8_t service = record->data[UNCONNECTED_SERVICE_OFFSET];
+
+            if(service == CIP_FORWARD_OPEN || service == CIP_FORWARD_OPEN_EX || service == CIP_FORWARD_CLOSE) {
+                return true;
+            }
+        }
+
+        if(slice_get_uint8(input, i) != record->data[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
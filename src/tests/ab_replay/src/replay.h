@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../../ab_server/src/slice.h"
+
+/* capture file format, see src/protocols/ab/capture.h in the library. */
+#define REPLAY_CAPTURE_MAGIC "PLCTCAP1"
+#define REPLAY_CAPTURE_MAGIC_SIZE (8)
+#define REPLAY_RECORD_HEADER_SIZE (13)
+
+#define REPLAY_RECORD_CONNECT (1)
+#define REPLAY_RECORD_SENT (2)
+#define REPLAY_RECORD_RECEIVED (3)
+
+typedef struct {
+    int64_t timestamp_ms;
+    uint8_t type;
+    size_t len;
+    uint8_t *data;
+} replay_record_s;
+
+typedef struct {
+    uint8_t *file_data;
+    replay_record_s *records;
+    size_t num_records;
+
+    /* the next record to replay. */
+    size_t next_record;
+
+    /* response delays are divided by this, zero means no delays. */
+    double speed;
+
+    /* statistics. */
+    size_t num_requests;
+    size_t num_mismatches;
+} replay_s;
+
+extern bool replay_load(replay_s *replay, const char *path);
+extern void replay_free(replay_s *replay);
+extern size_t replay_request_len(slice_s input);
+extern void *replay_open_conn(void *replay);
+extern slice_s replay_handle_request(slice_s input, slice_s output, void *replay);
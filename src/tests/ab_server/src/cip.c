@@ -34,6 +34,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cip.h"
 #include "eip.h"
 #include "pccc.h"
@@ -46,7 +47,7 @@
 const uint8_t CIP_MULTI[] = { 0x0A, 0x02, 0x20, 0x02, 0x24, 0x01 };
 const uint8_t CIP_READ[] = { 0x4C };
 const uint8_t CIP_WRITE[] = { 0x4D };
-const uint8_t CIP_RMW[] = { 0x4E, 0x02, 0x20, 0x02, 0x24, 0x01 };
+const uint8_t CIP_RMW[] = { 0x4E };
 const uint8_t CIP_READ_FRAG[] = { 0x52 };
 const uint8_t CIP_WRITE_FRAG[] = { 0x53 };
 
@@ -56,9 +57,14 @@ const uint8_t CIP_WRITE_FRAG[] = { 0x53 };
 const uint8_t CIP_PCCC_EXECUTE[] = { 0x4B, 0x02, 0x20, 0x67, 0x24, 0x01, 0x07, 0x3d, 0xf3, 0x45, 0x43, 0x50, 0x21 };
 const uint8_t CIP_FORWARD_CLOSE[] = { 0x4E, 0x02, 0x20, 0x06, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_OPEN[] = { 0x54, 0x02, 0x20, 0x06, 0x24, 0x01 };
-const uint8_t CIP_LIST_TAGS[] = { 0x55, 0x02, 0x20, 0x02, 0x24, 0x01 };
+const uint8_t CIP_LIST_TAGS[] = { 0x55 };
+const uint8_t CIP_GET_ATTRIBUTE_LIST[] = { 0x03 };
 const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 
+/* object classes addressed by the non-tag commands. */
+const uint8_t CIP_SYMBOL_CLASS[] = { 0x20, 0x6B };
+const uint8_t CIP_TEMPLATE_CLASS[] = { 0x20, 0x6C };
+
 /* path to match. */
 // uint8_t LOGIX_CONN_PATH[] = { 0x03, 0x00, 0x00, 0x20, 0x02, 0x24, 0x01 };
 // uint8_t MICRO800_CONN_PATH[] = { 0x02, 0x20, 0x02, 0x24, 0x01 };
@@ -67,15 +73,23 @@ const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 
 #define CIP_SYMBOLIC_SEGMENT_MARKER ((uint8_t)0x91)
 
+/* UDT data is typed as an abbreviated structure followed by the structure handle. */
+#define CIP_TYPE_ABBREVIATED_STRUCT ((uint16_t)0x02A0)
+
 /* CIP Errors */
 
 #define CIP_OK                  ((uint8_t)0x00)
 #define CIP_ERR_0x01            ((uint8_t)0x01)
 #define CIP_ERR_FRAG            ((uint8_t)0x06)
+#define CIP_ERR_PATH_UNKNOWN    ((uint8_t)0x05)
 #define CIP_ERR_UNSUPPORTED     ((uint8_t)0x08)
+#define CIP_ERR_INVALID_REPLY   ((uint8_t)0x13)
+#define CIP_ERR_ATTR_UNSUPPORTED ((uint8_t)0x14)
+#define CIP_ERR_PARTIAL         ((uint8_t)0x1E)
 #define CIP_ERR_EXTENDED        ((uint8_t)0xff)
 
 #define CIP_ERR_EX_TOO_LONG     ((uint16_t)0x2105)
+#define CIP_ERR_EX_BAD_SIZE     ((uint16_t)0x0109)
 
 typedef struct {
     uint8_t service_code;   /* why is the operation code _before_ the path? */
@@ -83,12 +97,21 @@ typedef struct {
     slice_s path;           /* store this in a slice to avoid copying */
 } cip_header_s;
 
+static slice_s handle_multi_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_rmw_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_list_tags(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_template_attributes(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_template_read(slice_s input, slice_s output, plc_s *plc);
 
+static bool inject_cip_error(slice_s input, plc_s *plc);
 static bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *start_read_offset);
+static bool process_instance_segment(slice_s input, size_t *offset, uint32_t *instance_id);
+static size_t tag_type_size(tag_def_s *tag);
+static size_t set_tag_type(slice_s output, size_t offset, tag_def_s *tag);
 static slice_s make_cip_error(slice_s output, uint8_t cip_cmd, uint8_t cip_err, bool extend, uint16_t extended_error);
 static bool match_path(slice_s input, bool need_pad, uint8_t *path, uint8_t path_len);
 
@@ -97,8 +120,15 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
     info("Got packet:");
     slice_dump(input);
 
+    /* tag reads and writes can be made to fail on purpose. */
+    if(inject_cip_error(input, plc)) {
+        return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | CIP_DONE), plc->cip_error_code, false, 0);
+    }
+
     /* match the prefix and dispatch. */
-    if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ))) {
+    if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ)) && slice_match_bytes(slice_from_slice(input, 2, slice_len(input)), CIP_TEMPLATE_CLASS, sizeof(CIP_TEMPLATE_CLASS))) {
+        return handle_template_read(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ))) {
         return handle_read_request(input, output, plc);
     } else if(slice_match_bytes(input, CIP_READ_FRAG, sizeof(CIP_READ_FRAG))) {
         return handle_read_request(input, output, plc);
@@ -112,14 +142,164 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
         return handle_forward_open(input, output, plc);
     } else if(slice_match_bytes(input, CIP_FORWARD_CLOSE, sizeof(CIP_FORWARD_CLOSE))) {
         return handle_forward_close(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_RMW, sizeof(CIP_RMW))) {
+        /* after Forward Close, which has the same service code. */
+        return handle_rmw_request(input, output, plc);
     } else if(slice_match_bytes(input, CIP_PCCC_EXECUTE, sizeof(CIP_PCCC_EXECUTE))) {
         return dispatch_pccc_request(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_MULTI, sizeof(CIP_MULTI))) {
+        return handle_multi_request(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_LIST_TAGS, sizeof(CIP_LIST_TAGS))) {
+        return handle_list_tags(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_GET_ATTRIBUTE_LIST, sizeof(CIP_GET_ATTRIBUTE_LIST))) {
+        return handle_template_attributes(input, output, plc);
     } else {
             return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | (uint8_t)CIP_DONE), (uint8_t)CIP_ERR_UNSUPPORTED, false, (uint16_t)0);
     }
 }
 
 
+/*
+ * Multiple Service Packet.
+ *
+ * Request:
+ *   0x0A 0x02 0x20 0x02 0x24 0x01  - service and path to the Message Router.
+ *   uint16 count                   - number of embedded requests.
+ *   uint16 offsets[count]          - offsets of each request from the count field.
+ *   requests...
+ *
+ * Response:
+ *   0x8A 0x00 <status> 0x00        - status is 0x1E if any embedded request failed.
+ *   uint16 count
+ *   uint16 offsets[count]          - offsets of each response from the count field.
+ *   responses...
+ *
+ * Each embedded request is dispatched as if it came in by itself.   We hold back
+ * enough space in the output for the minimal error response of each remaining
+ * request so that one large read cannot starve the requests after it.
+ *
+ * The input and output share the same buffer, so the request is copied before
+ * any responses are written.
+ */
+
+#define CIP_MULTI_MIN_SIZE          (10)
+#define CIP_MULTI_MIN_RESP_SIZE     (4)
+
+slice_s handle_multi_request(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t multi_cmd = slice_get_uint8(input, 0);
+    uint8_t *req_copy = NULL;
+    slice_s req_data;
+    slice_s resp_data;
+    uint16_t request_count = 0;
+    size_t req_header_size = 0;
+    size_t resp_offset = 0;
+    uint8_t multi_status = CIP_OK;
+
+    if(slice_len(input) < CIP_MULTI_MIN_SIZE) {
+        info("Insufficient data in the CIP multiple service request!");
+        return make_cip_error(output, multi_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    /* the offsets are all relative to the request count field. */
+    req_data = slice_from_slice(input, sizeof(CIP_MULTI), slice_len(input));
+    request_count = slice_get_uint16_le(req_data, 0);
+    req_header_size = (size_t)2 + ((size_t)2 * (size_t)request_count);
+
+    if(request_count == 0 || req_header_size >= slice_len(req_data)) {
+        info("Multiple service request has an illegal request count %u for a payload of %zu bytes!", request_count, slice_len(req_data));
+        return make_cip_error(output, multi_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    req_copy = malloc(slice_len(req_data));
+    if(!req_copy) {
+        error("Unable to allocate memory for the multiple service request!");
+    }
+
+    memcpy(req_copy, slice_get_bytes(req_data, 0), slice_len(req_data));
+    req_data = slice_make(req_copy, (ssize_t)slice_len(req_data));
+
+    /* the response header has the same layout after the generic CIP response header. */
+    resp_data = slice_from_slice(output, 4, slice_len(output));
+    resp_offset = req_header_size;
+
+    if(resp_offset + ((size_t)request_count * CIP_MULTI_MIN_RESP_SIZE) > slice_len(resp_data)) {
+        info("Multiple service request with %u requests cannot fit in a response of %zu bytes!", request_count, slice_len(output));
+        free(req_copy);
+        return make_cip_error(output, multi_cmd | CIP_DONE, CIP_ERR_INVALID_REPLY, false, 0);
+    }
+
+    slice_set_uint16_le(resp_data, 0, request_count);
+
+    for(uint16_t i=0; i < request_count; i++) {
+        size_t req_start = (size_t)slice_get_uint16_le(req_data, (size_t)2 + ((size_t)2 * i));
+        size_t req_end = (i + 1 < request_count ? (size_t)slice_get_uint16_le(req_data, (size_t)2 + ((size_t)2 * (i + 1))) : slice_len(req_data));
+        size_t resp_space = 0;
+        slice_s sub_req;
+        slice_s sub_resp;
+
+        /* hold back room for the minimal responses of the remaining requests. */
+        resp_space = slice_len(resp_data) - resp_offset - ((size_t)(request_count - i - 1) * CIP_MULTI_MIN_RESP_SIZE);
+        sub_resp = slice_from_slice(resp_data, resp_offset, resp_space);
+
+        if(req_start < req_header_size || req_end > slice_len(req_data) || req_start >= req_end) {
+            info("Embedded request %u has illegal bounds %zu to %zu!", i, req_start, req_end);
+            sub_resp = make_cip_error(sub_resp, 0, CIP_ERR_UNSUPPORTED, false, 0);
+        } else {
+            sub_req = slice_from_slice(req_data, req_start, req_end - req_start);
+
+            if(slice_match_bytes(sub_req, CIP_MULTI, sizeof(CIP_MULTI))) {
+                info("Nested multiple service requests are not supported!");
+                sub_resp = make_cip_error(sub_resp, multi_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+            } else {
+                sub_resp = cip_dispatch_request(sub_req, sub_resp, plc);
+            }
+        }
+
+        if(slice_has_err(sub_resp)) {
+            info("Embedded request %u could not be processed!", i);
+            free(req_copy);
+            return make_cip_error(output, multi_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+
+        /* fragmented reads are not errors, anything else is. */
+        if(slice_get_uint8(sub_resp, 2) != CIP_OK && slice_get_uint8(sub_resp, 2) != CIP_ERR_FRAG) {
+            multi_status = CIP_ERR_PARTIAL;
+        }
+
+        slice_set_uint16_le(resp_data, (size_t)2 + ((size_t)2 * i), (uint16_t)resp_offset);
+        resp_offset += slice_len(sub_resp);
+    }
+
+    free(req_copy);
+
+    slice_set_uint8(output, 0, multi_cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* reserved, must be zero. */
+    slice_set_uint8(output, 2, multi_status);
+    slice_set_uint8(output, 3, 0); /* no additional status words. */
+
+    return slice_from_slice(output, 0, resp_offset + 4);
+}
+
+
+/* randomly fail tag requests if asked to. */
+bool inject_cip_error(slice_s input, plc_s *plc)
+{
+    uint8_t service = slice_get_uint8(input, 0);
+
+    if(service != CIP_READ[0] && service != CIP_READ_FRAG[0] && service != CIP_WRITE[0] && service != CIP_WRITE_FRAG[0] && service != CIP_RMW[0]) {
+        return false;
+    }
+
+    if(util_rand_percent(plc->cip_error_percent)) {
+        info("Injecting CIP error %02x for service %02x.", plc->cip_error_code, slice_get_uint8(input, 0));
+        return true;
+    }
+
+    return false;
+}
+
+
 /* a handy structure to hold all the parameters we need to receive in a Forward Open request. */
 typedef struct {
     uint8_t secs_per_tick;                  /* seconds per tick */
@@ -206,10 +386,10 @@ slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc)
         return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | CIP_DONE), (uint8_t)CIP_ERR_UNSUPPORTED, false, (uint16_t)0);
     }
 
-    /* check to see how many refusals we should do. */
-    if(plc->reject_fo_count > 0) {
-        plc->reject_fo_count--;
-        info("Forward open request being bounced for debugging. %d to go.", plc->reject_fo_count);
+    /* check to see how many refusals we should do.   The count is across all connections. */
+    if(plc->shared && plc->shared->reject_fo_count > 0) {
+        plc->shared->reject_fo_count--;
+        info("Forward open request being bounced for debugging. %d to go.", plc->shared->reject_fo_count);
         return make_cip_error(output,
                              (uint8_t)(slice_get_uint8(input, 0) | CIP_DONE),
                              (uint8_t)CIP_ERR_0x01,
@@ -217,6 +397,25 @@ slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc)
                              (uint16_t)0x100);
     }
 
+    /* check the requested packet sizes against what we support. */
+    if(plc->max_packet > 0) {
+        uint32_t requested = fo_req.server_to_client_conn_params & ((fo_cmd == CIP_FORWARD_OPEN[0]) ? 0x1FF : 0x0FFF);
+
+        if(requested > plc->max_packet) {
+            info("Forward open request asks for %u bytes but only %u are supported.", requested, plc->max_packet);
+
+            offset = 0;
+            slice_set_uint8(output, offset, (uint8_t)(fo_cmd | CIP_DONE)); offset++;
+            slice_set_uint8(output, offset, 0); offset++; /* padding/reserved. */
+            slice_set_uint8(output, offset, CIP_ERR_0x01); offset++;
+            slice_set_uint8(output, offset, 2); offset++; /* two words of extended status. */
+            slice_set_uint16_le(output, offset, CIP_ERR_EX_BAD_SIZE); offset += 2;
+            slice_set_uint16_le(output, offset, (uint16_t)plc->max_packet); offset += 2;
+
+            return slice_from_slice(output, 0, offset);
+        }
+    }
+
     /* all good if we got here. */
     plc->client_connection_id = fo_req.client_conn_id;
     plc->client_connection_serial_number = fo_req.conn_serial_number;
@@ -448,7 +647,7 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
 
     /* do we need to fragment the result? */
     remaining_size = total_request_size - byte_offset;
-    packet_capacity = slice_len(output) - 6; /* MAGIC - CIP header plus data type bytes is 6 bytes. */
+    packet_capacity = slice_len(output) - (4 + tag_type_size(tag)); /* MAGIC - CIP header is 4 bytes, then the data type. */
 
     info("packet_capacity = %d", packet_capacity);
 
@@ -468,7 +667,7 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
     slice_set_uint8(output, offset, 0); offset++; /* no extra error fields. */
 
     /* copy the data type. */
-    slice_set_uint16_le(output, offset, tag->tag_type); offset += 2;
+    offset = set_tag_type(output, offset, tag);
 
     /* how much data to copy? */
     amount_to_copy = (remaining_size < packet_capacity ? remaining_size : packet_capacity);
@@ -483,7 +682,7 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
 
     /* FIXME - use memcpy */
     for(size_t i=0; i < amount_to_copy; i++) {
-        slice_set_uint8(output, offset + i, tag->data[byte_offset + i]);
+        slice_set_uint8(output, offset + i, tag->data[read_start_offset + byte_offset + i]);
     }
 
     offset += amount_to_copy;
@@ -535,8 +734,15 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
     /* get the tag data type and compare. */
     write_data_type = slice_get_uint16_le(input, offset); offset += 2;
 
-    /* check that the data types match. */
-    if(tag->tag_type != write_data_type) {
+    /* check that the data types match.  UDTs are identified by their structure handle. */
+    if(tag->udt) {
+        uint16_t write_handle = slice_get_uint16_le(input, offset); offset += 2;
+
+        if(write_data_type != CIP_TYPE_ABBREVIATED_STRUCT || write_handle != tag->udt->handle) {
+            info("tag structure handle %04x does not match the data type in the write request %04x:%04x", tag->udt->handle, write_data_type, write_handle);
+            return make_cip_error(output, write_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+    } else if(tag->tag_type != write_data_type) {
         info("tag data type %02x does not match the data type in the write request %02x", tag->tag_type, write_data_type);
         return make_cip_error(output, write_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
     }
@@ -567,7 +773,7 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
     info("total_request_size = %d", total_request_size);
 
     /* check the amount */
-    if(byte_offset + total_request_size > tag_data_length) {
+    if(write_start_offset + byte_offset + total_request_size > tag_data_length) {
         info("request tries to write too much data!");
         return make_cip_error(output, write_cmd | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
     }
@@ -576,7 +782,7 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
     info("byte_offset = %d", byte_offset);
     info("offset = %d", offset);
     info("total_request_size = %d", total_request_size);
-    memcpy(&tag->data[byte_offset], slice_get_bytes(input, offset), total_request_size);
+    memcpy(&tag->data[write_start_offset + byte_offset], slice_get_bytes(input, offset), total_request_size);
 
     /* start making the response. */
     offset = 0;
@@ -592,6 +798,511 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
 
 
 
+/*
+ * Read Modify Write Tag.
+ *
+ * Request:
+ *   0x4E <path size> <tag path>
+ *   uint16 mask size       - bytes in each mask.
+ *   uint8 or_mask[size]
+ *   uint8 and_mask[size]
+ *
+ * Response:
+ *   0xCE 0x00 <status> 0x00
+ *
+ * Each byte of the element becomes (old | OR) & AND.   This is how clients
+ * write single bits.
+ */
+
+#define CIP_RMW_MIN_SIZE (6)
+
+slice_s handle_rmw_request(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t tag_segment_size = 0;
+    size_t start_offset = 0;
+    size_t offset = 0;
+    tag_def_s *tag = NULL;
+    uint16_t mask_size = 0;
+
+    if(slice_len(input) < CIP_RMW_MIN_SIZE) {
+        info("Insufficient data in the CIP read-modify-write request!");
+        return make_cip_error(output, CIP_RMW[0] | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    offset = 1;
+    tag_segment_size = slice_get_uint8(input, offset); offset++;
+
+    /* check that we have space for the mask size. */
+    if(slice_len(input) < offset + (size_t)(tag_segment_size * 2) + 2) {
+        info("Request does not have enough space for the mask size!");
+        return make_cip_error(output, CIP_RMW[0] | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    if(!process_tag_segment(plc, slice_from_slice(input, offset, (size_t)(tag_segment_size * 2)), &tag, &start_offset)) {
+        return make_cip_error(output, CIP_RMW[0] | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    /* step past the tag segment. */
+    offset += (size_t)(tag_segment_size * 2);
+
+    mask_size = slice_get_uint16_le(input, offset); offset += 2;
+
+    if(mask_size == 0 || slice_len(input) != offset + (size_t)(mask_size * 2)) {
+        info("Mask size %d does not match the request length!", mask_size);
+        return make_cip_error(output, CIP_RMW[0] | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_BAD_SIZE);
+    }
+
+    if(start_offset + mask_size > (size_t)(tag->elem_count * tag->elem_size)) {
+        info("request tries to modify too much data!");
+        return make_cip_error(output, CIP_RMW[0] | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
+    }
+
+    for(size_t i=0; i < mask_size; i++) {
+        uint8_t or_mask = slice_get_uint8(input, offset + i);
+        uint8_t and_mask = slice_get_uint8(input, offset + mask_size + i);
+
+        tag->data[start_offset + i] = (uint8_t)((tag->data[start_offset + i] | or_mask) & and_mask);
+    }
+
+    /* start making the response. */
+    offset = 0;
+    slice_set_uint8(output, offset, CIP_RMW[0] | CIP_DONE); offset++;
+    slice_set_uint8(output, offset, 0); offset++; /* padding/reserved. */
+    slice_set_uint8(output, offset, CIP_OK); offset++; /* no error. */
+    slice_set_uint8(output, offset, 0); offset++; /* no extra error fields. */
+
+    return slice_from_slice(output, 0, offset);
+}
+
+
+
+
+
+/*
+ * Get Instance Attribute List on the Symbol Object.   This is how clients
+ * list the tags in the PLC.
+ *
+ * Request:
+ *   0x55 <path size> 0x20 0x6B <instance segment>   - first instance ID to return.
+ *   uint16 count                                   - number of attributes.
+ *   uint16 attributes[count]
+ *
+ * Response:
+ *   0xD5 0x00 <status> 0x00    - status is 0x06 if there are instances after the last one returned.
+ *   for each instance:
+ *     uint32 instance ID
+ *     the requested attributes in the order requested.
+ *
+ * Only whole instances are returned.   The client asks again starting after
+ * the last instance ID it received.
+ *
+ * We do not have any programs so listing program tags always fails.
+ */
+
+#define CIP_LIST_TAGS_MIN_SIZE      (10)
+#define CIP_LIST_TAGS_MAX_ATTRS     (8)
+
+#define SYMBOL_ATTR_NAME            ((uint16_t)1)
+#define SYMBOL_ATTR_TYPE            ((uint16_t)2)
+#define SYMBOL_ATTR_ELEM_SIZE       ((uint16_t)7)
+#define SYMBOL_ATTR_DIMENSIONS      ((uint16_t)8)
+
+static size_t symbol_attr_size(tag_def_s *tag, uint16_t attr);
+static size_t set_symbol_attr(slice_s output, size_t offset, tag_def_s *tag, uint16_t attr);
+
+slice_s handle_list_tags(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t list_cmd = slice_get_uint8(input, 0);
+    size_t path_size = (size_t)slice_get_uint8(input, 1) * 2;
+    slice_s path = slice_from_slice(input, 2, path_size);
+    size_t offset = 0;
+    uint32_t start_instance = 0;
+    uint16_t num_attrs = 0;
+    uint16_t attrs[CIP_LIST_TAGS_MAX_ATTRS];
+    size_t tag_index = 0;
+    size_t num_returned = 0;
+
+    if(slice_len(input) < CIP_LIST_TAGS_MIN_SIZE || slice_len(path) != path_size) {
+        info("Insufficient data in the CIP list tags request!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    if(slice_get_uint8(path, 0) == CIP_SYMBOLIC_SEGMENT_MARKER) {
+        info("Program tags are not supported!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_PATH_UNKNOWN, false, 0);
+    }
+
+    offset = sizeof(CIP_SYMBOL_CLASS);
+    if(!slice_match_bytes(path, CIP_SYMBOL_CLASS, sizeof(CIP_SYMBOL_CLASS))
+       || !process_instance_segment(path, &offset, &start_instance)
+       || offset != path_size) {
+        info("List tags request must be for the Symbol Object with a single instance segment!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_PATH_UNKNOWN, false, 0);
+    }
+
+    /* get the attribute list. */
+    offset = 2 + path_size;
+    num_attrs = slice_get_uint16_le(input, offset); offset += 2;
+
+    if(num_attrs == 0 || num_attrs > CIP_LIST_TAGS_MAX_ATTRS || offset + ((size_t)num_attrs * 2) != slice_len(input)) {
+        info("List tags request has an illegal attribute count %u!", num_attrs);
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    for(uint16_t i=0; i < num_attrs; i++) {
+        attrs[i] = slice_get_uint16_le(input, offset); offset += 2;
+
+        if(attrs[i] != SYMBOL_ATTR_NAME && attrs[i] != SYMBOL_ATTR_TYPE && attrs[i] != SYMBOL_ATTR_ELEM_SIZE && attrs[i] != SYMBOL_ATTR_DIMENSIONS) {
+            info("Unsupported symbol attribute %u!", attrs[i]);
+            return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_ATTR_UNSUPPORTED, false, 0);
+        }
+    }
+
+    info("Listing tags starting at instance %u.", start_instance);
+
+    /* fill in as many whole entries as fit after the response header. */
+    offset = 4;
+
+    for(tag_index = plc_find_tag_index(plc, start_instance); tag_index < plc->num_tags; tag_index++) {
+        tag_def_s *tag = plc->tags_by_instance[tag_index];
+        size_t entry_size = 4;
+
+        for(uint16_t i=0; i < num_attrs; i++) {
+            entry_size += symbol_attr_size(tag, attrs[i]);
+        }
+
+        if(offset + entry_size > slice_len(output)) {
+            break;
+        }
+
+        slice_set_uint32_le(output, offset, tag->instance_id); offset += 4;
+
+        for(uint16_t i=0; i < num_attrs; i++) {
+            offset = set_symbol_attr(output, offset, tag, attrs[i]);
+        }
+
+        num_returned++;
+    }
+
+    if(num_returned == 0 && tag_index < plc->num_tags) {
+        info("Tag %s does not fit in a response!", plc->tags_by_instance[tag_index]->name);
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_INVALID_REPLY, false, 0);
+    }
+
+    info("Returning %zu tags, %s.", num_returned, (tag_index < plc->num_tags ? "more to come" : "done"));
+
+    slice_set_uint8(output, 0, list_cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* reserved, must be zero. */
+    slice_set_uint8(output, 2, (tag_index < plc->num_tags ? CIP_ERR_FRAG : CIP_OK));
+    slice_set_uint8(output, 3, 0); /* no additional status words. */
+
+    return slice_from_slice(output, 0, offset);
+}
+
+
+size_t symbol_attr_size(tag_def_s *tag, uint16_t attr)
+{
+    switch(attr) {
+        case SYMBOL_ATTR_NAME: return 2 + strlen(tag->name);
+        case SYMBOL_ATTR_TYPE: return 2;
+        case SYMBOL_ATTR_ELEM_SIZE: return 2;
+        case SYMBOL_ATTR_DIMENSIONS: return 12;
+        default: return 0;
+    }
+}
+
+
+size_t set_symbol_attr(slice_s output, size_t offset, tag_def_s *tag, uint16_t attr)
+{
+    size_t name_len = strlen(tag->name);
+
+    switch(attr) {
+        case SYMBOL_ATTR_NAME:
+            slice_set_uint16_le(output, offset, (uint16_t)name_len); offset += 2;
+            for(size_t i=0; i < name_len; i++) {
+                slice_set_uint8(output, offset + i, (uint8_t)tag->name[i]);
+            }
+            offset += name_len;
+            break;
+
+        case SYMBOL_ATTR_TYPE:
+            /* the number of dimensions is in bits 13 and 14. */
+            slice_set_uint16_le(output, offset, (uint16_t)(tag->tag_type | (uint16_t)((tag->num_dimensions & 0x03) << 13))); offset += 2;
+            break;
+
+        case SYMBOL_ATTR_ELEM_SIZE:
+            slice_set_uint16_le(output, offset, (uint16_t)tag->elem_size); offset += 2;
+            break;
+
+        case SYMBOL_ATTR_DIMENSIONS:
+            for(size_t i=0; i < 3; i++) {
+                slice_set_uint32_le(output, offset, (uint32_t)(i < tag->num_dimensions ? tag->dimensions[i] : 0)); offset += 4;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return offset;
+}
+
+
+
+/*
+ * Template Object (UDT definition) services.
+ *
+ * Clients first get the attributes of the template to find the size of the
+ * definition and then read the definition, possibly over several requests.
+ *
+ * Get Attribute List request:
+ *   0x03 <path size> 0x20 0x6C <instance segment>
+ *   uint16 count
+ *   uint16 attributes[count]
+ *
+ * Get Attribute List response:
+ *   0x83 0x00 0x00 0x00
+ *   uint16 count
+ *   for each attribute: uint16 attribute, uint16 status, value if the status is zero.
+ *
+ * Read request:
+ *   0x4C <path size> 0x20 0x6C <instance segment>
+ *   uint32 byte offset into the definition
+ *   uint16 number of bytes to read
+ *
+ * Read response:
+ *   0xCC 0x00 <status> 0x00    - status is 0x06 if the requested data did not all fit.
+ *   definition bytes.
+ *
+ * The definition is:
+ *   for each member: uint16 array size or zero, uint16 type, uint32 byte offset
+ *   "<template name>;n" zero terminated.
+ *   each member name, zero terminated.
+ */
+
+#define CIP_TEMPLATE_ATTR_MIN_SIZE  (8)
+#define CIP_TEMPLATE_READ_MIN_SIZE  (12)
+
+#define TEMPLATE_ATTR_HANDLE        ((uint16_t)1)
+#define TEMPLATE_ATTR_MEMBER_COUNT  ((uint16_t)2)
+#define TEMPLATE_ATTR_DEF_SIZE      ((uint16_t)4)
+#define TEMPLATE_ATTR_STRUCT_SIZE   ((uint16_t)5)
+
+/* clients read (definition size * 4) - 23 bytes, so the size in 32-bit words includes that overhead. */
+#define TEMPLATE_DEF_OVERHEAD       (23)
+
+static template_def_s *process_template_path(slice_s input, plc_s *plc);
+static size_t set_template_definition(slice_s output, template_def_s *tmpl);
+
+slice_s handle_template_attributes(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t attr_cmd = slice_get_uint8(input, 0);
+    size_t path_size = (size_t)slice_get_uint8(input, 1) * 2;
+    template_def_s *tmpl = NULL;
+    size_t in_offset = 0;
+    size_t out_offset = 0;
+    uint16_t num_attrs = 0;
+
+    if(slice_len(input) < CIP_TEMPLATE_ATTR_MIN_SIZE) {
+        info("Insufficient data in the CIP get attribute list request!");
+        return make_cip_error(output, attr_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    tmpl = process_template_path(input, plc);
+    if(!tmpl) {
+        return make_cip_error(output, attr_cmd | CIP_DONE, CIP_ERR_PATH_UNKNOWN, false, 0);
+    }
+
+    in_offset = 2 + path_size;
+    num_attrs = slice_get_uint16_le(input, in_offset); in_offset += 2;
+
+    if(num_attrs == 0 || in_offset + ((size_t)num_attrs * 2) != slice_len(input)) {
+        info("Get attribute list request has an illegal attribute count %u!", num_attrs);
+        return make_cip_error(output, attr_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    out_offset = 4;
+    slice_set_uint16_le(output, out_offset, num_attrs); out_offset += 2;
+
+    for(uint16_t i=0; i < num_attrs; i++) {
+        uint16_t attr = slice_get_uint16_le(input, in_offset); in_offset += 2;
+
+        /* each attribute has at most eight bytes of ID, status and value. */
+        if(out_offset + 8 > slice_len(output)) {
+            info("Attribute list does not fit in a response!");
+            return make_cip_error(output, attr_cmd | CIP_DONE, CIP_ERR_INVALID_REPLY, false, 0);
+        }
+
+        slice_set_uint16_le(output, out_offset, attr); out_offset += 2;
+
+        switch(attr) {
+            case TEMPLATE_ATTR_HANDLE:
+                slice_set_uint16_le(output, out_offset, CIP_OK); out_offset += 2;
+                slice_set_uint16_le(output, out_offset, tmpl->handle); out_offset += 2;
+                break;
+
+            case TEMPLATE_ATTR_MEMBER_COUNT:
+                slice_set_uint16_le(output, out_offset, CIP_OK); out_offset += 2;
+                slice_set_uint16_le(output, out_offset, (uint16_t)tmpl->num_members); out_offset += 2;
+                break;
+
+            case TEMPLATE_ATTR_DEF_SIZE:
+                slice_set_uint16_le(output, out_offset, CIP_OK); out_offset += 2;
+                slice_set_uint32_le(output, out_offset, (uint32_t)((set_template_definition(slice_make_err(0), tmpl) + TEMPLATE_DEF_OVERHEAD + 3) / 4)); out_offset += 4;
+                break;
+
+            case TEMPLATE_ATTR_STRUCT_SIZE:
+                slice_set_uint16_le(output, out_offset, CIP_OK); out_offset += 2;
+                slice_set_uint32_le(output, out_offset, (uint32_t)tmpl->struct_size); out_offset += 4;
+                break;
+
+            default:
+                info("Unsupported template attribute %u.", attr);
+                slice_set_uint16_le(output, out_offset, CIP_ERR_ATTR_UNSUPPORTED); out_offset += 2;
+                break;
+        }
+    }
+
+    slice_set_uint8(output, 0, attr_cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* reserved, must be zero. */
+    slice_set_uint8(output, 2, CIP_OK);
+    slice_set_uint8(output, 3, 0); /* no additional status words. */
+
+    return slice_from_slice(output, 0, out_offset);
+}
+
+
+
+slice_s handle_template_read(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t read_cmd = slice_get_uint8(input, 0);
+    size_t path_size = (size_t)slice_get_uint8(input, 1) * 2;
+    template_def_s *tmpl = NULL;
+    size_t offset = 0;
+    uint32_t byte_offset = 0;
+    size_t read_size = 0;
+    size_t def_size = 0;
+    size_t amount_to_copy = 0;
+    uint8_t *def_data = NULL;
+    bool need_frag = false;
+
+    if(slice_len(input) < CIP_TEMPLATE_READ_MIN_SIZE) {
+        info("Insufficient data in the CIP template read request!");
+        return make_cip_error(output, read_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    tmpl = process_template_path(input, plc);
+    if(!tmpl) {
+        return make_cip_error(output, read_cmd | CIP_DONE, CIP_ERR_PATH_UNKNOWN, false, 0);
+    }
+
+    offset = 2 + path_size;
+    byte_offset = slice_get_uint32_le(input, offset); offset += 4;
+    read_size = (size_t)slice_get_uint16_le(input, offset); offset += 2;
+
+    if(offset != slice_len(input)) {
+        info("Request size does not match CIP template read request size!");
+        return make_cip_error(output, read_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    def_size = set_template_definition(slice_make_err(0), tmpl);
+
+    if(byte_offset > def_size) {
+        info("Template read offset %u is past the end of the definition!", byte_offset);
+        return make_cip_error(output, read_cmd | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
+    }
+
+    /* clients ask for the padded size, give them what we have. */
+    if(byte_offset + read_size > def_size) {
+        read_size = def_size - byte_offset;
+    }
+
+    amount_to_copy = read_size;
+    if(amount_to_copy > slice_len(output) - 4) {
+        /* keep the fragments 32-bit aligned. */
+        amount_to_copy = (slice_len(output) - 4) & ~(size_t)0x03;
+        need_frag = true;
+    }
+
+    def_data = malloc(def_size);
+    if(!def_data) {
+        error("Unable to allocate memory for the template definition!");
+    }
+
+    set_template_definition(slice_make(def_data, (ssize_t)def_size), tmpl);
+
+    slice_set_uint8(output, 0, read_cmd | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* reserved, must be zero. */
+    slice_set_uint8(output, 2, (need_frag ? CIP_ERR_FRAG : CIP_OK));
+    slice_set_uint8(output, 3, 0); /* no additional status words. */
+
+    memcpy(slice_get_bytes(output, 4), def_data + byte_offset, amount_to_copy);
+
+    free(def_data);
+
+    return slice_from_slice(output, 0, 4 + amount_to_copy);
+}
+
+
+template_def_s *process_template_path(slice_s input, plc_s *plc)
+{
+    size_t path_size = (size_t)slice_get_uint8(input, 1) * 2;
+    slice_s path = slice_from_slice(input, 2, path_size);
+    size_t offset = sizeof(CIP_TEMPLATE_CLASS);
+    uint32_t template_id = 0;
+    template_def_s *tmpl = NULL;
+
+    if(slice_len(path) != path_size
+       || !slice_match_bytes(path, CIP_TEMPLATE_CLASS, sizeof(CIP_TEMPLATE_CLASS))
+       || !process_instance_segment(path, &offset, &template_id)
+       || offset != path_size) {
+        info("Request must be for the Template Object with a single instance segment!");
+        return NULL;
+    }
+
+    tmpl = plc_find_template(plc, (uint16_t)template_id);
+    if(!tmpl || template_id > TAG_CIP_TYPE_TEMPLATE_MASK) {
+        info("Template %u not found!", template_id);
+        return NULL;
+    }
+
+    return tmpl;
+}
+
+
+/* write out the template definition and return its size.  Pass an empty slice to just get the size. */
+size_t set_template_definition(slice_s output, template_def_s *tmpl)
+{
+    size_t offset = 0;
+    const char *name_suffix = ";n";
+
+    for(size_t i=0; i < tmpl->num_members; i++) {
+        slice_set_uint16_le(output, offset, tmpl->members[i].array_size); offset += 2;
+        slice_set_uint16_le(output, offset, tmpl->members[i].member_type); offset += 2;
+        slice_set_uint32_le(output, offset, tmpl->members[i].offset); offset += 4;
+    }
+
+    for(size_t i=0; i < strlen(tmpl->name); i++) {
+        slice_set_uint8(output, offset, (uint8_t)tmpl->name[i]); offset++;
+    }
+
+    for(size_t i=0; i <= strlen(name_suffix); i++) {
+        slice_set_uint8(output, offset, (uint8_t)name_suffix[i]); offset++;
+    }
+
+    for(size_t i=0; i < tmpl->num_members; i++) {
+        const char *member_name = tmpl->members[i].name;
+
+        for(size_t j=0; j <= strlen(member_name); j++) {
+            slice_set_uint8(output, offset, (uint8_t)member_name[j]); offset++;
+        }
+    }
+
+    return offset;
+}
+
+
+
 /*
  * we should see:
  *  0x91 <name len> <name bytes> (<numeric segment>){0-3}
@@ -626,16 +1337,7 @@ bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *sta
 
     /* try to find the tag. */
     tag_name = slice_from_slice(input, 2, name_len);
-    *tag = plc->tags;
-
-    while(*tag) {
-        if(slice_match_string(tag_name, (*tag)->name)) {
-            info("Found tag %s", (*tag)->name);
-            break;
-        }
-
-        (*tag) = (*tag)->next_tag;
-    }
+    *tag = plc_find_tag(plc, tag_name);
 
     if(*tag) {
         slice_s numeric_segments = slice_from_slice(input, offset, slice_len(input));
@@ -716,6 +1418,63 @@ bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *sta
     return true;
 }
 
+/* get a logical instance segment of 8, 16 or 32 bits. */
+bool process_instance_segment(slice_s input, size_t *offset, uint32_t *instance_id)
+{
+    uint8_t segment_type = slice_get_uint8(input, *offset);
+
+    switch(segment_type) {
+        case 0x24: /* 8-bit instance */
+            if(!slice_in_bounds(input, *offset + 1)) {
+                return false;
+            }
+            *instance_id = slice_get_uint8(input, *offset + 1);
+            *offset += 2;
+            return true;
+
+        case 0x25: /* 16-bit instance, one byte of padding */
+            if(!slice_in_bounds(input, *offset + 3)) {
+                return false;
+            }
+            *instance_id = slice_get_uint16_le(input, *offset + 2);
+            *offset += 4;
+            return true;
+
+        case 0x26: /* 32-bit instance, one byte of padding */
+            if(!slice_in_bounds(input, *offset + 5)) {
+                return false;
+            }
+            *instance_id = slice_get_uint32_le(input, *offset + 2);
+            *offset += 6;
+            return true;
+
+        default:
+            info("Unexpected instance segment type %x!", segment_type);
+            return false;
+    }
+}
+
+
+/* UDT data is typed by the structure handle, everything else by the atomic type. */
+size_t tag_type_size(tag_def_s *tag)
+{
+    return (tag->udt ? 4 : 2);
+}
+
+
+size_t set_tag_type(slice_s output, size_t offset, tag_def_s *tag)
+{
+    if(tag->udt) {
+        slice_set_uint16_le(output, offset, CIP_TYPE_ABBREVIATED_STRUCT); offset += 2;
+        slice_set_uint16_le(output, offset, tag->udt->handle); offset += 2;
+    } else {
+        slice_set_uint16_le(output, offset, tag->tag_type); offset += 2;
+    }
+
+    return offset;
+}
+
+
 /* match a path.   This is tricky, thanks, Rockwell. */
 bool match_path(slice_s input, bool need_pad, uint8_t *path, uint8_t path_len)
 {
@@ -55,11 +55,17 @@
 #include "utils.h"
 
 static void usage(void);
-static void process_args(int argc, const char **argv, plc_s *plc);
+static void process_args(int argc, const char **argv, plc_s *plc, tcp_server_faults_s *faults);
 static void parse_path(const char *path, plc_s *plc);
 static void parse_pccc_tag(const char *tag, plc_s *plc);
 static void parse_cip_tag(const char *tag, plc_s *plc);
 static slice_s request_handler(slice_s input, slice_s output, void *plc);
+static size_t request_len(slice_s input);
+static void *open_connection(void *plc_def);
+static void close_connection(void *plc);
+
+/* CIP only allows 4002 for the CIP request, but there is overhead. */
+#define CONN_BUFFER_SIZE (4200)
 
 
 #ifdef IS_WINDOWS
@@ -146,9 +152,8 @@ void setup_break_handler(void)
 int main(int argc, const char **argv)
 {
     tcp_server_p server = NULL;
-    uint8_t buf[4200];  /* CIP only allows 4002 for the CIP request, but there is overhead. */
-    slice_s server_buf = slice_make(buf, sizeof(buf));
     plc_s plc;
+    tcp_server_faults_s faults;
 
     /* set up handler for ^C etc. */
     setup_break_handler();
@@ -157,14 +162,21 @@ int main(int argc, const char **argv)
 
     /* clear out context to make sure we do not get gremlins */
     memset(&plc, 0, sizeof(plc));
+    memset(&faults, 0, sizeof(faults));
 
     /* set the random seed. */
     srand((unsigned int)time(NULL));
 
-    process_args(argc, argv, &plc);
+    process_args(argc, argv, &plc, &faults);
+
+    /* build the lookup tables now that all the tags are defined. */
+    plc_index_tags(&plc);
 
     /* open a server connection and listen on the right port. */
-    server = tcp_server_create("0.0.0.0", "44818", server_buf, request_handler, &plc);
+    server = tcp_server_create("0.0.0.0", "44818", CONN_BUFFER_SIZE, request_handler, open_connection, close_connection, &plc);
+
+    tcp_server_set_request_len(server, request_len);
+    tcp_server_set_faults(server, &faults);
 
     tcp_server_start(server, &done);
 
@@ -203,18 +215,31 @@ void usage(void)
                     "\n"
                     "        <sizes>> field is one or more (up to 3) numbers separated by commas.\n"
                     "\n"
+                    "   --synthetic_tags=<count> (CIP PLCs only) define <count> generated tags, Synth_000000\n"
+                    "                            and so on, including a UDT.  Use to test large tag listings.\n"
+                    "\n"
+                    "   Debugging options:\n"
+                    "       --debug                turn on debugging output.\n"
+                    "       --reject_fo=<count>    refuse the first <count> Forward Open requests as duplicates.\n"
+                    "       --max_packet=<size>    refuse Forward Open requests for larger packets and report <size>.\n"
+                    "       --cip_error=<pct>[,<code>] fail <pct> percent of tag reads and writes with the hex CIP\n"
+                    "                              status <code> (default 02, resource unavailable).\n"
+                    "\n"
+                    TCP_SERVER_FAULT_USAGE
+                    "\n"
                     "Example: ab_server --plc=ControlLogix --path=1,0 --tag=MyTag:DINT[10,10]\n");
 
     exit(1);
 }
 
 
-void process_args(int argc, const char **argv, plc_s *plc)
+void process_args(int argc, const char **argv, plc_s *plc, tcp_server_faults_s *faults)
 {
     bool has_path = false;
     bool needs_path = false;
     bool has_plc = false;
     bool has_tag = false;
+    size_t synthetic_tags = 0;
 
     /* make sure that the reject FO count is zero. */
     plc->reject_fo_count = 0;
@@ -356,6 +381,15 @@ void process_args(int argc, const char **argv, plc_s *plc)
             has_tag = true;
         }
 
+        if(strncmp(argv[i],"--synthetic_tags=", 17) == 0) {
+            if(str_scanf(&argv[i][17], "%zu", &synthetic_tags) != 1 || synthetic_tags == 0) {
+                fprintf(stderr, "Unable to parse synthetic tag count in \"%s\"!\n", argv[i]);
+                usage();
+            }
+
+            has_tag = true;
+        }
+
         if(strcmp(argv[i],"--debug") == 0) {
             debug_on();
         }
@@ -366,6 +400,32 @@ void process_args(int argc, const char **argv, plc_s *plc)
                 plc->reject_fo_count = atoi(&argv[i][12]);
             }
         }
+
+        if(strncmp(argv[i],"--max_packet=", 13) == 0) {
+            int max_packet = atoi(&argv[i][13]);
+
+            if(max_packet <= 0 || max_packet > 4002) {
+                fprintf(stderr, "The maximum packet size must be between 1 and 4002!\n");
+                usage();
+            }
+
+            info("Setting maximum packet size to %d.", max_packet);
+            plc->max_packet = (uint32_t)max_packet;
+        }
+
+        if(strncmp(argv[i],"--cip_error=", 12) == 0) {
+            unsigned int cip_error_code = 0x02; /* resource unavailable. */
+
+            if(str_scanf(&argv[i][12], "%lf,%x", &plc->cip_error_percent, &cip_error_code) < 1
+               || plc->cip_error_percent < 0.0 || cip_error_code == 0 || cip_error_code > 0xFF) {
+                fprintf(stderr, "Unable to parse CIP error option \"%s\"!\n", argv[i]);
+                usage();
+            }
+
+            plc->cip_error_code = (uint8_t)cip_error_code;
+        }
+
+        tcp_server_parse_fault_arg(argv[i], faults);
     }
 
     if(needs_path && !has_path) {
@@ -382,6 +442,15 @@ void process_args(int argc, const char **argv, plc_s *plc)
         fprintf(stderr, "You must define at least one tag.\n");
         usage();
     }
+
+    if(synthetic_tags > 0) {
+        if(plc->plc_type == PLC_PLC5 || plc->plc_type == PLC_SLC || plc->plc_type == PLC_MICROLOGIX) {
+            fprintf(stderr, "Synthetic tags are only supported on CIP PLCs!\n");
+            usage();
+        }
+
+        plc_add_synthetic_tags(plc, synthetic_tags);
+    }
 }
 
 
@@ -747,3 +816,39 @@ slice_s request_handler(slice_s input, slice_s output, void *plc)
     /* we do not have a complete packet, get more data. */
     return slice_make_err(TCP_SERVER_INCOMPLETE);
 }
+
+
+
+/* EIP requests are the header plus the length in the header. */
+size_t request_len(slice_s input)
+{
+    if(slice_len(input) < EIP_HEADER_SIZE) {
+        return 0;
+    }
+
+    return (size_t)EIP_HEADER_SIZE + (size_t)slice_get_uint16_le(input, 2);
+}
+
+
+
+/*
+ * Each client connection gets its own copy of the PLC definition so that
+ * session and connection state is not shared.   The tags are shared.
+ */
+void *open_connection(void *plc_def)
+{
+    plc_s *plc = calloc(1, sizeof(*plc));
+
+    if(plc) {
+        *plc = *(plc_s *)plc_def;
+        plc->shared = (plc_s *)plc_def;
+    }
+
+    return plc;
+}
+
+
+void close_connection(void *plc)
+{
+    free(plc);
+}
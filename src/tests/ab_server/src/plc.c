@@ -0,0 +1,294 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plc.h"
+#include "slice.h"
+#include "utils.h"
+
+
+/*
+ * Tag indexes.
+ *
+ * The tag definitions are kept in a simple linked list, newest first.   That
+ * is fine for a handful of tags but not for the large synthetic directories
+ * used to test tag listing.   Once all tags are defined, we build an array of
+ * them in instance ID order, for paging through the Symbol Object, and a hash
+ * table by name, for tag reads and writes.
+ *
+ * Instance IDs are handed out in definition order with gaps between them.  Real
+ * PLCs do not use contiguous instance IDs either and clients must not assume
+ * that they do.
+ */
+
+#define INSTANCE_ID_STRIDE (2)
+
+static uint32_t hash_name(const uint8_t *name, size_t name_len);
+
+
+void plc_index_tags(plc_s *plc)
+{
+    size_t num_tags = 0;
+    size_t index = 0;
+
+    for(tag_def_s *tag = plc->tags; tag; tag = tag->next_tag) {
+        num_tags++;
+    }
+
+    plc->num_tags = num_tags;
+
+    if(num_tags == 0) {
+        return;
+    }
+
+    plc->tags_by_instance = calloc(num_tags, sizeof(tag_def_s *));
+    if(!plc->tags_by_instance) {
+        error("Unable to allocate memory for the tag instance index!");
+    }
+
+    /* the list is newest first, fill the array from the end. */
+    index = num_tags;
+    for(tag_def_s *tag = plc->tags; tag; tag = tag->next_tag) {
+        index--;
+        plc->tags_by_instance[index] = tag;
+    }
+
+    for(index = 0; index < num_tags; index++) {
+        plc->tags_by_instance[index]->instance_id = (uint32_t)((index + 1) * INSTANCE_ID_STRIDE);
+    }
+
+    /* keep the hash table at most half full. */
+    plc->tag_hash_size = 16;
+    while(plc->tag_hash_size < (num_tags * 2)) {
+        plc->tag_hash_size *= 2;
+    }
+
+    plc->tag_hash = calloc(plc->tag_hash_size, sizeof(tag_def_s *));
+    if(!plc->tag_hash) {
+        error("Unable to allocate memory for the tag name index!");
+    }
+
+    /* walk the list newest first so that the last definition of a name wins, as it always has. */
+    for(tag_def_s *tag = plc->tags; tag; tag = tag->next_tag) {
+        size_t bucket = hash_name((const uint8_t *)tag->name, strlen(tag->name)) & (plc->tag_hash_size - 1);
+
+        while(plc->tag_hash[bucket] && strcmp(plc->tag_hash[bucket]->name, tag->name) != 0) {
+            bucket = (bucket + 1) & (plc->tag_hash_size - 1);
+        }
+
+        if(plc->tag_hash[bucket]) {
+            info("Tag %s is defined more than once, using the last definition.", tag->name);
+        } else {
+            plc->tag_hash[bucket] = tag;
+        }
+    }
+
+    info("Indexed %zu tags in %zu hash buckets.", num_tags, plc->tag_hash_size);
+}
+
+
+tag_def_s *plc_find_tag(plc_s *plc, slice_s name)
+{
+    size_t bucket = 0;
+
+    if(!plc->tag_hash || slice_has_err(name)) {
+        return NULL;
+    }
+
+    bucket = hash_name(name.data, slice_len(name)) & (plc->tag_hash_size - 1);
+
+    while(plc->tag_hash[bucket]) {
+        tag_def_s *tag = plc->tag_hash[bucket];
+
+        if(strlen(tag->name) == slice_len(name) && slice_match_string(name, tag->name)) {
+            return tag;
+        }
+
+        bucket = (bucket + 1) & (plc->tag_hash_size - 1);
+    }
+
+    return NULL;
+}
+
+
+/* returns the index of the first tag with an instance ID at or after the passed one. */
+size_t plc_find_tag_index(plc_s *plc, uint32_t instance_id)
+{
+    size_t low = 0;
+    size_t high = plc->num_tags;
+
+    while(low < high) {
+        size_t mid = low + ((high - low) / 2);
+
+        if(plc->tags_by_instance[mid]->instance_id < instance_id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+template_def_s *plc_find_template(plc_s *plc, uint16_t template_id)
+{
+    for(template_def_s *tmpl = plc->templates; tmpl; tmpl = tmpl->next_template) {
+        if(tmpl->template_id == template_id) {
+            return tmpl;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Synthetic tag directories.
+ *
+ * Generate a large number of tags without having to pass them all on the
+ * command line.   The tags cycle through a few shapes so that listing
+ * clients see scalars, arrays of one to three dimensions, strings and a UDT.
+ */
+
+static const template_member_s synth_struct_members[] = {
+    { .name = "Count", .member_type = TAG_CIP_TYPE_DINT, .array_size = 0, .offset = 0 },
+    { .name = "Value", .member_type = TAG_CIP_TYPE_REAL, .array_size = 0, .offset = 4 },
+    { .name = "Flags", .member_type = TAG_CIP_TYPE_INT, .array_size = 4, .offset = 8 }
+};
+
+static template_def_s synth_struct = {
+    .next_template = NULL,
+    .name = "SynthStruct",
+    .template_id = 0x0101,
+    .handle = 0,
+    .num_members = sizeof(synth_struct_members)/sizeof(synth_struct_members[0]),
+    .members = synth_struct_members,
+    .struct_size = 16
+};
+
+#define SYNTH_SHAPE_COUNT (5)
+
+
+void plc_add_synthetic_tags(plc_s *plc, size_t num_tags)
+{
+    if(num_tags > 0 && !synth_struct.handle) {
+        /* any stable value will do for the handle, real PLCs use a CRC of the definition. */
+        synth_struct.handle = (uint16_t)hash_name((const uint8_t *)synth_struct.name, strlen(synth_struct.name));
+        synth_struct.next_template = plc->templates;
+        plc->templates = &synth_struct;
+    }
+
+    for(size_t i=0; i < num_tags; i++) {
+        tag_def_s *tag = calloc(1, sizeof(*tag));
+        char name[32] = { 0 };
+
+        if(!tag) {
+            error("Unable to allocate memory for synthetic tag!");
+        }
+
+        snprintf(name, sizeof(name), "Synth_%06zu", i);
+
+        tag->dimensions[0] = 1;
+        tag->dimensions[1] = 1;
+        tag->dimensions[2] = 1;
+        tag->num_dimensions = 1;
+
+        switch(i % SYNTH_SHAPE_COUNT) {
+            case 0:
+                tag->tag_type = TAG_CIP_TYPE_DINT;
+                tag->elem_size = 4;
+                break;
+
+            case 1:
+                tag->tag_type = TAG_CIP_TYPE_REAL;
+                tag->elem_size = 4;
+                tag->dimensions[0] = 10;
+                break;
+
+            case 2:
+                tag->tag_type = TAG_CIP_TYPE_INT;
+                tag->elem_size = 2;
+                tag->dimensions[0] = 2;
+                tag->dimensions[1] = 3;
+                tag->dimensions[2] = 4;
+                tag->num_dimensions = 3;
+                break;
+
+            case 3:
+                tag->tag_type = TAG_CIP_TYPE_STRING;
+                tag->elem_size = 88;
+                break;
+
+            default:
+                tag->tag_type = (tag_type_t)(TAG_CIP_TYPE_STRUCT_FLAG | synth_struct.template_id);
+                tag->elem_size = synth_struct.struct_size;
+                tag->udt = &synth_struct;
+                break;
+        }
+
+        tag->elem_count = tag->dimensions[0] * tag->dimensions[1] * tag->dimensions[2];
+
+        tag->name = strdup(name);
+        tag->data = calloc(tag->elem_count, tag->elem_size);
+        if(!tag->name || !tag->data) {
+            error("Unable to allocate memory for synthetic tag %s!", name);
+        }
+
+        tag->next_tag = plc->tags;
+        plc->tags = tag;
+    }
+
+    info("Added %zu synthetic tags.", num_tags);
+}
+
+
+
+/* FNV-1a */
+uint32_t hash_name(const uint8_t *name, size_t name_len)
+{
+    uint32_t hash = 2166136261u;
+
+    for(size_t i=0; i < name_len; i++) {
+        hash ^= name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
@@ -35,6 +35,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "slice.h"
 
 
 typedef uint16_t tag_type_t;
@@ -52,16 +53,42 @@ typedef uint16_t tag_type_t;
 #define TAG_CIP_TYPE_LREAL       ((tag_type_t)0x00CB) /* 64–bit floating point value, IEEE format */
 #define TAG_CIP_TYPE_STRING      ((tag_type_t)0x00D0) /* 88-byte string, with 82 bytes of data, 4-byte count and 2 bytes of padding */
 
+/* UDT tags have this bit set in the symbol type, the low 12 bits are the template instance ID. */
+#define TAG_CIP_TYPE_STRUCT_FLAG ((tag_type_t)0x8000)
+#define TAG_CIP_TYPE_TEMPLATE_MASK ((tag_type_t)0x0FFF)
+
 /* PCCC data types.   FIXME */
 #define TAG_PCCC_TYPE_INT         ((uint8_t)0x89) /* Signed 16–bit integer value */
 #define TAG_PCCC_TYPE_DINT        ((uint8_t)0x91) /* Signed 32–bit integer value */
 #define TAG_PCCC_TYPE_REAL        ((uint8_t)0x8a) /* 32–bit floating point value, IEEE format */
 #define TAG_PCCC_TYPE_STRING      ((uint8_t)0x8d) /* 82-byte string with 2-byte count word. */
 
+/* one field of a UDT. */
+typedef struct {
+    const char *name;
+    tag_type_t member_type;
+    uint16_t array_size;        /* zero for scalars. */
+    uint32_t offset;            /* byte offset within the structure. */
+} template_member_s;
+
+struct template_def_s {
+    struct template_def_s *next_template;
+    const char *name;
+    uint16_t template_id;       /* Template Object (0x6C) instance ID. */
+    uint16_t handle;            /* structure handle, sent in place of the type in reads and writes. */
+    size_t num_members;
+    const template_member_s *members;
+    size_t struct_size;
+};
+
+typedef struct template_def_s template_def_s;
+
 struct tag_def_s {
     struct tag_def_s *next_tag;
     char *name;
+    uint32_t instance_id;       /* Symbol Object (0x6B) instance ID, set when the tags are indexed. */
     tag_type_t tag_type;
+    struct template_def_s *udt; /* set for UDT tags. */
     size_t elem_size;
     size_t elem_count;
     size_t data_file_num;
@@ -81,8 +108,13 @@ typedef enum {
     PLC_MICROLOGIX
 } plc_type_t;
 
-/* Define the context that is passed around. */
-typedef struct {
+/*
+ * Define the context that is passed around.
+ *
+ * There is one of these for the PLC definition and one copy of it per client
+ * connection.   The tag list is shared.
+ */
+typedef struct plc_s {
     plc_type_t plc_type;
     uint8_t path[20];
     uint8_t path_len;
@@ -106,10 +138,32 @@ typedef struct {
     /* PCCC info */
     uint16_t pccc_seq_id;
 
-    /* debugging. */
+    /* debugging and fault injection. */
     int reject_fo_count;
+    uint32_t max_packet;        /* Forward Opens asking for more than this are refused with the supported size. */
+    double cip_error_percent;   /* chance that a tag read or write fails with cip_error_code. */
+    uint8_t cip_error_code;
 
     /* list of tags served by this "PLC" */
     struct tag_def_s *tags;
+
+    /* indexes over the tag list, built once all the tags are defined. */
+    size_t num_tags;
+    struct tag_def_s **tags_by_instance;    /* sorted by instance ID. */
+    struct tag_def_s **tag_hash;            /* open addressing by name. */
+    size_t tag_hash_size;
+
+    /* UDT definitions served through the Template Object. */
+    struct template_def_s *templates;
+
+    /* the PLC definition this connection was copied from, NULL in the definition itself. */
+    struct plc_s *shared;
 } plc_s;
 
+
+
+extern void plc_index_tags(plc_s *plc);
+extern tag_def_s *plc_find_tag(plc_s *plc, slice_s name);
+extern size_t plc_find_tag_index(plc_s *plc, uint32_t instance_id);
+extern template_def_s *plc_find_template(plc_s *plc, uint16_t template_id);
+extern void plc_add_synthetic_tags(plc_s *plc, size_t num_tags);
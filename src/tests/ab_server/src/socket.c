@@ -39,6 +39,7 @@
 #else
     #include <arpa/inet.h>
     #include <errno.h>
+    #include <fcntl.h>
     #include <netdb.h>
     #include <netinet/in.h>
     #include <sys/socket.h>
@@ -54,6 +55,11 @@
 #include "utils.h"
 
 
+/* macOS does not have MSG_NOSIGNAL. */
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL (0)
+#endif
+
 /* lengths for socket read and write. */
 #ifdef IS_MSVC
     typedef int sock_io_len_t;
@@ -63,7 +69,7 @@
 #endif
 
 
-#define LISTEN_QUEUE (10)
+#define LISTEN_QUEUE (128)
 
 int socket_open(const char *host, const char *port)
 {
@@ -139,6 +145,15 @@ int socket_open(const char *host, const char *port)
     if(strcmp(host,"0.0.0.0") == 0) {
         info("socket_open() setting up server socket.   Binding to address 0.0.0.0.");
 
+        /* set up our socket to allow reuse if we crash suddenly.  This must be done before bind(). */
+        sock_opt = 1;
+        rc = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&sock_opt, sizeof(sock_opt));
+        if(rc) {
+            socket_close(sock);
+            info("ERROR: Setting SO_REUSEADDR on socket failed: %s\n", gai_strerror(rc));
+            return SOCKET_ERR_SETOPT;
+        }
+
         rc = bind(sock, addr_info->ai_addr, (socklen_t)(unsigned int)addr_info->ai_addrlen);
         if (rc < 0)	{
             printf("ERROR: Unable to bind() socket: %s\n", gai_strerror(rc));
@@ -150,15 +165,6 @@ int socket_open(const char *host, const char *port)
             info("ERROR: Unable to call listen() on socket: %s\n", gai_strerror(rc));
             return SOCKET_ERR_LISTEN;
         }
-
-        /* set up our socket to allow reuse if we crash suddenly. */
-        sock_opt = 1;
-        rc = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&sock_opt, sizeof(sock_opt));
-        if(rc) {
-            socket_close(sock);
-            info("ERROR: Setting SO_REUSEADDR on socket failed: %s\n", gai_strerror(rc));
-            return SOCKET_ERR_SETOPT;
-        }
     } else {
         struct timeval timeout; /* used for timing out connections etc. */
         struct linger so_linger; /* used to set up short/no lingering after connections are close()ed. */
@@ -254,6 +260,29 @@ int socket_accept(int sock)
 }
 
 
+int socket_set_nonblocking(int sock)
+{
+#ifdef IS_WINDOWS
+    u_long non_blocking = 1;
+
+    if(ioctlsocket((SOCKET)sock, FIONBIO, &non_blocking) != NO_ERROR) {
+        info("ERROR: Unable to set socket %d to non-blocking mode!", sock);
+        return SOCKET_ERR_SETOPT;
+    }
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+
+    if(flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        info("ERROR: Unable to set socket %d to non-blocking mode, errno %d!", sock, errno);
+        return SOCKET_ERR_SETOPT;
+    }
+#endif
+
+    return SOCKET_STATUS_OK;
+}
+
+
+/* returns an error slice with SOCKET_ERR_CLOSED if the other end closed the connection. */
 slice_s socket_read(int sock, slice_s in_buf)
 {
 #ifdef IS_WINDOWS
@@ -262,7 +291,10 @@ slice_s socket_read(int sock, slice_s in_buf)
     int rc = (int)recv(sock, (char *)in_buf.data, (size_t)in_buf.len, 0);
 #endif 
 
-    if(rc < 0) {
+    if(rc == 0 && slice_len(in_buf) > 0) {
+        info("Socket closed by the client.");
+        rc = SOCKET_ERR_CLOSED;
+    } else if(rc < 0) {
 #ifdef IS_WINDOWS
         rc = WSAGetLastError();
         if(rc == WSAEWOULDBLOCK) {
@@ -281,6 +313,34 @@ slice_s socket_read(int sock, slice_s in_buf)
 }
 
 
+/* this writes as much as the socket will take without blocking. */
+int socket_write_some(int sock, slice_s out_buf)
+{
+#ifdef IS_WINDOWS
+    int rc = (int)send(sock, (char *)out_buf.data, (int)out_buf.len, 0);
+#else
+    int rc = (int)send(sock, (char *)out_buf.data, (size_t)out_buf.len, MSG_NOSIGNAL);
+#endif
+
+    if(rc < 0) {
+#ifdef IS_WINDOWS
+        rc = WSAGetLastError();
+        if(rc == WSAEWOULDBLOCK) {
+#else
+        rc = errno;
+        if(rc == EAGAIN || rc == EWOULDBLOCK || rc == EINTR) {
+#endif
+            rc = 0;
+        } else {
+            info("Socket write error rc=%d.\n", rc);
+            rc = SOCKET_ERR_WRITE;
+        }
+    }
+
+    return rc;
+}
+
+
 /* this blocks until all the data is written or there is an error. */
 int socket_write(int sock, slice_s out_buf)
 {
@@ -46,12 +46,15 @@ typedef enum {
     SOCKET_ERR_READ     = -8,
     SOCKET_ERR_WRITE    = -9,
     SOCKET_ERR_SELECT   = -10,
-    SOCKET_ERR_ACCEPT   = -11
+    SOCKET_ERR_ACCEPT   = -11,
+    SOCKET_ERR_CLOSED   = -12
 } socket_err_t;
 
 extern int socket_open(const char *host, const char *port);
 extern void socket_close(int sock);
 extern int socket_accept(int sock);
+extern int socket_set_nonblocking(int sock);
 extern slice_s socket_read(int sock, slice_s in_buf);
+extern int socket_write_some(int sock, slice_s out_buf);
 extern int socket_write(int sock, slice_s out_buf);
 
@@ -31,24 +31,132 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include "compat.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+    #define USE_EPOLL (1)
+    #include <sys/epoll.h>
+    #include <unistd.h>
+#elif defined(IS_WINDOWS)
+    /*
+     * a Windows fd_set is a counted array of sockets, 64 by default.  The
+     * size has to be set before winsock2.h is included.
+     */
+    #define FD_SETSIZE (1024)
+    #include <winsock2.h>
+#else
+    #include <sys/select.h>
+#endif
+
 #include "slice.h"
 #include "socket.h"
 #include "tcp_server.h"
 #include "utils.h"
 
+
+/*
+ * The server runs a single event loop over all client connections.   Linux uses
+ * epoll, everything else falls back to select().   Each connection has its own
+ * buffers and its own context from the open_conn() callback so that the handler
+ * never sees state from another client.
+ *
+ * With select() the number of clients is limited by FD_SETSIZE.  On Windows it
+ * counts sockets, so the listener and 1023 clients fit.  Elsewhere it caps the
+ * socket number, usually at 1024.  Clients past the limit are closed as they are
+ * accepted.  epoll has no such limit.
+ *
+ * Responses are queued on the connection rather than written directly.  That
+ * lets the fault options delay, reorder, throttle and split them without
+ * blocking other connections.
+ *
+ * If the protocol has a request length function, each complete request in the
+ * input is handed to the handler separately.   Clients may then send several
+ * requests without waiting for the responses.
+ */
+
+#define TCP_SERVER_WAIT_MS (100)
+#define TCP_SERVER_MAX_EVENTS (64)
+#define TCP_SERVER_MAX_QUEUED (16)
+#define TCP_SERVER_DEFAULT_REORDER_HOLD_MS (250)
+
+typedef struct tcp_resp_s {
+    struct tcp_resp_s *next;
+    int64_t ready_ms;       /* do not send before this time. */
+    int64_t hold_until_ms;  /* held back for reordering until this time or until a later response passes it. */
+    size_t sent;
+    slice_s data;
+} tcp_resp_s;
+
+typedef struct tcp_conn_s {
+    struct tcp_conn_s *next;
+    int sock_fd;
+    void *context;
+    bool closing;
+
+    /* input collects a full request, possibly over several reads. */
+    slice_s in_buf;
+    size_t in_len;
+
+    /* the handler builds the response here before it is queued. */
+    slice_s out_buf;
+
+    /* responses waiting to be written. */
+    tcp_resp_s *responses;
+    int num_responses;
+    bool write_blocked;
+    int64_t next_write_ms;
+} tcp_conn_s;
+
 struct tcp_server {
     int sock_fd;
-    slice_s buffer;
+    size_t buffer_size;
     slice_s (*handler)(slice_s input, slice_s output, void *context);
+    size_t (*request_len)(slice_s input);
+    void *(*open_conn)(void *context);
+    void (*close_conn)(void *conn_context);
     void *context;
+
+    tcp_server_faults_s faults;
+
+    tcp_conn_s *conns;
+    int num_conns;
+
+#ifdef USE_EPOLL
+    int epoll_fd;
+#endif
 };
 
 
-tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context)
+static void accept_connections(tcp_server_p server);
+static tcp_conn_s *conn_create(tcp_server_p server, int sock_fd);
+static void conn_destroy(tcp_server_p server, tcp_conn_s *conn);
+static void conn_read(tcp_server_p server, tcp_conn_s *conn);
+static void conn_handle_request(tcp_server_p server, tcp_conn_s *conn, size_t request_len);
+static void conn_consume_input(tcp_conn_s *conn, size_t request_len);
+static void conn_queue_response(tcp_server_p server, tcp_conn_s *conn, slice_s output);
+static void conn_write(tcp_server_p server, tcp_conn_s *conn);
+static int64_t conn_next_write_time(tcp_conn_s *conn);
+static void conn_update_events(tcp_server_p server, tcp_conn_s *conn);
+static void reap_connections(tcp_server_p server);
+static int wait_time_ms(tcp_server_p server);
+static void wait_for_events(tcp_server_p server);
+static void service_responses(tcp_server_p server);
+static int64_t sample_delay_ms(tcp_server_faults_s *faults);
+
+
+tcp_server_p tcp_server_create(const char *host, const char *port, size_t buffer_size,
+                               slice_s (*handler)(slice_s input, slice_s output, void *conn_context),
+                               void *(*open_conn)(void *context),
+                               void (*close_conn)(void *conn_context),
+                               void *context)
 {
     tcp_server_p server = calloc(1, sizeof(*server));
 
@@ -59,97 +167,145 @@ tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffe
             error("ERROR: Unable to open TCP socket, error code %d!", server->sock_fd);
         }
 
-        server->buffer = buffer;
+        if(socket_set_nonblocking(server->sock_fd) != SOCKET_STATUS_OK) {
+            error("ERROR: Unable to set the listening socket to non-blocking!");
+        }
+
+        server->buffer_size = buffer_size;
         server->handler = handler;
+        server->open_conn = open_conn;
+        server->close_conn = close_conn;
         server->context = context;
+
+#ifdef USE_EPOLL
+        {
+            struct epoll_event event = {0};
+
+            server->epoll_fd = epoll_create1(0);
+            if(server->epoll_fd < 0) {
+                error("ERROR: Unable to create epoll instance!");
+            }
+
+            event.events = EPOLLIN;
+            event.data.ptr = NULL; /* NULL marks the listening socket. */
+
+            if(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->sock_fd, &event) < 0) {
+                error("ERROR: Unable to add the listening socket to epoll!");
+            }
+        }
+#endif
     }
 
     return server;
 }
 
-void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
+
+void tcp_server_set_request_len(tcp_server_p server, size_t (*request_len)(slice_s input))
 {
-    int client_fd;
-    bool done = false;
-
-    info("Waiting for new client connection.");
-
-    do {
-        client_fd = socket_accept(server->sock_fd);
-
-        if(client_fd >= 0) {
-            slice_s tmp_input = server->buffer;
-            slice_s tmp_output;
-            int rc;
-
-            info("Got new client connection, going into processing loop.");
-
-            do {
-                rc = TCP_SERVER_PROCESSED;
-
-                /* get an incoming packet or a partial packet. */
-                tmp_input = socket_read(client_fd, tmp_input);
-
-                if((rc = slice_has_err(tmp_input))) {
-                    info("WARN: error response reading socket! error %d", rc);
-                    rc = TCP_SERVER_DONE;
-                    break;
-                }
-
-                /* try to process the packet. */
-                tmp_output = server->handler(tmp_input, server->buffer, server->context);
-
-                /* check the response. */
-                if(!slice_has_err(tmp_output)) {
-                    /* FIXME - this should be in a loop to make sure all data is pushed. */
-                    rc = socket_write(client_fd, tmp_output);
-
-                    /* error writing? */
-                    if(rc < 0) {
-                        info("ERROR: error writing output packet! Error: %d", rc);
-                        rc = TCP_SERVER_DONE;
-                        break;
-                    } else {
-                        /* all good. Reset the buffers etc. */
-                        tmp_input = server->buffer;
-                        rc = TCP_SERVER_PROCESSED;
-                    }
-                } else {
-                    /* there was some sort of error or exceptional condition. */
-                    switch((rc = slice_get_err(tmp_input))) {
-                        case TCP_SERVER_DONE:
-                            done = true;
-                            break;
-
-                        case TCP_SERVER_INCOMPLETE:
-                            tmp_input = slice_from_slice(server->buffer, slice_len(tmp_input), slice_len(server->buffer) - slice_len(tmp_input));
-                            break;
-
-                        case TCP_SERVER_PROCESSED:
-                            break;
-
-                        case TCP_SERVER_UNSUPPORTED:
-                            info("WARN: Unsupported packet!");
-                            slice_dump(tmp_input);
-                            break;
-
-                        default:
-                            info("WARN: Unsupported return code %d!", rc);
-                            break;
-                    }
-                }
-            } while(rc == TCP_SERVER_INCOMPLETE || rc == TCP_SERVER_PROCESSED);
-
-            /* done with the socket */
-            socket_close(client_fd);
-        } else if (client_fd != SOCKET_STATUS_OK) {
-            /* There was an error either opening or accepting! */
-            info("WARN: error while trying to open/accept the client socket.");
+    server->request_len = request_len;
+}
+
+
+void tcp_server_set_faults(tcp_server_p server, const tcp_server_faults_s *faults)
+{
+    server->faults = *faults;
+
+    if(server->faults.reorder_hold_ms <= 0) {
+        server->faults.reorder_hold_ms = TCP_SERVER_DEFAULT_REORDER_HOLD_MS;
+    }
+}
+
+
+/*
+ * Returns true if the argument was a transport fault option.  Malformed
+ * options are fatal.
+ */
+bool tcp_server_parse_fault_arg(const char *arg, tcp_server_faults_s *faults)
+{
+    if(strncmp(arg, "--delay=", 8) == 0) {
+        const char *dist = &arg[8];
+        int num_args = 0;
+
+        faults->delay_b_ms = 0.0;
+
+        if(strncmp(dist, "fixed:", 6) == 0) {
+            faults->delay_type = TCP_SERVER_DELAY_FIXED;
+            num_args = str_scanf(&dist[6], "%lf", &faults->delay_a_ms);
+        } else if(strncmp(dist, "uniform:", 8) == 0) {
+            faults->delay_type = TCP_SERVER_DELAY_UNIFORM;
+            num_args = str_scanf(&dist[8], "%lf,%lf", &faults->delay_a_ms, &faults->delay_b_ms) - 1;
+        } else if(strncmp(dist, "normal:", 7) == 0) {
+            faults->delay_type = TCP_SERVER_DELAY_NORMAL;
+            num_args = str_scanf(&dist[7], "%lf,%lf", &faults->delay_a_ms, &faults->delay_b_ms) - 1;
+        } else if(strncmp(dist, "exp:", 4) == 0) {
+            faults->delay_type = TCP_SERVER_DELAY_EXPONENTIAL;
+            num_args = str_scanf(&dist[4], "%lf", &faults->delay_a_ms);
         }
 
-        /* wait a bit to give back the CPU. */
-        util_sleep_ms(1);
-    } while(!done && !*terminate);
+        if(num_args != 1 || faults->delay_a_ms < 0.0 || faults->delay_b_ms < 0.0) {
+            error("Unable to parse delay option \"%s\"!", arg);
+        }
+
+        if(faults->delay_type == TCP_SERVER_DELAY_UNIFORM && faults->delay_b_ms < faults->delay_a_ms) {
+            error("The uniform delay maximum must not be less than the minimum in \"%s\"!", arg);
+        }
+
+        return true;
+    }
+
+    if(strncmp(arg, "--bandwidth=", 12) == 0) {
+        long bandwidth = atol(&arg[12]);
+
+        if(bandwidth <= 0) {
+            error("Bandwidth must be a positive number of bytes per second in \"%s\"!", arg);
+        }
+
+        faults->bandwidth = (uint32_t)bandwidth;
+
+        return true;
+    }
+
+    if(strncmp(arg, "--reorder=", 10) == 0) {
+        if(str_scanf(&arg[10], "%lf,%d", &faults->reorder_percent, &faults->reorder_hold_ms) < 1 || faults->reorder_percent < 0.0) {
+            error("Unable to parse reorder option \"%s\"!", arg);
+        }
+
+        return true;
+    }
+
+    if(strncmp(arg, "--drop=", 7) == 0) {
+        if(str_scanf(&arg[7], "%lf", &faults->drop_percent) != 1 || faults->drop_percent < 0.0) {
+            error("Unable to parse drop option \"%s\"!", arg);
+        }
+
+        return true;
+    }
+
+    if(strncmp(arg, "--partial_write=", 16) == 0) {
+        int max_chunk = atoi(&arg[16]);
+
+        if(max_chunk <= 0) {
+            error("The partial write chunk size must be positive in \"%s\"!", arg);
+        }
+
+        faults->partial_write_max = (size_t)(unsigned int)max_chunk;
+
+        return true;
+    }
+
+    return false;
+}
+
+
+void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
+{
+    info("Waiting for new client connections.");
+
+    while(!*terminate) {
+        wait_for_events(server);
+        service_responses(server);
+        reap_connections(server);
+    }
 }
 
 
@@ -157,6 +313,18 @@ void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
 void tcp_server_destroy(tcp_server_p server)
 {
     if(server) {
+        while(server->conns) {
+            server->conns->closing = true;
+            reap_connections(server);
+        }
+
+#ifdef USE_EPOLL
+        if(server->epoll_fd >= 0) {
+            close(server->epoll_fd);
+            server->epoll_fd = INT_MIN;
+        }
+#endif
+
         if(server->sock_fd >= 0) {
             socket_close(server->sock_fd);
             server->sock_fd = INT_MIN;
@@ -164,3 +332,578 @@ void tcp_server_destroy(tcp_server_p server)
         free(server);
     }
 }
+
+
+
+#ifdef USE_EPOLL
+
+void wait_for_events(tcp_server_p server)
+{
+    struct epoll_event events[TCP_SERVER_MAX_EVENTS];
+    int num_events = epoll_wait(server->epoll_fd, events, TCP_SERVER_MAX_EVENTS, wait_time_ms(server));
+
+    for(int i=0; i < num_events; i++) {
+        tcp_conn_s *conn = (tcp_conn_s *)events[i].data.ptr;
+
+        if(!conn) {
+            accept_connections(server);
+            continue;
+        }
+
+        /* a connection closed earlier in this batch may still have events queued. */
+        if(conn->closing) {
+            continue;
+        }
+
+        if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+            info("Connection on socket %d closed or in error.", conn->sock_fd);
+            conn->closing = true;
+            continue;
+        }
+
+        if(events[i].events & EPOLLOUT) {
+            conn->write_blocked = false;
+            conn_write(server, conn);
+        }
+
+        if(!conn->closing && (events[i].events & EPOLLIN)) {
+            conn_read(server, conn);
+        }
+    }
+}
+
+
+void conn_update_events(tcp_server_p server, tcp_conn_s *conn)
+{
+    struct epoll_event event = {0};
+
+    /* stop reading when too many responses are waiting. */
+    event.events = (conn->num_responses < TCP_SERVER_MAX_QUEUED ? EPOLLIN : 0)
+                 | (conn->write_blocked ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+
+    if(epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->sock_fd, &event) < 0) {
+        info("WARN: Unable to update epoll events for socket %d!", conn->sock_fd);
+        conn->closing = true;
+    }
+}
+
+#else
+
+void wait_for_events(tcp_server_p server)
+{
+    fd_set read_fds;
+    fd_set write_fds;
+    struct timeval timeout;
+    int max_fd = server->sock_fd;
+    int wait_ms = wait_time_ms(server);
+    int rc = 0;
+
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+
+    FD_SET(server->sock_fd, &read_fds);
+
+    for(tcp_conn_s *conn = server->conns; conn; conn = conn->next) {
+        if(conn->write_blocked) {
+            FD_SET(conn->sock_fd, &write_fds);
+        }
+
+        if(conn->num_responses < TCP_SERVER_MAX_QUEUED) {
+            FD_SET(conn->sock_fd, &read_fds);
+        }
+
+        if(conn->sock_fd > max_fd) {
+            max_fd = conn->sock_fd;
+        }
+    }
+
+    timeout.tv_sec = wait_ms / 1000;
+    timeout.tv_usec = (wait_ms % 1000) * 1000;
+
+    rc = select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+    if(rc <= 0) {
+        return;
+    }
+
+    for(tcp_conn_s *conn = server->conns; conn; conn = conn->next) {
+        if(FD_ISSET(conn->sock_fd, &write_fds)) {
+            conn->write_blocked = false;
+            conn_write(server, conn);
+        }
+
+        if(!conn->closing && FD_ISSET(conn->sock_fd, &read_fds)) {
+            conn_read(server, conn);
+        }
+    }
+
+    /* accept last so that new connections are not in the sets above. */
+    if(FD_ISSET(server->sock_fd, &read_fds)) {
+        accept_connections(server);
+    }
+}
+
+
+void conn_update_events(tcp_server_p server, tcp_conn_s *conn)
+{
+    /* the fd sets are rebuilt from the connection state on every pass. */
+    (void)server;
+    (void)conn;
+}
+
+#endif
+
+
+
+/* how long to wait for socket events before a queued response is due. */
+int wait_time_ms(tcp_server_p server)
+{
+    int64_t now = util_time_ms();
+    int64_t wait_ms = TCP_SERVER_WAIT_MS;
+
+    for(tcp_conn_s *conn = server->conns; conn; conn = conn->next) {
+        if(conn->responses && !conn->write_blocked) {
+            int64_t due_ms = conn_next_write_time(conn) - now;
+
+            if(due_ms < wait_ms) {
+                wait_ms = (due_ms > 0 ? due_ms : 0);
+            }
+        }
+    }
+
+    return (int)wait_ms;
+}
+
+
+
+void service_responses(tcp_server_p server)
+{
+    for(tcp_conn_s *conn = server->conns; conn; conn = conn->next) {
+        if(!conn->closing && conn->responses && !conn->write_blocked) {
+            conn_write(server, conn);
+        }
+    }
+}
+
+
+
+void accept_connections(tcp_server_p server)
+{
+    int client_fd = SOCKET_STATUS_OK;
+
+    while((client_fd = socket_accept(server->sock_fd)) >= 0) {
+#if defined(IS_WINDOWS)
+        /* the listening socket takes one slot. */
+        if(server->num_conns + 1 >= FD_SETSIZE) {
+            info("WARN: Already %d clients, the most select() can wait on, closing the new one.", server->num_conns);
+            socket_close(client_fd);
+            continue;
+        }
+#elif !defined(USE_EPOLL)
+        if(client_fd >= FD_SETSIZE) {
+            info("WARN: Client socket %d is too large for select(), closing it.", client_fd);
+            socket_close(client_fd);
+            continue;
+        }
+#endif
+
+        if(!conn_create(server, client_fd)) {
+            socket_close(client_fd);
+        }
+    }
+
+    if(client_fd != SOCKET_STATUS_OK) {
+        /* There was an error either opening or accepting! */
+        info("WARN: error while trying to open/accept the client socket.");
+    }
+}
+
+
+
+tcp_conn_s *conn_create(tcp_server_p server, int sock_fd)
+{
+    tcp_conn_s *conn = NULL;
+    uint8_t *buffers = NULL;
+
+    if(socket_set_nonblocking(sock_fd) != SOCKET_STATUS_OK) {
+        return NULL;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    buffers = calloc(2, server->buffer_size);
+
+    if(!conn || !buffers) {
+        info("WARN: Unable to allocate memory for new client connection!");
+        free(conn);
+        free(buffers);
+        return NULL;
+    }
+
+    conn->sock_fd = sock_fd;
+    conn->in_buf = slice_make(buffers, (ssize_t)server->buffer_size);
+    conn->out_buf = slice_make(buffers + server->buffer_size, (ssize_t)server->buffer_size);
+    conn->context = (server->open_conn ? server->open_conn(server->context) : server->context);
+
+    if(!conn->context) {
+        info("WARN: Unable to create context for new client connection!");
+        free(buffers);
+        free(conn);
+        return NULL;
+    }
+
+#ifdef USE_EPOLL
+    {
+        struct epoll_event event = {0};
+
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+
+        if(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, sock_fd, &event) < 0) {
+            info("WARN: Unable to add client socket %d to epoll!", sock_fd);
+
+            if(server->close_conn) {
+                server->close_conn(conn->context);
+            }
+
+            free(buffers);
+            free(conn);
+            return NULL;
+        }
+    }
+#endif
+
+    conn->next = server->conns;
+    server->conns = conn;
+    server->num_conns++;
+
+    info("Got new client connection on socket %d, %d connections open.", sock_fd, server->num_conns);
+
+    return conn;
+}
+
+
+
+void conn_destroy(tcp_server_p server, tcp_conn_s *conn)
+{
+#ifdef USE_EPOLL
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->sock_fd, NULL);
+#endif
+
+    socket_close(conn->sock_fd);
+
+    if(server->close_conn) {
+        server->close_conn(conn->context);
+    }
+
+    while(conn->responses) {
+        tcp_resp_s *resp = conn->responses;
+
+        conn->responses = resp->next;
+        free(resp);
+    }
+
+    server->num_conns--;
+
+    info("Closed client connection on socket %d, %d connections open.", conn->sock_fd, server->num_conns);
+
+    /* the output buffer is part of the same allocation. */
+    free(conn->in_buf.data);
+    free(conn);
+}
+
+
+
+void reap_connections(tcp_server_p server)
+{
+    tcp_conn_s **walker = &server->conns;
+
+    while(*walker) {
+        tcp_conn_s *conn = *walker;
+
+        if(conn->closing) {
+            *walker = conn->next;
+            conn_destroy(server, conn);
+        } else {
+            walker = &conn->next;
+        }
+    }
+}
+
+
+
+void conn_read(tcp_server_p server, tcp_conn_s *conn)
+{
+    slice_s tmp_input;
+
+    /* get an incoming packet or a partial packet. */
+    tmp_input = socket_read(conn->sock_fd, slice_from_slice(conn->in_buf, conn->in_len, slice_len(conn->in_buf) - conn->in_len));
+
+    if(slice_has_err(tmp_input)) {
+        info("WARN: error response reading socket! error %d", slice_get_err(tmp_input));
+        conn->closing = true;
+        return;
+    }
+
+    if(slice_len(tmp_input) == 0) {
+        /* spurious wake up. */
+        return;
+    }
+
+    conn->in_len += slice_len(tmp_input);
+
+    if(!server->request_len) {
+        conn_handle_request(server, conn, conn->in_len);
+        return;
+    }
+
+    /* hand over each complete request in turn. */
+    while(!conn->closing && conn->in_len > 0) {
+        size_t request_len = server->request_len(slice_from_slice(conn->in_buf, 0, conn->in_len));
+        size_t old_len = conn->in_len;
+
+        if(request_len == 0 || request_len > conn->in_len) {
+            if(request_len > slice_len(conn->in_buf) || conn->in_len >= slice_len(conn->in_buf)) {
+                info("WARN: Request is larger than the %zu byte buffer!", slice_len(conn->in_buf));
+                conn->closing = true;
+            }
+
+            break;
+        }
+
+        conn_handle_request(server, conn, request_len);
+
+        if(conn->in_len == old_len) {
+            /* the handler wants more data than the request length said. */
+            break;
+        }
+    }
+}
+
+
+/* process the request at the start of the input buffer and consume it unless it is incomplete. */
+void conn_handle_request(tcp_server_p server, tcp_conn_s *conn, size_t request_len)
+{
+    slice_s tmp_input = slice_from_slice(conn->in_buf, 0, request_len);
+    slice_s tmp_output;
+    int rc;
+
+    /* try to process the packet. */
+    tmp_output = server->handler(tmp_input, conn->out_buf, conn->context);
+
+    /* check the response. */
+    if(!slice_has_err(tmp_output)) {
+        conn_consume_input(conn, request_len);
+
+        if(util_rand_percent(server->faults.drop_percent)) {
+            info("Dropping connection on socket %d instead of responding.", conn->sock_fd);
+            conn->closing = true;
+            return;
+        }
+
+        conn_queue_response(server, conn, tmp_output);
+        conn_write(server, conn);
+        return;
+    }
+
+    /* there was some sort of error or exceptional condition. */
+    switch((rc = slice_get_err(tmp_output))) {
+        case TCP_SERVER_DONE:
+            conn->closing = true;
+            break;
+
+        case TCP_SERVER_INCOMPLETE:
+            if(conn->in_len >= slice_len(conn->in_buf)) {
+                info("WARN: Request is larger than the %zu byte buffer!", slice_len(conn->in_buf));
+                conn->closing = true;
+            }
+            break;
+
+        case TCP_SERVER_PROCESSED:
+            conn_consume_input(conn, request_len);
+            break;
+
+        case TCP_SERVER_UNSUPPORTED:
+            info("WARN: Unsupported packet!");
+            slice_dump(tmp_input);
+            conn_consume_input(conn, request_len);
+            break;
+
+        default:
+            info("WARN: Unsupported return code %d!", rc);
+            conn_consume_input(conn, request_len);
+            break;
+    }
+}
+
+
+/* drop the processed request and move any requests after it to the front of the buffer. */
+void conn_consume_input(tcp_conn_s *conn, size_t request_len)
+{
+    if(request_len < conn->in_len) {
+        memmove(conn->in_buf.data, conn->in_buf.data + request_len, conn->in_len - request_len);
+        conn->in_len -= request_len;
+    } else {
+        conn->in_len = 0;
+    }
+}
+
+
+
+void conn_queue_response(tcp_server_p server, tcp_conn_s *conn, slice_s output)
+{
+    tcp_resp_s **walker = &conn->responses;
+    tcp_resp_s *resp = calloc(1, sizeof(*resp) + slice_len(output));
+    int64_t now = util_time_ms();
+
+    if(!resp) {
+        info("WARN: Unable to allocate memory for response!");
+        conn->closing = true;
+        return;
+    }
+
+    resp->data = slice_make((uint8_t *)(resp + 1), (ssize_t)slice_len(output));
+    memcpy(resp->data.data, output.data, slice_len(output));
+    resp->ready_ms = now + sample_delay_ms(&server->faults);
+
+    /* find the tail. */
+    while(*walker && (*walker)->next) {
+        walker = &(*walker)->next;
+    }
+
+    if(*walker && (*walker)->hold_until_ms > 0 && (*walker)->sent == 0) {
+        /* the last response was held back, this one passes it. */
+        info("Reordering response on socket %d.", conn->sock_fd);
+        (*walker)->hold_until_ms = 0;
+        resp->next = *walker;
+        *walker = resp;
+    } else {
+        if(util_rand_percent(server->faults.reorder_percent)) {
+            resp->hold_until_ms = now + server->faults.reorder_hold_ms;
+        }
+
+        if(*walker) {
+            (*walker)->next = resp;
+        } else {
+            *walker = resp;
+        }
+    }
+
+    conn->num_responses++;
+}
+
+
+
+int64_t conn_next_write_time(tcp_conn_s *conn)
+{
+    tcp_resp_s *resp = conn->responses;
+    int64_t next_ms = conn->next_write_ms;
+
+    if(resp->ready_ms > next_ms) {
+        next_ms = resp->ready_ms;
+    }
+
+    if(resp->hold_until_ms > next_ms) {
+        next_ms = resp->hold_until_ms;
+    }
+
+    return next_ms;
+}
+
+
+
+void conn_write(tcp_server_p server, tcp_conn_s *conn)
+{
+    tcp_server_faults_s *faults = &server->faults;
+
+    while(conn->responses && !conn->closing) {
+        tcp_resp_s *resp = conn->responses;
+        int64_t now = util_time_ms();
+        size_t chunk_size = slice_len(resp->data) - resp->sent;
+        int rc = 0;
+
+        if(conn_next_write_time(conn) > now) {
+            break;
+        }
+
+        /* the hold on a response only matters until it starts being sent. */
+        resp->hold_until_ms = 0;
+
+        if(faults->partial_write_max > 0) {
+            size_t max_chunk = 1 + (size_t)(util_rand_double() * (double)faults->partial_write_max);
+
+            if(chunk_size > max_chunk) {
+                chunk_size = max_chunk;
+            }
+        }
+
+        /* send at most 10ms worth of data at a time. */
+        if(faults->bandwidth > 0 && chunk_size > (faults->bandwidth / 100) + 1) {
+            chunk_size = (faults->bandwidth / 100) + 1;
+        }
+
+        rc = socket_write_some(conn->sock_fd, slice_from_slice(resp->data, resp->sent, chunk_size));
+
+        if(rc < 0) {
+            info("ERROR: error writing output packet! Error: %d", rc);
+            conn->closing = true;
+            return;
+        }
+
+        if(rc == 0) {
+            /* the socket is full, wait until it is writable. */
+            conn->write_blocked = true;
+            break;
+        }
+
+        resp->sent += (size_t)(unsigned int)rc;
+
+        if(faults->bandwidth > 0) {
+            conn->next_write_ms = now + (int64_t)(((uint64_t)(unsigned int)rc * 1000) / faults->bandwidth);
+        }
+
+        if(faults->partial_write_max > 0 && conn->next_write_ms <= now) {
+            /* give the client a chance to see the partial packet. */
+            conn->next_write_ms = now + 1;
+        }
+
+        if(resp->sent >= slice_len(resp->data)) {
+            conn->responses = resp->next;
+            conn->num_responses--;
+            free(resp);
+        }
+    }
+
+    conn_update_events(server, conn);
+}
+
+
+
+int64_t sample_delay_ms(tcp_server_faults_s *faults)
+{
+    double delay = 0.0;
+
+    switch(faults->delay_type) {
+        case TCP_SERVER_DELAY_FIXED:
+            delay = faults->delay_a_ms;
+            break;
+
+        case TCP_SERVER_DELAY_UNIFORM:
+            delay = faults->delay_a_ms + (util_rand_double() * (faults->delay_b_ms - faults->delay_a_ms));
+            break;
+
+        case TCP_SERVER_DELAY_NORMAL:
+            /* Box-Muller. */
+            delay = faults->delay_a_ms + faults->delay_b_ms * sqrt(-2.0 * log(1.0 - util_rand_double())) * cos(2.0 * 3.14159265358979323846 * util_rand_double());
+            break;
+
+        case TCP_SERVER_DELAY_EXPONENTIAL:
+            delay = -faults->delay_a_ms * log(1.0 - util_rand_double());
+            break;
+
+        default:
+            delay = 0.0;
+            break;
+    }
+
+    return (delay > 0.0 ? (int64_t)delay : 0);
+}
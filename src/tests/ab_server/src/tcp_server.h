@@ -35,6 +35,8 @@
 
 #include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "slice.h"
 
 typedef enum {
@@ -47,7 +49,59 @@ typedef enum {
 
 typedef struct tcp_server *tcp_server_p;
 
-extern tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context);
+/* transport level faults, for testing clients against slow or unreliable networks. */
+typedef enum {
+    TCP_SERVER_DELAY_NONE = 0,
+    TCP_SERVER_DELAY_FIXED,         /* a = delay */
+    TCP_SERVER_DELAY_UNIFORM,       /* a = min, b = max */
+    TCP_SERVER_DELAY_NORMAL,        /* a = mean, b = standard deviation */
+    TCP_SERVER_DELAY_EXPONENTIAL    /* a = mean */
+} tcp_server_delay_t;
+
+typedef struct {
+    tcp_server_delay_t delay_type;
+    double delay_a_ms;
+    double delay_b_ms;
+    uint32_t bandwidth;             /* bytes per second per connection, zero for unlimited. */
+    double reorder_percent;         /* chance that a response is held back behind the next one. */
+    int reorder_hold_ms;            /* how long a held response waits for a later one. */
+    double drop_percent;            /* chance that a request closes the connection instead of being answered. */
+    size_t partial_write_max;       /* if non-zero, responses go out in random chunks of at most this many bytes. */
+} tcp_server_faults_s;
+
+#define TCP_SERVER_FAULT_USAGE \
+    "   Transport fault options:\n" \
+    "       --delay=<dist>         delay each response.  <dist> is one of:\n" \
+    "                              fixed:<ms>, uniform:<min ms>,<max ms>,\n" \
+    "                              normal:<mean ms>,<std dev ms> or exp:<mean ms>.\n" \
+    "       --bandwidth=<bytes/s>  limit the response rate of each connection.\n" \
+    "       --reorder=<pct>[,<ms>] hold back <pct> percent of responses behind the next response\n" \
+    "                              on the same connection, for at most <ms> (default 250).\n" \
+    "       --drop=<pct>           close the connection instead of answering <pct> percent of requests.\n" \
+    "       --partial_write=<max>  write responses in random chunks of 1 to <max> bytes.\n"
+
+extern bool tcp_server_parse_fault_arg(const char *arg, tcp_server_faults_s *faults);
+
+/*
+ * open_conn() is called for each new client with the server context and returns the
+ * context passed to handler() for that client.  close_conn() is called with that
+ * context when the client goes away.   If open_conn() is NULL, all clients share
+ * the server context.
+ */
+extern tcp_server_p tcp_server_create(const char *host, const char *port, size_t buffer_size,
+                                      slice_s (*handler)(slice_s input, slice_s output, void *conn_context),
+                                      void *(*open_conn)(void *context),
+                                      void (*close_conn)(void *conn_context),
+                                      void *context);
+
+/*
+ * request_len() returns the length of the request at the start of the input,
+ * or zero if there is not enough data yet to tell.  Without it, the handler
+ * gets all buffered input and must return TCP_SERVER_INCOMPLETE until it has
+ * a whole request.
+ */
+extern void tcp_server_set_request_len(tcp_server_p server, size_t (*request_len)(slice_s input));
+extern void tcp_server_set_faults(tcp_server_p server, const tcp_server_faults_s *faults);
 extern void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate);
 extern void tcp_server_destroy(tcp_server_p server);
 
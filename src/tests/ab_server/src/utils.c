@@ -127,6 +127,23 @@ int64_t util_time_ms(void)
 #endif 
 
 
+/*
+ * random helpers
+ */
+
+/* returns a value in [0.0, 1.0). */
+double util_rand_double(void)
+{
+    return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+
+bool util_rand_percent(double percent)
+{
+    return (percent > 0.0 && (util_rand_double() * 100.0) < percent);
+}
+
+
 /*
  * string helpers
  */
@@ -33,6 +33,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "compat.h"
 #include "slice.h"
@@ -40,6 +41,10 @@
 extern int util_sleep_ms(int ms);
 extern int64_t util_time_ms(void);
 
+/* random helpers */
+extern double util_rand_double(void);
+extern bool util_rand_percent(double percent);
+
 /* string helpers */
 extern int match_chars(const char* source, int start_index, const char *chars);
 
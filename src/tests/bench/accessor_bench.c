@@ -0,0 +1,445 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Data accessor microbenchmark.
+ *
+ * Times the plc_tag_get_xxx()/plc_tag_set_xxx() functions on in-memory
+ * tags from the system protocol, so nothing but the accessor code and the
+ * tag locking is measured.   Each accessor is run in two byte orders, the
+ * CIP/little-endian default and the Modbus word order set up through the
+ * xxx_byte_order attributes, first in one thread and then with several
+ * threads hammering the same tag.
+ *
+ * The output mimics Google Benchmark's console and JSON reporters so that
+ * the usual comparison scripts can be used on it.
+ *
+ * POSIX only.
+ */
+
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "../../lib/libplctag.h"
+
+
+#define REQUIRED_VERSION 2,1,0
+
+#define DEFAULT_MIN_TIME_S (0.5)
+#define DEFAULT_THREADS (4)
+#define MAX_THREADS (256)
+#define MAX_ITERATIONS (1000000000LL)
+
+/* system tags are small, keep all offsets well inside them. */
+#define TEST_STRING "Hello PLC"
+
+/*
+ * the string capacity must be set or the zero-terminated system strings can
+ * only be overwritten by strings no longer than the current one.  The library
+ * has no Modbus string format, so use the common byte swapped register layout.
+ */
+#define SYSTEM_TAG_ATTRIBS "make=system&family=library&name=debug&str_max_capacity=16"
+#define MODBUS_ORDER_ATTRIBS "&int16_byte_order=10&int32_byte_order=3210&int64_byte_order=76543210"\
+                             "&float32_byte_order=3210&float64_byte_order=76543210&str_is_byte_swapped=1"
+
+
+typedef void (*accessor_func)(int32_t tag, int64_t iteration);
+
+typedef struct {
+    const char *name;
+    accessor_func func;
+} accessor_s;
+
+
+typedef struct {
+    const char *name;
+    const char *attribs;
+} byte_order_s;
+
+
+typedef struct {
+    int32_t tag;
+    accessor_func func;
+    int64_t iterations;
+    int64_t elapsed_us;
+    pthread_barrier_t *start_barrier;
+} thread_args_s;
+
+
+/* results are stored here so the compiler cannot drop the calls. */
+static volatile int64_t sink = 0;
+
+
+/* the accessors. */
+
+static void bench_get_bit(int32_t tag, int64_t i) { sink += plc_tag_get_bit(tag, (int)(i & 0x3F)); }
+static void bench_set_bit(int32_t tag, int64_t i) { plc_tag_set_bit(tag, (int)(i & 0x3F), (int)(i & 1)); }
+static void bench_get_uint8(int32_t tag, int64_t i) { sink += plc_tag_get_uint8(tag, (int)(i & 0x07)); }
+static void bench_set_uint8(int32_t tag, int64_t i) { plc_tag_set_uint8(tag, (int)(i & 0x07), (uint8_t)i); }
+static void bench_get_int8(int32_t tag, int64_t i) { sink += plc_tag_get_int8(tag, (int)(i & 0x07)); }
+static void bench_set_int8(int32_t tag, int64_t i) { plc_tag_set_int8(tag, (int)(i & 0x07), (int8_t)i); }
+static void bench_get_uint16(int32_t tag, int64_t i) { sink += plc_tag_get_uint16(tag, (int)(i & 0x03) * 2); }
+static void bench_set_uint16(int32_t tag, int64_t i) { plc_tag_set_uint16(tag, (int)(i & 0x03) * 2, (uint16_t)i); }
+static void bench_get_int16(int32_t tag, int64_t i) { sink += plc_tag_get_int16(tag, (int)(i & 0x03) * 2); }
+static void bench_set_int16(int32_t tag, int64_t i) { plc_tag_set_int16(tag, (int)(i & 0x03) * 2, (int16_t)i); }
+static void bench_get_uint32(int32_t tag, int64_t i) { sink += plc_tag_get_uint32(tag, (int)(i & 0x01) * 4); }
+static void bench_set_uint32(int32_t tag, int64_t i) { plc_tag_set_uint32(tag, (int)(i & 0x01) * 4, (uint32_t)i); }
+static void bench_get_int32(int32_t tag, int64_t i) { sink += plc_tag_get_int32(tag, (int)(i & 0x01) * 4); }
+static void bench_set_int32(int32_t tag, int64_t i) { plc_tag_set_int32(tag, (int)(i & 0x01) * 4, (int32_t)i); }
+static void bench_get_uint64(int32_t tag, int64_t i) { (void)i; sink += (int64_t)plc_tag_get_uint64(tag, 0); }
+static void bench_set_uint64(int32_t tag, int64_t i) { plc_tag_set_uint64(tag, 0, (uint64_t)i); }
+static void bench_get_int64(int32_t tag, int64_t i) { (void)i; sink += plc_tag_get_int64(tag, 0); }
+static void bench_set_int64(int32_t tag, int64_t i) { plc_tag_set_int64(tag, 0, i); }
+static void bench_get_float32(int32_t tag, int64_t i) { sink += (int64_t)plc_tag_get_float32(tag, (int)(i & 0x01) * 4); }
+static void bench_set_float32(int32_t tag, int64_t i) { plc_tag_set_float32(tag, (int)(i & 0x01) * 4, (float)i); }
+static void bench_get_float64(int32_t tag, int64_t i) { (void)i; sink += (int64_t)plc_tag_get_float64(tag, 0); }
+static void bench_set_float64(int32_t tag, int64_t i) { plc_tag_set_float64(tag, 0, (double)i); }
+
+static void bench_get_string(int32_t tag, int64_t i)
+{
+    char buf[sizeof(TEST_STRING) + 1];
+
+    (void)i;
+
+    sink += plc_tag_get_string(tag, 0, buf, (int)sizeof(buf));
+}
+
+static void bench_set_string(int32_t tag, int64_t i) { (void)i; plc_tag_set_string(tag, 0, TEST_STRING); }
+static void bench_get_string_length(int32_t tag, int64_t i) { (void)i; sink += plc_tag_get_string_length(tag, 0); }
+
+static void bench_get_raw_bytes(int32_t tag, int64_t i)
+{
+    uint8_t buf[16];
+
+    (void)i;
+
+    sink += plc_tag_get_raw_bytes(tag, 0, buf, (int)sizeof(buf));
+}
+
+static void bench_set_raw_bytes(int32_t tag, int64_t i)
+{
+    uint8_t buf[16];
+
+    memset(buf, (int)(i & 0xFF), sizeof(buf));
+
+    plc_tag_set_raw_bytes(tag, 0, buf, (int)sizeof(buf));
+}
+
+
+static accessor_s accessors[] = {
+    { "get_bit", bench_get_bit },
+    { "set_bit", bench_set_bit },
+    { "get_uint8", bench_get_uint8 },
+    { "set_uint8", bench_set_uint8 },
+    { "get_int8", bench_get_int8 },
+    { "set_int8", bench_set_int8 },
+    { "get_uint16", bench_get_uint16 },
+    { "set_uint16", bench_set_uint16 },
+    { "get_int16", bench_get_int16 },
+    { "set_int16", bench_set_int16 },
+    { "get_uint32", bench_get_uint32 },
+    { "set_uint32", bench_set_uint32 },
+    { "get_int32", bench_get_int32 },
+    { "set_int32", bench_set_int32 },
+    { "get_uint64", bench_get_uint64 },
+    { "set_uint64", bench_set_uint64 },
+    { "get_int64", bench_get_int64 },
+    { "set_int64", bench_set_int64 },
+    { "get_float32", bench_get_float32 },
+    { "set_float32", bench_set_float32 },
+    { "get_float64", bench_get_float64 },
+    { "set_float64", bench_set_float64 },
+    { "get_string", bench_get_string },
+    { "set_string", bench_set_string },
+    { "get_string_length", bench_get_string_length },
+    { "get_raw_bytes", bench_get_raw_bytes },
+    { "set_raw_bytes", bench_set_raw_bytes }
+};
+
+#define NUM_ACCESSORS ((int)(sizeof(accessors)/sizeof(accessors[0])))
+
+
+static byte_order_s byte_orders[] = {
+    { "cip", SYSTEM_TAG_ATTRIBS },
+    { "modbus", SYSTEM_TAG_ATTRIBS MODBUS_ORDER_ATTRIBS }
+};
+
+#define NUM_BYTE_ORDERS ((int)(sizeof(byte_orders)/sizeof(byte_orders[0])))
+
+
+
+
+static int64_t time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((int64_t)tv.tv_sec * 1000000) + (int64_t)tv.tv_usec;
+}
+
+
+static int64_t cpu_time_us(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return ((int64_t)usage.ru_utime.tv_sec * 1000000) + (int64_t)usage.ru_utime.tv_usec
+         + ((int64_t)usage.ru_stime.tv_sec * 1000000) + (int64_t)usage.ru_stime.tv_usec;
+}
+
+
+static void *bench_thread(void *data)
+{
+    thread_args_s *args = (thread_args_s *)data;
+    int64_t start_us = 0;
+
+    pthread_barrier_wait(args->start_barrier);
+
+    start_us = time_us();
+
+    for(int64_t i=0; i < args->iterations; i++) {
+        args->func(args->tag, i);
+    }
+
+    args->elapsed_us = time_us() - start_us;
+
+    return NULL;
+}
+
+
+/*
+ * Run the accessor the given number of iterations in each thread.  Returns
+ * the average wall time per thread and the CPU time of the whole process.
+ */
+static void run_once(int32_t tag, accessor_func func, int num_threads, int64_t iterations, int64_t *elapsed_us, int64_t *cpu_us)
+{
+    pthread_t threads[MAX_THREADS];
+    thread_args_s args[MAX_THREADS];
+    pthread_barrier_t start_barrier;
+    int64_t start_cpu_us = 0;
+    int64_t total_elapsed_us = 0;
+
+    pthread_barrier_init(&start_barrier, NULL, (unsigned int)num_threads + 1);
+
+    for(int i=0; i < num_threads; i++) {
+        args[i].tag = tag;
+        args[i].func = func;
+        args[i].iterations = iterations;
+        args[i].elapsed_us = 0;
+        args[i].start_barrier = &start_barrier;
+
+        if(pthread_create(&threads[i], NULL, bench_thread, &args[i])) {
+            fprintf(stderr, "Unable to create thread %d!\n", i);
+            exit(1);
+        }
+    }
+
+    start_cpu_us = cpu_time_us();
+
+    pthread_barrier_wait(&start_barrier);
+
+    for(int i=0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        total_elapsed_us += args[i].elapsed_us;
+    }
+
+    *cpu_us = cpu_time_us() - start_cpu_us;
+    *elapsed_us = total_elapsed_us / num_threads;
+
+    pthread_barrier_destroy(&start_barrier);
+}
+
+
+static int name_matches(const char *name, const char *filter)
+{
+    return (!filter || strstr(name, filter) != NULL);
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_accessor_bench [options]\n"
+                    "  --benchmark_filter=<substring>  only run benchmarks whose name contains <substring>.\n"
+                    "  --benchmark_min_time=<seconds>  minimum run time of each benchmark (default 0.5).\n"
+                    "  --benchmark_format=<console|json> output format (default console).\n"
+                    "  --threads=<count>               threads in the contended runs (default 4).\n"
+                    "\n"
+                    "  Benchmarks are named <accessor>/<byte order>/threads:<count>.\n");
+
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    double min_time_s = DEFAULT_MIN_TIME_S;
+    int json = 0;
+    int thread_counts[2] = { 1, DEFAULT_THREADS };
+    int first = 1;
+
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i], "--benchmark_filter=", 19) == 0) {
+            filter = &argv[i][19];
+        } else if(strncmp(argv[i], "--benchmark_min_time=", 21) == 0) {
+            min_time_s = atof(&argv[i][21]);
+        } else if(strcmp(argv[i], "--benchmark_format=json") == 0) {
+            json = 1;
+        } else if(strcmp(argv[i], "--benchmark_format=console") == 0) {
+            json = 0;
+        } else if(strncmp(argv[i], "--threads=", 10) == 0) {
+            thread_counts[1] = atoi(&argv[i][10]);
+        } else {
+            fprintf(stderr, "Unknown argument \"%s\"!\n", argv[i]);
+            usage();
+        }
+    }
+
+    if(min_time_s <= 0.0 || thread_counts[1] < 1 || thread_counts[1] > MAX_THREADS) {
+        fprintf(stderr, "The minimum time must be positive and the thread count between 1 and %d!\n", MAX_THREADS);
+        usage();
+    }
+
+    if(json) {
+        printf("{\n");
+        printf("  \"context\": {\n");
+        printf("    \"library_version\": \"%d.%d.%d\",\n",
+               plc_tag_get_int_attribute(0, "version_major", 0),
+               plc_tag_get_int_attribute(0, "version_minor", 0),
+               plc_tag_get_int_attribute(0, "version_patch", 0));
+        printf("    \"num_cpus\": %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+        printf("  },\n");
+        printf("  \"benchmarks\": [\n");
+    } else {
+        printf("%-48s %13s %15s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+        printf("------------------------------------------------------------------------------------------\n");
+    }
+
+    for(int order=0; order < NUM_BYTE_ORDERS; order++) {
+        int32_t tag = plc_tag_create(byte_orders[order].attribs, 1000);
+
+        if(tag < 0) {
+            fprintf(stderr, "Unable to create %s tag, got error %s!\n", byte_orders[order].name, plc_tag_decode_error(tag));
+            exit(1);
+        }
+
+        for(int a=0; a < NUM_ACCESSORS; a++) {
+            for(int t=0; t < 2; t++) {
+                char name[128];
+                int num_threads = thread_counts[t];
+                int64_t iterations = 1;
+                int64_t elapsed_us = 0;
+                int64_t cpu_us = 0;
+                double time_ns = 0.0;
+                double cpu_ns = 0.0;
+
+                /* a contended run with one thread is the same as the uncontended one. */
+                if(t == 1 && num_threads == 1) {
+                    continue;
+                }
+
+                snprintf(name, sizeof(name), "%s/%s/threads:%d", accessors[a].name, byte_orders[order].name, num_threads);
+
+                if(!name_matches(name, filter)) {
+                    continue;
+                }
+
+                /* grow the iteration count until the run is long enough, like Google Benchmark. */
+                while(1) {
+                    run_once(tag, accessors[a].func, num_threads, iterations, &elapsed_us, &cpu_us);
+
+                    if((double)elapsed_us >= min_time_s * 1000000.0 || iterations >= MAX_ITERATIONS) {
+                        break;
+                    }
+
+                    if(elapsed_us < 1000) {
+                        iterations *= 10;
+                    } else {
+                        double scale = (min_time_s * 1000000.0 * 1.4) / (double)elapsed_us;
+                        int64_t next = (int64_t)((double)iterations * scale);
+
+                        iterations = (next > iterations ? next : iterations + 1);
+                    }
+
+                    if(iterations > MAX_ITERATIONS) {
+                        iterations = MAX_ITERATIONS;
+                    }
+                }
+
+                time_ns = ((double)elapsed_us * 1000.0) / (double)iterations;
+                cpu_ns = ((double)cpu_us * 1000.0) / ((double)iterations * (double)num_threads);
+
+                if(json) {
+                    printf("%s    {\n", (first ? "" : ",\n"));
+                    printf("      \"name\": \"%s\",\n", name);
+                    printf("      \"run_type\": \"iteration\",\n");
+                    printf("      \"threads\": %d,\n", num_threads);
+                    printf("      \"iterations\": %" PRId64 ",\n", iterations);
+                    printf("      \"real_time\": %.2f,\n", time_ns);
+                    printf("      \"cpu_time\": %.2f,\n", cpu_ns);
+                    printf("      \"time_unit\": \"ns\"\n");
+                    printf("    }");
+                } else {
+                    printf("%-48s %10.1f ns %12.1f ns %12" PRId64 "\n", name, time_ns, cpu_ns, iterations);
+                }
+
+                fflush(stdout);
+
+                first = 0;
+            }
+        }
+
+        plc_tag_destroy(tag);
+    }
+
+    if(json) {
+        printf("\n  ]\n}\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,907 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Benchmark driver.
+ *
+ * Runs a fixed set of scenarios against the ab_server and modbus_server
+ * simulators and writes the results as JSON so that runs can be compared
+ * by scripts.  run_bench.sh starts the simulators and then runs this.
+ *
+ * For each scenario we report the number of operations, operations per
+ * second, the 50th and 99th percentile latency of single operations and the
+ * CPU time used by the whole process (including the library threads) per
+ * operation.
+ *
+ * POSIX only.
+ */
+
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "../../lib/libplctag.h"
+
+
+#define REQUIRED_VERSION 2,1,0
+
+#define DEFAULT_AB_GATEWAY "127.0.0.1"
+#define DEFAULT_MB_GATEWAY "127.0.0.1:5020"
+#define DEFAULT_DURATION_S (5)
+#define DEFAULT_TAGS (100)
+#define DEFAULT_AUTO_SYNC_TAGS (1000)
+#define DEFAULT_AUTO_SYNC_MS (100)
+#define DEFAULT_THREADS (8)
+
+#define TIMEOUT_MS (5000)
+#define TAG_STRING_SIZE (256)
+
+/* tags served by the simulators, see run_bench.sh. */
+#define AB_SMALL_TAG "BenchSmall"
+#define AB_SMALL_TAG_SIZE (1000)
+#define AB_BIG_TAG "BenchBig"
+#define AB_BIG_TAG_SIZE (2000)
+
+
+typedef struct {
+    const char *ab_gateway;
+    const char *mb_gateway;
+    int duration_s;
+    int num_tags;
+    int num_auto_sync_tags;
+    int auto_sync_ms;
+    int num_threads;
+} config_s;
+
+
+typedef struct {
+    int64_t *samples;
+    size_t count;
+    size_t capacity;
+} latency_s;
+
+
+typedef struct {
+    const char *scenario;
+    int num_tags;
+    int num_threads;
+    int64_t ops;
+    int64_t errors;
+    int64_t elapsed_us;
+    int64_t cpu_us;
+    latency_s latency;
+} result_s;
+
+
+typedef struct {
+    const char *name;
+    int (*run)(config_s *config, result_s *result);
+} scenario_s;
+
+
+static int run_small_tags(config_s *config, result_s *result);
+static int run_large_array(config_s *config, result_s *result);
+static int run_mixed_rw(config_s *config, result_s *result);
+static int run_auto_sync(config_s *config, result_s *result);
+static int run_threads_one_tag(config_s *config, result_s *result);
+static int run_modbus_small_tags(config_s *config, result_s *result);
+
+static scenario_s scenarios[] = {
+    { "small_tags", run_small_tags },
+    { "large_array", run_large_array },
+    { "mixed_rw", run_mixed_rw },
+    { "auto_sync", run_auto_sync },
+    { "threads_one_tag", run_threads_one_tag },
+    { "modbus_small_tags", run_modbus_small_tags }
+};
+
+#define NUM_SCENARIOS ((int)(sizeof(scenarios)/sizeof(scenarios[0])))
+
+
+
+/* timing and accounting helpers. */
+
+static int64_t time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((int64_t)tv.tv_sec * 1000000) + (int64_t)tv.tv_usec;
+}
+
+
+static int64_t cpu_time_us(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return ((int64_t)usage.ru_utime.tv_sec * 1000000) + (int64_t)usage.ru_utime.tv_usec
+         + ((int64_t)usage.ru_stime.tv_sec * 1000000) + (int64_t)usage.ru_stime.tv_usec;
+}
+
+
+static void latency_add(latency_s *latency, int64_t sample_us)
+{
+    if(latency->count >= latency->capacity) {
+        size_t new_capacity = (latency->capacity ? latency->capacity * 2 : 4096);
+        int64_t *new_samples = realloc(latency->samples, new_capacity * sizeof(int64_t));
+
+        if(!new_samples) {
+            /* drop the sample rather than fail the run. */
+            return;
+        }
+
+        latency->samples = new_samples;
+        latency->capacity = new_capacity;
+    }
+
+    latency->samples[latency->count] = sample_us;
+    latency->count++;
+}
+
+
+static void latency_merge(latency_s *dest, latency_s *src)
+{
+    for(size_t i=0; i < src->count; i++) {
+        latency_add(dest, src->samples[i]);
+    }
+}
+
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t left = *(const int64_t *)a;
+    int64_t right = *(const int64_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+
+/* the samples must be sorted. */
+static int64_t latency_percentile(latency_s *latency, int percentile)
+{
+    size_t index = 0;
+
+    if(latency->count == 0) {
+        return -1;
+    }
+
+    index = (latency->count * (size_t)percentile) / 100;
+    if(index >= latency->count) {
+        index = latency->count - 1;
+    }
+
+    return latency->samples[index];
+}
+
+
+
+
+/*
+ * Asynchronous operations are timed from the tag callbacks.   The callback
+ * only gets the tag ID, so we keep a small hash table from tag ID to the
+ * start time of the outstanding operation.   The table is filled before any
+ * callbacks are registered and not changed while they run.
+ */
+
+typedef struct {
+    int32_t tag_id;
+    int64_t start_us;
+} tag_timer_s;
+
+static pthread_mutex_t cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cb_cond = PTHREAD_COND_INITIALIZER;
+static tag_timer_s *cb_timers = NULL;
+static size_t cb_timers_size = 0;
+static latency_s *cb_latency = NULL;
+static int64_t cb_completed = 0;
+static int64_t cb_errors = 0;
+
+
+static tag_timer_s *find_timer(int32_t tag_id)
+{
+    size_t index = ((uint32_t)tag_id * 2654435761u) & (cb_timers_size - 1);
+
+    while(cb_timers[index].tag_id != tag_id) {
+        if(cb_timers[index].tag_id == 0) {
+            return NULL;
+        }
+
+        index = (index + 1) & (cb_timers_size - 1);
+    }
+
+    return &cb_timers[index];
+}
+
+
+static void timers_setup(int32_t *tags, int num_tags, latency_s *latency)
+{
+    cb_timers_size = 16;
+    while(cb_timers_size < (size_t)num_tags * 2) {
+        cb_timers_size *= 2;
+    }
+
+    cb_timers = calloc(cb_timers_size, sizeof(tag_timer_s));
+    if(!cb_timers) {
+        fprintf(stderr, "Unable to allocate the tag timer table!\n");
+        exit(PLCTAG_ERR_NO_MEM);
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        size_t index = ((uint32_t)tags[i] * 2654435761u) & (cb_timers_size - 1);
+
+        while(cb_timers[index].tag_id != 0) {
+            index = (index + 1) & (cb_timers_size - 1);
+        }
+
+        cb_timers[index].tag_id = tags[i];
+    }
+
+    cb_latency = latency;
+    cb_completed = 0;
+    cb_errors = 0;
+}
+
+
+static void timers_teardown(void)
+{
+    pthread_mutex_lock(&cb_mutex);
+    free(cb_timers);
+    cb_timers = NULL;
+    cb_timers_size = 0;
+    cb_latency = NULL;
+    pthread_mutex_unlock(&cb_mutex);
+}
+
+
+static void tag_callback(int32_t tag_id, int event, int status)
+{
+    int64_t now = time_us();
+    tag_timer_s *timer = NULL;
+
+    pthread_mutex_lock(&cb_mutex);
+
+    if(cb_timers && (timer = find_timer(tag_id))) {
+        switch(event) {
+            case PLCTAG_EVENT_READ_STARTED:
+            case PLCTAG_EVENT_WRITE_STARTED:
+                timer->start_us = now;
+                break;
+
+            case PLCTAG_EVENT_READ_COMPLETED:
+            case PLCTAG_EVENT_WRITE_COMPLETED:
+                /* ignore completions of operations we did not see start, such as the creation read. */
+                if(timer->start_us > 0) {
+                    /* the status is fetched after the fact and can still show pending, that is not an error. */
+                    if(status == PLCTAG_STATUS_OK || status == PLCTAG_STATUS_PENDING) {
+                        latency_add(cb_latency, now - timer->start_us);
+                    } else {
+                        cb_errors++;
+                    }
+
+                    timer->start_us = 0;
+                    cb_completed++;
+                    pthread_cond_broadcast(&cb_cond);
+                }
+                break;
+
+            case PLCTAG_EVENT_ABORTED:
+                timer->start_us = 0;
+                cb_errors++;
+                cb_completed++;
+                pthread_cond_broadcast(&cb_cond);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    pthread_mutex_unlock(&cb_mutex);
+}
+
+
+/* wait until the callbacks have seen the target number of completions. */
+static int wait_for_completions(int64_t target, int timeout_ms)
+{
+    int64_t end_us = time_us() + ((int64_t)timeout_ms * 1000);
+    int rc = PLCTAG_STATUS_OK;
+
+    pthread_mutex_lock(&cb_mutex);
+
+    while(cb_completed < target) {
+        struct timespec deadline;
+        int64_t deadline_us = 0;
+
+        if(time_us() >= end_us) {
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+        }
+
+        /* the condition variable uses the realtime clock, like gettimeofday(). */
+        deadline_us = time_us() + 1000;
+        deadline.tv_sec = (time_t)(deadline_us / 1000000);
+        deadline.tv_nsec = (long)((deadline_us % 1000000) * 1000);
+
+        pthread_cond_timedwait(&cb_cond, &cb_mutex, &deadline);
+    }
+
+    pthread_mutex_unlock(&cb_mutex);
+
+    return rc;
+}
+
+
+
+
+/* tag creation helpers. */
+
+static int32_t create_tag(const char *attribs)
+{
+    int32_t tag = plc_tag_create(attribs, TIMEOUT_MS);
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag < 0) {
+        fprintf(stderr, "Unable to create tag \"%s\", got error %s!\n", attribs, plc_tag_decode_error(tag));
+        exit(1);
+    }
+
+    if((rc = plc_tag_status(tag)) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Tag \"%s\" has status %s!\n", attribs, plc_tag_decode_error(rc));
+        exit(1);
+    }
+
+    return tag;
+}
+
+
+/* the template takes the gateway and the tag index, in that order. */
+static int32_t *create_tags(const char *attribs_template, const char *gateway, int num_tags)
+{
+    int32_t *tags = calloc((size_t)(unsigned int)num_tags, sizeof(int32_t));
+    char attribs[TAG_STRING_SIZE];
+
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate the tag array!\n");
+        exit(PLCTAG_ERR_NO_MEM);
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        snprintf(attribs, sizeof(attribs), attribs_template, gateway, i);
+        tags[i] = create_tag(attribs);
+    }
+
+    return tags;
+}
+
+
+static void destroy_tags(int32_t *tags, int num_tags)
+{
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(tags);
+}
+
+
+/*
+ * Start an operation on every tag and wait for all of them, over and over
+ * until the time is up.   If write_every is non-zero, every write_every'th
+ * tag is written instead of read.
+ */
+static int run_async_rounds(config_s *config, result_s *result, int32_t *tags, int num_tags, int write_every)
+{
+    int64_t end_us = 0;
+    int64_t start_us = 0;
+    int64_t start_cpu_us = 0;
+    int64_t issued = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    timers_setup(tags, num_tags, &result->latency);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_register_callback(tags[i], tag_callback);
+    }
+
+    start_us = time_us();
+    start_cpu_us = cpu_time_us();
+    end_us = start_us + ((int64_t)config->duration_s * 1000000);
+
+    while(time_us() < end_us && rc == PLCTAG_STATUS_OK) {
+        for(int i=0; i < num_tags; i++) {
+            int op_rc = PLCTAG_STATUS_OK;
+
+            if(write_every && (i % write_every) == 0) {
+                plc_tag_set_int32(tags[i], 0, (int32_t)issued);
+                op_rc = plc_tag_write(tags[i], 0);
+            } else {
+                op_rc = plc_tag_read(tags[i], 0);
+            }
+
+            if(op_rc != PLCTAG_STATUS_OK && op_rc != PLCTAG_STATUS_PENDING) {
+                result->errors++;
+                plc_tag_abort(tags[i]);
+            }
+
+            issued++;
+        }
+
+        rc = wait_for_completions(issued, TIMEOUT_MS);
+
+        /*
+         * the completion callback can run just before the tag is marked idle,
+         * make sure all the tags are idle so the next round does not get busy errors.
+         */
+        for(int i=0; i < num_tags && rc == PLCTAG_STATUS_OK; i++) {
+            while(plc_tag_status(tags[i]) == PLCTAG_STATUS_PENDING) {
+                sched_yield();
+            }
+        }
+    }
+
+    result->elapsed_us = time_us() - start_us;
+    result->cpu_us = cpu_time_us() - start_cpu_us;
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_unregister_callback(tags[i]);
+    }
+
+    pthread_mutex_lock(&cb_mutex);
+    result->ops = cb_completed;
+    result->errors += cb_errors;
+    pthread_mutex_unlock(&cb_mutex);
+
+    timers_teardown();
+
+    return rc;
+}
+
+
+
+
+/* Scenarios. */
+
+/* many single DINT tags read in parallel. */
+int run_small_tags(config_s *config, result_s *result)
+{
+    int32_t *tags = create_tags("protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1&name=" AB_SMALL_TAG "[%d]",
+                                config->ab_gateway, config->num_tags);
+    int rc = run_async_rounds(config, result, tags, config->num_tags, 0);
+
+    result->num_tags = config->num_tags;
+
+    destroy_tags(tags, config->num_tags);
+
+    return rc;
+}
+
+
+/* one large array read over and over.   The reads are fragmented. */
+int run_large_array(config_s *config, result_s *result)
+{
+    char attribs[TAG_STRING_SIZE];
+    int32_t tag = 0;
+    int64_t end_us = 0;
+    int64_t start_us = 0;
+    int64_t start_cpu_us = 0;
+
+    snprintf(attribs, sizeof(attribs), "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&elem_size=4&elem_count=%d&name=" AB_BIG_TAG,
+             config->ab_gateway, AB_BIG_TAG_SIZE);
+    tag = create_tag(attribs);
+
+    result->num_tags = 1;
+
+    start_us = time_us();
+    start_cpu_us = cpu_time_us();
+    end_us = start_us + ((int64_t)config->duration_s * 1000000);
+
+    while(time_us() < end_us) {
+        int64_t op_start_us = time_us();
+        int rc = plc_tag_read(tag, TIMEOUT_MS);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            latency_add(&result->latency, time_us() - op_start_us);
+        } else {
+            result->errors++;
+        }
+
+        result->ops++;
+    }
+
+    result->elapsed_us = time_us() - start_us;
+    result->cpu_us = cpu_time_us() - start_cpu_us;
+
+    plc_tag_destroy(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* many single DINT tags, half written and half read in parallel. */
+int run_mixed_rw(config_s *config, result_s *result)
+{
+    int32_t *tags = create_tags("protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1&name=" AB_SMALL_TAG "[%d]",
+                                config->ab_gateway, config->num_tags);
+    int rc = run_async_rounds(config, result, tags, config->num_tags, 2);
+
+    result->num_tags = config->num_tags;
+
+    destroy_tags(tags, config->num_tags);
+
+    return rc;
+}
+
+
+/* thousands of tags reading themselves in the background. */
+int run_auto_sync(config_s *config, result_s *result)
+{
+    char attribs_template[TAG_STRING_SIZE];
+    int32_t *tags = NULL;
+    int64_t start_us = 0;
+    int64_t start_cpu_us = 0;
+
+    result->num_tags = config->num_auto_sync_tags;
+
+    snprintf(attribs_template, sizeof(attribs_template),
+             "protocol=ab-eip&gateway=%%s&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1&auto_sync_read_ms=%d&name=" AB_SMALL_TAG "[%%d]",
+             config->auto_sync_ms);
+
+    /* the simulator tag is only so big, tags past the end share elements. */
+    tags = calloc((size_t)(unsigned int)config->num_auto_sync_tags, sizeof(int32_t));
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate the tag array!\n");
+        exit(PLCTAG_ERR_NO_MEM);
+    }
+
+    for(int i=0; i < config->num_auto_sync_tags; i++) {
+        char attribs[TAG_STRING_SIZE];
+
+        snprintf(attribs, sizeof(attribs), attribs_template, config->ab_gateway, i % AB_SMALL_TAG_SIZE);
+
+        tags[i] = create_tag(attribs);
+    }
+
+    timers_setup(tags, config->num_auto_sync_tags, &result->latency);
+
+    for(int i=0; i < config->num_auto_sync_tags; i++) {
+        plc_tag_register_callback(tags[i], tag_callback);
+    }
+
+    start_us = time_us();
+    start_cpu_us = cpu_time_us();
+
+    sleep((unsigned int)config->duration_s);
+
+    result->elapsed_us = time_us() - start_us;
+    result->cpu_us = cpu_time_us() - start_cpu_us;
+
+    for(int i=0; i < config->num_auto_sync_tags; i++) {
+        plc_tag_unregister_callback(tags[i]);
+    }
+
+    pthread_mutex_lock(&cb_mutex);
+    result->ops = cb_completed;
+    result->errors = cb_errors;
+    pthread_mutex_unlock(&cb_mutex);
+
+    timers_teardown();
+
+    destroy_tags(tags, config->num_auto_sync_tags);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* many threads doing blocking reads of the same tag. */
+
+typedef struct {
+    int32_t tag;
+    volatile int *done;
+    int64_t ops;
+    int64_t errors;
+    latency_s latency;
+} thread_args_s;
+
+
+static void *reader_thread(void *data)
+{
+    thread_args_s *args = (thread_args_s *)data;
+
+    while(!*(args->done)) {
+        int64_t op_start_us = time_us();
+        int rc = plc_tag_read(args->tag, TIMEOUT_MS);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            latency_add(&args->latency, time_us() - op_start_us);
+        } else {
+            args->errors++;
+        }
+
+        args->ops++;
+    }
+
+    return NULL;
+}
+
+
+int run_threads_one_tag(config_s *config, result_s *result)
+{
+    char attribs[TAG_STRING_SIZE];
+    int32_t tag = 0;
+    pthread_t *threads = calloc((size_t)(unsigned int)config->num_threads, sizeof(pthread_t));
+    thread_args_s *args = calloc((size_t)(unsigned int)config->num_threads, sizeof(thread_args_s));
+    volatile int done = 0;
+    int64_t start_us = 0;
+    int64_t start_cpu_us = 0;
+
+    if(!threads || !args) {
+        fprintf(stderr, "Unable to allocate the thread arrays!\n");
+        exit(PLCTAG_ERR_NO_MEM);
+    }
+
+    snprintf(attribs, sizeof(attribs), "protocol=ab-eip&gateway=%s&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1&name=" AB_SMALL_TAG "[0]",
+             config->ab_gateway);
+    tag = create_tag(attribs);
+
+    result->num_tags = 1;
+    result->num_threads = config->num_threads;
+
+    start_us = time_us();
+    start_cpu_us = cpu_time_us();
+
+    for(int i=0; i < config->num_threads; i++) {
+        args[i].tag = tag;
+        args[i].done = &done;
+
+        if(pthread_create(&threads[i], NULL, reader_thread, &args[i])) {
+            fprintf(stderr, "Unable to create thread %d!\n", i);
+            exit(1);
+        }
+    }
+
+    sleep((unsigned int)config->duration_s);
+
+    done = 1;
+
+    for(int i=0; i < config->num_threads; i++) {
+        pthread_join(threads[i], NULL);
+
+        result->ops += args[i].ops;
+        result->errors += args[i].errors;
+        latency_merge(&result->latency, &args[i].latency);
+        free(args[i].latency.samples);
+    }
+
+    result->elapsed_us = time_us() - start_us;
+    result->cpu_us = cpu_time_us() - start_cpu_us;
+
+    free(threads);
+    free(args);
+
+    plc_tag_destroy(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* many single holding register tags read in parallel from the Modbus simulator. */
+int run_modbus_small_tags(config_s *config, result_s *result)
+{
+    int32_t *tags = create_tags("protocol=modbus-tcp&gateway=%s&path=1&elem_size=2&elem_count=1&name=hr%d",
+                                config->mb_gateway, config->num_tags);
+    int rc = run_async_rounds(config, result, tags, config->num_tags, 0);
+
+    result->num_tags = config->num_tags;
+
+    destroy_tags(tags, config->num_tags);
+
+    return rc;
+}
+
+
+
+
+/* output */
+
+static void print_result(FILE *out, result_s *result, int first)
+{
+    double seconds = (double)result->elapsed_us / 1000000.0;
+
+    qsort(result->latency.samples, result->latency.count, sizeof(int64_t), compare_int64);
+
+    fprintf(out, "%s    {\n", (first ? "" : ",\n"));
+    fprintf(out, "      \"scenario\": \"%s\",\n", result->scenario);
+    fprintf(out, "      \"tags\": %d,\n", result->num_tags);
+    fprintf(out, "      \"threads\": %d,\n", (result->num_threads > 0 ? result->num_threads : 1));
+    fprintf(out, "      \"ops\": %" PRId64 ",\n", result->ops);
+    fprintf(out, "      \"errors\": %" PRId64 ",\n", result->errors);
+    fprintf(out, "      \"seconds\": %.3f,\n", seconds);
+    fprintf(out, "      \"ops_per_sec\": %.1f,\n", (seconds > 0.0 ? (double)result->ops / seconds : 0.0));
+    fprintf(out, "      \"p50_us\": %" PRId64 ",\n", latency_percentile(&result->latency, 50));
+    fprintf(out, "      \"p99_us\": %" PRId64 ",\n", latency_percentile(&result->latency, 99));
+    fprintf(out, "      \"cpu_us_per_op\": %.2f\n", (result->ops > 0 ? (double)result->cpu_us / (double)result->ops : 0.0));
+    fprintf(out, "    }");
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_bench [options] [<scenario> ...]\n"
+                    "  Runs all scenarios if none are given.  Scenarios:\n"
+                    "    small_tags        - many single DINT tags read in parallel.\n"
+                    "    large_array       - one 2000 element DINT array read repeatedly.\n"
+                    "    mixed_rw          - many single DINT tags, half written and half read.\n"
+                    "    auto_sync         - thousands of tags with automatic background reads.\n"
+                    "    threads_one_tag   - many threads reading the same tag.\n"
+                    "    modbus_small_tags - many single holding registers read in parallel.\n"
+                    "\n"
+                    "  Options:\n"
+                    "    --ab_gateway=<host>   ab_server address (default " DEFAULT_AB_GATEWAY ").\n"
+                    "    --mb_gateway=<host>   modbus_server address (default " DEFAULT_MB_GATEWAY ").\n"
+                    "    --duration=<seconds>  run time of each scenario (default 5).\n"
+                    "    --tags=<count>        tags in the parallel scenarios (default 100).\n"
+                    "    --auto_tags=<count>   tags in the auto_sync scenario (default 1000).\n"
+                    "    --auto_ms=<ms>        auto sync read period (default 100).\n"
+                    "    --threads=<count>     threads in the threads_one_tag scenario (default 8).\n"
+                    "    --output=<file>       write the JSON results to <file> instead of stdout.\n"
+                    "    --debug=<level>       set the library debug level.\n"
+                    "\n"
+                    "  The simulators must be running, see run_bench.sh.\n");
+
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    config_s config = { DEFAULT_AB_GATEWAY, DEFAULT_MB_GATEWAY, DEFAULT_DURATION_S, DEFAULT_TAGS,
+                        DEFAULT_AUTO_SYNC_TAGS, DEFAULT_AUTO_SYNC_MS, DEFAULT_THREADS };
+    int selected[NUM_SCENARIOS] = { 0 };
+    int any_selected = 0;
+    const char *output_file = NULL;
+    FILE *out = stdout;
+    int first = 1;
+    int status = 0;
+
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i], "--ab_gateway=", 13) == 0) {
+            config.ab_gateway = &argv[i][13];
+        } else if(strncmp(argv[i], "--mb_gateway=", 13) == 0) {
+            config.mb_gateway = &argv[i][13];
+        } else if(strncmp(argv[i], "--duration=", 11) == 0) {
+            config.duration_s = atoi(&argv[i][11]);
+        } else if(strncmp(argv[i], "--tags=", 7) == 0) {
+            config.num_tags = atoi(&argv[i][7]);
+        } else if(strncmp(argv[i], "--auto_tags=", 12) == 0) {
+            config.num_auto_sync_tags = atoi(&argv[i][12]);
+        } else if(strncmp(argv[i], "--auto_ms=", 10) == 0) {
+            config.auto_sync_ms = atoi(&argv[i][10]);
+        } else if(strncmp(argv[i], "--threads=", 10) == 0) {
+            config.num_threads = atoi(&argv[i][10]);
+        } else if(strncmp(argv[i], "--output=", 9) == 0) {
+            output_file = &argv[i][9];
+        } else if(strncmp(argv[i], "--debug=", 8) == 0) {
+            plc_tag_set_debug_level(atoi(&argv[i][8]));
+        } else {
+            int found = 0;
+
+            for(int j=0; j < NUM_SCENARIOS; j++) {
+                if(strcmp(argv[i], scenarios[j].name) == 0) {
+                    selected[j] = 1;
+                    any_selected = 1;
+                    found = 1;
+                }
+            }
+
+            if(!found) {
+                fprintf(stderr, "Unknown argument or scenario \"%s\"!\n", argv[i]);
+                usage();
+            }
+        }
+    }
+
+    if(config.duration_s <= 0 || config.num_tags <= 0 || config.num_tags > AB_SMALL_TAG_SIZE
+       || config.num_auto_sync_tags <= 0 || config.auto_sync_ms <= 0 || config.num_threads <= 0) {
+        fprintf(stderr, "Durations and counts must be positive and there can be at most %d parallel tags!\n", AB_SMALL_TAG_SIZE);
+        usage();
+    }
+
+    if(output_file) {
+        out = fopen(output_file, "w");
+        if(!out) {
+            fprintf(stderr, "Unable to open output file %s!\n", output_file);
+            exit(1);
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"library_version\": \"%d.%d.%d\",\n",
+            plc_tag_get_int_attribute(0, "version_major", 0),
+            plc_tag_get_int_attribute(0, "version_minor", 0),
+            plc_tag_get_int_attribute(0, "version_patch", 0));
+    fprintf(out, "  \"duration_s\": %d,\n", config.duration_s);
+    fprintf(out, "  \"results\": [\n");
+
+    for(int i=0; i < NUM_SCENARIOS; i++) {
+        result_s result;
+        int rc = PLCTAG_STATUS_OK;
+
+        if(any_selected && !selected[i]) {
+            continue;
+        }
+
+        memset(&result, 0, sizeof(result));
+        result.scenario = scenarios[i].name;
+
+        fprintf(stderr, "Running %s...\n", scenarios[i].name);
+
+        rc = scenarios[i].run(&config, &result);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Scenario %s stopped early with error %s!\n", scenarios[i].name, plc_tag_decode_error(rc));
+            status = 1;
+        }
+
+        print_result(out, &result, first);
+        first = 0;
+
+        fprintf(stderr, "  %" PRId64 " ops, %" PRId64 " errors, %.1f ops/s.\n", result.ops, result.errors,
+                (result.elapsed_us > 0 ? (double)result.ops * 1000000.0 / (double)result.elapsed_us : 0.0));
+
+        free(result.latency.samples);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if(output_file) {
+        fclose(out);
+    }
+
+    return status;
+}
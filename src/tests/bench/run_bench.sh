@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Start the simulators, run the benchmark scenarios against them and stop
+# them again.
+#
+# Usage: run_bench.sh <directory with ab_server, modbus_server and plctag_bench> [plctag_bench options]
+#
+# The results are written as JSON to stdout unless --output=<file> is given.
+#
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <binary directory> [plctag_bench options]" >&2
+    exit 1
+fi
+
+BIN_DIR="$1"
+shift
+
+"$BIN_DIR/ab_server" --plc=ControlLogix --path=1,0 --tag=BenchSmall:DINT[1000] --tag=BenchBig:DINT[2000] > /dev/null 2>&1 &
+AB_SERVER_PID=$!
+
+"$BIN_DIR/modbus_server" --port=5020 --unit=1 > /dev/null 2>&1 &
+MODBUS_SERVER_PID=$!
+
+trap 'kill $AB_SERVER_PID $MODBUS_SERVER_PID 2> /dev/null' EXIT INT TERM
+
+# give the simulators time to start listening.
+sleep 2
+
+"$BIN_DIR/plctag_bench" "$@"
@@ -0,0 +1,318 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/defs.h>
+#include <ab/eip_cip.h>
+#include <ab/pccc.h>
+#include <ab/session.h>
+#include <ab/tag.h>
+#include <util/rc.h>
+#include "fuzz_harness.h"
+
+
+/* the number of parts of a multi-service response we try to unpack. */
+#define FUZZ_MAX_SUB_PACKETS (4)
+
+/* sized to take a response to a large Forward Open. */
+#define FUZZ_MAX_PAYLOAD (4002)
+
+
+static ab_session_p session = NULL;
+
+static size_t load_session_data(const uint8_t *data, size_t size);
+static int load_request(ab_request_p *req, const uint8_t *data, size_t size);
+static int run_read_tickler(const uint8_t *data, size_t size, int tag_list);
+
+
+
+int fuzz_harness_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(session) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    session = (ab_session_p)mem_alloc((int)sizeof(struct ab_session_t));
+    if(!session) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    session->max_payload_size = FUZZ_MAX_PAYLOAD;
+    session->data_capacity = MAX_PACKET_SIZE_EX;
+
+    rc = mutex_create(&session->mutex);
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(session);
+        session = NULL;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * Run the input through session_unpack_response() as if it was the reply
+ * to several bundled requests.   Each part is unpacked into its own request
+ * like the session thread does.
+ */
+
+int fuzz_unpack_response(const uint8_t *data, size_t size)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!load_session_data(data, size)) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    for(int sub_packet = 0; sub_packet < FUZZ_MAX_SUB_PACKETS && rc == PLCTAG_STATUS_OK; sub_packet++) {
+        ab_request_p req = NULL;
+
+        rc = session_create_request(session, 0, &req);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        rc = session_unpack_response(session, req, sub_packet);
+
+        rc_dec(req);
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * Run the input through the connected CIP read response checks.
+ */
+
+int fuzz_check_read(const uint8_t *data, size_t size)
+{
+    return run_read_tickler(data, size, 0);
+}
+
+
+
+/*
+ * Run the input through the connected tag listing response checks.
+ */
+
+int fuzz_check_tag_list(const uint8_t *data, size_t size)
+{
+    return run_read_tickler(data, size, 1);
+}
+
+
+
+/*
+ * Decode the PCCC type/size header at the start of the input the way the
+ * PCCC read response checks do, including the second header of an array.
+ * Unlike the other entry points, the input is the PCCC data only, not a
+ * whole EIP frame.
+ */
+
+int fuzz_pccc_dt_byte(const uint8_t *data, size_t size)
+{
+    uint8_t *buf = NULL;
+    uint8_t *buf_end = NULL;
+    uint8_t *p = NULL;
+    int res_type = 0;
+    int res_length = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(size == 0 || size > MAX_PACKET_SIZE_EX) {
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    /* exact size copy so that overruns are caught by the sanitizers. */
+    buf = (uint8_t *)malloc(size);
+    if(!buf) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    memcpy(buf, data, size);
+    buf_end = buf + size;
+
+    do {
+        p = pccc_decode_dt_byte(buf, (int)size, &res_type, &res_length);
+        if(!p) {
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if(res_type == AB_PCCC_DATA_ARRAY) {
+            p = pccc_decode_dt_byte(p, (int)(buf_end - p), &res_type, &res_length);
+            if(!p) {
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
+        }
+
+        if(p > buf_end) {
+            /* the decoder walked off the end of the data. */
+            abort();
+        }
+    } while(0);
+
+    free(buf);
+
+    return rc;
+}
+
+
+
+
+/*
+ * Copy an EIP frame into the session buffer the way recv_eip_response()
+ * leaves it.   The encapsulation length is fixed up to match the input
+ * size as the receive code reads exactly that many bytes.
+ */
+
+size_t load_session_data(const uint8_t *data, size_t size)
+{
+    if(size < sizeof(eip_encap)) {
+        return 0;
+    }
+
+    if(size > session->data_capacity) {
+        size = session->data_capacity;
+    }
+
+    memset(session->data, 0, session->data_capacity);
+    memcpy(session->data, data, size);
+
+    ((eip_encap *)(session->data))->encap_length = h2le16((uint16_t)(size - sizeof(eip_encap)));
+
+    session->data_offset = (uint32_t)size;
+    session->data_size = (uint32_t)size;
+
+    return size;
+}
+
+
+/*
+ * Hand the input to a fresh request as a single, already unpacked, response.
+ */
+
+int load_request(ab_request_p *req, const uint8_t *data, size_t size)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!load_session_data(data, size)) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    rc = session_create_request(session, 0, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    memcpy((*req)->data, session->data, session->data_size);
+    (*req)->request_size = (int)session->data_size;
+    (*req)->resp_received = 1;
+
+    return rc;
+}
+
+
+/*
+ * Set up a connected tag with a read in flight, hand it the response and
+ * call the tag's tickler, which runs the response check.
+ *
+ * A fragmented response would make the check start the next read through
+ * the session, which does not exist here, so fragmented responses are
+ * treated as final.
+ */
+
+int run_read_tickler(const uint8_t *data, size_t size, int tag_list)
+{
+    struct ab_tag_t *tag = NULL;
+    eip_cip_co_resp *resp = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    tag = (struct ab_tag_t *)mem_alloc((int)sizeof(struct ab_tag_t));
+    if(!tag) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->vtable = &eip_cip_vtable;
+    tag->session = session;
+    tag->use_connected_msg = 1;
+    tag->tag_list = tag_list;
+    tag->elem_count = 1;
+    tag->elem_size = 4;
+    tag->size = tag->elem_count * tag->elem_size;
+    tag->data = (uint8_t *)mem_alloc(tag->size);
+    tag->first_read = 1;
+
+    do {
+        if(!tag->data) {
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        rc = load_request(&tag->req, data, size);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        resp = (eip_cip_co_resp *)(tag->req->data);
+        if(resp->status == AB_CIP_STATUS_FRAG) {
+            resp->status = AB_CIP_STATUS_OK;
+        }
+
+        tag->read_in_progress = 1;
+
+        rc = tag->vtable->tickler((plc_tag_p)tag);
+    } while(0);
+
+    if(tag->req) {
+        tag->req = rc_dec(tag->req);
+    }
+
+    if(tag->data) {
+        mem_free(tag->data);
+    }
+
+    mem_free(tag);
+
+    return rc;
+}
@@ -0,0 +1,60 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PLCTAG_FUZZ_HARNESS_H__
+#define __PLCTAG_FUZZ_HARNESS_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Entry points into the AB response parsers for the fuzz targets and the
+ * parser benchmark.
+ *
+ * Each function takes the raw bytes of one EIP frame, exactly as the
+ * session would receive it from the PLC, sets up the session, request and
+ * tag state the parser expects and runs the parser once.   The return
+ * value is whatever the parser returned.   Only a crash or a sanitizer
+ * report is a failure.
+ *
+ * fuzz_harness_init() must be called once before any of the others.
+ */
+
+extern int fuzz_harness_init(void);
+
+extern int fuzz_unpack_response(const uint8_t *data, size_t size);
+extern int fuzz_check_read(const uint8_t *data, size_t size);
+extern int fuzz_check_tag_list(const uint8_t *data, size_t size);
+extern int fuzz_pccc_dt_byte(const uint8_t *data, size_t size);
+
+#endif
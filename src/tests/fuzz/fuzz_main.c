@@ -0,0 +1,158 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Stand-in for the libFuzzer main() when the fuzz targets are built with
+ * a compiler that does not have libFuzzer.   It does no fuzzing, it just
+ * runs every file named on the command line, or found in a directory named
+ * on the command line, through the target once.   That is enough to check
+ * a corpus or a crash reproducer under the sanitizers.
+ *
+ * POSIX only.
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+extern int LLVMFuzzerInitialize(int *argc, char ***argv);
+extern int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int run_file(const char *path);
+static int run_path(const char *path);
+
+
+int run_file(const char *path)
+{
+    FILE *f = NULL;
+    uint8_t *data = NULL;
+    long size = 0;
+
+    f = fopen(path, "rb");
+    if(!f) {
+        fprintf(stderr, "Unable to open %s!\n", path);
+        return 1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    /* allocate at least one byte so empty inputs are still run. */
+    data = (uint8_t *)malloc((size_t)(size > 0 ? size : 1));
+    if(!data || (size > 0 && fread(data, 1, (size_t)size, f) != (size_t)size)) {
+        fprintf(stderr, "Unable to read %s!\n", path);
+        free(data);
+        fclose(f);
+        return 1;
+    }
+
+    fclose(f);
+
+    LLVMFuzzerTestOneInput(data, (size_t)size);
+
+    free(data);
+
+    return 0;
+}
+
+
+int run_path(const char *path)
+{
+    struct stat st;
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+    int failed = 0;
+
+    if(stat(path, &st) != 0) {
+        fprintf(stderr, "Unable to find %s!\n", path);
+        return 1;
+    }
+
+    if(!S_ISDIR(st.st_mode)) {
+        return run_file(path);
+    }
+
+    dir = opendir(path);
+    if(!dir) {
+        fprintf(stderr, "Unable to open directory %s!\n", path);
+        return 1;
+    }
+
+    while((entry = readdir(dir)) != NULL) {
+        char child[4096];
+
+        if(entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+
+        failed += run_path(child);
+    }
+
+    closedir(dir);
+
+    return failed;
+}
+
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    int count = 0;
+
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <input file or corpus directory>...\n", argv[0]);
+        return 1;
+    }
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    for(int i=1; i < argc; i++) {
+        if(argv[i][0] == '-') {
+            /* ignore libFuzzer options so the same command line works for both. */
+            continue;
+        }
+
+        failed += run_path(argv[i]);
+        count++;
+    }
+
+    fprintf(stderr, "Ran %d path(s), %d failed to load.\n", count, failed);
+
+    return (failed ? 1 : 0);
+}
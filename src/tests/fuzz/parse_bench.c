@@ -0,0 +1,423 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * AB response parser throughput benchmark.
+ *
+ * Runs a corpus of responses through the same entry points the fuzz
+ * targets use and reports the time per response and the throughput of
+ * each parser.   The corpus is given on the command line as capture files
+ * written with the capture_file tag attribute, in which case every received
+ * frame is used, or as files each holding one raw EIP frame, such as a
+ * fuzzer corpus directory.   The PCCC type/size decoder is run over a
+ * built-in set of headers instead since it does not take whole frames.
+ *
+ * The times include the request and tag setup done for each response.
+ * The session does the same request setup on the live path.
+ *
+ * The output mimics Google Benchmark's console and JSON reporters, like
+ * plctag_accessor_bench.
+ *
+ * POSIX only.
+ */
+
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "fuzz_harness.h"
+
+
+#define DEFAULT_MIN_TIME_S (0.5)
+#define MAX_ITERATIONS (1000000000LL)
+
+#define CAPTURE_MAGIC "PLCTCAP1"
+#define CAPTURE_MAGIC_SIZE (8)
+#define CAPTURE_RECORD_HEADER_SIZE (13)
+#define CAPTURE_RECORD_RECEIVED (3)
+
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} response_s;
+
+typedef struct {
+    response_s *items;
+    int count;
+    int capacity;
+    size_t total_bytes;
+} corpus_s;
+
+typedef int (*parser_func)(const uint8_t *data, size_t size);
+
+typedef struct {
+    const char *name;
+    parser_func func;
+    corpus_s *corpus;
+} parser_s;
+
+
+/* DT headers: short form, extended type, extended type and size, two byte type and size. */
+static uint8_t pccc_headers[][8] = {
+    { 0x42, 0x00 },
+    { 0x91, 0x09, 0x42, 0x00 },
+    { 0x99, 0x09, 0x0C, 0x42, 0x00 },
+    { 0xAA, 0x00, 0x09, 0x00, 0x0C, 0x42, 0x00 }
+};
+static size_t pccc_header_sizes[] = { 2, 4, 5, 7 };
+
+#define NUM_PCCC_HEADERS ((int)(sizeof(pccc_header_sizes)/sizeof(pccc_header_sizes[0])))
+
+
+static corpus_s frames = { NULL, 0, 0, 0 };
+static corpus_s pccc = { NULL, 0, 0, 0 };
+
+static parser_s parsers[] = {
+    { "unpack_response", fuzz_unpack_response, &frames },
+    { "check_read", fuzz_check_read, &frames },
+    { "check_tag_list", fuzz_check_tag_list, &frames },
+    { "pccc_dt_byte", fuzz_pccc_dt_byte, &pccc }
+};
+
+#define NUM_PARSERS ((int)(sizeof(parsers)/sizeof(parsers[0])))
+
+
+
+
+static int64_t time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((int64_t)tv.tv_sec * 1000000) + (int64_t)tv.tv_usec;
+}
+
+
+static int64_t cpu_time_us(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return ((int64_t)usage.ru_utime.tv_sec * 1000000) + (int64_t)usage.ru_utime.tv_usec
+         + ((int64_t)usage.ru_stime.tv_sec * 1000000) + (int64_t)usage.ru_stime.tv_usec;
+}
+
+
+static void corpus_add(corpus_s *corpus, const uint8_t *data, size_t size)
+{
+    if(corpus->count >= corpus->capacity) {
+        corpus->capacity = (corpus->capacity ? corpus->capacity * 2 : 64);
+        corpus->items = (response_s *)realloc(corpus->items, sizeof(response_s) * (size_t)corpus->capacity);
+
+        if(!corpus->items) {
+            fprintf(stderr, "Unable to allocate memory for the corpus!\n");
+            exit(1);
+        }
+    }
+
+    corpus->items[corpus->count].data = (uint8_t *)malloc(size ? size : 1);
+    if(!corpus->items[corpus->count].data) {
+        fprintf(stderr, "Unable to allocate memory for the corpus!\n");
+        exit(1);
+    }
+
+    memcpy(corpus->items[corpus->count].data, data, size);
+    corpus->items[corpus->count].size = size;
+    corpus->count++;
+    corpus->total_bytes += size;
+}
+
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+/* a capture file contributes all received frames, anything else is one raw frame. */
+static void load_file(const char *path)
+{
+    FILE *f = NULL;
+    uint8_t *buf = NULL;
+    long size = 0;
+
+    f = fopen(path, "rb");
+    if(!f) {
+        fprintf(stderr, "Unable to open %s!\n", path);
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    buf = (uint8_t *)malloc((size_t)(size > 0 ? size : 1));
+    if(!buf || (size > 0 && fread(buf, 1, (size_t)size, f) != (size_t)size)) {
+        fprintf(stderr, "Unable to read %s!\n", path);
+        exit(1);
+    }
+
+    fclose(f);
+
+    if(size >= CAPTURE_MAGIC_SIZE && memcmp(buf, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) == 0) {
+        long offset = CAPTURE_MAGIC_SIZE;
+
+        while(offset + CAPTURE_RECORD_HEADER_SIZE <= size) {
+            uint8_t record_type = buf[offset + 8];
+            uint32_t len = get_le32(&buf[offset + 9]);
+
+            offset += CAPTURE_RECORD_HEADER_SIZE;
+
+            if((long)len > size - offset) {
+                fprintf(stderr, "Truncated record in capture %s!\n", path);
+                break;
+            }
+
+            if(record_type == CAPTURE_RECORD_RECEIVED) {
+                corpus_add(&frames, &buf[offset], len);
+            }
+
+            offset += (long)len;
+        }
+    } else {
+        corpus_add(&frames, buf, (size_t)size);
+    }
+
+    free(buf);
+}
+
+
+static void load_path(const char *path)
+{
+    struct stat st;
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+
+    if(stat(path, &st) != 0) {
+        fprintf(stderr, "Unable to find %s!\n", path);
+        exit(1);
+    }
+
+    if(!S_ISDIR(st.st_mode)) {
+        load_file(path);
+        return;
+    }
+
+    dir = opendir(path);
+    if(!dir) {
+        fprintf(stderr, "Unable to open directory %s!\n", path);
+        exit(1);
+    }
+
+    while((entry = readdir(dir)) != NULL) {
+        char child[4096];
+
+        if(entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+
+        load_path(child);
+    }
+
+    closedir(dir);
+}
+
+
+static void run_once(parser_s *parser, int64_t iterations, int64_t *elapsed_us, int64_t *cpu_us)
+{
+    int64_t start = time_us();
+    int64_t cpu_start = cpu_time_us();
+
+    for(int64_t i=0; i < iterations; i++) {
+        response_s *r = &parser->corpus->items[i % parser->corpus->count];
+
+        parser->func(r->data, r->size);
+    }
+
+    *elapsed_us = time_us() - start;
+    *cpu_us = cpu_time_us() - cpu_start;
+}
+
+
+static int name_matches(const char *name, const char *filter)
+{
+    return (!filter || strstr(name, filter) != NULL);
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_parse_bench [options] <capture file or corpus directory>...\n"
+                    "  --benchmark_filter=<substring>  only run benchmarks whose name contains <substring>.\n"
+                    "  --benchmark_min_time=<seconds>  minimum run time of each benchmark (default 0.5).\n"
+                    "  --benchmark_format=<console|json> output format (default console).\n"
+                    "\n"
+                    "  Benchmarks are named <parser>/responses:<count>.  Each iteration parses one response.\n");
+
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    double min_time_s = DEFAULT_MIN_TIME_S;
+    int json = 0;
+    int first = 1;
+
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i], "--benchmark_filter=", 19) == 0) {
+            filter = &argv[i][19];
+        } else if(strncmp(argv[i], "--benchmark_min_time=", 21) == 0) {
+            min_time_s = atof(&argv[i][21]);
+        } else if(strcmp(argv[i], "--benchmark_format=json") == 0) {
+            json = 1;
+        } else if(strcmp(argv[i], "--benchmark_format=console") == 0) {
+            json = 0;
+        } else if(argv[i][0] == '-') {
+            fprintf(stderr, "Unknown argument \"%s\"!\n", argv[i]);
+            usage();
+        } else {
+            load_path(argv[i]);
+        }
+    }
+
+    if(min_time_s <= 0.0) {
+        fprintf(stderr, "The minimum time must be positive!\n");
+        usage();
+    }
+
+    if(frames.count == 0) {
+        fprintf(stderr, "No responses found in the corpus!\n");
+        usage();
+    }
+
+    for(int i=0; i < NUM_PCCC_HEADERS; i++) {
+        corpus_add(&pccc, pccc_headers[i], pccc_header_sizes[i]);
+    }
+
+    if(fuzz_harness_init() != 0) {
+        fprintf(stderr, "Unable to set up the parser harness!\n");
+        exit(1);
+    }
+
+    if(json) {
+        printf("{\n");
+        printf("  \"context\": {\n");
+        printf("    \"responses\": %d,\n", frames.count);
+        printf("    \"response_bytes\": %zu\n", frames.total_bytes);
+        printf("  },\n");
+        printf("  \"benchmarks\": [\n");
+    } else {
+        printf("%-40s %13s %15s %12s %12s\n", "Benchmark", "Time", "CPU", "Iterations", "Throughput");
+        printf("--------------------------------------------------------------------------------------------------\n");
+    }
+
+    for(int p=0; p < NUM_PARSERS; p++) {
+        char name[128];
+        int64_t iterations = 1;
+        int64_t elapsed_us = 0;
+        int64_t cpu_us = 0;
+        double time_ns = 0.0;
+        double cpu_ns = 0.0;
+        double mb_per_s = 0.0;
+        double avg_bytes = (double)parsers[p].corpus->total_bytes / (double)parsers[p].corpus->count;
+
+        snprintf(name, sizeof(name), "%s/responses:%d", parsers[p].name, parsers[p].corpus->count);
+
+        if(!name_matches(name, filter)) {
+            continue;
+        }
+
+        /* grow the iteration count until the run is long enough, like Google Benchmark. */
+        while(1) {
+            run_once(&parsers[p], iterations, &elapsed_us, &cpu_us);
+
+            if((double)elapsed_us >= min_time_s * 1000000.0 || iterations >= MAX_ITERATIONS) {
+                break;
+            }
+
+            if(elapsed_us < 1000) {
+                iterations *= 10;
+            } else {
+                double scale = (min_time_s * 1000000.0 * 1.4) / (double)elapsed_us;
+                int64_t next = (int64_t)((double)iterations * scale);
+
+                iterations = (next > iterations ? next : iterations + 1);
+            }
+
+            if(iterations > MAX_ITERATIONS) {
+                iterations = MAX_ITERATIONS;
+            }
+        }
+
+        time_ns = ((double)elapsed_us * 1000.0) / (double)iterations;
+        cpu_ns = ((double)cpu_us * 1000.0) / (double)iterations;
+        mb_per_s = (time_ns > 0.0 ? (avg_bytes * 1000.0) / time_ns : 0.0);
+
+        if(json) {
+            printf("%s    {\n", (first ? "" : ",\n"));
+            printf("      \"name\": \"%s\",\n", name);
+            printf("      \"run_type\": \"iteration\",\n");
+            printf("      \"iterations\": %" PRId64 ",\n", iterations);
+            printf("      \"real_time\": %.2f,\n", time_ns);
+            printf("      \"cpu_time\": %.2f,\n", cpu_ns);
+            printf("      \"bytes_per_second\": %.0f,\n", mb_per_s * 1000000.0);
+            printf("      \"time_unit\": \"ns\"\n");
+            printf("    }");
+        } else {
+            printf("%-40s %10.1f ns %12.1f ns %12" PRId64 " %7.1f MB/s\n", name, time_ns, cpu_ns, iterations, mb_per_s);
+        }
+
+        fflush(stdout);
+
+        first = 0;
+    }
+
+    if(json) {
+        printf("\n  ]\n}\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "../../ab_server/src/compat.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(IS_WINDOWS)
+#include <Windows.h>
+#else
+ /* assume it is POSIX of some sort... */
+#include <signal.h>
+#include <strings.h>
+#endif
+
+#include "modbus.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+static void usage(void);
+static void process_args(int argc, const char **argv, mb_server_s *server, const char **port, tcp_server_faults_s *faults);
+static void parse_units(const char *units_str, mb_server_s *server);
+static size_t parse_count(const char *arg, const char *count_str);
+
+/* the largest Modbus/TCP frame is 260 bytes, leave room for several pipelined requests. */
+#define CONN_BUFFER_SIZE (4096)
+
+#define DEFAULT_PORT "502"
+#define DEFAULT_COUNT (10000)
+
+
+#ifdef IS_WINDOWS
+
+typedef volatile int sig_flag_t;
+
+sig_flag_t done = 0;
+
+/* straight from MS' web site :-) */
+int WINAPI CtrlHandler(DWORD fdwCtrlType)
+{
+    switch (fdwCtrlType)
+    {
+        // Handle the CTRL-C signal.
+    case CTRL_C_EVENT:
+        info("^C event");
+        done = 1;
+        return TRUE;
+
+        // CTRL-CLOSE: confirm that the user wants to exit.
+    case CTRL_CLOSE_EVENT:
+        info("Close event");
+        done = 1;
+        return TRUE;
+
+        // Pass other signals to the next handler.
+    case CTRL_BREAK_EVENT:
+        info("^Break event");
+        done = 1;
+        return TRUE;
+
+    case CTRL_LOGOFF_EVENT:
+        info("Logoff event");
+        done = 1;
+        return TRUE;
+
+    case CTRL_SHUTDOWN_EVENT:
+        info("Shutdown event");
+        done = 1;
+        return TRUE;
+
+    default:
+        info("Default Event: %d", fdwCtrlType);
+        return FALSE;
+    }
+}
+
+
+void setup_break_handler(void)
+{
+    if (!SetConsoleCtrlHandler(CtrlHandler, TRUE))
+    {
+        printf("\nERROR: Could not set control handler!\n");
+        usage();
+    }
+}
+
+#else
+
+typedef volatile sig_atomic_t sig_flag_t;
+
+sig_flag_t done = 0;
+
+void SIGINT_handler(int not_used)
+{
+    (void)not_used;
+
+    done = 1;
+}
+
+void setup_break_handler(void)
+{
+    struct sigaction act;
+
+    /* set up signal handler. */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGINT_handler;
+    sigaction(SIGINT, &act, NULL);
+}
+
+#endif
+
+
+int main(int argc, const char **argv)
+{
+    tcp_server_p tcp_server = NULL;
+    mb_server_s *server = NULL;
+    const char *port = DEFAULT_PORT;
+    tcp_server_faults_s faults;
+
+    /* set up handler for ^C etc. */
+    setup_break_handler();
+
+    debug_off();
+
+    /* the unit table is large, keep it off the stack. */
+    server = calloc(1, sizeof(*server));
+    if(!server) {
+        error("Unable to allocate memory for the server!");
+    }
+
+    memset(&faults, 0, sizeof(faults));
+
+    /* set the random seed. */
+    srand((unsigned int)time(NULL));
+
+    process_args(argc, argv, server, &port, &faults);
+
+    /* open a server connection and listen on the right port. */
+    tcp_server = tcp_server_create("0.0.0.0", port, CONN_BUFFER_SIZE, mb_dispatch_request, NULL, NULL, server);
+
+    tcp_server_set_request_len(tcp_server, mb_request_len);
+    tcp_server_set_faults(tcp_server, &faults);
+
+    tcp_server_start(tcp_server, &done);
+
+    tcp_server_destroy(tcp_server);
+
+    for(size_t i=0; i < MB_MAX_UNITS; i++) {
+        if(server->units[i]) {
+            free(server->units[i]->coils);
+            free(server->units[i]->discrete_inputs);
+            free(server->units[i]->holding_registers);
+            free(server->units[i]->input_registers);
+            free(server->units[i]);
+        }
+    }
+
+    free(server);
+
+    return 0;
+}
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: modbus_server [--port=<port>] [--unit=<ids>] [<data options>] [<debugging options>]\n"
+                    "   <port> = TCP port to listen on, default 502.\n"
+                    "\n"
+                    "   <ids> = unit IDs to answer, e.g. \"1\" or \"1-10\".  May be given more than once.\n"
+                    "           All unit IDs are answered if none are given.  Other unit IDs get\n"
+                    "           exception 0B, gateway target device failed to respond.\n"
+                    "\n"
+                    "   Data options, each unit has its own data:\n"
+                    "       --coils=<count>             number of coils (co), default 10000.\n"
+                    "       --discrete_inputs=<count>   number of discrete inputs (di), default 10000.\n"
+                    "       --holding_registers=<count> number of holding registers (hr), default 10000.\n"
+                    "       --input_registers=<count>   number of input registers (ir), default 10000.\n"
+                    "\n"
+                    "       Discrete inputs alternate 0 and 1 and input registers hold their own address.\n"
+                    "\n"
+                    "   Debugging options:\n"
+                    "       --debug                turn on debugging output.\n"
+                    "       --exception=<pct>[,<code>] fail <pct> percent of requests with the hex Modbus\n"
+                    "                              exception <code> (default 06, server device busy).\n"
+                    "\n"
+                    TCP_SERVER_FAULT_USAGE
+                    "\n"
+                    "Example: modbus_server --port=5020 --unit=1-4 --holding_registers=1000\n");
+
+    exit(1);
+}
+
+
+void process_args(int argc, const char **argv, mb_server_s *server, const char **port, tcp_server_faults_s *faults)
+{
+    bool has_unit = false;
+
+    server->num_coils = DEFAULT_COUNT;
+    server->num_discrete_inputs = DEFAULT_COUNT;
+    server->num_holding_registers = DEFAULT_COUNT;
+    server->num_input_registers = DEFAULT_COUNT;
+
+    /* skip the program name. */
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i],"--port=",7) == 0) {
+            *port = &argv[i][7];
+        } else if(strncmp(argv[i],"--unit=",7) == 0) {
+            parse_units(&argv[i][7], server);
+            has_unit = true;
+        } else if(strncmp(argv[i],"--coils=",8) == 0) {
+            server->num_coils = parse_count(argv[i], &argv[i][8]);
+        } else if(strncmp(argv[i],"--discrete_inputs=",18) == 0) {
+            server->num_discrete_inputs = parse_count(argv[i], &argv[i][18]);
+        } else if(strncmp(argv[i],"--holding_registers=",20) == 0) {
+            server->num_holding_registers = parse_count(argv[i], &argv[i][20]);
+        } else if(strncmp(argv[i],"--input_registers=",18) == 0) {
+            server->num_input_registers = parse_count(argv[i], &argv[i][18]);
+        } else if(strcmp(argv[i],"--debug") == 0) {
+            debug_on();
+        } else if(strncmp(argv[i],"--exception=",12) == 0) {
+            unsigned int exception_code = 0x06; /* server device busy. */
+
+            if(str_scanf(&argv[i][12], "%lf,%x", &server->exception_percent, &exception_code) < 1
+               || server->exception_percent < 0.0 || exception_code == 0 || exception_code > 0xFF) {
+                fprintf(stderr, "Unable to parse exception option \"%s\"!\n", argv[i]);
+                usage();
+            }
+
+            server->exception_code = (uint8_t)exception_code;
+        } else if(!tcp_server_parse_fault_arg(argv[i], faults)) {
+            fprintf(stderr, "Unknown option \"%s\"!\n", argv[i]);
+            usage();
+        }
+    }
+
+    if(!has_unit) {
+        for(size_t i=0; i < MB_MAX_UNITS; i++) {
+            server->unit_enabled[i] = true;
+        }
+    }
+}
+
+
+void parse_units(const char *units_str, mb_server_s *server)
+{
+    unsigned int first = 0;
+    unsigned int last = 0;
+    int num_matched = str_scanf(units_str, "%u-%u", &first, &last);
+
+    if(num_matched == 1) {
+        last = first;
+    }
+
+    if(num_matched < 1 || first > last || last >= MB_MAX_UNITS) {
+        fprintf(stderr, "Unable to parse unit IDs \"%s\", must be one ID or a range of IDs from 0 to 255!\n", units_str);
+        usage();
+    }
+
+    for(unsigned int i=first; i <= last; i++) {
+        server->unit_enabled[i] = true;
+    }
+
+    info("Serving unit IDs %u to %u.", first, last);
+}
+
+
+size_t parse_count(const char *arg, const char *count_str)
+{
+    size_t count = 0;
+
+    if(str_scanf(count_str, "%zu", &count) != 1 || count > MB_MAX_ADDRESSES) {
+        fprintf(stderr, "Unable to parse \"%s\", the count must be between 0 and %d!\n", arg, MB_MAX_ADDRESSES);
+        usage();
+    }
+
+    return count;
+}
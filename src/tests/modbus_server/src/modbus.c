@@ -0,0 +1,505 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "modbus.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+
+/*
+ * Modbus/TCP requests and responses have the same MBAP header:
+ *
+ *   uint16 transaction ID      - copied from the request to the response.
+ *   uint16 protocol ID         - always zero.
+ *   uint16 length              - bytes following this field.
+ *   uint8  unit ID
+ *   uint8  function code
+ *   data...
+ *
+ * All the fields are big endian.   Exception responses have the high bit of
+ * the function code set and a single byte of exception code as data.
+ *
+ * Each request is answered on its own.   The TCP server splits the input on
+ * the MBAP length, so a client can have many transactions outstanding.
+ */
+
+#define MBAP_HEADER_SIZE        (7)
+#define MBAP_MAX_PDU_SIZE       (253)
+
+/* functions */
+#define MB_READ_COILS           ((uint8_t)0x01)
+#define MB_READ_DISCRETE_INPUTS ((uint8_t)0x02)
+#define MB_READ_HOLDING_REGS    ((uint8_t)0x03)
+#define MB_READ_INPUT_REGS      ((uint8_t)0x04)
+#define MB_WRITE_COIL           ((uint8_t)0x05)
+#define MB_WRITE_REG            ((uint8_t)0x06)
+#define MB_WRITE_COILS          ((uint8_t)0x0F)
+#define MB_WRITE_REGS           ((uint8_t)0x10)
+
+#define MB_EXCEPTION_FLAG       ((uint8_t)0x80)
+
+/* exceptions */
+#define MB_ERR_ILLEGAL_FUNCTION ((uint8_t)0x01)
+#define MB_ERR_ILLEGAL_ADDRESS  ((uint8_t)0x02)
+#define MB_ERR_ILLEGAL_VALUE    ((uint8_t)0x03)
+#define MB_ERR_NO_RESPONSE      ((uint8_t)0x0B) /* gateway target device failed to respond. */
+
+/* quantity limits from the Modbus specification. */
+#define MB_MAX_READ_BITS        (2000)
+#define MB_MAX_READ_REGS        (125)
+#define MB_MAX_WRITE_BITS       (1968)
+#define MB_MAX_WRITE_REGS       (123)
+
+static mb_unit_s *get_unit(mb_server_s *server, uint8_t unit_id);
+static uint8_t handle_read_bits(slice_s pdu, slice_s resp, size_t *resp_len, uint8_t *bits, size_t num_bits);
+static uint8_t handle_read_regs(slice_s pdu, slice_s resp, size_t *resp_len, uint16_t *regs, size_t num_regs);
+static uint8_t handle_write_coil(slice_s pdu, slice_s resp, size_t *resp_len, uint8_t *coils, size_t num_coils);
+static uint8_t handle_write_reg(slice_s pdu, slice_s resp, size_t *resp_len, uint16_t *regs, size_t num_regs);
+static uint8_t handle_write_coils(slice_s pdu, slice_s resp, size_t *resp_len, uint8_t *coils, size_t num_coils);
+static uint8_t handle_write_regs(slice_s pdu, slice_s resp, size_t *resp_len, uint16_t *regs, size_t num_regs);
+static uint16_t get_uint16_be(slice_s s, size_t offset);
+static void set_uint16_be(slice_s s, size_t offset, uint16_t val);
+
+
+size_t mb_request_len(slice_s input)
+{
+    if(slice_len(input) < 6) {
+        return 0;
+    }
+
+    return (size_t)6 + (size_t)get_uint16_be(input, 4);
+}
+
+
+slice_s mb_dispatch_request(slice_s input, slice_s output, void *context)
+{
+    mb_server_s *server = (mb_server_s *)context;
+    uint16_t length = 0;
+    uint8_t unit_id = 0;
+    uint8_t function = 0;
+    slice_s pdu;
+    slice_s resp;
+    size_t resp_len = 0;
+    uint8_t exception = 0;
+    mb_unit_s *unit = NULL;
+
+    info("Got packet:");
+    slice_dump(input);
+
+    if(slice_len(input) < MBAP_HEADER_SIZE + 1) {
+        return slice_make_err(TCP_SERVER_INCOMPLETE);
+    }
+
+    length = get_uint16_be(input, 4);
+
+    if(get_uint16_be(input, 2) != 0 || length < 2 || length > MBAP_MAX_PDU_SIZE + 1) {
+        info("Illegal MBAP header, protocol %u and length %u!", get_uint16_be(input, 2), length);
+        return slice_make_err(TCP_SERVER_DONE);
+    }
+
+    unit_id = slice_get_uint8(input, 6);
+    function = slice_get_uint8(input, 7);
+
+    /* the PDU is the function code and its data. */
+    pdu = slice_from_slice(input, MBAP_HEADER_SIZE, (size_t)length - 1);
+    resp = slice_from_slice(output, MBAP_HEADER_SIZE, MBAP_MAX_PDU_SIZE);
+
+    if(!server->unit_enabled[unit_id]) {
+        info("Unit %u is not served.", unit_id);
+        exception = MB_ERR_NO_RESPONSE;
+    } else if(util_rand_percent(server->exception_percent)) {
+        info("Injecting exception %02x for function %02x.", server->exception_code, function);
+        exception = server->exception_code;
+    } else {
+        unit = get_unit(server, unit_id);
+
+        /* every response starts with the function code. */
+        slice_set_uint8(resp, 0, function);
+        resp_len = 1;
+
+        switch(function) {
+            case MB_READ_COILS:
+                exception = handle_read_bits(pdu, resp, &resp_len, unit->coils, server->num_coils);
+                break;
+
+            case MB_READ_DISCRETE_INPUTS:
+                exception = handle_read_bits(pdu, resp, &resp_len, unit->discrete_inputs, server->num_discrete_inputs);
+                break;
+
+            case MB_READ_HOLDING_REGS:
+                exception = handle_read_regs(pdu, resp, &resp_len, unit->holding_registers, server->num_holding_registers);
+                break;
+
+            case MB_READ_INPUT_REGS:
+                exception = handle_read_regs(pdu, resp, &resp_len, unit->input_registers, server->num_input_registers);
+                break;
+
+            case MB_WRITE_COIL:
+                exception = handle_write_coil(pdu, resp, &resp_len, unit->coils, server->num_coils);
+                break;
+
+            case MB_WRITE_REG:
+                exception = handle_write_reg(pdu, resp, &resp_len, unit->holding_registers, server->num_holding_registers);
+                break;
+
+            case MB_WRITE_COILS:
+                exception = handle_write_coils(pdu, resp, &resp_len, unit->coils, server->num_coils);
+                break;
+
+            case MB_WRITE_REGS:
+                exception = handle_write_regs(pdu, resp, &resp_len, unit->holding_registers, server->num_holding_registers);
+                break;
+
+            default:
+                info("Unsupported function %02x!", function);
+                exception = MB_ERR_ILLEGAL_FUNCTION;
+                break;
+        }
+    }
+
+    if(exception) {
+        slice_set_uint8(resp, 0, (uint8_t)(function | MB_EXCEPTION_FLAG));
+        slice_set_uint8(resp, 1, exception);
+        resp_len = 2;
+    }
+
+    /* build the MBAP header, the transaction ID is copied from the request. */
+    set_uint16_be(output, 0, get_uint16_be(input, 0));
+    set_uint16_be(output, 2, 0);
+    set_uint16_be(output, 4, (uint16_t)(resp_len + 1));
+    slice_set_uint8(output, 6, unit_id);
+
+    return slice_from_slice(output, 0, MBAP_HEADER_SIZE + resp_len);
+}
+
+
+mb_unit_s *get_unit(mb_server_s *server, uint8_t unit_id)
+{
+    mb_unit_s *unit = server->units[unit_id];
+
+    if(unit) {
+        return unit;
+    }
+
+    unit = calloc(1, sizeof(*unit));
+    if(!unit) {
+        error("Unable to allocate memory for unit %u!", unit_id);
+    }
+
+    /* calloc(0) may return NULL, so always ask for at least one element. */
+    unit->coils = calloc(server->num_coils + 1, sizeof(uint8_t));
+    unit->discrete_inputs = calloc(server->num_discrete_inputs + 1, sizeof(uint8_t));
+    unit->holding_registers = calloc(server->num_holding_registers + 1, sizeof(uint16_t));
+    unit->input_registers = calloc(server->num_input_registers + 1, sizeof(uint16_t));
+
+    if(!unit->coils || !unit->discrete_inputs || !unit->holding_registers || !unit->input_registers) {
+        error("Unable to allocate memory for the data of unit %u!", unit_id);
+    }
+
+    /* inputs cannot be written, so give them a known pattern to read back. */
+    for(size_t i=0; i < server->num_discrete_inputs; i++) {
+        unit->discrete_inputs[i] = (uint8_t)(i & 0x01);
+    }
+
+    for(size_t i=0; i < server->num_input_registers; i++) {
+        unit->input_registers[i] = (uint16_t)i;
+    }
+
+    info("Created unit %u.", unit_id);
+
+    server->units[unit_id] = unit;
+
+    return unit;
+}
+
+
+/*
+ * Read coils or discrete inputs.
+ *
+ * Request: uint16 first address, uint16 count.
+ * Response: uint8 byte count, packed bits, first address in the low bit of the first byte.
+ */
+uint8_t handle_read_bits(slice_s pdu, slice_s resp, size_t *resp_len, uint8_t *bits, size_t num_bits)
+{
+    size_t address = 0;
+    size_t count = 0;
+    size_t byte_count = 0;
+
+    if(slice_len(pdu) != 5) {
+        info("Read bits request must have 5 bytes, found %zu!", slice_len(pdu));
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    count = get_uint16_be(pdu, 3);
+
+    if(count == 0 || count > MB_MAX_READ_BITS) {
+        info("Illegal read bit count %zu!", count);
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    if(address + count > num_bits) {
+        info("Read of %zu bits from %zu is past the last address %zu!", count, address, num_bits);
+        return MB_ERR_ILLEGAL_ADDRESS;
+    }
+
+    byte_count = (count + 7) / 8;
+    slice_set_uint8(resp, 1, (uint8_t)byte_count);
+
+    for(size_t i=0; i < byte_count; i++) {
+        uint8_t val = 0;
+
+        for(size_t bit=0; bit < 8 && (i * 8) + bit < count; bit++) {
+            val |= (uint8_t)(bits[address + (i * 8) + bit] << bit);
+        }
+
+        slice_set_uint8(resp, 2 + i, val);
+    }
+
+    *resp_len = 2 + byte_count;
+
+    return 0;
+}
+
+
+/*
+ * Read holding or input registers.
+ *
+ * Request: uint16 first address, uint16 count.
+ * Response: uint8 byte count, registers.
+ */
+uint8_t handle_read_regs(slice_s pdu, slice_s resp, size_t *resp_len, uint16_t *regs, size_t num_regs)
+{
+    size_t address = 0;
+    size_t count = 0;
+
+    if(slice_len(pdu) != 5) {
+        info("Read registers request must have 5 bytes, found %zu!", slice_len(pdu));
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    count = get_uint16_be(pdu, 3);
+
+    if(count == 0 || count > MB_MAX_READ_REGS) {
+        info("Illegal read register count %zu!", count);
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    if(address + count > num_regs) {
+        info("Read of %zu registers from %zu is past the last address %zu!", count, address, num_regs);
+        return MB_ERR_ILLEGAL_ADDRESS;
+    }
+
+    slice_set_uint8(resp, 1, (uint8_t)(count * 2));
+
+    for(size_t i=0; i < count; i++) {
+        set_uint16_be(resp, 2 + (i * 2), regs[address + i]);
+    }
+
+    *resp_len = 2 + (count * 2);
+
+    return 0;
+}
+
+
+/*
+ * Write a single coil.
+ *
+ * Request: uint16 address, uint16 value, 0xFF00 for on and 0x0000 for off.
+ * Response: copy of the request.
+ */
+uint8_t handle_write_coil(slice_s pdu, slice_s resp, size_t *resp_len, uint8_t *coils, size_t num_coils)
+{
+    size_t address = 0;
+    uint16_t value = 0;
+
+    if(slice_len(pdu) != 5) {
+        info("Write coil request must have 5 bytes, found %zu!", slice_len(pdu));
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    value = get_uint16_be(pdu, 3);
+
+    if(value != 0xFF00 && value != 0x0000) {
+        info("Illegal coil value %04x!", value);
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    if(address >= num_coils) {
+        info("Coil address %zu is past the last address %zu!", address, num_coils);
+        return MB_ERR_ILLEGAL_ADDRESS;
+    }
+
+    coils[address] = (value ? 1 : 0);
+
+    memcpy(slice_get_bytes(resp, 0), slice_get_bytes(pdu, 0), slice_len(pdu));
+    *resp_len = slice_len(pdu);
+
+    return 0;
+}
+
+
+/*
+ * Write a single holding register.
+ *
+ * Request: uint16 address, uint16 value.
+ * Response: copy of the request.
+ */
+uint8_t handle_write_reg(slice_s pdu, slice_s resp, size_t *resp_len, uint16_t *regs, size_t num_regs)
+{
+    size_t address = 0;
+
+    if(slice_len(pdu) != 5) {
+        info("Write register request must have 5 bytes, found %zu!", slice_len(pdu));
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+
+    if(address >= num_regs) {
+        info("Register address %zu is past the last address %zu!", address, num_regs);
+        return MB_ERR_ILLEGAL_ADDRESS;
+    }
+
+    regs[address] = get_uint16_be(pdu, 3);
+
+    memcpy(slice_get_bytes(resp, 0), slice_get_bytes(pdu, 0), slice_len(pdu));
+    *resp_len = slice_len(pdu);
+
+    return 0;
+}
+
+
+/*
+ * Write multiple coils.
+ *
+ * Request: uint16 first address, uint16 count, uint8 byte count, packed bits.
+ * Response: uint16 first address, uint16 count.
+ */
+uint8_t handle_write_coils(slice_s pdu, slice_s resp, size_t *resp_len, uint8_t *coils, size_t num_coils)
+{
+    size_t address = 0;
+    size_t count = 0;
+    size_t byte_count = 0;
+
+    if(slice_len(pdu) < 7) {
+        info("Write coils request must have at least 7 bytes, found %zu!", slice_len(pdu));
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    count = get_uint16_be(pdu, 3);
+    byte_count = slice_get_uint8(pdu, 5);
+
+    if(count == 0 || count > MB_MAX_WRITE_BITS || byte_count != (count + 7) / 8 || slice_len(pdu) != 6 + byte_count) {
+        info("Illegal write of %zu coils in %zu bytes!", count, byte_count);
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    if(address + count > num_coils) {
+        info("Write of %zu coils from %zu is past the last address %zu!", count, address, num_coils);
+        return MB_ERR_ILLEGAL_ADDRESS;
+    }
+
+    for(size_t i=0; i < count; i++) {
+        coils[address + i] = (uint8_t)((slice_get_uint8(pdu, 6 + (i / 8)) >> (i % 8)) & 0x01);
+    }
+
+    memcpy(slice_get_bytes(resp, 1), slice_get_bytes(pdu, 1), 4);
+    *resp_len = 5;
+
+    return 0;
+}
+
+
+/*
+ * Write multiple holding registers.
+ *
+ * Request: uint16 first address, uint16 count, uint8 byte count, registers.
+ * Response: uint16 first address, uint16 count.
+ */
+uint8_t handle_write_regs(slice_s pdu, slice_s resp, size_t *resp_len, uint16_t *regs, size_t num_regs)
+{
+    size_t address = 0;
+    size_t count = 0;
+    size_t byte_count = 0;
+
+    if(slice_len(pdu) < 8) {
+        info("Write registers request must have at least 8 bytes, found %zu!", slice_len(pdu));
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    count = get_uint16_be(pdu, 3);
+    byte_count = slice_get_uint8(pdu, 5);
+
+    if(count == 0 || count > MB_MAX_WRITE_REGS || byte_count != count * 2 || slice_len(pdu) != 6 + byte_count) {
+        info("Illegal write of %zu registers in %zu bytes!", count, byte_count);
+        return MB_ERR_ILLEGAL_VALUE;
+    }
+
+    if(address + count > num_regs) {
+        info("Write of %zu registers from %zu is past the last address %zu!", count, address, num_regs);
+        return MB_ERR_ILLEGAL_ADDRESS;
+    }
+
+    for(size_t i=0; i < count; i++) {
+        regs[address + i] = get_uint16_be(pdu, 6 + (i * 2));
+    }
+
+    memcpy(slice_get_bytes(resp, 1), slice_get_bytes(pdu, 1), 4);
+    *resp_len = 5;
+
+    return 0;
+}
+
+
+/* Modbus is big endian, the slice helpers are little endian. */
+uint16_t get_uint16_be(slice_s s, size_t offset)
+{
+    return (uint16_t)(((uint16_t)slice_get_uint8(s, offset) << 8) + (uint16_t)slice_get_uint8(s, offset + 1));
+}
+
+
+void set_uint16_be(slice_s s, size_t offset, uint16_t val)
+{
+    slice_set_uint8(s, offset, (uint8_t)((val >> 8) & 0xFF));
+    slice_set_uint8(s, offset + 1, (uint8_t)(val & 0xFF));
+}
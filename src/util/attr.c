@@ -368,6 +368,54 @@ extern float attr_get_float(attr attrs, const char *name, float def)
 }
 
 
+/*
+ * attr_to_str
+ *
+ * Build an attribute string from the attributes, the reverse of
+ * attr_create_from_str().  Attributes named in the NULL terminated skip
+ * list are left out.  The order of the attributes is not kept.
+ *
+ * The caller must free the returned string.  Returns NULL on failure.
+ */
+extern char *attr_to_str(attr attrs, const char **skip)
+{
+    attr_entry e;
+    char *res = NULL;
+    int size = 1;
+    int len = 0;
+
+    if(!attrs) {
+        return NULL;
+    }
+
+    for(e = attrs->head; e; e = e->next) {
+        size += str_length(e->name) + str_length(e->val) + 2;
+    }
+
+    res = mem_alloc(size);
+    if(!res) {
+        return NULL;
+    }
+
+    for(e = attrs->head; e; e = e->next) {
+        int skipped = 0;
+
+        for(int i = 0; skip && skip[i]; i++) {
+            if(str_cmp(e->name, skip[i]) == 0) {
+                skipped = 1;
+                break;
+            }
+        }
+
+        if(!skipped) {
+            len += snprintf_platform(res + len, (size_t)(unsigned int)(size - len), "%s%s=%s", (len ? "&" : ""), e->name, e->val);
+        }
+    }
+
+    return res;
+}
+
+
 extern int attr_remove(attr attrs, const char *name)
 {
     attr_entry e, p;
@@ -46,6 +46,7 @@ extern int attr_set_float(attr attrs, const char *name, float val);
 extern const char *attr_get_str(attr attrs, const char *name, const char *def);
 extern int attr_get_int(attr attrs, const char *name, int def);
 extern float attr_get_float(attr attrs, const char *name, float def);
+extern char *attr_to_str(attr attrs, const char **skip);
 extern int attr_remove(attr attrs, const char *name);
 extern void attr_destroy(attr attrs);
 
@@ -0,0 +1,633 @@
+#ifndef LIBPLCTAG_HPP
+#define LIBPLCTAG_HPP
+
+// Header-only C++17 API for libplctag.
+//
+//	libplctag::Tag<float> t("protocol=ab-eip&gateway=10.1.2.3&path=1,0&plc=ControlLogix&elem_size=4&elem_count=10&name=MyREALs");
+//	std::array<float, 10> values;
+//	t.read(5000);
+//	t.copy_to(values);		// no allocation, one plc_tag_get_raw_bytes() call
+//	t[3] = 1.5f;			// element proxy, calls plc_tag_set_float32()
+//	t.write(5000);
+//
+// Tag<T> owns one libplctag tag handle (RAII, move-only) and maps T at compile
+// time to the matching plc_tag_get_xxx()/plc_tag_set_xxx() pair for single
+// elements.  copy_to()/copy_from() and the iterators move raw bytes and decode
+// them here, in the tag's byte order, so a whole array costs one library call
+// instead of one per element (bulk copies of padded elements, or tags from a
+// library without the byte order attributes, fall back to the accessors).
+//
+// There is no lock in the wrapper.  Every call is atomic in the library, which
+// locks per tag, so any number of threads can use any number of tags.  When
+// several threads share one Tag and need a read followed by a copy to be seen
+// as one step, hold a Tag::Lock (plc_tag_lock()) across both.
+//
+// Errors are thrown as libplctag::Error, which carries the PLCTAG_ERR_xxx code.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <libplctag.h>
+
+namespace libplctag
+{
+
+class Error : public std::runtime_error
+{
+public:
+	Error(int status, const std::string &context)
+		: std::runtime_error(context + ": " + plc_tag_decode_error(status)), status_(status)
+	{
+	}
+
+	int status() const noexcept { return status_; }
+
+private:
+	int status_;
+};
+
+// throw on a negative library status, pass anything else back.
+inline int check(int status, const char *context)
+{
+	if (status < 0)
+	{
+		throw Error(status, context);
+	}
+
+	return status;
+}
+
+// Minimal stand-in for std::span (C++20): a pointer and a length.
+template <typename T>
+class Span
+{
+public:
+	constexpr Span() noexcept = default;
+	constexpr Span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+	template <std::size_t N>
+	constexpr Span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+
+	// anything with contiguous data() and size(): std::array, std::vector, std::span...
+	template <typename C, typename = decltype(std::declval<C &>().data()), typename = decltype(std::declval<C &>().size())>
+	constexpr Span(C &container) noexcept : data_(container.data()), size_(container.size()) {}
+
+	constexpr T *data() const noexcept { return data_; }
+	constexpr std::size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+	constexpr T *begin() const noexcept { return data_; }
+	constexpr T *end() const noexcept { return data_ + size_; }
+
+private:
+	T *data_ = nullptr;
+	std::size_t size_ = 0;
+};
+
+namespace detail
+{
+
+// Compile-time mapping of element types to the library accessors.
+template <typename T>
+struct accessor
+{
+	static_assert(sizeof(T) == 0, "libplctag has no accessor for this element type");
+};
+
+#define LIBPLCTAG_HPP_ACCESSOR(TYPE, SUFFIX)                                                                \
+	template <>                                                                                        \
+	struct accessor<TYPE>                                                                              \
+	{                                                                                                  \
+		static TYPE get(int32_t id, int offset) noexcept { return plc_tag_get_##SUFFIX(id, offset); }  \
+		static int set(int32_t id, int offset, TYPE v) noexcept { return plc_tag_set_##SUFFIX(id, offset, v); } \
+	};
+
+LIBPLCTAG_HPP_ACCESSOR(int8_t, int8)
+LIBPLCTAG_HPP_ACCESSOR(uint8_t, uint8)
+LIBPLCTAG_HPP_ACCESSOR(int16_t, int16)
+LIBPLCTAG_HPP_ACCESSOR(uint16_t, uint16)
+LIBPLCTAG_HPP_ACCESSOR(int32_t, int32)
+LIBPLCTAG_HPP_ACCESSOR(uint32_t, uint32)
+LIBPLCTAG_HPP_ACCESSOR(int64_t, int64)
+LIBPLCTAG_HPP_ACCESSOR(uint64_t, uint64)
+LIBPLCTAG_HPP_ACCESSOR(float, float32)
+LIBPLCTAG_HPP_ACCESSOR(double, float64)
+
+#undef LIBPLCTAG_HPP_ACCESSOR
+
+// bool elements are bits, the offset is a bit number.
+template <>
+struct accessor<bool>
+{
+	static bool get(int32_t id, int bit) noexcept { return plc_tag_get_bit(id, bit) > 0; }
+	static int set(int32_t id, int bit, bool v) noexcept { return plc_tag_set_bit(id, bit, v ? 1 : 0); }
+};
+
+// The tag attribute with the byte order of T, none for single bytes.
+template <typename T>
+inline const char *byte_order_attribute() noexcept
+{
+	if constexpr (sizeof(T) == 1)
+	{
+		return nullptr;
+	}
+	else if constexpr (std::is_floating_point<T>::value)
+	{
+		return (sizeof(T) == 4 ? "float32_byte_order" : "float64_byte_order");
+	}
+	else
+	{
+		return (sizeof(T) == 2 ? "int16_byte_order" : (sizeof(T) == 4 ? "int32_byte_order" : "int64_byte_order"));
+	}
+}
+
+// order[i] is the offset in the tag buffer of byte i of the value, least
+// significant first, as the library's getters and setters use it.
+template <typename T>
+inline T decode(const uint8_t *raw, const int *order) noexcept
+{
+	using U = typename std::conditional<sizeof(T) == 8, uint64_t, uint32_t>::type;
+	U bits = 0;
+	T value;
+
+	for (std::size_t i = 0; i < sizeof(T); i++)
+	{
+		bits |= static_cast<U>(raw[order[i]]) << (8 * i);
+	}
+
+	if constexpr (sizeof(T) == sizeof(U))
+	{
+		std::memcpy(&value, &bits, sizeof(T));
+	}
+	else
+	{
+		value = static_cast<T>(bits);
+	}
+
+	return value;
+}
+
+template <typename T>
+inline void encode(T value, uint8_t *raw, const int *order) noexcept
+{
+	using U = typename std::conditional<sizeof(T) == 8, uint64_t, uint32_t>::type;
+	U bits = 0;
+
+	if constexpr (sizeof(T) == sizeof(U))
+	{
+		std::memcpy(&bits, &value, sizeof(T));
+	}
+	else
+	{
+		bits = static_cast<U>(static_cast<typename std::make_unsigned<T>::type>(value));
+	}
+
+	for (std::size_t i = 0; i < sizeof(T); i++)
+	{
+		raw[order[i]] = static_cast<uint8_t>(bits >> (8 * i));
+	}
+}
+
+} // namespace detail
+
+// Owns one tag handle.  Untyped, see Tag<T> for element access.
+class TagHandle
+{
+public:
+	TagHandle() noexcept = default;
+
+	explicit TagHandle(const std::string &attributes, int timeout_ms = 5000)
+		: id_(check(plc_tag_create(attributes.c_str(), timeout_ms), "plc_tag_create"))
+	{
+		int status = plc_tag_status(id_);
+
+		// a zero timeout creates the tag asynchronously.
+		if (status < 0)
+		{
+			plc_tag_destroy(id_);
+			throw Error(status, "plc_tag_create");
+		}
+	}
+
+	~TagHandle() { reset(); }
+
+	TagHandle(const TagHandle &) = delete;
+	TagHandle &operator=(const TagHandle &) = delete;
+
+	TagHandle(TagHandle &&other) noexcept : id_(std::exchange(other.id_, INVALID_ID)) {}
+
+	TagHandle &operator=(TagHandle &&other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			id_ = std::exchange(other.id_, INVALID_ID);
+		}
+
+		return *this;
+	}
+
+	void reset() noexcept
+	{
+		if (id_ != INVALID_ID)
+		{
+			plc_tag_destroy(id_);
+			id_ = INVALID_ID;
+		}
+	}
+
+	int32_t id() const noexcept { return id_; }
+	explicit operator bool() const noexcept { return id_ != INVALID_ID; }
+
+	// a zero timeout starts the operation and returns PLCTAG_STATUS_PENDING.
+	int read(int timeout_ms = 5000) const { return check(plc_tag_read(id_, timeout_ms), "plc_tag_read"); }
+	int write(int timeout_ms = 5000) const { return check(plc_tag_write(id_, timeout_ms), "plc_tag_write"); }
+	int abort() const { return check(plc_tag_abort(id_), "plc_tag_abort"); }
+	int status() const noexcept { return plc_tag_status(id_); }
+
+	int size_bytes() const { return check(plc_tag_get_size(id_), "plc_tag_get_size"); }
+
+	int get_int_attribute(const char *name, int default_value) const noexcept
+	{
+		return plc_tag_get_int_attribute(id_, name, default_value);
+	}
+
+	void set_int_attribute(const char *name, int value) const
+	{
+		check(plc_tag_set_int_attribute(id_, name, value), "plc_tag_set_int_attribute");
+	}
+
+	void get_raw_bytes(int offset, Span<uint8_t> out) const
+	{
+		check(plc_tag_get_raw_bytes(id_, offset, out.data(), static_cast<int>(out.size())), "plc_tag_get_raw_bytes");
+	}
+
+	void set_raw_bytes(int offset, Span<uint8_t> in) const
+	{
+		check(plc_tag_set_raw_bytes(id_, offset, in.data(), static_cast<int>(in.size())), "plc_tag_set_raw_bytes");
+	}
+
+	// holds plc_tag_lock() for the life of the object.  Not recursive.
+	class Lock
+	{
+	public:
+		explicit Lock(const TagHandle &tag) : id_(tag.id()) { check(plc_tag_lock(id_), "plc_tag_lock"); }
+		~Lock() { plc_tag_unlock(id_); }
+
+		Lock(const Lock &) = delete;
+		Lock &operator=(const Lock &) = delete;
+
+	private:
+		int32_t id_;
+	};
+
+private:
+	static constexpr int32_t INVALID_ID = -1;
+
+	int32_t id_ = INVALID_ID;
+};
+
+// A tag holding an array of T.  Elements are elem_size bytes apart when the
+// tag has that attribute, sizeof(T) apart otherwise.  For bool the elements
+// are the bits of the tag buffer.
+template <typename T>
+class Tag : public TagHandle
+{
+	static_assert(std::is_arithmetic<T>::value, "Tag<T> needs an integer, floating point or bool element type");
+
+public:
+	using value_type = T;
+
+	// read/write proxy for one element.
+	class Element
+	{
+	public:
+		Element(int32_t id, int offset) noexcept : id_(id), offset_(offset) {}
+
+		T get() const noexcept { return detail::accessor<T>::get(id_, offset_); }
+		operator T() const noexcept { return get(); }
+
+		const Element &operator=(T value) const
+		{
+			check(detail::accessor<T>::set(id_, offset_, value), "plc_tag_set");
+			return *this;
+		}
+
+	private:
+		int32_t id_;
+		int offset_;
+	};
+
+	// random access over the current element values, by value.  The values
+	// are copied out BLOCK elements at a time, so walking the tag costs one
+	// library call per block.
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = T;
+
+		const_iterator(const Tag *tag, std::size_t index) noexcept : tag_(tag), index_(index) {}
+
+		T operator*() const { return load(index_); }
+		T operator[](difference_type n) const { return load(index_ + static_cast<std::size_t>(n)); }
+		const_iterator &operator++() noexcept { ++index_; return *this; }
+		const_iterator operator++(int) noexcept { const_iterator old = *this; ++index_; return old; }
+		const_iterator &operator--() noexcept { --index_; return *this; }
+		const_iterator operator--(int) noexcept { const_iterator old = *this; --index_; return old; }
+		const_iterator &operator+=(difference_type n) noexcept { index_ += static_cast<std::size_t>(n); return *this; }
+		const_iterator &operator-=(difference_type n) noexcept { index_ -= static_cast<std::size_t>(n); return *this; }
+		const_iterator operator+(difference_type n) const noexcept { return const_iterator(tag_, index_ + static_cast<std::size_t>(n)); }
+		const_iterator operator-(difference_type n) const noexcept { return const_iterator(tag_, index_ - static_cast<std::size_t>(n)); }
+		difference_type operator-(const const_iterator &o) const noexcept { return static_cast<difference_type>(index_) - static_cast<difference_type>(o.index_); }
+		bool operator==(const const_iterator &o) const noexcept { return index_ == o.index_; }
+		bool operator!=(const const_iterator &o) const noexcept { return index_ != o.index_; }
+		bool operator<(const const_iterator &o) const noexcept { return index_ < o.index_; }
+
+	private:
+		static constexpr std::size_t BLOCK = 16;
+		static constexpr std::size_t NO_BLOCK = static_cast<std::size_t>(-1);
+
+		T load(std::size_t index) const
+		{
+			if (index / BLOCK != block_)
+			{
+				block_ = index / BLOCK;
+				tag_->copy_to(Span<T>(cache_, BLOCK), block_ * BLOCK);
+			}
+
+			return cache_[index % BLOCK];
+		}
+
+		const Tag *tag_;
+		std::size_t index_;
+		mutable std::size_t block_ = NO_BLOCK;
+		mutable T cache_[BLOCK] = {};
+	};
+
+	Tag() noexcept = default;
+
+	explicit Tag(const std::string &attributes, int timeout_ms = 5000)
+		: TagHandle(attributes, timeout_ms)
+	{
+		stride_ = get_int_attribute("elem_size", 0);
+
+		if (stride_ <= 0 || std::is_same<T, bool>::value)
+		{
+			stride_ = (std::is_same<T, bool>::value ? 1 : static_cast<int>(sizeof(T)));
+		}
+
+		load_byte_order();
+	}
+
+	// number of elements in the tag buffer.
+	std::size_t size() const
+	{
+		int bytes = size_bytes();
+
+		if constexpr (std::is_same<T, bool>::value)
+		{
+			return static_cast<std::size_t>(bytes) * 8;
+		}
+		else
+		{
+			return (bytes < static_cast<int>(sizeof(T)) ? 0 : static_cast<std::size_t>((bytes - static_cast<int>(sizeof(T))) / stride_ + 1));
+		}
+	}
+
+	// unchecked, like std::span.  Out of range indexes set the tag status to PLCTAG_ERR_OUT_OF_BOUNDS.
+	T get(std::size_t index) const noexcept { return detail::accessor<T>::get(id(), offset(index)); }
+
+	void set(std::size_t index, T value) const
+	{
+		check(detail::accessor<T>::set(id(), offset(index), value), "plc_tag_set");
+	}
+
+	// checked.
+	T at(std::size_t index) const
+	{
+		if (index >= size())
+		{
+			throw Error(PLCTAG_ERR_OUT_OF_BOUNDS, "Tag::at");
+		}
+
+		return get(index);
+	}
+
+	Element operator[](std::size_t index) const noexcept { return Element(id(), offset(index)); }
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, size()); }
+
+	// copy elements [first, first + out.size()) out of the tag buffer.  Returns the number copied.
+	std::size_t copy_to(Span<T> out, std::size_t first = 0) const
+	{
+		std::size_t n = clamp(first, out.size());
+
+		if (n == 0)
+		{
+			return 0;
+		}
+
+		if constexpr (std::is_same<T, bool>::value)
+		{
+			uint64_t bitmap[BITMAP_WORDS];
+
+			for (std::size_t done = 0; done < n; done += BITMAP_WORDS * 64)
+			{
+				std::size_t count = (n - done < BITMAP_WORDS * 64 ? n - done : BITMAP_WORDS * 64);
+
+				check(plc_tag_get_bits(id(), static_cast<int>(first + done), static_cast<int>(count), bitmap), "plc_tag_get_bits");
+
+				for (std::size_t i = 0; i < count; i++)
+				{
+					out[done + i] = ((bitmap[i / 64] >> (i % 64)) & 1) != 0;
+				}
+			}
+		}
+		else if (raw_)
+		{
+			// the raw bytes land where the values go and are decoded in place.
+			uint8_t *raw = reinterpret_cast<uint8_t *>(out.data());
+
+			get_raw_bytes(offset(first), Span<uint8_t>(raw, n * sizeof(T)));
+
+			for (std::size_t i = 0; i < n; i++)
+			{
+				uint8_t element[sizeof(T)];
+
+				std::memcpy(element, raw + (i * sizeof(T)), sizeof(T));
+				out[i] = detail::decode<T>(element, order_);
+			}
+		}
+		else
+		{
+			for (std::size_t i = 0; i < n; i++)
+			{
+				out[i] = get(first + i);
+			}
+		}
+
+		return n;
+	}
+
+	// copy elements into the tag buffer starting at element first.  Returns the number copied.
+	std::size_t copy_from(Span<const T> in, std::size_t first = 0) const
+	{
+		std::size_t n = clamp(first, in.size());
+
+		if (n == 0)
+		{
+			return 0;
+		}
+
+		if constexpr (std::is_same<T, bool>::value)
+		{
+			uint64_t bitmap[BITMAP_WORDS];
+
+			for (std::size_t done = 0; done < n; done += BITMAP_WORDS * 64)
+			{
+				std::size_t count = (n - done < BITMAP_WORDS * 64 ? n - done : BITMAP_WORDS * 64);
+
+				std::memset(bitmap, 0, sizeof(bitmap));
+
+				for (std::size_t i = 0; i < count; i++)
+				{
+					bitmap[i / 64] |= static_cast<uint64_t>(in[done + i] ? 1 : 0) << (i % 64);
+				}
+
+				check(plc_tag_set_bits(id(), static_cast<int>(first + done), static_cast<int>(count), bitmap), "plc_tag_set_bits");
+			}
+		}
+		else if (raw_)
+		{
+			// encode a chunk at a time on the stack, no allocation.
+			uint8_t raw[RAW_CHUNK_BYTES];
+			std::size_t per_chunk = RAW_CHUNK_BYTES / sizeof(T);
+
+			for (std::size_t done = 0; done < n; done += per_chunk)
+			{
+				std::size_t count = (n - done < per_chunk ? n - done : per_chunk);
+
+				for (std::size_t i = 0; i < count; i++)
+				{
+					detail::encode<T>(in[done + i], raw + (i * sizeof(T)), order_);
+				}
+
+				set_raw_bytes(offset(first + done), Span<uint8_t>(raw, count * sizeof(T)));
+			}
+		}
+		else
+		{
+			for (std::size_t i = 0; i < n; i++)
+			{
+				set(first + i, in[i]);
+			}
+		}
+
+		return n;
+	}
+
+	// read from the PLC and copy out under the tag lock, so that other threads
+	// using read_into()/write_from() on this tag cannot interleave.
+	std::size_t read_into(Span<T> out, int timeout_ms = 5000) const
+	{
+		Lock lock(*this);
+
+		read(timeout_ms);
+
+		return copy_to(out);
+	}
+
+	std::size_t write_from(Span<const T> in, int timeout_ms = 5000) const
+	{
+		Lock lock(*this);
+
+		std::size_t n = copy_from(in);
+
+		write(timeout_ms);
+
+		return n;
+	}
+
+private:
+	static constexpr std::size_t BITMAP_WORDS = 16;
+	static constexpr std::size_t RAW_CHUNK_BYTES = 1024;
+
+	int offset(std::size_t index) const noexcept { return static_cast<int>(index) * stride_; }
+
+	// Raw copies need packed elements and the tag's byte order.  Without
+	// them the copies fall back to the per-element accessors.
+	void load_byte_order() noexcept
+	{
+		raw_ = false;
+
+		if constexpr (!std::is_same<T, bool>::value)
+		{
+			const char *attribute = detail::byte_order_attribute<T>();
+			int digits = 0;
+			int seen = 0;
+
+			if (stride_ != static_cast<int>(sizeof(T)))
+			{
+				return;
+			}
+
+			if (!attribute)
+			{
+				order_[0] = 0;
+				raw_ = true;
+				return;
+			}
+
+			// the digits of the byte order string, "1032" is 1032.
+			if ((digits = get_int_attribute(attribute, -1)) < 0)
+			{
+				return;
+			}
+
+			for (int i = static_cast<int>(sizeof(T)) - 1; i >= 0; i--)
+			{
+				order_[i] = digits % 10;
+				digits /= 10;
+
+				if (order_[i] >= static_cast<int>(sizeof(T)) || (seen & (1 << order_[i])))
+				{
+					return;
+				}
+
+				seen |= 1 << order_[i];
+			}
+
+			raw_ = true;
+		}
+	}
+
+	std::size_t clamp(std::size_t first, std::size_t count) const
+	{
+		std::size_t total = size();
+
+		if (first >= total)
+		{
+			return 0;
+		}
+
+		return (count < total - first ? count : total - first);
+	}
+
+	int stride_ = static_cast<int>(sizeof(T));
+	bool raw_ = false;
+	int order_[8] = {};
+};
+
+} // namespace libplctag
+
+#endif
@@ -0,0 +1,547 @@
+#ifndef LIBPLCTAG_CORO_HPP
+#define LIBPLCTAG_CORO_HPP
+
+// C++20 coroutine interface for libplctag, on top of libplctag.hpp.
+//
+//	libplctag::Executor ex;
+//	libplctag::AsyncTag<int32_t> a(ex, "...&name=A"), b(ex, "...&name=B");
+//	libplctag::TagGroup group(ex);
+//	group.add(a);
+//	group.add(b);
+//
+//	ex.spawn([&]() -> libplctag::Task<void> {
+//		co_await a.read();		// throws libplctag::Error on failure
+//		co_await group.read_all();	// starts every read, resumes when all are done
+//	}());
+//	ex.run();				// returns when every spawned task has finished
+//
+// Operations are started with a zero timeout and completed by the library's
+// tag callback (plc_tag_register_callback()), which fires in the library's
+// background thread.  The callback only queues the waiting coroutine on its
+// Executor.  Coroutines are resumed by Executor::run(), so one thread drives
+// every outstanding operation.
+//
+// The library callback has no user data, so pending operations are found by
+// tag ID in one process-wide table.  A tag can have one operation pending at
+// a time, as in the C API.  Starting a second one fails with PLCTAG_ERR_BUSY.
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "libplctag.hpp"
+
+namespace libplctag
+{
+
+class Executor
+{
+public:
+	Executor() = default;
+	Executor(const Executor &) = delete;
+	Executor &operator=(const Executor &) = delete;
+
+	// queue a coroutine to be resumed by run().  Safe from any thread.
+	void post(std::coroutine_handle<> h)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			ready_.push_back(h);
+		}
+
+		cond_.notify_one();
+	}
+
+	// resume queued coroutines until every spawned task has finished or stop() is called.
+	void run()
+	{
+		for (;;)
+		{
+			std::coroutine_handle<> h;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+
+				cond_.wait(lock, [this]() { return !ready_.empty() || live_tasks_ == 0 || stopped_; });
+
+				if (ready_.empty())
+				{
+					stopped_ = false;
+					return;
+				}
+
+				h = ready_.front();
+				ready_.pop_front();
+			}
+
+			h.resume();
+		}
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopped_ = true;
+		}
+
+		cond_.notify_all();
+	}
+
+	template <typename TaskT>
+	void spawn(TaskT task);
+
+	// used by spawned tasks.
+	void task_started()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		live_tasks_++;
+	}
+
+	void task_finished()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			live_tasks_--;
+		}
+
+		cond_.notify_all();
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::deque<std::coroutine_handle<>> ready_;
+	long live_tasks_ = 0;
+	bool stopped_ = false;
+};
+
+// Lazy coroutine returning T.  Starts when awaited or spawned.
+template <typename T>
+class Task;
+
+namespace detail
+{
+
+template <typename T>
+struct task_promise_base
+{
+	std::coroutine_handle<> continuation = std::noop_coroutine();
+	std::exception_ptr error;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	struct final_awaiter
+	{
+		bool await_ready() noexcept { return false; }
+
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept { return h.promise().continuation; }
+
+		void await_resume() noexcept {}
+	};
+
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct task_promise : task_promise_base<T>
+{
+	T value{};
+
+	Task<T> get_return_object() noexcept;
+	void return_value(T v) { value = std::move(v); }
+
+	T result()
+	{
+		if (this->error)
+		{
+			std::rethrow_exception(this->error);
+		}
+
+		return std::move(value);
+	}
+};
+
+template <>
+struct task_promise<void> : task_promise_base<void>
+{
+	Task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+
+	void result()
+	{
+		if (this->error)
+		{
+			std::rethrow_exception(this->error);
+		}
+	}
+};
+
+} // namespace detail
+
+template <typename T>
+class Task
+{
+public:
+	using promise_type = detail::task_promise<T>;
+
+	explicit Task(std::coroutine_handle<promise_type> h) noexcept : handle_(h) {}
+	Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	~Task()
+	{
+		if (handle_)
+		{
+			handle_.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle_.promise().continuation = awaiting;
+		return handle_;
+	}
+
+	T await_resume() { return handle_.promise().result(); }
+
+private:
+	std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail
+{
+
+template <typename T>
+Task<T> task_promise<T>::get_return_object() noexcept
+{
+	return Task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline Task<void> task_promise<void>::get_return_object() noexcept
+{
+	return Task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+// fire-and-forget root coroutine used by Executor::spawn().
+struct detached
+{
+	struct promise_type
+	{
+		detached get_return_object() noexcept { return detached{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+template <typename TaskT>
+detached run_detached(Executor &ex, TaskT task)
+{
+	try
+	{
+		co_await std::move(task);
+	}
+	catch (...)
+	{
+		// an unobserved failure of a spawned task.  Nobody is left to report it to.
+	}
+
+	ex.task_finished();
+}
+
+// Completion tracking shared by single and group operations.
+struct waiter
+{
+	Executor *executor = nullptr;
+	std::coroutine_handle<> handle;
+
+	// one per started operation plus one held by the starter until it has suspended.
+	std::atomic<int> remaining{1};
+
+	void complete_one()
+	{
+		if (remaining.fetch_sub(1) == 1)
+		{
+			executor->post(handle);
+		}
+	}
+};
+
+struct pending_op
+{
+	int32_t tag_id = 0;
+	bool is_write = false;
+	int status = PLCTAG_STATUS_PENDING;
+	waiter *owner = nullptr;
+};
+
+class registry
+{
+public:
+	static registry &instance()
+	{
+		static registry r;
+		return r;
+	}
+
+	bool add(pending_op *op)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return ops_.emplace(op->tag_id, op).second;
+	}
+
+	// remove op if it is still there.  False means the callback already took it.
+	bool remove(pending_op *op)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto it = ops_.find(op->tag_id);
+
+		if (it == ops_.end() || it->second != op)
+		{
+			return false;
+		}
+
+		ops_.erase(it);
+		return true;
+	}
+
+	// the callback registered on every AsyncTag.
+	static void tag_callback(int32_t tag_id, int event, int status)
+	{
+		registry &r = instance();
+		pending_op *op = nullptr;
+
+		if (event == PLCTAG_EVENT_READ_STARTED || event == PLCTAG_EVENT_WRITE_STARTED)
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(r.mutex_);
+			auto it = r.ops_.find(tag_id);
+
+			if (it == r.ops_.end())
+			{
+				return;
+			}
+
+			op = it->second;
+
+			// an automatic read completing does not finish a pending write, and the other way around.
+			if ((event == PLCTAG_EVENT_READ_COMPLETED && op->is_write) || (event == PLCTAG_EVENT_WRITE_COMPLETED && !op->is_write))
+			{
+				return;
+			}
+
+			r.ops_.erase(it);
+		}
+
+		if (event == PLCTAG_EVENT_ABORTED || event == PLCTAG_EVENT_DESTROYED)
+		{
+			status = PLCTAG_ERR_ABORT;
+		}
+
+		op->status = status;
+		op->owner->complete_one();
+	}
+
+private:
+	std::mutex mutex_;
+	std::unordered_map<int32_t, pending_op *> ops_;
+};
+
+// start one read or write with a zero timeout.  Immediate results complete the op here.
+//
+// The op is registered only once the library says it is pending, so the
+// callback can not hand it the completion of an earlier read or write of
+// the tag.  If the operation finished before add(), its callback found
+// nothing, and the status shows that it is done.
+inline void start_op(pending_op &op)
+{
+	int rc = (op.is_write ? plc_tag_write(op.tag_id, 0) : plc_tag_read(op.tag_id, 0));
+
+	if (rc != PLCTAG_STATUS_PENDING)
+	{
+		op.status = rc;
+		op.owner->remaining--;
+		return;
+	}
+
+	if (!registry::instance().add(&op))
+	{
+		op.status = PLCTAG_ERR_BUSY;
+		op.owner->remaining--;
+		return;
+	}
+
+	rc = plc_tag_status(op.tag_id);
+
+	// false means the callback took it after add().
+	if (rc != PLCTAG_STATUS_PENDING && registry::instance().remove(&op))
+	{
+		op.status = rc;
+		op.owner->remaining--;
+	}
+}
+
+} // namespace detail
+
+template <typename TaskT>
+void Executor::spawn(TaskT task)
+{
+	task_started();
+	post(detail::run_detached(*this, std::move(task)).handle);
+}
+
+// Awaitable for one read or write.  co_await returns the status and throws on error.
+class TagOperation
+{
+public:
+	TagOperation(Executor &ex, int32_t tag_id, bool is_write) noexcept
+	{
+		waiter_.executor = &ex;
+		op_.tag_id = tag_id;
+		op_.is_write = is_write;
+		op_.owner = &waiter_;
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		waiter_.handle = h;
+		waiter_.remaining = 2;
+
+		detail::start_op(op_);
+
+		// drop the starter's count.  If nothing is left, carry on without suspending.
+		return waiter_.remaining.fetch_sub(1) != 1;
+	}
+
+	int await_resume() const { return check(op_.status, (op_.is_write ? "plc_tag_write" : "plc_tag_read")); }
+
+private:
+	detail::waiter waiter_;
+	detail::pending_op op_;
+};
+
+// Tag<T> whose read() and write() are awaited instead of blocking.
+template <typename T>
+class AsyncTag : public Tag<T>
+{
+public:
+	AsyncTag(Executor &ex, const std::string &attributes, int timeout_ms = 5000)
+		: Tag<T>(attributes, timeout_ms), executor_(&ex)
+	{
+		check(plc_tag_register_callback(this->id(), &detail::registry::tag_callback), "plc_tag_register_callback");
+	}
+
+	TagOperation read() { return TagOperation(*executor_, this->id(), false); }
+	TagOperation write() { return TagOperation(*executor_, this->id(), true); }
+
+	// the blocking versions are still there.
+	int read_blocking(int timeout_ms = 5000) const { return Tag<T>::read(timeout_ms); }
+	int write_blocking(int timeout_ms = 5000) const { return Tag<T>::write(timeout_ms); }
+
+	Executor &executor() const noexcept { return *executor_; }
+
+private:
+	Executor *executor_;
+};
+
+// A set of AsyncTags read or written together.
+class TagGroup
+{
+public:
+	explicit TagGroup(Executor &ex) : executor_(&ex) {}
+
+	template <typename T>
+	void add(AsyncTag<T> &tag) { ids_.push_back(tag.id()); }
+
+	std::size_t size() const noexcept { return ids_.size(); }
+
+	// status of each tag from the last read_all()/write_all(), in the order added.
+	const std::vector<int> &statuses() const noexcept { return statuses_; }
+
+	class Operation
+	{
+	public:
+		Operation(TagGroup &group, bool is_write) : group_(group), ops_(group.ids_.size())
+		{
+			waiter_.executor = group.executor_;
+
+			for (std::size_t i = 0; i < ops_.size(); i++)
+			{
+				ops_[i].tag_id = group.ids_[i];
+				ops_[i].is_write = is_write;
+				ops_[i].owner = &waiter_;
+			}
+		}
+
+		bool await_ready() const noexcept { return ops_.empty(); }
+
+		bool await_suspend(std::coroutine_handle<> h)
+		{
+			waiter_.handle = h;
+			waiter_.remaining = static_cast<int>(ops_.size()) + 1;
+
+			for (auto &op : ops_)
+			{
+				detail::start_op(op);
+			}
+
+			return waiter_.remaining.fetch_sub(1) != 1;
+		}
+
+		// PLCTAG_STATUS_OK or the first error.  Per tag results are in statuses().
+		int await_resume()
+		{
+			int rc = PLCTAG_STATUS_OK;
+
+			group_.statuses_.clear();
+
+			for (auto &op : ops_)
+			{
+				group_.statuses_.push_back(op.status);
+
+				if (rc == PLCTAG_STATUS_OK && op.status != PLCTAG_STATUS_OK)
+				{
+					rc = op.status;
+				}
+			}
+
+			return rc;
+		}
+
+	private:
+		TagGroup &group_;
+		detail::waiter waiter_;
+		std::vector<detail::pending_op> ops_;
+	};
+
+	Operation read_all() { return Operation(*this, false); }
+	Operation write_all() { return Operation(*this, true); }
+
+private:
+	Executor *executor_;
+	std::vector<int32_t> ids_;
+	std::vector<int> statuses_;
+};
+
+} // namespace libplctag
+
+#endif
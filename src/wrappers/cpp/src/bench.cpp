@@ -0,0 +1,158 @@
+#include "../include/plctag.hpp"
+#include "../include/libplctag.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// Notes ---------------------------------------------------------------------------
+// Compares the boost::mutex based plctag class with the header-only Tag<T> API.
+// Both read the 5 element REAL tag test_float that the plctag class uses.
+//
+// ./ab_server --plc=ControlLogix --path=1,0 --tag=test_float:REAL[5] --tag=test_string:STRING[5] &
+// make bench && ./bench [gateway] [seconds] [threads]
+
+namespace
+{
+
+constexpr int ELEMENTS = 5;
+
+struct result
+{
+	long ops;
+	double seconds;
+};
+
+template <typename F>
+result run_threads(int num_threads, double seconds, F body)
+{
+	std::atomic<bool> stop(false);
+	std::atomic<long> ops(0);
+	std::vector<std::thread> threads;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < num_threads; i++)
+	{
+		threads.emplace_back([&, i]() {
+			long count = 0;
+
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				body(i);
+				count++;
+			}
+
+			ops += count;
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	stop = true;
+
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	return result{ops.load(), elapsed.count()};
+}
+
+void report(const char *name, int num_threads, const result &r)
+{
+	std::printf("%-28s threads:%-3d %10ld ops %12.1f ops/s %10.1f us/op\n",
+				name, num_threads, r.ops, r.ops / r.seconds,
+				(r.ops ? (r.seconds * 1e6 * num_threads) / r.ops : 0.0));
+	std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	std::string gateway = (argc > 1 ? argv[1] : "127.0.0.1");
+	double seconds = (argc > 2 ? std::atof(argv[2]) : 3.0);
+	int max_threads = (argc > 3 ? std::atoi(argv[3]) : 4);
+
+	std::string attrs = "protocol=ab-eip&gateway=" + gateway + "&path=1,0&plc=ControlLogix&elem_size=4&elem_count=" + std::to_string(ELEMENTS) + "&name=test_float";
+
+	try
+	{
+		// the plctag destructor shuts the library down, so it has to outlive the other tags.
+		plctag old_api(plctag::PROT_AB_LGX, gateway, false);
+
+		for (int num_threads : {1, max_threads})
+		{
+			// current wrapper: one object, every call under its mutex, a new vector per read.
+			{
+				result r = run_threads(num_threads, seconds, [&](int) {
+					std::vector<float> v = old_api.read_tag(3, 5000, plctag::ELE_FLOAT, ELEMENTS);
+					(void)v;
+				});
+
+				report("plctag::read_tag", num_threads, r);
+			}
+
+			// header-only API: a tag per thread, typed copy into a stack buffer.
+			{
+				std::vector<libplctag::Tag<float>> tags;
+
+				for (int i = 0; i < num_threads; i++)
+				{
+					tags.emplace_back(attrs);
+				}
+
+				result r = run_threads(num_threads, seconds, [&](int i) {
+					std::array<float, ELEMENTS> v;
+					tags[i].read(5000);
+					tags[i].copy_to(v);
+				});
+
+				report("Tag<float>::read+copy_to", num_threads, r);
+			}
+
+			// header-only API: one tag shared by all threads.
+			{
+				libplctag::Tag<float> tag(attrs);
+
+				result r = run_threads(num_threads, seconds, [&](int) {
+					std::array<float, ELEMENTS> v;
+					tag.read_into(v);
+				});
+
+				report("Tag<float>::read_into", num_threads, r);
+			}
+
+			// element decode alone, no network.
+			{
+				libplctag::Tag<float> tag(attrs);
+
+				tag.read(5000);
+
+				result r = run_threads(num_threads, seconds, [&](int) {
+					std::array<float, ELEMENTS> v;
+					tag.copy_to(v);
+				});
+
+				report("Tag<float>::copy_to", num_threads, r);
+			}
+		}
+	}
+	catch (const libplctag::Error &e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	catch (int error)
+	{
+		std::fprintf(stderr, "plctag error %d\n", error);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include "../include/libplctag_coro.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+// Notes ---------------------------------------------------------------------------
+// Drives many concurrent reads from one thread with the coroutine interface.
+//
+// ./ab_server --plc=ControlLogix --path=1,0 --tag=TestDINTArray:DINT[10] &
+// make coro_demo && ./coro_demo [gateway] [tags] [seconds]
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+struct counters
+{
+	long reads = 0;
+	long group_reads = 0;
+	long errors = 0;
+};
+
+libplctag::Task<void> read_loop(libplctag::AsyncTag<int32_t> &tag, clock_type::time_point deadline, counters &c)
+{
+	while (clock_type::now() < deadline)
+	{
+		try
+		{
+			co_await tag.read();
+			c.reads++;
+		}
+		catch (const libplctag::Error &)
+		{
+			c.errors++;
+		}
+	}
+}
+
+libplctag::Task<void> group_loop(libplctag::TagGroup &group, clock_type::time_point deadline, counters &c)
+{
+	while (clock_type::now() < deadline)
+	{
+		// kept out of the if, g++ 12 mishandles co_await in a condition.
+		int rc = co_await group.read_all();
+
+		if (rc == PLCTAG_STATUS_OK)
+		{
+			c.group_reads++;
+		}
+		else
+		{
+			c.errors++;
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	std::string gateway = (argc > 1 ? argv[1] : "127.0.0.1");
+	int num_tags = (argc > 2 ? std::atoi(argv[2]) : 100);
+	double seconds = (argc > 3 ? std::atof(argv[3]) : 3.0);
+
+	libplctag::Executor ex;
+	std::vector<std::unique_ptr<libplctag::AsyncTag<int32_t>>> tags;
+	std::vector<std::unique_ptr<libplctag::AsyncTag<int32_t>>> group_tags;
+	libplctag::TagGroup group(ex);
+	counters c;
+
+	try
+	{
+		for (int i = 0; i < num_tags; i++)
+		{
+			std::string attrs = "protocol=ab-eip&gateway=" + gateway + "&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1&name=TestDINTArray[" + std::to_string(i % 10) + "]";
+
+			tags.push_back(std::make_unique<libplctag::AsyncTag<int32_t>>(ex, attrs));
+		}
+
+		// the group has its own tags, a tag can only have one operation in flight.
+		for (int i = 0; i < 10; i++)
+		{
+			std::string attrs = "protocol=ab-eip&gateway=" + gateway + "&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1&name=TestDINTArray[" + std::to_string(i) + "]";
+
+			group_tags.push_back(std::make_unique<libplctag::AsyncTag<int32_t>>(ex, attrs));
+			group.add(*group_tags.back());
+		}
+	}
+	catch (const libplctag::Error &e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+
+	auto start = clock_type::now();
+	auto deadline = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(seconds));
+
+	for (auto &tag : tags)
+	{
+		ex.spawn(read_loop(*tag, deadline, c));
+	}
+
+	ex.spawn(group_loop(group, deadline, c));
+
+	// every coroutine is resumed on this thread.
+	ex.run();
+
+	std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+	std::printf("%d tags, %.1f s: %ld reads (%.0f/s), %ld group reads of %zu tags, %ld errors.\n",
+				num_tags, elapsed.count(), c.reads, c.reads / elapsed.count(), c.group_reads, group.size(), c.errors);
+
+	return (c.errors ? 1 : 0);
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *   Copyright (C) 2019 Aníbal Limón <limon.anibal@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+package main
+
+/*
+ * Reads a set of tags three ways: ReadMany plus one GetFloat32s per tag,
+ * and asynchronously with the completions arriving on a channel.
+ *
+ * ./ab_server --plc=ControlLogix --path=1,0 --tag=TestREALArray:REAL[100] &
+ * go run examples/batch_read.go
+ */
+
+import (
+	"fmt"
+	"os"
+	"plctag"
+	"time"
+)
+
+const (
+	TAG_PATH     = "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=100&name=TestREALArray"
+	NUM_TAGS     = 20
+	DATA_TIMEOUT = 5000
+	RUN_TIME     = 2 * time.Second
+)
+
+func main() {
+	tags := make([]int32, 0, NUM_TAGS)
+
+	for i := 0; i < NUM_TAGS; i++ {
+		tag := plctag.Create(TAG_PATH, DATA_TIMEOUT)
+		if tag < 0 {
+			fmt.Printf("ERROR %s: Could not create tag!\n", plctag.DecodeError(int(tag)))
+			os.Exit(1)
+		}
+
+		tags = append(tags, tag)
+	}
+
+	defer func() {
+		for _, tag := range tags {
+			plctag.Destroy(tag)
+		}
+	}()
+
+	/* batch reads, one cgo call per batch and one per tag to decode */
+	values := make([]float32, 100)
+	batches := 0
+
+	for end := time.Now().Add(RUN_TIME); time.Now().Before(end); batches++ {
+		for i, rc := range plctag.ReadMany(tags, DATA_TIMEOUT) {
+			if rc != plctag.STATUS_OK {
+				fmt.Printf("ERROR: Unable to read tag %d! Got error code %d: %s\n", tags[i], rc, plctag.DecodeError(rc))
+				os.Exit(1)
+			}
+
+			plctag.GetFloat32s(tags[i], 0, values)
+		}
+	}
+
+	fmt.Printf("ReadMany: %d tag reads/s, values[0..2] = %v\n", batches*NUM_TAGS/int(RUN_TIME/time.Second), values[:3])
+
+	/* asynchronous reads, restarted as each completion arrives */
+	events := make(chan plctag.Event, NUM_TAGS)
+
+	for _, tag := range tags {
+		if rc := plctag.Subscribe(tag, events); rc != plctag.STATUS_OK {
+			fmt.Printf("ERROR: Unable to subscribe! Got error code %d: %s\n", rc, plctag.DecodeError(rc))
+			os.Exit(1)
+		}
+
+		plctag.Read(tag, 0)
+	}
+
+	reads := 0
+	inFlight := NUM_TAGS
+
+	for end := time.Now().Add(RUN_TIME); inFlight > 0; {
+		ev := <-events
+
+		if ev.Event != plctag.EVENT_READ_COMPLETED {
+			continue
+		}
+
+		if ev.Status != plctag.STATUS_OK {
+			fmt.Printf("ERROR: Read of tag %d failed with error code %d: %s\n", ev.Tag, ev.Status, plctag.DecodeError(ev.Status))
+			os.Exit(1)
+		}
+
+		reads++
+
+		if time.Now().Before(end) {
+			plctag.Read(ev.Tag, 0)
+		} else {
+			inFlight--
+		}
+	}
+
+	for _, tag := range tags {
+		plctag.Unsubscribe(tag)
+	}
+
+	fmt.Printf("Subscribe: %d tag reads/s\n", reads/int(RUN_TIME/time.Second))
+}
@@ -0,0 +1,436 @@
+/***************************************************************************
+ *   Copyright (C) 2019 Aníbal Limón <limon.anibal@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+package plctag
+
+/*
+#cgo pkg-config: libplctag
+#include <stdint.h>
+#include <stdlib.h>
+#include <libplctag.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define plctag_go_sleep_ms(ms) Sleep(ms)
+#define plctag_go_now_ms() ((int64_t)GetTickCount64())
+#else
+#include <time.h>
+static void plctag_go_sleep_ms(int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+
+	nanosleep(&ts, NULL);
+}
+
+// monotonic, so a clock change does not stretch or cut the timeout.
+static int64_t plctag_go_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+#endif
+
+// start the operation on every tag, then wait for all of them in C so the
+// whole batch costs one cgo call.  Each tag's final status goes in status[].
+static void plctag_go_batch(int32_t *tags, int *status, int count, int timeout, int is_write)
+{
+	int64_t deadline = plctag_go_now_ms() + timeout;
+	int pending = 0;
+	int i;
+
+	for(i = 0; i < count; i++) {
+		status[i] = (is_write ? plc_tag_write(tags[i], 0) : plc_tag_read(tags[i], 0));
+
+		if(status[i] == PLCTAG_STATUS_PENDING) {
+			pending++;
+		}
+	}
+
+	while(pending > 0 && plctag_go_now_ms() < deadline) {
+		plctag_go_sleep_ms(1);
+
+		pending = 0;
+
+		for(i = 0; i < count; i++) {
+			if(status[i] == PLCTAG_STATUS_PENDING) {
+				status[i] = plc_tag_status(tags[i]);
+
+				if(status[i] == PLCTAG_STATUS_PENDING) {
+					pending++;
+				}
+			}
+		}
+	}
+
+	for(i = 0; i < count; i++) {
+		if(status[i] == PLCTAG_STATUS_PENDING) {
+			plc_tag_abort(tags[i]);
+			status[i] = PLCTAG_ERR_TIMEOUT;
+		}
+	}
+}
+
+// the digits of the tag's byte order string for width byte values, "1032"
+// is 1032.  Picking the attribute name here keeps C strings out of Go.
+static int plctag_go_byte_order(int32_t tag, int width, int is_float)
+{
+	const char *attrib = NULL;
+
+	switch(width) {
+		case 2: attrib = "int16_byte_order"; break;
+		case 4: attrib = (is_float ? "float32_byte_order" : "int32_byte_order"); break;
+		case 8: attrib = (is_float ? "float64_byte_order" : "int64_byte_order"); break;
+		default: return PLCTAG_ERR_UNSUPPORTED;
+	}
+
+	return plc_tag_get_int_attribute(tag, attrib, PLCTAG_ERR_UNSUPPORTED);
+}
+*/
+import "C"
+
+import (
+	"sync"
+	"unsafe"
+)
+
+// The functions here move a whole tag, or a set of tags, per cgo call
+// instead of one value per call.  Typed slices use the tag's byte order
+// attributes, the same ones the scalar getters and setters use.
+
+// GetBytes copies len(buf) bytes of tag data starting at offset into buf.
+func GetBytes(tag int32, offset int, buf []byte) int {
+	if len(buf) == 0 {
+		return STATUS_OK
+	}
+
+	result := C.plc_tag_get_raw_bytes(C.int32_t(tag), C.int(offset), (*C.uint8_t)(unsafe.Pointer(&buf[0])), C.int(len(buf)))
+	return int(result)
+}
+
+// SetBytes copies buf into the tag data starting at offset.
+func SetBytes(tag int32, offset int, buf []byte) int {
+	if len(buf) == 0 {
+		return STATUS_OK
+	}
+
+	result := C.plc_tag_set_raw_bytes(C.int32_t(tag), C.int(offset), (*C.uint8_t)(unsafe.Pointer(&buf[0])), C.int(len(buf)))
+	return int(result)
+}
+
+// ReadBytes reads the tag and copies all of its data into buf, growing buf
+// if it is too small.  Reusing the returned slice avoids allocating per read.
+func ReadBytes(tag int32, timeout int, buf []byte) ([]byte, int) {
+	if rc := Read(tag, timeout); rc != STATUS_OK {
+		return buf, rc
+	}
+
+	size := GetSize(tag)
+	if size < 0 {
+		return buf, size
+	}
+
+	if cap(buf) < size {
+		buf = make([]byte, size)
+	}
+
+	buf = buf[:size]
+
+	return buf, GetBytes(tag, 0, buf)
+}
+
+// tagOrder is the byte order of width byte values in a tag.  order[i] is
+// the offset of byte i of a value, least significant first.
+type tagOrder struct {
+	width  int
+	order  [8]int
+	native bool
+}
+
+const rawChunkBytes = 1024
+
+var hostLittleEndian = func() bool {
+	x := uint16(1)
+	return *(*byte)(unsafe.Pointer(&x)) == 1
+}()
+
+// chunks for setters that can not encode in the caller's slice.
+var rawChunks = sync.Pool{New: func() interface{} { return new([rawChunkBytes]byte) }}
+
+func loadOrder(tag int32, width int, isFloat bool) (tagOrder, int) {
+	o := tagOrder{width: width}
+	isFloatArg := C.int(0)
+	seen := 0
+	same := true
+
+	if isFloat {
+		isFloatArg = 1
+	}
+
+	digits := int(C.plctag_go_byte_order(C.int32_t(tag), C.int(width), isFloatArg))
+	if digits < 0 {
+		return o, digits
+	}
+
+	// "0123" comes back as 123, the missing digit is the leading 0.
+	for i := width - 1; i >= 0; i-- {
+		o.order[i] = digits % 10
+		digits /= 10
+
+		if o.order[i] >= width || seen&(1<<uint(o.order[i])) != 0 {
+			return o, ERR_UNSUPPORTED
+		}
+
+		seen |= 1 << uint(o.order[i])
+		same = same && o.order[i] == i
+	}
+
+	// the tag stores values the way the host does, bytes copy as they are.
+	o.native = same && hostLittleEndian
+
+	return o, STATUS_OK
+}
+
+// toHost rewrites each value in b from the tag's order to the host's, in place.
+func (o *tagOrder) toHost(b []byte) {
+	for e := 0; e+o.width <= len(b); e += o.width {
+		var bits uint64
+
+		for i := 0; i < o.width; i++ {
+			bits |= uint64(b[e+o.order[i]]) << uint(8*i)
+		}
+
+		switch o.width {
+		case 2:
+			*(*uint16)(unsafe.Pointer(&b[e])) = uint16(bits)
+		case 4:
+			*(*uint32)(unsafe.Pointer(&b[e])) = uint32(bits)
+		case 8:
+			*(*uint64)(unsafe.Pointer(&b[e])) = bits
+		}
+	}
+}
+
+// fromHost rewrites each value in b from the host's order to the tag's, in place.
+func (o *tagOrder) fromHost(b []byte) {
+	for e := 0; e+o.width <= len(b); e += o.width {
+		var bits uint64
+
+		switch o.width {
+		case 2:
+			bits = uint64(*(*uint16)(unsafe.Pointer(&b[e])))
+		case 4:
+			bits = uint64(*(*uint32)(unsafe.Pointer(&b[e])))
+		case 8:
+			bits = *(*uint64)(unsafe.Pointer(&b[e]))
+		}
+
+		for i := 0; i < o.width; i++ {
+			b[e+o.order[i]] = byte(bits >> uint(8*i))
+		}
+	}
+}
+
+// getValues copies the tag data straight into dst, the memory of the
+// caller's slice, then reorders it there if the tag's order is not the host's.
+func getValues(tag int32, offset int, dst []byte, width int, isFloat bool) int {
+	if len(dst) == 0 {
+		return STATUS_OK
+	}
+
+	o, rc := loadOrder(tag, width, isFloat)
+	if rc != STATUS_OK {
+		return rc
+	}
+
+	if rc = GetBytes(tag, offset, dst); rc != STATUS_OK {
+		return rc
+	}
+
+	if !o.native {
+		o.toHost(dst)
+	}
+
+	return STATUS_OK
+}
+
+// setValues copies src, the memory of the caller's slice, into the tag.
+// Values not in the host's order are encoded in a pooled chunk, so src is
+// left as it is.
+func setValues(tag int32, offset int, src []byte, width int, isFloat bool) int {
+	if len(src) == 0 {
+		return STATUS_OK
+	}
+
+	o, rc := loadOrder(tag, width, isFloat)
+	if rc != STATUS_OK {
+		return rc
+	}
+
+	if o.native {
+		return SetBytes(tag, offset, src)
+	}
+
+	chunk := rawChunks.Get().(*[rawChunkBytes]byte)
+	defer rawChunks.Put(chunk)
+
+	for done := 0; done < len(src); {
+		n := copy(chunk[:], src[done:])
+
+		o.fromHost(chunk[:n])
+
+		if rc = SetBytes(tag, offset+done, chunk[:n]); rc != STATUS_OK {
+			return rc
+		}
+
+		done += n
+	}
+
+	return STATUS_OK
+}
+
+// the memory of a typed slice, elem bytes per element.
+func sliceBytes(p unsafe.Pointer, count int, elem int) []byte {
+	return unsafe.Slice((*byte)(p), count*elem)
+}
+
+// GetInt16s fills dst with the 16-bit elements starting at offset.
+func GetInt16s(tag int32, offset int, dst []int16) int {
+	if len(dst) == 0 {
+		return STATUS_OK
+	}
+
+	return getValues(tag, offset, sliceBytes(unsafe.Pointer(&dst[0]), len(dst), 2), 2, false)
+}
+
+// GetInt32s fills dst with the 32-bit elements starting at offset.
+func GetInt32s(tag int32, offset int, dst []int32) int {
+	if len(dst) == 0 {
+		return STATUS_OK
+	}
+
+	return getValues(tag, offset, sliceBytes(unsafe.Pointer(&dst[0]), len(dst), 4), 4, false)
+}
+
+// GetInt64s fills dst with the 64-bit elements starting at offset.
+func GetInt64s(tag int32, offset int, dst []int64) int {
+	if len(dst) == 0 {
+		return STATUS_OK
+	}
+
+	return getValues(tag, offset, sliceBytes(unsafe.Pointer(&dst[0]), len(dst), 8), 8, false)
+}
+
+// GetFloat32s fills dst with the REAL elements starting at offset.
+func GetFloat32s(tag int32, offset int, dst []float32) int {
+	if len(dst) == 0 {
+		return STATUS_OK
+	}
+
+	return getValues(tag, offset, sliceBytes(unsafe.Pointer(&dst[0]), len(dst), 4), 4, true)
+}
+
+// GetFloat64s fills dst with the LREAL elements starting at offset.
+func GetFloat64s(tag int32, offset int, dst []float64) int {
+	if len(dst) == 0 {
+		return STATUS_OK
+	}
+
+	return getValues(tag, offset, sliceBytes(unsafe.Pointer(&dst[0]), len(dst), 8), 8, true)
+}
+
+// SetInt16s stores src as 16-bit elements starting at offset.
+func SetInt16s(tag int32, offset int, src []int16) int {
+	if len(src) == 0 {
+		return STATUS_OK
+	}
+
+	return setValues(tag, offset, sliceBytes(unsafe.Pointer(&src[0]), len(src), 2), 2, false)
+}
+
+// SetInt32s stores src as 32-bit elements starting at offset.
+func SetInt32s(tag int32, offset int, src []int32) int {
+	if len(src) == 0 {
+		return STATUS_OK
+	}
+
+	return setValues(tag, offset, sliceBytes(unsafe.Pointer(&src[0]), len(src), 4), 4, false)
+}
+
+// SetInt64s stores src as 64-bit elements starting at offset.
+func SetInt64s(tag int32, offset int, src []int64) int {
+	if len(src) == 0 {
+		return STATUS_OK
+	}
+
+	return setValues(tag, offset, sliceBytes(unsafe.Pointer(&src[0]), len(src), 8), 8, false)
+}
+
+// SetFloat32s stores src as REAL elements starting at offset.
+func SetFloat32s(tag int32, offset int, src []float32) int {
+	if len(src) == 0 {
+		return STATUS_OK
+	}
+
+	return setValues(tag, offset, sliceBytes(unsafe.Pointer(&src[0]), len(src), 4), 4, true)
+}
+
+// SetFloat64s stores src as LREAL elements starting at offset.
+func SetFloat64s(tag int32, offset int, src []float64) int {
+	if len(src) == 0 {
+		return STATUS_OK
+	}
+
+	return setValues(tag, offset, sliceBytes(unsafe.Pointer(&src[0]), len(src), 8), 8, true)
+}
+
+func batch(tags []int32, timeout int, isWrite int) []int {
+	status := make([]int, len(tags))
+
+	if len(tags) == 0 {
+		return status
+	}
+
+	cstatus := make([]C.int, len(tags))
+
+	C.plctag_go_batch((*C.int32_t)(unsafe.Pointer(&tags[0])), &cstatus[0], C.int(len(tags)), C.int(timeout), C.int(isWrite))
+
+	for i, rc := range cstatus {
+		status[i] = int(rc)
+	}
+
+	return status
+}
+
+// ReadMany starts a read on every tag and waits up to timeout milliseconds
+// for all of them in one cgo call.  It returns each tag's status, in order.
+// Tags still pending at the timeout are aborted and get ERR_TIMEOUT.
+func ReadMany(tags []int32, timeout int) []int {
+	return batch(tags, timeout, 0)
+}
+
+// WriteMany is ReadMany for writes.
+func WriteMany(tags []int32, timeout int) []int {
+	return batch(tags, timeout, 1)
+}
@@ -0,0 +1,144 @@
+/***************************************************************************
+ *   Copyright (C) 2019 Aníbal Limón <limon.anibal@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+package plctag
+
+/*
+#cgo pkg-config: libplctag
+#include <stdint.h>
+#include <libplctag.h>
+
+extern void plctagGoCallback(int32_t tag_id, int event, int status);
+*/
+import "C"
+
+import "sync"
+
+const (
+	EVENT_READ_STARTED    = C.PLCTAG_EVENT_READ_STARTED
+	EVENT_READ_COMPLETED  = C.PLCTAG_EVENT_READ_COMPLETED
+	EVENT_WRITE_STARTED   = C.PLCTAG_EVENT_WRITE_STARTED
+	EVENT_WRITE_COMPLETED = C.PLCTAG_EVENT_WRITE_COMPLETED
+	EVENT_ABORTED         = C.PLCTAG_EVENT_ABORTED
+	EVENT_DESTROYED       = C.PLCTAG_EVENT_DESTROYED
+)
+
+// Event is one tag callback from the library.
+type Event struct {
+	Tag    int32
+	Event  int
+	Status int
+}
+
+// Every subscribed tag has the same C callback.  It runs in the library's
+// helper thread, which must not block, so it only queues the event.  One
+// goroutine delivers the queue to the subscribers' channels.
+var events struct {
+	sync.Mutex
+	cond    *sync.Cond
+	queue   []Event
+	subs    map[int32]chan<- Event
+	started bool
+}
+
+//export plctagGoCallback
+func plctagGoCallback(tag C.int32_t, event C.int, status C.int) {
+	events.Lock()
+	events.queue = append(events.queue, Event{int32(tag), int(event), int(status)})
+	events.Unlock()
+
+	events.cond.Signal()
+}
+
+func dispatchEvents() {
+	var batch []Event
+
+	for {
+		events.Lock()
+
+		for len(events.queue) == 0 {
+			events.cond.Wait()
+		}
+
+		batch, events.queue = events.queue, batch[:0]
+
+		events.Unlock()
+
+		for _, ev := range batch {
+			events.Lock()
+			ch := events.subs[ev.Tag]
+			events.Unlock()
+
+			if ch != nil {
+				ch <- ev
+			}
+
+			if ev.Event == EVENT_DESTROYED {
+				events.Lock()
+				if events.subs[ev.Tag] == ch {
+					delete(events.subs, ev.Tag)
+				}
+				events.Unlock()
+			}
+		}
+	}
+}
+
+// Subscribe sends every event on tag to ch.  Events arrive in the order the
+// library raised them.  A slow reader delays delivery for all tags but never
+// stalls the library.  Several tags can share one channel, so a collector can
+// watch thousands of tags from one goroutine.
+func Subscribe(tag int32, ch chan<- Event) int {
+	events.Lock()
+
+	if !events.started {
+		events.cond = sync.NewCond(&events.Mutex)
+		events.subs = make(map[int32]chan<- Event)
+		events.started = true
+
+		go dispatchEvents()
+	}
+
+	events.subs[tag] = ch
+
+	events.Unlock()
+
+	result := int(C.plc_tag_register_callback(C.int32_t(tag), (*[0]byte)(C.plctagGoCallback)))
+
+	if result != STATUS_OK {
+		events.Lock()
+		delete(events.subs, tag)
+		events.Unlock()
+	}
+
+	return result
+}
+
+// Unsubscribe stops the events for tag.  Events already queued are dropped.
+func Unsubscribe(tag int32) int {
+	result := int(C.plc_tag_unregister_callback(C.int32_t(tag)))
+
+	events.Lock()
+	if events.subs != nil {
+		delete(events.subs, tag)
+	}
+	events.Unlock()
+
+	return result
+}
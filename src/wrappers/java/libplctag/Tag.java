@@ -33,9 +33,17 @@
 
 package libplctag;
 
-import dev.java.net.jna.Library;
-import dev.java.net.jna.Native;
-import dev.java.net.jna.NativeLibrary;
+import com.sun.jna.Callback;
+import com.sun.jna.Library;
+import com.sun.jna.Native;
+import com.sun.jna.NativeLibrary;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.Executor;
+import java.util.concurrent.ForkJoinPool;
 
 public class Tag implements Library {
     // static native library stuff
@@ -46,8 +54,8 @@ static {
         Native.register(Tag.JNA_LIBRARY_NAME);
 
         if(!Tag.checkLibraryVersion(2, 1, 0)) {
-            System.err.printLn("Library must be compatible with version 2.1.0!");
-            System.abort();
+            System.err.println("Library must be compatible with version 2.1.0!");
+            System.exit(1);
         }
     }
 
@@ -105,11 +113,21 @@ static {
 
     private static final int PLCTAG_DEBUG_LAST         = (6);
 
+    // callback events
+    public static final int PLCTAG_EVENT_READ_STARTED     = (1);
+    public static final int PLCTAG_EVENT_READ_COMPLETED   = (2);
+    public static final int PLCTAG_EVENT_WRITE_STARTED    = (3);
+    public static final int PLCTAG_EVENT_WRITE_COMPLETED  = (4);
+    public static final int PLCTAG_EVENT_ABORTED          = (5);
+    public static final int PLCTAG_EVENT_DESTROYED        = (6);
+
 
 
     private int tag_id;
     private int status;
     private String attributes;
+    private ByteOrder byteOrder = ByteOrder.LITTLE_ENDIAN;
+    private boolean callbackRegistered = false;
 
 
     /*
@@ -226,6 +244,237 @@ static {
         return Tag.plc_tag_get_size(this.tag_id);
     }
 
+    public int getId() {
+        return this.tag_id;
+    }
+
+
+
+    /*
+     * Bulk data access.
+     *
+     * The get/set routines below are one native call per value.  These move
+     * the whole tag data, or a range of it, in one call to or from a direct
+     * ByteBuffer.  JNA passes a direct buffer to C by address so the library
+     * copies straight into Java memory.
+     *
+     * The buffers are set to the tag's byte order.  That is little endian,
+     * as Allen-Bradley and Omron PLCs use, unless changed with setByteOrder().
+     */
+
+    public ByteOrder getByteOrder() {
+        return this.byteOrder;
+    }
+
+    public void setByteOrder(ByteOrder order) {
+        this.byteOrder = order;
+    }
+
+    /* copy buf.remaining() bytes from offset in the tag data into buf.  buf must be direct. */
+    public int getBytes(int offset, ByteBuffer buf) {
+        if(!buf.isDirect()) {
+            return Tag.PLCTAG_ERR_BAD_PARAM;
+        }
+
+        if(buf.remaining() == 0) {
+            return Tag.PLCTAG_STATUS_OK;
+        }
+
+        // slice() so the native pointer starts at the buffer's position.
+        return Tag.plc_tag_get_raw_bytes(this.tag_id, offset, buf.slice(), buf.remaining());
+    }
+
+    /* copy buf.remaining() bytes from buf into the tag data at offset.  buf must be direct. */
+    public int setBytes(int offset, ByteBuffer buf) {
+        if(!buf.isDirect()) {
+            return Tag.PLCTAG_ERR_BAD_PARAM;
+        }
+
+        if(buf.remaining() == 0) {
+            return Tag.PLCTAG_STATUS_OK;
+        }
+
+        return Tag.plc_tag_set_raw_bytes(this.tag_id, offset, buf.slice(), buf.remaining());
+    }
+
+    /*
+     * Return a new direct buffer holding a copy of all of the tag data, in the
+     * tag's byte order, or null if the copy failed.  Reuse a buffer with
+     * getBytes() to avoid the allocation.
+     */
+    public ByteBuffer getBuffer() {
+        int size = this.size();
+
+        if(size < 0) {
+            return null;
+        }
+
+        ByteBuffer buf = ByteBuffer.allocateDirect(size).order(this.byteOrder);
+
+        if(this.getBytes(0, buf) != Tag.PLCTAG_STATUS_OK) {
+            return null;
+        }
+
+        return buf;
+    }
+
+    /* read the tag, then copy its data into buf.  One call for the read and one for the data. */
+    public int readInto(ByteBuffer buf, int timeout) {
+        int rc = this.read(timeout);
+
+        if(rc != Tag.PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        return this.getBytes(0, buf);
+    }
+
+    /* copy buf into the tag data, then write the tag. */
+    public int writeFrom(ByteBuffer buf, int timeout) {
+        int rc = this.setBytes(0, buf);
+
+        if(rc != Tag.PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        return this.write(timeout);
+    }
+
+
+
+    /*
+     * Asynchronous operations.
+     *
+     * readAsync() and writeAsync() start the operation and return at once.
+     * The future completes with the final status when the library calls back.
+     * Every tag used this way has the same native callback.  It runs in the
+     * library's helper thread, so it only hands the status to an executor,
+     * the common fork/join pool unless changed with setCallbackExecutor().
+     *
+     * A tag can have one asynchronous operation outstanding.  Starting a
+     * second one completes with PLCTAG_ERR_BUSY.
+     */
+
+    public interface TagCallback extends Callback {
+        void callback(int tag_id, int event, int status);
+    }
+
+    private static final class PendingOp {
+        final boolean isWrite;
+        final CompletableFuture<Integer> future;
+
+        PendingOp(boolean isWrite, CompletableFuture<Integer> future) {
+            this.isWrite = isWrite;
+            this.future = future;
+        }
+    }
+
+    private static final ConcurrentHashMap<Integer, PendingOp> pendingOps = new ConcurrentHashMap<Integer, PendingOp>();
+    private static volatile Executor callbackExecutor = ForkJoinPool.commonPool();
+
+    // held in a static field so that it is never garbage collected while native code has it.
+    private static final TagCallback dispatcher = new TagCallback() {
+        public void callback(int tag_id, int event, int status) {
+            PendingOp op = pendingOps.get(tag_id);
+
+            if(op == null) {
+                return;
+            }
+
+            switch(event) {
+                case Tag.PLCTAG_EVENT_READ_COMPLETED:
+                    if(op.isWrite) {
+                        return;
+                    }
+                    break;
+
+                case Tag.PLCTAG_EVENT_WRITE_COMPLETED:
+                    if(!op.isWrite) {
+                        return;
+                    }
+                    break;
+
+                case Tag.PLCTAG_EVENT_ABORTED:
+                case Tag.PLCTAG_EVENT_DESTROYED:
+                    status = Tag.PLCTAG_ERR_ABORT;
+                    break;
+
+                default:
+                    return;
+            }
+
+            if(pendingOps.remove(tag_id, op)) {
+                final int final_status = status;
+
+                callbackExecutor.execute(new Runnable() {
+                    public void run() {
+                        op.future.complete(final_status);
+                    }
+                });
+            }
+        }
+    };
+
+    public static void setCallbackExecutor(Executor executor) {
+        callbackExecutor = executor;
+    }
+
+    public CompletableFuture<Integer> readAsync() {
+        return startAsync(false);
+    }
+
+    public CompletableFuture<Integer> writeAsync() {
+        return startAsync(true);
+    }
+
+    private CompletableFuture<Integer> startAsync(boolean isWrite) {
+        CompletableFuture<Integer> future = new CompletableFuture<Integer>();
+        int rc;
+
+        synchronized(this) {
+            if(!this.callbackRegistered) {
+                rc = Tag.plc_tag_register_callback(this.tag_id, Tag.dispatcher);
+
+                if(rc != Tag.PLCTAG_STATUS_OK) {
+                    future.complete(rc);
+                    return future;
+                }
+
+                this.callbackRegistered = true;
+            }
+        }
+
+        rc = (isWrite ? Tag.plc_tag_write(this.tag_id, 0) : Tag.plc_tag_read(this.tag_id, 0));
+
+        // anything but pending is the final result.
+        if(rc != Tag.PLCTAG_STATUS_PENDING) {
+            future.complete(rc);
+            return future;
+        }
+
+        /*
+         * The op is registered only once the library says it is pending, so the
+         * callback can not hand it the completion of an earlier read or write of
+         * the tag.  If the operation finished before this, its callback found
+         * nothing, and the status shows that it is done.
+         */
+        PendingOp op = new PendingOp(isWrite, future);
+
+        if(pendingOps.putIfAbsent(this.tag_id, op) != null) {
+            future.complete(Tag.PLCTAG_ERR_BUSY);
+            return future;
+        }
+
+        rc = Tag.plc_tag_status(this.tag_id);
+
+        // false means the callback took it first.
+        if(rc != Tag.PLCTAG_STATUS_PENDING && pendingOps.remove(this.tag_id, op)) {
+            future.complete(rc);
+        }
+
+        return future;
+    }
+
 
     /* data routines */
     // Java does not have a 64-bit unsigned type. */
@@ -357,34 +606,32 @@ static {
      * 0x00020104 is version 2.1.4
      */
 
-    private static native int plc_tag_get_lib_version(void);
+    private static native int plc_tag_get_lib_version();
 
 
     /**
      * Check that the library supports the required API version.
      *
-     * The version is passed as an encoded integer.   The encoding is the same
-     * as for plc_tag_get_lib_version().   The lower three bytes of the version
-     * are (from the least significant byte:
+     * The version is passed as three integers:
      *
-     * ver_patch - the patch version of the library.   The library must have a patch
+     * req_major - the major version of the library.  This must be an exact match.
+     * req_minor - the minor version of the library.   The library must have a minor
+     *             version greater than or equal to the requested version.
+     * req_patch - the patch version of the library.   The library must have a patch
      *             version greater than or equal to the requested version if the minor
      *             version is the same as that requested.   If the library minor version
      *             is greater than that requested, any patch version will be accepted.
-     * ver_minor - the minor version of the library.   The library must have a minor
-     *             version greater than or equal to the requested version.
-     * ver_major - the major version of the library.  This must be an exact match.
      *
      * PLCTAG_STATUS_OK is returned if the version matches.  If it does not, PLCTAG_ERR_UNSUPPORTED
      * is returned.
      *
      * Examples:
      *
-     * To match version 2.1.4, pass the encoded integer 0x00020104.
+     * To match version 2.1.4, call plc_tag_check_lib_version(2, 1, 4).
      *
      */
 
-    private static native int plc_tag_check_lib_version(int encoded_version);
+    private static native int plc_tag_check_lib_version(int req_major, int req_minor, int req_patch);
 
 
 
@@ -597,6 +844,21 @@ static {
      */
     private static native int plc_tag_set_float32(int tag_id, int offset, float val);
 
+    /**
+     * Original signature : <code>int plc_tag_get_raw_bytes(int32_t, int, uint8_t *, int)</code>
+     */
+    private static native int plc_tag_get_raw_bytes(int tag_id, int offset, ByteBuffer buffer, int buffer_length);
+
+    /**
+     * Original signature : <code>int plc_tag_set_raw_bytes(int32_t, int, uint8_t *, int)</code>
+     */
+    private static native int plc_tag_set_raw_bytes(int tag_id, int offset, ByteBuffer buffer, int buffer_length);
+
+    /**
+     * Original signature : <code>int plc_tag_register_callback(int32_t, void (*)(int32_t, int, int))</code>
+     */
+    private static native int plc_tag_register_callback(int tag_id, TagCallback callback);
+
 
     /**
      * finalize
@@ -0,0 +1,134 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+package libplctag;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.TimeUnit;
+import java.util.function.Function;
+
+/*
+ * A set of tags read or written together.
+ *
+ * All of the operations are started before any is waited on, so the
+ * library can send the requests for the whole group together instead of
+ * one round trip per tag.
+ */
+
+public class TagGroup {
+    private final List<Tag> tags = new ArrayList<Tag>();
+
+    public void add(Tag tag) {
+        this.tags.add(tag);
+    }
+
+    public List<Tag> tags() {
+        return this.tags;
+    }
+
+    public int size() {
+        return this.tags.size();
+    }
+
+
+    /*
+     * Start a read on every tag.  The future completes with the status of
+     * each tag, in the order they were added, when all of them are done.
+     */
+    public CompletableFuture<int[]> readAllAsync() {
+        return startAll(false);
+    }
+
+    public CompletableFuture<int[]> writeAllAsync() {
+        return startAll(true);
+    }
+
+
+    /*
+     * Read every tag and wait up to timeout milliseconds for all of them.
+     * Tags that have not finished by then are aborted and get
+     * PLCTAG_ERR_TIMEOUT.
+     */
+    public int[] readAll(int timeout) {
+        return waitAll(false, timeout);
+    }
+
+    public int[] writeAll(int timeout) {
+        return waitAll(true, timeout);
+    }
+
+
+    private CompletableFuture<int[]> startAll(boolean isWrite) {
+        final List<CompletableFuture<Integer>> futures = new ArrayList<CompletableFuture<Integer>>(this.tags.size());
+
+        for(Tag tag : this.tags) {
+            futures.add(isWrite ? tag.writeAsync() : tag.readAsync());
+        }
+
+        return CompletableFuture.allOf(futures.toArray(new CompletableFuture<?>[0])).thenApply(new Function<Void, int[]>() {
+            public int[] apply(Void ignored) {
+                int[] status = new int[futures.size()];
+
+                for(int i = 0; i < status.length; i++) {
+                    status[i] = futures.get(i).join();
+                }
+
+                return status;
+            }
+        });
+    }
+
+    private int[] waitAll(boolean isWrite, int timeout) {
+        List<CompletableFuture<Integer>> futures = new ArrayList<CompletableFuture<Integer>>(this.tags.size());
+        long end = System.nanoTime() + TimeUnit.MILLISECONDS.toNanos(timeout);
+        int[] status = new int[this.tags.size()];
+
+        for(Tag tag : this.tags) {
+            futures.add(isWrite ? tag.writeAsync() : tag.readAsync());
+        }
+
+        for(int i = 0; i < status.length; i++) {
+            try {
+                status[i] = futures.get(i).get(Math.max(0, end - System.nanoTime()), TimeUnit.NANOSECONDS);
+            } catch(Exception e) {
+                // timed out or interrupted.  The abort completes the future with PLCTAG_ERR_ABORT.
+                this.tags.get(i).abort();
+                status[i] = Tag.PLCTAG_ERR_TIMEOUT;
+            }
+        }
+
+        return status;
+    }
+}
@@ -1,6 +1,13 @@
 #!/usr/bin/python
 import platform
 import ctypes
+import struct
+
+# NumPy is optional.  When it is there the array accessors return numpy arrays.
+try:
+    import numpy
+except ImportError:
+    numpy = None
 
 PLCTAG_STATUS_PENDING = 1
 PLCTAG_STATUS_OK      = 0
@@ -198,6 +205,12 @@ plcTagGetFloat32 = defineFloatFunc(lib.plc_tag_get_float32, [ctypes.c_int, ctype
 # Creates IntFunc because it returns int for the result, but notice it takes a float for the val
 plcTagSetFloat32 = defineIntFunc(lib.plc_tag_set_float32, [ctypes.c_int, ctypes.c_int, ctypes.c_float])
 
+# Create the raw byte bulk accessors.  The buffer is passed as a plain pointer
+# so that any object exporting the buffer protocol can be filled in place.
+
+plcTagGetRawBytes = defineIntFunc(lib.plc_tag_get_raw_bytes, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagSetRawBytes = defineIntFunc(lib.plc_tag_set_raw_bytes, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+
 
 
 ##############################################################################
@@ -471,3 +484,150 @@ if plc_tag_check_lib_version(2, 2, 0) == 0:
 
     def plc_tag_get_string_total_length(tag, string_start_offset):
         return plcTagGetStringTotalLength(tag, string_start_offset)
+
+
+# Bulk accessors
+#
+# Each getter above is one trip through ctypes per element.  The functions
+# below move a whole range of the tag's data in one call to
+# plc_tag_get_raw_bytes() or plc_tag_set_raw_bytes() and decode it in Python
+# (or NumPy when it is installed), so a 1000 element REAL array costs one
+# call instead of 1000.
+#
+# The raw bytes are in the PLC's byte order.  That is little endian for
+# Allen-Bradley and Omron PLCs, which is the default here.  Modbus registers
+# are big endian, pass byte_order='>' for those.
+
+# element type names, the same as tag_rw.py uses, and their struct codes.
+PLC_TAG_ARRAY_TYPES = {
+    'uint8':  'B',
+    'sint8':  'b',
+    'uint16': 'H',
+    'sint16': 'h',
+    'uint32': 'I',
+    'sint32': 'i',
+    'uint64': 'Q',
+    'sint64': 'q',
+    'real32': 'f',
+    'real64': 'd'
+}
+
+
+def _buffer_size(buffer):
+    view = memoryview(buffer)
+    size = view.itemsize
+
+    for dim in view.shape:
+        size = size * dim
+
+    return size
+
+
+# return a ctypes object that points at the memory of buffer.  Writable
+# buffers are used in place.  Read-only ones (bytes) are copied when they
+# are only a source and raise TypeError when they are a destination.
+def _buffer_pointer(buffer, size, source=False):
+    if source and memoryview(buffer).readonly:
+        return ctypes.create_string_buffer(bytes(buffer), size)
+
+    return (ctypes.c_ubyte * size).from_buffer(buffer)
+
+
+def _array_format(type_name, byte_order):
+    if type_name not in PLC_TAG_ARRAY_TYPES:
+        raise ValueError('unknown element type %s' % type_name)
+
+    return byte_order + PLC_TAG_ARRAY_TYPES[type_name]
+
+
+# the same as the C functions.  buffer can be a ctypes array or anything
+# that exports the buffer protocol (bytearray, array.array, numpy arrays).
+def plc_tag_get_raw_bytes(tag, offset, buffer, buffer_length):
+    return plcTagGetRawBytes(tag, offset, _buffer_pointer(buffer, _buffer_size(buffer)), buffer_length)
+
+def plc_tag_set_raw_bytes(tag, offset, buffer, buffer_length):
+    return plcTagSetRawBytes(tag, offset, _buffer_pointer(buffer, _buffer_size(buffer), True), buffer_length)
+
+
+# plc_tag_read_into
+#
+# Copy the tag data starting at offset into buffer, filling all of it.  No
+# new objects are created, so the same buffer can be reused every read.
+#
+def plc_tag_read_into(tag, buffer, offset=0):
+    size = _buffer_size(buffer)
+    return plcTagGetRawBytes(tag, offset, _buffer_pointer(buffer, size), size)
+
+
+# plc_tag_write_from
+#
+# Copy all of buffer into the tag data starting at offset.  The tag still
+# has to be written with plc_tag_write().
+#
+def plc_tag_write_from(tag, buffer, offset=0):
+    size = _buffer_size(buffer)
+    return plcTagSetRawBytes(tag, offset, _buffer_pointer(buffer, size, True), size)
+
+
+# plc_tag_get_bytes
+#
+# Return a copy of length bytes of the tag data from offset, all of it by
+# default, as a bytearray.  memoryview() of the result gives typed views
+# without further copies, e.g. memoryview(data).cast('f') for REALs.
+#
+# Raises RuntimeError with the library error text if the copy fails.
+#
+def plc_tag_get_bytes(tag, offset=0, length=None):
+    if length is None:
+        length = plc_tag_get_size(tag) - offset
+
+    data = bytearray(length)
+
+    if length > 0:
+        rc = plc_tag_read_into(tag, data, offset)
+
+        if rc != PLCTAG_STATUS_OK:
+            raise RuntimeError(plc_tag_decode_error(rc))
+
+    return data
+
+
+# plc_tag_get_array
+#
+# Decode count elements of type_name starting at offset in one call.  count
+# defaults to as many elements as fit in the rest of the tag.  Returns a
+# numpy array if NumPy is installed, otherwise a list.
+#
+def plc_tag_get_array(tag, type_name, count=None, offset=0, byte_order='<'):
+    fmt = _array_format(type_name, byte_order)
+    elem_size = struct.calcsize(fmt)
+
+    if count is None:
+        count = (plc_tag_get_size(tag) - offset) // elem_size
+
+    data = plc_tag_get_bytes(tag, offset, count * elem_size)
+
+    if numpy is not None:
+        return numpy.frombuffer(data, dtype=numpy.dtype(fmt), count=count)
+
+    return list(struct.unpack_from(byte_order + str(count) + PLC_TAG_ARRAY_TYPES[type_name], data))
+
+
+# plc_tag_set_array
+#
+# Encode values as type_name elements and store them starting at offset in
+# one call.  values can be any sequence or a numpy array.  The tag still has
+# to be written with plc_tag_write().
+#
+def plc_tag_set_array(tag, type_name, values, offset=0, byte_order='<'):
+    fmt = _array_format(type_name, byte_order)
+
+    if numpy is not None:
+        data = bytearray(numpy.ascontiguousarray(values, dtype=numpy.dtype(fmt)).tobytes())
+    else:
+        data = bytearray(struct.pack(byte_order + str(len(values)) + PLC_TAG_ARRAY_TYPES[type_name], *values))
+
+    if len(data) == 0:
+        return PLCTAG_STATUS_OK
+
+    return plc_tag_write_from(tag, data, offset)